@@ -392,7 +392,8 @@ static const char * const sampler_target_format[4] = {
 };
 
 
-static int column;
+/* Per thread, intel-gen4disasm decodes several programs at once. */
+static __thread int column;
 
 static int string (FILE *file, const char *string)
 {
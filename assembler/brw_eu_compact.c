@@ -37,6 +37,7 @@
  * instruction in 8 bytes using some lookup tables for various fields.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "brw_compat.h"
@@ -328,13 +329,74 @@ static const uint32_t *datatype_table;
 static const uint32_t *subreg_table;
 static const uint32_t *src_index_table;
 
+/* Reverse of the four tables above, from the uncompacted bits to the table
+ * index, in small open addressed hash tables. They are only rebuilt when
+ * the generation changes.
+ */
+#define COMPACT_HASH_SIZE 64
+
+struct compact_hash {
+   uint32_t key[COMPACT_HASH_SIZE];
+   int8_t index[COMPACT_HASH_SIZE];
+};
+
+static struct compact_hash control_index_hash;
+static struct compact_hash datatype_hash;
+static struct compact_hash subreg_hash;
+static struct compact_hash src_index_hash;
+static int compaction_tables_gen;
+
+static unsigned
+compact_hash_slot(uint32_t key)
+{
+   return (key * 0x9e3779b1u) >> 26;
+}
+
+static void
+compact_hash_init(struct compact_hash *hash, const uint32_t *table)
+{
+   memset(hash->index, -1, sizeof(hash->index));
+
+   for (int i = 0; i < 32; i++) {
+      unsigned slot = compact_hash_slot(table[i]);
+
+      /* Keep the first index for duplicated entries, as a search would. */
+      while (hash->index[slot] >= 0 && hash->key[slot] != table[i])
+         slot = (slot + 1) % COMPACT_HASH_SIZE;
+
+      if (hash->index[slot] < 0) {
+         hash->key[slot] = table[i];
+         hash->index[slot] = i;
+      }
+   }
+}
+
+static bool
+compact_hash_lookup(const struct compact_hash *hash, uint32_t uncompacted,
+                    uint32_t *compacted)
+{
+   /* There are never more than 32 of the 64 slots taken. */
+   for (unsigned slot = compact_hash_slot(uncompacted);
+        hash->index[slot] >= 0;
+        slot = (slot + 1) % COMPACT_HASH_SIZE) {
+      if (hash->key[slot] == uncompacted) {
+         *compacted = hash->index[slot];
+         return true;
+      }
+   }
+
+   return false;
+}
+
 static bool
 set_control_index(struct intel_context *intel,
                   struct brw_compact_instruction *dst,
                   struct brw_instruction *src)
 {
-   uint32_t *src_u32 = (uint32_t *)src;
-   uint32_t uncompacted = 0;
+   uint32_t src_u32[4];
+   uint32_t compacted, uncompacted = 0;
+
+   memcpy(src_u32, src, sizeof(src_u32));
 
    uncompacted |= ((src_u32[0] >> 8) & 0xffff) << 0;
    uncompacted |= ((src_u32[0] >> 31) & 0x1) << 16;
@@ -344,67 +406,50 @@ set_control_index(struct intel_context *intel,
    if (intel->gen >= 7)
       uncompacted |= ((src_u32[2] >> 25) & 0x3) << 17;
 
-   for (int i = 0; i < 32; i++) {
-      if (control_index_table[i] == uncompacted) {
-	 dst->dw0.control_index = i;
-	 return true;
-      }
-   }
+   if (!compact_hash_lookup(&control_index_hash, uncompacted, &compacted))
+      return false;
 
-   return false;
+   dst->dw0.control_index = compacted;
+
+   return true;
 }
 
 static bool
 set_datatype_index(struct brw_compact_instruction *dst,
                    struct brw_instruction *src)
 {
-   uint32_t uncompacted = 0;
+   uint32_t compacted, uncompacted = 0;
 
    uncompacted |= src->bits1.ud & 0x7fff;
    uncompacted |= (src->bits1.ud >> 29) << 15;
 
-   for (int i = 0; i < 32; i++) {
-      if (datatype_table[i] == uncompacted) {
-	 dst->dw0.data_type_index = i;
-	 return true;
-      }
-   }
+   if (!compact_hash_lookup(&datatype_hash, uncompacted, &compacted))
+      return false;
 
-   return false;
+   dst->dw0.data_type_index = compacted;
+
+   return true;
 }
 
 static bool
 set_subreg_index(struct brw_compact_instruction *dst,
-                 struct brw_instruction *src)
+                 struct brw_instruction *src,
+                 bool is_immediate)
 {
-   uint32_t uncompacted = 0;
+   uint32_t compacted, uncompacted = 0;
 
    uncompacted |= src->bits1.da1.dest_subreg_nr << 0;
    uncompacted |= src->bits2.da1.src0_subreg_nr << 5;
-   uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
-
-   for (int i = 0; i < 32; i++) {
-      if (subreg_table[i] == uncompacted) {
-	 dst->dw0.sub_reg_index = i;
-	 return true;
-      }
-   }
+   /* For immediates, those bits are part of the value. */
+   if (!is_immediate)
+      uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
 
-   return false;
-}
+   if (!compact_hash_lookup(&subreg_hash, uncompacted, &compacted))
+      return false;
 
-static bool
-get_src_index(uint32_t uncompacted,
-              uint32_t *compacted)
-{
-   for (int i = 0; i < 32; i++) {
-      if (src_index_table[i] == uncompacted) {
-	 *compacted = i;
-	 return true;
-      }
-   }
+   dst->dw0.sub_reg_index = compacted;
 
-   return false;
+   return true;
 }
 
 static bool
@@ -415,7 +460,7 @@ set_src0_index(struct brw_compact_instruction *dst,
 
    uncompacted |= (src->bits2.ud >> 13) & 0xfff;
 
-   if (!get_src_index(uncompacted, &compacted))
+   if (!compact_hash_lookup(&src_index_hash, uncompacted, &compacted))
       return false;
 
    dst->dw0.src0_index = compacted & 0x3;
@@ -426,13 +471,19 @@ set_src0_index(struct brw_compact_instruction *dst,
 
 static bool
 set_src1_index(struct brw_compact_instruction *dst,
-               struct brw_instruction *src)
+               struct brw_instruction *src,
+               bool is_immediate)
 {
    uint32_t compacted, uncompacted = 0;
 
+   if (is_immediate) {
+      dst->dw1.src1_index = (src->bits3.ud >> 8) & 0x1f;
+      return true;
+   }
+
    uncompacted |= (src->bits3.ud >> 13) & 0xfff;
 
-   if (!get_src_index(uncompacted, &compacted))
+   if (!compact_hash_lookup(&src_index_hash, uncompacted, &compacted))
       return false;
 
    dst->dw1.src1_index = compacted;
@@ -440,11 +491,60 @@ set_src1_index(struct brw_compact_instruction *dst,
    return true;
 }
 
+/**
+ * A compacted immediate keeps its low 12 bits, and one bit replicated
+ * through the top 20.
+ */
+static bool
+is_compactable_immediate(uint32_t imm)
+{
+   imm &= ~0xfff;
+
+   return imm == 0 || imm == 0xfffff000;
+}
+
+/**
+ * Gen6 IF, ELSE, ENDIF and WHILE keep their jump count in the high bits of
+ * the destination, which only compact for a few values, and those may not
+ * survive brw_compact_instructions() adjusting the jump.
+ */
+static bool
+has_gen6_jump_count(struct intel_context *intel, struct brw_instruction *insn)
+{
+   if (intel->gen != 6)
+      return false;
+
+   switch (insn->header.opcode) {
+   case BRW_OPCODE_IF:
+   case BRW_OPCODE_ELSE:
+   case BRW_OPCODE_ENDIF:
+   case BRW_OPCODE_WHILE:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static bool
+is_3src(struct brw_instruction *insn)
+{
+   switch (insn->header.opcode) {
+   case BRW_OPCODE_BFE:
+   case BRW_OPCODE_BFI2:
+   case BRW_OPCODE_MAD:
+   case BRW_OPCODE_LRP:
+      return true;
+   default:
+      return false;
+   }
+}
+
 /**
  * Tries to compact instruction src into dst.
  *
  * It doesn't modify dst unless src is compactable, which is relied on by
- * brw_compact_instructions().
+ * brw_compact_instructions(). Only compactions that uncompact back to src
+ * bit for bit are accepted.
  */
 bool
 brw_try_compact_instruction(struct brw_compile *p,
@@ -454,22 +554,18 @@ brw_try_compact_instruction(struct brw_compile *p,
    struct brw_context *brw = p->brw;
    struct intel_context *intel = &brw->intel;
    struct brw_compact_instruction temp;
+   struct brw_instruction uncompacted;
+   bool is_immediate;
 
-   if (src->header.opcode == BRW_OPCODE_IF ||
-       src->header.opcode == BRW_OPCODE_ELSE ||
-       src->header.opcode == BRW_OPCODE_ENDIF ||
-       src->header.opcode == BRW_OPCODE_HALT ||
-       src->header.opcode == BRW_OPCODE_DO ||
-       src->header.opcode == BRW_OPCODE_WHILE) {
-      /* FINISHME: The fixup code below, and brw_set_uip_jip and friends, needs
-       * to be able to handle compacted flow control instructions..
-       */
+   if (intel->gen != compaction_tables_gen)
+      return false;
+
+   if (is_3src(src) || has_gen6_jump_count(intel, src))
       return false;
-   }
 
-   /* FINISHME: immediates */
-   if (src->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
-       src->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE)
+   is_immediate = src->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
+                  src->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE;
+   if (is_immediate && !is_compactable_immediate(src->bits3.ud))
       return false;
 
    memset(&temp, 0, sizeof(temp));
@@ -480,7 +576,7 @@ brw_try_compact_instruction(struct brw_compile *p,
       return false;
    if (!set_datatype_index(&temp, src))
       return false;
-   if (!set_subreg_index(&temp, src))
+   if (!set_subreg_index(&temp, src, is_immediate))
       return false;
    temp.dw0.acc_wr_control = src->header.acc_wr_control;
    temp.dw0.conditionalmod = src->header.destreg__conditionalmod;
@@ -489,11 +585,21 @@ brw_try_compact_instruction(struct brw_compile *p,
    temp.dw0.cmpt_ctrl = 1;
    if (!set_src0_index(&temp, src))
       return false;
-   if (!set_src1_index(&temp, src))
+   if (!set_src1_index(&temp, src, is_immediate))
       return false;
    temp.dw1.dst_reg_nr = src->bits1.da1.dest_reg_nr;
    temp.dw1.src0_reg_nr = src->bits2.da1.src0_reg_nr;
-   temp.dw1.src1_reg_nr = src->bits3.da1.src1_reg_nr;
+   if (is_immediate)
+      temp.dw1.src1_reg_nr = src->bits3.ud & 0xff;
+   else
+      temp.dw1.src1_reg_nr = src->bits3.da1.src1_reg_nr;
+
+   /* Whatever the tables can't express, such as bits outside of the
+    * compacted fields, shows up as a difference here.
+    */
+   brw_uncompact_instruction(intel, &uncompacted, &temp);
+   if (memcmp(&uncompacted, src, sizeof(uncompacted)))
+      return false;
 
    *dst = temp;
 
@@ -505,14 +611,21 @@ set_uncompacted_control(struct intel_context *intel,
                         struct brw_instruction *dst,
                         struct brw_compact_instruction *src)
 {
-   uint32_t *dst_u32 = (uint32_t *)dst;
    uint32_t uncompacted = control_index_table[src->dw0.control_index];
+   uint32_t dst_u32[4];
+
+   /* Edit a copy, the bitfield stores to dst must not be reordered past
+    * these ones under strict aliasing.
+    */
+   memcpy(dst_u32, dst, sizeof(dst_u32));
 
    dst_u32[0] |= ((uncompacted >> 0) & 0xffff) << 8;
    dst_u32[0] |= ((uncompacted >> 16) & 0x1) << 31;
 
    if (intel->gen >= 7)
       dst_u32[2] |= ((uncompacted >> 17) & 0x3) << 25;
+
+   memcpy(dst, dst_u32, sizeof(dst_u32));
 }
 
 static void
@@ -529,13 +642,15 @@ set_uncompacted_datatype(struct brw_instruction *dst,
 
 static void
 set_uncompacted_subreg(struct brw_instruction *dst,
-                       struct brw_compact_instruction *src)
+                       struct brw_compact_instruction *src,
+                       bool is_immediate)
 {
    uint32_t uncompacted = subreg_table[src->dw0.sub_reg_index];
 
    dst->bits1.da1.dest_subreg_nr = (uncompacted >> 0)  & 0x1f;
    dst->bits2.da1.src0_subreg_nr = (uncompacted >> 5)  & 0x1f;
-   dst->bits3.da1.src1_subreg_nr = (uncompacted >> 10) & 0x1f;
+   if (!is_immediate)
+      dst->bits3.da1.src1_subreg_nr = (uncompacted >> 10) & 0x1f;
 }
 
 static void
@@ -550,11 +665,22 @@ set_uncompacted_src0(struct brw_instruction *dst,
 
 static void
 set_uncompacted_src1(struct brw_instruction *dst,
-                     struct brw_compact_instruction *src)
+                     struct brw_compact_instruction *src,
+                     bool is_immediate)
 {
-   uint32_t uncompacted = src_index_table[src->dw1.src1_index];
-
-   dst->bits3.ud |= uncompacted << 13;
+   if (is_immediate) {
+      uint32_t high5 = src->dw1.src1_index;
+
+      /* Replicate the top bit of the index through bits 12 to 31. */
+      dst->bits3.ud = high5 << 8 | src->dw1.src1_reg_nr;
+      if (high5 & 0x10)
+         dst->bits3.ud |= 0xfffff000;
+   } else {
+      uint32_t uncompacted = src_index_table[src->dw1.src1_index];
+
+      dst->bits3.ud |= uncompacted << 13;
+      dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
+   }
 }
 
 void
@@ -562,6 +688,8 @@ brw_uncompact_instruction(struct intel_context *intel,
                           struct brw_instruction *dst,
                           struct brw_compact_instruction *src)
 {
+   bool is_immediate;
+
    memset(dst, 0, sizeof(*dst));
 
    dst->header.opcode = src->dw0.opcode;
@@ -569,16 +697,17 @@ brw_uncompact_instruction(struct intel_context *intel,
 
    set_uncompacted_control(intel, dst, src);
    set_uncompacted_datatype(dst, src);
-   set_uncompacted_subreg(dst, src);
+   is_immediate = dst->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
+                  dst->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE;
+   set_uncompacted_subreg(dst, src, is_immediate);
    dst->header.acc_wr_control = src->dw0.acc_wr_control;
    dst->header.destreg__conditionalmod = src->dw0.conditionalmod;
    if (intel->gen <= 6)
       dst->bits2.da1.flag_subreg_nr = src->dw0.flag_subreg_nr;
    set_uncompacted_src0(dst, src);
-   set_uncompacted_src1(dst, src);
+   set_uncompacted_src1(dst, src, is_immediate);
    dst->bits1.da1.dest_reg_nr = src->dw1.dst_reg_nr;
    dst->bits2.da1.src0_reg_nr = src->dw1.src0_reg_nr;
-   dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
 }
 
 void brw_debug_compact_uncompact(struct intel_context *intel,
@@ -594,8 +723,9 @@ void brw_debug_compact_uncompact(struct intel_context *intel,
    fprintf(stderr, "  after:  ");
    brw_disasm(stderr, uncompacted, intel->gen);
 
-   uint32_t *before_bits = (uint32_t *)orig;
-   uint32_t *after_bits = (uint32_t *)uncompacted;
+   uint32_t before_bits[4], after_bits[4];
+   memcpy(before_bits, orig, sizeof(before_bits));
+   memcpy(after_bits, uncompacted, sizeof(after_bits));
    printf("  changed bits:\n");
    for (int i = 0; i < 128; i++) {
       uint32_t before = before_bits[i / 32] & (1 << (i & 31));
@@ -609,29 +739,101 @@ void brw_debug_compact_uncompact(struct intel_context *intel,
    }
 }
 
+/*
+ * The jump fields brw_compact_instructions() has to adjust, all of them in
+ * 8 byte units except Haswell JMPI which counts bytes.
+ */
+enum jump_fields {
+   JUMP_NONE,
+   JUMP_GEN6_COUNT,	/* bits1.branch_gen6.jump_count, from this IP */
+   JUMP_JIP_UIP,	/* bits3.break_cont.jip and uip, from this IP */
+   JUMP_JIP,		/* bits3.JIP, from this IP */
+   JUMP_JMPI,		/* bits3.JIP, from the next IP */
+};
+
+static enum jump_fields
+jump_fields(struct intel_context *intel, struct brw_instruction *insn)
+{
+   switch (insn->header.opcode) {
+   case BRW_OPCODE_IF:
+   case BRW_OPCODE_ELSE:
+   case BRW_OPCODE_ENDIF:
+   case BRW_OPCODE_WHILE:
+      return intel->gen == 6 ? JUMP_GEN6_COUNT : JUMP_JIP_UIP;
+   case BRW_OPCODE_BREAK:
+   case BRW_OPCODE_CONTINUE:
+   case BRW_OPCODE_HALT:
+      return JUMP_JIP_UIP;
+   case BRW_OPCODE_CALL:
+      return intel->gen == 6 ? JUMP_JIP : JUMP_JIP_UIP;
+   case BRW_OPCODE_JMPI:
+      return JUMP_JMPI;
+   default:
+      return JUMP_NONE;
+   }
+}
+
+struct compaction_map {
+   /* For the instruction at byte offset 8*i before compaction, the byte
+    * offset it moved to divided by 8, or -1 if none starts there. The
+    * entry past the last instruction maps the end of the program.
+    */
+   int *new_ip;
+   int old_size;
+};
+
+/**
+ * Moves a jump of the instruction at old byte offset this_old, new byte
+ * offset this_new, to the same target after compaction. base_old and
+ * base_new are what the jump is relative to, this instruction or the next.
+ */
 static int
-compacted_between(int old_ip, int old_target_ip, int *compacted_counts)
+update_jump(const struct compaction_map *map, int jump, int unit,
+            int base_old, int base_new)
 {
-   int this_compacted_count = compacted_counts[old_ip];
-   int target_compacted_count = compacted_counts[old_target_ip];
-   return target_compacted_count - this_compacted_count;
+   int target_old = base_old + jump * unit;
+
+   if (target_old < 0 || target_old > map->old_size || target_old % 8 ||
+       map->new_ip[target_old / 8] < 0)
+      return jump;
+
+   return (map->new_ip[target_old / 8] * 8 - base_new) / unit;
 }
 
 static void
-update_uip_jip(struct brw_instruction *insn, int this_old_ip,
-               int *compacted_counts)
+update_jumps(struct intel_context *intel, const struct compaction_map *map,
+             struct brw_instruction *insn,
+             int this_old, int old_size, int this_new, int new_size)
 {
-   int target_old_ip;
+   switch (jump_fields(intel, insn)) {
+   case JUMP_NONE:
+      break;
 
-   target_old_ip = this_old_ip + insn->bits3.break_cont.jip;
-   insn->bits3.break_cont.jip -= compacted_between(this_old_ip,
-                                                   target_old_ip,
-                                                   compacted_counts);
+   case JUMP_GEN6_COUNT:
+      insn->bits1.branch_gen6.jump_count =
+         update_jump(map, insn->bits1.branch_gen6.jump_count, 8,
+                     this_old, this_new);
+      break;
 
-   target_old_ip = this_old_ip + insn->bits3.break_cont.uip;
-   insn->bits3.break_cont.uip -= compacted_between(this_old_ip,
-                                                   target_old_ip,
-                                                   compacted_counts);
+   case JUMP_JIP_UIP:
+      insn->bits3.break_cont.jip =
+         update_jump(map, insn->bits3.break_cont.jip, 8, this_old, this_new);
+      insn->bits3.break_cont.uip =
+         update_jump(map, insn->bits3.break_cont.uip, 8, this_old, this_new);
+      break;
+
+   case JUMP_JIP:
+      insn->bits3.JIP = update_jump(map, insn->bits3.JIP, 8,
+                                    this_old, this_new);
+      break;
+
+   case JUMP_JMPI:
+      insn->bits3.JIP = update_jump(map, insn->bits3.JIP,
+                                    intel->is_haswell ? 1 : 8,
+                                    this_old + old_size,
+                                    this_new + new_size);
+      break;
+   }
 }
 
 void
@@ -646,6 +848,9 @@ brw_init_compaction_tables(struct intel_context *intel)
    assert(gen7_subreg_table[ARRAY_SIZE(gen6_subreg_table) - 1] != 0);
    assert(gen7_src_index_table[ARRAY_SIZE(gen6_src_index_table) - 1] != 0);
 
+   if (intel->gen == compaction_tables_gen)
+      return;
+
    switch (intel->gen) {
    case 7:
       control_index_table = gen7_control_index_table;
@@ -662,119 +867,165 @@ brw_init_compaction_tables(struct intel_context *intel)
    default:
       return;
    }
+
+   compact_hash_init(&control_index_hash, control_index_table);
+   compact_hash_init(&datatype_hash, datatype_table);
+   compact_hash_init(&subreg_hash, subreg_table);
+   compact_hash_init(&src_index_hash, src_index_table);
+   compaction_tables_gen = intel->gen;
 }
 
-void
-brw_compact_instructions(struct brw_compile *p)
+/**
+ * Compacts the program in orig into p->store, leaving alone the
+ * instructions marked in keep, and returns its new size. old_ip gets,
+ * for the instruction at byte offset 8*i after compaction, the byte offset
+ * it was at before divided by 8.
+ */
+static int
+compact_program(struct brw_compile *p, const void *orig, int size,
+                const bool *keep, struct compaction_map *map, int *old_ip)
 {
-   struct brw_context *brw = p->brw;
-   struct intel_context *intel = &brw->intel;
    void *store = p->store;
-   /* For an instruction at byte offset 8*i before compaction, this is the number
-    * of compacted instructions that preceded it.
-    */
-   int compacted_counts[p->next_insn_offset / 8];
-   /* For an instruction at byte offset 8*i after compaction, this is the
-    * 8-byte offset it was at before compaction.
-    */
-   int old_ip[p->next_insn_offset / 8];
+   int src_offset, offset = 0;
 
-   if (intel->gen < 6)
-      return;
+   for (int i = 0; i <= size / 8; i++)
+      map->new_ip[i] = -1;
 
-   int src_offset;
-   int offset = 0;
-   int compacted_count = 0;
-   for (src_offset = 0; src_offset < p->nr_insn * 16;) {
-      struct brw_instruction *src = store + src_offset;
+   for (src_offset = 0; src_offset < size;) {
+      const struct brw_instruction *src = orig + src_offset;
       void *dst = store + offset;
 
-      old_ip[offset / 8] = src_offset / 8;
-      compacted_counts[src_offset / 8] = compacted_count;
-
-      struct brw_instruction saved = *src;
-
-      if (!src->header.cmpt_control &&
-          brw_try_compact_instruction(p, dst, src)) {
-         compacted_count++;
-
-         if (INTEL_DEBUG) {
-            struct brw_instruction uncompacted;
-            brw_uncompact_instruction(intel, &uncompacted, dst);
-            if (memcmp(&saved, &uncompacted, sizeof(uncompacted))) {
-               brw_debug_compact_uncompact(intel, &saved, &uncompacted);
-            }
-         }
+      if (!src->header.cmpt_control && !keep[src_offset / 8]) {
+         struct brw_instruction insn = *src;
 
-         offset += 8;
-         src_offset += 16;
-      } else {
-         int size = src->header.cmpt_control ? 8 : 16;
-
-         /* It appears that the end of thread SEND instruction needs to be
-          * aligned, or the GPU hangs.
-          */
-         if ((src->header.opcode == BRW_OPCODE_SEND ||
-              src->header.opcode == BRW_OPCODE_SENDC) &&
-             src->bits3.generic.end_of_thread &&
-             (offset & 8) != 0) {
-            struct brw_compact_instruction *align = store + offset;
-            memset(align, 0, sizeof(*align));
-            align->dw0.opcode = BRW_OPCODE_NOP;
-            align->dw0.cmpt_ctrl = 1;
-            offset += 8;
+         if (brw_try_compact_instruction(p, dst, &insn)) {
+            map->new_ip[src_offset / 8] = offset / 8;
             old_ip[offset / 8] = src_offset / 8;
-            dst = store + offset;
+            offset += 8;
+            src_offset += 16;
+            continue;
          }
+      }
 
-         /* If we didn't compact this intruction, we need to move it down into
-          * place.
-          */
-         if (offset != src_offset) {
-            memmove(dst, src, size);
-         }
-         offset += size;
-         src_offset += size;
+      int insn_size = src->header.cmpt_control ? 8 : 16;
+
+      /* It appears that the end of thread SEND instruction needs to be
+       * aligned, or the GPU hangs.
+       */
+      if ((src->header.opcode == BRW_OPCODE_SEND ||
+           src->header.opcode == BRW_OPCODE_SENDC) &&
+          src->bits3.generic.end_of_thread &&
+          (offset & 8) != 0) {
+         struct brw_compact_instruction *align = store + offset;
+         memset(align, 0, sizeof(*align));
+         align->dw0.opcode = BRW_OPCODE_NOP;
+         align->dw0.cmpt_ctrl = 1;
+         old_ip[offset / 8] = -1;
+         offset += 8;
+         dst = store + offset;
       }
+
+      map->new_ip[src_offset / 8] = offset / 8;
+      old_ip[offset / 8] = src_offset / 8;
+      memcpy(dst, src, insn_size);
+      offset += insn_size;
+      src_offset += insn_size;
    }
 
-   /* Fix up control flow offsets. */
-   p->next_insn_offset = offset;
-   for (offset = 0; offset < p->next_insn_offset;) {
+   map->new_ip[size / 8] = offset / 8;
+
+   return offset;
+}
+
+/**
+ * Points the jumps of the compacted program at the instructions they
+ * targeted before, and returns the old byte offset divided by 8 of a
+ * compacted instruction which no longer compacts with its new jump, or -1.
+ */
+static int
+fixup_jumps(struct brw_compile *p, const void *orig,
+            const struct compaction_map *map, const int *old_ip, int size)
+{
+   struct intel_context *intel = &p->brw->intel;
+   void *store = p->store;
+
+   for (int offset = 0; offset < size;) {
       struct brw_instruction *insn = store + offset;
-      int this_old_ip = old_ip[offset / 8];
-      int this_compacted_count = compacted_counts[this_old_ip];
-      int target_old_ip, target_compacted_count;
-
-      switch (insn->header.opcode) {
-      case BRW_OPCODE_BREAK:
-      case BRW_OPCODE_CONTINUE:
-      case BRW_OPCODE_HALT:
-         update_uip_jip(insn, this_old_ip, compacted_counts);
-         break;
-
-      case BRW_OPCODE_IF:
-      case BRW_OPCODE_ELSE:
-      case BRW_OPCODE_ENDIF:
-      case BRW_OPCODE_WHILE:
-         if (intel->gen == 6) {
-            target_old_ip = this_old_ip + insn->bits1.branch_gen6.jump_count;
-            target_compacted_count = compacted_counts[target_old_ip];
-            insn->bits1.branch_gen6.jump_count -= (target_compacted_count -
-                                                   this_compacted_count);
-         } else {
-            update_uip_jip(insn, this_old_ip, compacted_counts);
-         }
-         break;
+      const struct brw_instruction *src;
+      int this_old = old_ip[offset / 8];
+
+      if (this_old < 0) {
+         offset += 8;
+         continue;
+      }
+      src = orig + this_old * 8;
+
+      if (jump_fields(intel, (struct brw_instruction *)src) == JUMP_NONE) {
+         offset += insn->header.cmpt_control ? 8 : 16;
+         continue;
       }
 
-      if (insn->header.cmpt_control) {
+      if (insn->header.cmpt_control && !src->header.cmpt_control) {
+         struct brw_instruction uncompacted = *src;
+
+         update_jumps(intel, map, &uncompacted,
+                      this_old * 8, 16, offset, 8);
+         if (!brw_try_compact_instruction(p, (void *)insn, &uncompacted))
+            return this_old;
          offset += 8;
-      } else {
+      } else if (!insn->header.cmpt_control) {
+         update_jumps(intel, map, insn, this_old * 8, 16, offset, 16);
          offset += 16;
+      } else {
+         /* Compacted before we got it, leave it be. */
+         offset += 8;
       }
    }
 
+   return -1;
+}
+
+void
+brw_compact_instructions(struct brw_compile *p)
+{
+   struct brw_context *brw = p->brw;
+   struct intel_context *intel = &brw->intel;
+   void *store = p->store;
+   int size = p->next_insn_offset;
+   struct compaction_map map = { .old_size = size };
+   bool *keep;
+   void *orig;
+   int *old_ip;
+   int offset, failed;
+
+   if (intel->gen != compaction_tables_gen)
+      return;
+
+   orig = malloc(size);
+   keep = calloc(size / 8 + 1, sizeof(*keep));
+   map.new_ip = malloc((size / 8 + 1) * sizeof(*map.new_ip));
+   old_ip = malloc((size / 8 + 1) * sizeof(*old_ip));
+   assert(orig && keep && map.new_ip && old_ip);
+   memcpy(orig, store, size);
+
+   /* Jumps only get shorter, but an alignment NOP can stretch one past
+    * what its compacted immediate holds: keep that instruction whole and
+    * start over.
+    */
+   do {
+      offset = compact_program(p, orig, size, keep, &map, old_ip);
+      failed = fixup_jumps(p, orig, &map, old_ip, offset);
+      if (failed >= 0)
+         keep[failed] = true;
+   } while (failed >= 0);
+
+   p->next_insn_offset = offset;
+
+   free(old_ip);
+   free(map.new_ip);
+   free(keep);
+   free(orig);
+
    /* p->nr_insn is counting the number of uncompacted instructions still, so
     * divide.  We do want to be sure there's a valid instruction in any
     * alignment padding, so that the next compression pass (for the FS 8/16
@@ -20,26 +20,93 @@
  * OF THIS SOFTWARE.
  */
 
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <getopt.h>
 #include <unistd.h>
 
 #include "gen4asm.h"
+#include "brw_context.h"
 #include "brw_eu.h"
 #include "gen8_instruction.h"
 
 static const struct option longopts[] = {
+	{ "binary", no_argument, NULL, 'b' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "gen", required_argument, NULL, 'g' },
+	{ "archive", no_argument, NULL, 'a' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "json", no_argument, NULL, 'J' },
 	{ NULL, 0, NULL, 0 }
 };
 
+/* Gen6 and Gen7 compacted instructions are 8 bytes, with bit 29 set. */
+#define COMPACTED (1 << 29)
+
+static int gen = 4;
+static int compact;
+static int byte_array_input;
+static int json_output;
+static struct brw_context brw;
+
+/*
+ * One program to disassemble: a whole input file, or a section of an
+ * archive already read in memory. Workers leave the disassembly, or
+ * what went wrong, in text/error for the main thread to print in order.
+ */
+struct job {
+    const char	*name;
+    const char	*path;
+    const char	*data;
+    size_t	size;
+
+    char	*text;
+    size_t	len;
+    char	*error;
+    bool	done;
+};
+
+static struct {
+    struct job	    *jobs;
+    int		    n_jobs;
+    int		    next;
+    int		    printed;
+    int		    window;
+    pthread_mutex_t mutex;
+    pthread_cond_t  claimable;
+    pthread_cond_t  done;
+} queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .claimable = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static struct brw_program_instruction *
+add_entry (struct brw_program_instruction ***prev, const void *inst,
+	   int size, unsigned offset)
+{
+    struct brw_program_instruction *entry;
+
+    entry = calloc (1, sizeof (struct brw_program_instruction));
+    memcpy (&entry->insn, inst, size);
+    entry->inst_offset = offset;
+    **prev = entry;
+    *prev = &entry->next;
+    return entry;
+}
+
 static struct brw_program *
-read_program (FILE *input)
+read_program (FILE *input, int compact)
 {
     uint32_t			    inst[4];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
+    struct brw_program_instruction  **prev;
+    unsigned		offset = 0;
     int			c;
     int			n = 0;
 
@@ -50,12 +117,9 @@ read_program (FILE *input)
 	if (c == '0') {
 	    if (fscanf (input, "x%x", &inst[n]) == 1) {
 		++n;
-		if (n == 4) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 4 * sizeof (uint32_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
+		if (n == 4 || (n == 2 && compact && (inst[0] & COMPACTED))) {
+		    add_entry (&prev, inst, n * sizeof (uint32_t), offset);
+		    offset += n * sizeof (uint32_t);
 		    n = 0;
 		}
 	    }
@@ -65,12 +129,13 @@ read_program (FILE *input)
 }
 
 static struct brw_program *
-read_program_binary (FILE *input)
+read_program_binary (FILE *input, int compact)
 {
     uint32_t			    temp;
     uint8_t			    inst[16];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
+    struct brw_program_instruction  **prev;
+    unsigned		offset = 0;
     int			c;
     int			n = 0;
 
@@ -81,12 +146,9 @@ read_program_binary (FILE *input)
 	if (c == '0') {
 	    if (fscanf (input, "x%2x", &temp) == 1) {
 		inst[n++] = (uint8_t)temp;
-		if (n == 16) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 16 * sizeof (uint8_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
+		if (n == 16 || (n == 8 && compact && (inst[3] & (COMPACTED >> 24)))) {
+		    add_entry (&prev, inst, n * sizeof (uint8_t), offset);
+		    offset += n;
 		    n = 0;
 		}
 	    }
@@ -95,27 +157,374 @@ read_program_binary (FILE *input)
     return program;
 }
 
+static void
+free_program (struct brw_program *program)
+{
+    struct brw_program_instruction *inst, *next;
+
+    for (inst = program->first; inst; inst = next) {
+	next = inst->next;
+	free (inst);
+    }
+    free (program);
+}
+
+static void
+disasm_instruction (FILE *output, struct brw_program_instruction *inst)
+{
+    if (gen >= 8)
+	gen8_disassemble(output, &inst->insn.gen8, gen);
+    else if (compact && inst->insn.gen.header.cmpt_control) {
+	struct brw_instruction uncompacted;
+
+	brw_uncompact_instruction(&brw.intel, &uncompacted,
+				  (struct brw_compact_instruction *)&inst->insn.gen);
+	brw_disasm (output, &uncompacted, gen);
+    } else
+	brw_disasm (output, &inst->insn.gen, gen);
+}
+
+static void
+json_string (FILE *output, const char *s, size_t len)
+{
+    size_t i;
+
+    fputc ('"', output);
+    for (i = 0; i < len; i++) {
+	unsigned char c = s[i];
+
+	if (c == '"' || c == '\\')
+	    fprintf (output, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf (output, "\\u%04x", c);
+	else
+	    fputc (c, output);
+    }
+    fputc ('"', output);
+}
+
+struct token {
+    const char	*s;
+    size_t	len;
+    int		line;
+};
+
+/*
+ * Splits text in blank separated tokens, keeping the blanks inside
+ * brackets as in "[0F, 1F, 2F, 3F]VF" or in sampler "(0, 0, 1, 0)".
+ */
+static int
+tokenize (const char *s, struct token *tokens, int max)
+{
+    int n = 0, line = 0;
+
+    while (*s && n < max) {
+	const char *start;
+	int depth = 0;
+
+	if (*s == ' ' || *s == '\t' || *s == '\n') {
+	    if (*s++ == '\n')
+		line++;
+	    continue;
+	}
+	for (start = s; *s; s++) {
+	    if (*s == '(' || *s == '[')
+		depth++;
+	    else if ((*s == ')' || *s == ']') && depth)
+		depth--;
+	    else if (!depth && (*s == ' ' || *s == '\t' || *s == '\n'))
+		break;
+	}
+	tokens[n].s = start;
+	tokens[n].len = s - start;
+	tokens[n].line = line;
+	n++;
+    }
+    return n;
+}
+
+static void
+json_tokens (FILE *output, const struct token *first, const struct token *last)
+{
+    json_string (output, first->s, last->s + last->len - first->s);
+}
+
+/*
+ * Splits the disassembly of one instruction, as brw_disasm() and
+ * gen8_disassemble() print it, into JSON fields:
+ *
+ *   [(predicate)] opcode[(execsize)] operand... { option... };
+ *
+ * send has its message description on a second line, before the options.
+ */
+static void
+print_instruction_json (FILE *output, const char *name,
+			struct brw_program_instruction *inst, const char *text)
+{
+    struct token tokens[64];
+    int n, i = 0, opcode, options, j;
+
+    n = tokenize (text, tokens, 64);
+    for (options = 0; options < n; options++)
+	if (tokens[options].len == 1 && strchr ("{;", tokens[options].s[0]))
+	    break;
+
+    fputs ("{\"program\":", output);
+    json_string (output, name, strlen (name));
+    fprintf (output, ",\"offset\":%u", inst->inst_offset);
+    if (compact && gen < 8 && inst->insn.gen.header.cmpt_control)
+	fputs (",\"compacted\":true", output);
+
+    if (i < options && tokens[i].s[0] == '(') {
+	fputs (",\"predicate\":", output);
+	json_string (output, tokens[i].s + 1, tokens[i].len - 2);
+	i++;
+    }
+
+    /* The opcode runs up to the execution size, "math inv(8)" or "nop". */
+    for (opcode = i; i < options && tokens[i].line == 0; i++)
+	if (memchr (tokens[i].s, '(', tokens[i].len))
+	    break;
+    if (i < options && tokens[i].line == 0) {
+	const char *paren = memchr (tokens[i].s, '(', tokens[i].len);
+	const char *end = paren;
+
+	while (end > tokens[opcode].s && end[-1] == ' ')
+	    end--;
+	fputs (",\"opcode\":", output);
+	json_string (output, tokens[opcode].s, end - tokens[opcode].s);
+	fprintf (output, ",\"execsize\":%d", atoi (paren + 1));
+	i++;
+    } else {
+	i = opcode;
+	while (i < options && tokens[i].line == 0)
+	    i++;
+	fputs (",\"opcode\":", output);
+	if (i > opcode)
+	    json_tokens (output, &tokens[opcode], &tokens[i - 1]);
+	else
+	    fputs ("\"\"", output);
+    }
+
+    fputs (",\"operands\":[", output);
+    for (j = i; i < options && tokens[i].line == 0; i++) {
+	if (i > j)
+	    fputc (',', output);
+	json_string (output, tokens[i].s, tokens[i].len);
+    }
+    fputc (']', output);
+
+    if (i < options) {
+	fputs (",\"message\":", output);
+	json_tokens (output, &tokens[i], &tokens[options - 1]);
+    }
+
+    if (options < n && tokens[options].s[0] == '{') {
+	fputs (",\"options\":[", output);
+	for (i = options + 1, j = 0; i < n && tokens[i].s[0] != '}'; i++) {
+	    size_t len = tokens[i].len;
+
+	    if (tokens[i].s[len - 1] == ',')
+		len--;
+	    if (!len)
+		continue;
+	    if (j++)
+		fputc (',', output);
+	    json_string (output, tokens[i].s, len);
+	}
+	fputc (']', output);
+    }
+    fputs ("}\n", output);
+}
+
+static void
+disasm_job (struct job *job)
+{
+    struct brw_program		    *program;
+    struct brw_program_instruction  *inst;
+    FILE	*input, *output;
+    char	*text = NULL;
+    size_t	len = 0;
+
+    if (job->path)
+	input = strcmp (job->path, "-") ? fopen (job->path, "r") : stdin;
+    else
+	input = fmemopen ((void *)job->data, job->size, "r");
+    if (input == NULL) {
+	if (asprintf (&job->error, "Couldn't open %s: %s",
+		      job->name, strerror (errno)) < 0)
+	    job->error = NULL;
+	return;
+    }
+
+    if (byte_array_input)
+	program = read_program_binary (input, compact);
+    else
+	program = read_program (input, compact);
+    if (input != stdin)
+	fclose (input);
+
+    output = open_memstream (&job->text, &job->len);
+    if (!json_output) {
+	if (queue.n_jobs > 1 || job->data)
+	    fprintf (output, "# %s\n", job->name);
+	for (inst = program->first; inst; inst = inst->next)
+	    disasm_instruction (output, inst);
+    } else {
+	/* Each instruction goes through text, then gets split in fields. */
+	FILE *scratch = open_memstream (&text, &len);
+
+	for (inst = program->first; inst; inst = inst->next) {
+	    rewind (scratch);
+	    disasm_instruction (scratch, inst);
+	    fputc ('\0', scratch);
+	    fflush (scratch);
+	    print_instruction_json (output, job->name, inst, text);
+	}
+	fclose (scratch);
+	free (text);
+    }
+    fclose (output);
+
+    free_program (program);
+}
+
+/*
+ * Workers claim programs in order, at most queue.window ahead of the one
+ * the main thread is printing, so the output stays in input order
+ * without holding all of it in memory.
+ */
+static void *
+disasm_thread (void *arg)
+{
+    for (;;) {
+	struct job *job;
+
+	pthread_mutex_lock (&queue.mutex);
+	while (queue.next < queue.n_jobs &&
+	       queue.next >= queue.printed + queue.window)
+	    pthread_cond_wait (&queue.claimable, &queue.mutex);
+	if (queue.next == queue.n_jobs) {
+	    pthread_mutex_unlock (&queue.mutex);
+	    return NULL;
+	}
+	job = &queue.jobs[queue.next++];
+	pthread_mutex_unlock (&queue.mutex);
+
+	disasm_job (job);
+
+	pthread_mutex_lock (&queue.mutex);
+	job->done = true;
+	pthread_cond_broadcast (&queue.done);
+	pthread_mutex_unlock (&queue.mutex);
+    }
+}
+
+static struct job *
+add_job (const char *name)
+{
+    queue.jobs = realloc (queue.jobs, (queue.n_jobs + 1) * sizeof (struct job));
+    memset (&queue.jobs[queue.n_jobs], 0, sizeof (struct job));
+    queue.jobs[queue.n_jobs].name = name;
+    return &queue.jobs[queue.n_jobs++];
+}
+
+static char *
+read_file (const char *path, size_t *size)
+{
+    FILE	*input;
+    char	*data = NULL;
+    size_t	n;
+
+    input = strcmp (path, "-") ? fopen (path, "r") : stdin;
+    if (input == NULL)
+	return NULL;
+
+    *size = 0;
+    do {
+	data = realloc (data, *size + 65536 + 1);
+	n = fread (data + *size, 1, 65536, input);
+	*size += n;
+    } while (n);
+    data[*size] = '\0';
+
+    if (input != stdin)
+	fclose (input);
+    return data;
+}
+
+/*
+ * An archive holds several programs, each after a "# name" line, as
+ * printed by e.g. "for f in *.hex; do echo \# $f; cat $f; done".
+ */
+static bool
+add_archive_jobs (const char *path)
+{
+    const char	*line, *end, *start, *name = NULL;
+    char	*data;
+    size_t	size;
+
+    data = read_file (path, &size);
+    if (data == NULL)
+	return false;
+
+    end = data + size;
+    for (start = line = data; line < end; ) {
+	const char *eol = memchr (line, '\n', end - line);
+
+	eol = eol ? eol + 1 : end;
+	if (*line == '#') {
+	    const char *s = line + 1, *e = eol;
+	    const char *code = strstr (start, "0x");
+
+	    /* Anything before the first name is only kept if it has code. */
+	    if (name || (code && code < line)) {
+		struct job *job = add_job (name ? name : path);
+
+		job->data = start;
+		job->size = line - start;
+	    }
+
+	    while (s < e && (*s == ' ' || *s == '\t'))
+		s++;
+	    while (e > s && (e[-1] == '\n' || e[-1] == ' ' || e[-1] == '\t'))
+		e--;
+	    name = strndup (s, e - s);
+	    start = eol;
+	}
+	line = eol;
+    }
+    if (name || strstr (start, "0x")) {
+	struct job *job = add_job (name ? name : path);
+
+	job->data = start;
+	job->size = end - start;
+    }
+    return true;
+}
+
 static void usage(void)
 {
-    fprintf(stderr, "usage: intel-gen4disasm [options] inputfile\n");
+    fprintf(stderr, "usage: intel-gen4disasm [options] inputfile...\n");
     fprintf(stderr, "\t-b, --binary                         C style binary output\n");
     fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
     fprintf(stderr, "\t-g, --gen <4|5|6|7|8|9>              Specify GPU generation\n");
+    fprintf(stderr, "\t-a, --archive                        Inputs hold several programs, each after a \"# name\" line\n");
+    fprintf(stderr, "\t-j, --jobs {n}                       Disassemble n programs at once (default: one per CPU)\n");
+    fprintf(stderr, "\t-J, --json                           One JSON object per instruction\n");
 }
 
 int main(int argc, char **argv)
 {
-    struct brw_program	*program;
-    FILE		*input = stdin;
     FILE		*output = stdout;
-    char		*input_filename = NULL;
     char		*output_file = NULL;
-    int			byte_array_input = 0;
-    int			o;
-    int			gen = 4;
-    struct brw_program_instruction  *inst;
+    int			archive = 0;
+    int			n_threads = 0;
+    int			o, i;
+    int			status = 0;
+    pthread_t		*threads;
 
-    while ((o = getopt_long(argc, argv, "o:bg:", longopts, NULL)) != -1) {
+    while ((o = getopt_long(argc, argv, "o:bg:aj:J", longopts, NULL)) != -1) {
 	switch (o) {
 	case 'o':
 	    if (strcmp(optarg, "-") != 0)
@@ -132,6 +541,21 @@ int main(int argc, char **argv)
 		    exit(1);
 	    }
 
+	    break;
+	case 'a':
+	    archive = 1;
+	    break;
+	case 'j':
+	    n_threads = strtol(optarg, NULL, 10);
+
+	    if (n_threads < 1) {
+		    usage();
+		    exit(1);
+	    }
+
+	    break;
+	case 'J':
+	    json_output = 1;
 	    break;
 	default:
 	    usage();
@@ -140,25 +564,28 @@ int main(int argc, char **argv)
     }
     argc -= optind;
     argv += optind;
-    if (argc != 1) {
+    if (argc < 1) {
 	usage();
 	exit(1);
     }
 
-    if (strcmp(argv[0], "-") != 0) {
-	input_filename = argv[0];
-	input = fopen(input_filename, "r");
-	if (input == NULL) {
-	    perror("Couldn't open input file");
-	    exit(1);
-	}
+    for (i = 0; i < argc; i++) {
+	if (archive) {
+	    if (!add_archive_jobs (argv[i])) {
+		perror("Couldn't open input file");
+		exit(1);
+	    }
+	} else
+	    add_job (argv[i])->path = argv[i];
     }
-    if (byte_array_input)
-	program = read_program_binary (input);
-    else
-	program = read_program (input);
-    if (!program)
-	exit (1);
+
+    /* Programs compacted by intel-gen4asm -c mix 8 and 16 byte instructions. */
+    compact = gen == 6 || gen == 7;
+    if (compact) {
+	brw_init_context(&brw, gen * 10);
+	brw_init_compaction_tables(&brw.intel);
+    }
+
     if (output_file) {
 	output = fopen (output_file, "w");
 	if (output == NULL) {
@@ -167,11 +594,46 @@ int main(int argc, char **argv)
 	}
     }
 
-    for (inst = program->first; inst; inst = inst->next)
-	if (gen >= 8)
-	    gen8_disassemble(output, &inst->insn.gen8, gen);
-	else
-	    brw_disasm (output, &inst->insn.gen, gen);
+    if (!n_threads)
+	n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n_threads > queue.n_jobs)
+	n_threads = queue.n_jobs;
+    queue.window = 4 * n_threads;
+
+    threads = calloc (n_threads, sizeof (pthread_t));
+    for (i = 1; i < n_threads; i++)
+	pthread_create (&threads[i], NULL, disasm_thread, NULL);
+
+    for (i = 0; i < queue.n_jobs; i++) {
+	struct job *job = &queue.jobs[i];
+
+	/* Without helpers, or while they are busy, decode it ourselves. */
+	pthread_mutex_lock (&queue.mutex);
+	if (queue.next == i) {
+	    queue.next++;
+	    pthread_mutex_unlock (&queue.mutex);
+	    disasm_job (job);
+	    pthread_mutex_lock (&queue.mutex);
+	    job->done = true;
+	}
+	while (!job->done)
+	    pthread_cond_wait (&queue.done, &queue.mutex);
+	queue.printed = i + 1;
+	pthread_cond_broadcast (&queue.claimable);
+	pthread_mutex_unlock (&queue.mutex);
+
+	if (job->error) {
+	    fprintf (stderr, "%s\n", job->error);
+	    status = 1;
+	} else
+	    fwrite (job->text, 1, job->len, output);
+	free (job->text);
+	free (job->error);
+    }
+
+    for (i = 1; i < n_threads; i++)
+	pthread_join (threads[i], NULL);
+    free (threads);
 
-    exit (0);
+    exit (status);
 }
@@ -263,7 +263,8 @@ static const char *const m_urb_opcode[16] = {
 
 static const char *const m_urb_interleave[2] = { "", "interleaved" };
 
-static int column;
+/* Thread local, programs may be disassembled concurrently. */
+static __thread int column;
 
 static int
 string(FILE *file, const char *string)
@@ -26,6 +26,7 @@
  *
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +57,8 @@ struct program_defaults program_defaults = {.register_type = BRW_REGISTER_TYPE_F
 
 /* 0: default output style, 1: nice C-style output */
 static int binary_like_output = 0;
+/* 1: compact the instructions that can be, Gen6 and Gen7 only */
+static int compact_output = 0;
 static char *export_filename = NULL;
 static const char binary_prepend[] = "static const char gen_eu_bytes[] = {\n";
 
@@ -71,16 +74,29 @@ typedef struct hash_item *hash_table[HASH_SIZE];
 
 static hash_table declared_register_table;
 
+/*
+ * Labels by name, each with the addresses it is defined at in program
+ * order, hence ascending. The table is grown to keep about one label per
+ * bucket.
+ */
 struct label_item {
 	char *name;
-	int addr;
+	int *addrs;
+	int n_addrs;
+	int n_allocated;
 	struct label_item *next;
 };
-static struct label_item *label_table;
+
+static struct {
+	struct label_item **buckets;
+	unsigned int size;
+	unsigned int count;
+} label_table;
 
 static const struct option longopts[] = {
 	{"advanced", no_argument, 0, 'a'},
 	{"binary", no_argument, 0, 'b'},
+	{"compact", no_argument, 0, 'c'},
 	{"export", required_argument, 0, 'e'},
 	{"input_list", required_argument, 0, 'l'},
 	{"output", required_argument, 0, 'o'},
@@ -94,6 +110,7 @@ static void usage(void)
 	fprintf(stderr, "OPTIONS:\n");
 	fprintf(stderr, "\t-a, --advanced                       Set advanced flag\n");
 	fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+	fprintf(stderr, "\t-c, --compact                        Compact instructions (Gen6 and Gen7)\n");
 	fprintf(stderr, "\t-e, --export {exportfile}            Export label file\n");
 	fprintf(stderr, "\t-l, --input_list {entrytablefile}    Input entry_table_list file\n");
 	fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
@@ -153,47 +170,131 @@ void insert_register(struct declared_register *reg)
     insert_hash_item(declared_register_table, reg->name, reg);
 }
 
+static unsigned int label_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+	return hash;
+}
+
+static struct label_item *find_label(const char *name)
+{
+	struct label_item *p;
+
+	if (!label_table.size)
+		return NULL;
+
+	for (p = label_table.buckets[label_hash(name) & (label_table.size - 1)];
+	     p; p = p->next)
+		if (strcmp(p->name, name) == 0)
+			return p;
+
+	return NULL;
+}
+
+static void grow_label_table(void)
+{
+	unsigned int size = label_table.size ? 2 * label_table.size : 256;
+	struct label_item **buckets = calloc(size, sizeof(*buckets));
+	unsigned int i;
+
+	assert(buckets);
+
+	for (i = 0; i < label_table.size; i++) {
+		struct label_item *p, *next;
+
+		for (p = label_table.buckets[i]; p; p = next) {
+			unsigned int index = label_hash(p->name) & (size - 1);
+
+			next = p->next;
+			p->next = buckets[index];
+			buckets[index] = p;
+		}
+	}
+
+	free(label_table.buckets);
+	label_table.buckets = buckets;
+	label_table.size = size;
+}
+
 static void add_label(struct brw_program_instruction *i)
 {
-    struct label_item **p = &label_table;
+	struct label_item *p;
+
+	assert(is_label(i));
+
+	p = find_label(label_name(i));
+	if (!p) {
+		unsigned int index;
+
+		if (label_table.count >= label_table.size)
+			grow_label_table();
+
+		p = calloc(1, sizeof(*p));
+		assert(p);
+		p->name = label_name(i);
 
-    assert(is_label(i));
+		index = label_hash(p->name) & (label_table.size - 1);
+		p->next = label_table.buckets[index];
+		label_table.buckets[index] = p;
+		label_table.count++;
+	}
+
+	if (p->n_addrs == p->n_allocated) {
+		p->n_allocated = p->n_allocated ? 2 * p->n_allocated : 1;
+		p->addrs = realloc(p->addrs, p->n_allocated * sizeof(*p->addrs));
+		assert(p->addrs);
+	}
 
-    while(*p)
-        p = &((*p)->next);
-    *p = calloc(1, sizeof(**p));
-    (*p)->name = label_name(i);
-    (*p)->addr = i->inst_offset;
+	assert(!p->n_addrs || p->addrs[p->n_addrs - 1] <= i->inst_offset);
+	p->addrs[p->n_addrs++] = i->inst_offset;
 }
 
 /* Some assembly code have duplicated labels.
    Start from start_addr. Search as a loop. Return the first label found. */
 static int label_to_addr(char *name, int start_addr)
 {
-    /* return the first label just after start_addr, or the first label from the head */
-    struct label_item *p;
-    int r = -1;
-    for(p = label_table; p; p = p->next) {
-        if(strcmp(p->name, name) == 0) {
-            if(p->addr >= start_addr) // the first label just after start_addr
-                return p->addr;
-            else if(r == -1) // the first label from the head
-                r = p->addr;
-        }
-    }
-    if(r == -1) {
-        fprintf(stderr, "Can't find label %s\n", name);
-        exit(1);
-    }
-    return r;
+	/* return the first label just after start_addr, or the first label from the head */
+	struct label_item *p = find_label(name);
+	int lo = 0, hi;
+
+	if (!p) {
+		fprintf(stderr, "Can't find label %s\n", name);
+		exit(1);
+	}
+
+	hi = p->n_addrs;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (p->addrs[mid] < start_addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < p->n_addrs ? p->addrs[lo] : p->addrs[0];
 }
 
-static void free_label_table(struct label_item *p)
+static void free_label_table(void)
 {
-    if(p) {
-        free_label_table(p->next);
-        free(p);
-    }
+	unsigned int i;
+
+	for (i = 0; i < label_table.size; i++) {
+		struct label_item *p, *next;
+
+		for (p = label_table.buckets[i]; p; p = next) {
+			next = p->next;
+			free(p->addrs);
+			free(p);
+		}
+	}
+
+	free(label_table.buckets);
+	memset(&label_table, 0, sizeof(label_table));
 }
 
 struct entry_point_item {
@@ -246,7 +347,24 @@ static void free_entry_point_table(struct entry_point_item *p) {
 static void
 print_instruction(FILE *output, struct brw_instruction *instruction)
 {
-	if (binary_like_output) {
+	/* Compacted instructions are only 8 bytes. */
+	if (compact_output && instruction->header.cmpt_control) {
+		if (binary_like_output)
+			fprintf(output, "\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
+					"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n",
+				((unsigned char *)instruction)[0],
+				((unsigned char *)instruction)[1],
+				((unsigned char *)instruction)[2],
+				((unsigned char *)instruction)[3],
+				((unsigned char *)instruction)[4],
+				((unsigned char *)instruction)[5],
+				((unsigned char *)instruction)[6],
+				((unsigned char *)instruction)[7]);
+		else
+			fprintf(output, "   { 0x%08x, 0x%08x },\n",
+				((int *)instruction)[0],
+				((int *)instruction)[1]);
+	} else if (binary_like_output) {
 		fprintf(output, "\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
 				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n"
 				"\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
@@ -275,6 +393,46 @@ print_instruction(FILE *output, struct brw_instruction *instruction)
 			((int *)instruction)[3]);
 	}
 }
+
+/*
+ * Moves the resolved program into the compile store and compacts it there,
+ * brw_compact_instructions() takes care of the jumps. Labels are gone by
+ * then, which is why this doesn't mix with exporting them or entry points.
+ */
+static void print_compacted_program(FILE *output)
+{
+	struct brw_program_instruction *entry;
+	unsigned int n = 0, offset;
+	void *store;
+
+	for (entry = compiled_program.first; entry; entry = entry->next)
+		if (!is_label(entry))
+			n++;
+
+	if (n > genasm_compile.store_size) {
+		genasm_compile.store_size = n;
+		genasm_compile.store = reralloc(genasm_compile.mem_ctx,
+						genasm_compile.store,
+						struct brw_instruction, n);
+	}
+
+	n = 0;
+	for (entry = compiled_program.first; entry; entry = entry->next)
+		if (!is_label(entry))
+			genasm_compile.store[n++] = entry->insn.gen;
+	genasm_compile.nr_insn = n;
+	genasm_compile.next_insn_offset = n * sizeof(struct brw_instruction);
+
+	brw_compact_instructions(&genasm_compile);
+
+	store = genasm_compile.store;
+	for (offset = 0; offset < genasm_compile.next_insn_offset;) {
+		struct brw_instruction *insn = store + offset;
+
+		print_instruction(output, insn);
+		offset += insn->header.cmpt_control ? 8 : 16;
+	}
+}
 int main(int argc, char **argv)
 {
 	char *output_file = NULL;
@@ -286,7 +444,7 @@ int main(int argc, char **argv)
 	char o;
 	void *mem_ctx;
 
-	while ((o = getopt_long(argc, argv, "e:l:o:g:abW", longopts, NULL)) != -1) {
+	while ((o = getopt_long(argc, argv, "e:l:o:g:abcW", longopts, NULL)) != -1) {
 		switch (o) {
 		case 'o':
 			if (strcmp(optarg, "-") != 0)
@@ -326,6 +484,10 @@ int main(int argc, char **argv)
 			binary_like_output = 1;
 			break;
 
+		case 'c':
+			compact_output = 1;
+			break;
+
 		case 'e':
 			need_export = 1;
 			if (strcmp(optarg, "-") != 0)
@@ -353,6 +515,17 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (compact_output) {
+		if (gen_level < 60 || gen_level >= 80) {
+			fprintf(stderr, "Instruction compaction is only supported on Gen6 and Gen7\n");
+			exit(1);
+		}
+		if (need_export || entry_table_file) {
+			fprintf(stderr, "Instruction compaction can't be used with -e or -l\n");
+			exit(1);
+		}
+	}
+
 	if (strcmp(argv[0], "-") != 0) {
 		input_filename = argv[0];
 		yyin = fopen(input_filename, "r");
@@ -450,14 +623,17 @@ int main(int argc, char **argv)
 	if (binary_like_output)
 		fprintf(output, "%s", binary_prepend);
 
+	if (compact_output)
+		print_compacted_program(output);
+
 	for (entry = compiled_program.first;
 		entry != NULL;
 		entry = entry1) {
 	    entry1 = entry->next;
-	    if (!is_label(entry))
-		print_instruction(output, &entry->insn.gen);
-	    else
+	    if (is_label(entry))
 		free(entry->insn.label.name);
+	    else if (!compact_output)
+		print_instruction(output, &entry->insn.gen);
 	    free(entry);
 	}
 	if (binary_like_output)
@@ -465,7 +641,7 @@ int main(int argc, char **argv)
 
 	free_entry_point_table(entry_point_table);
 	free_hash_table(declared_register_table);
-	free_label_table(label_table);
+	free_label_table();
 
 	fflush (output);
 	if (ferror (output)) {
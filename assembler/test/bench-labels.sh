@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Assembles a synthetic program of $1 (default 100000) blocks, each one
+# a label followed by a mov and a jump to a random label, with a fifth of
+# the label names defined twice.
+
+BUILDDIR="${top_builddir-`pwd`}"
+BLOCKS="${1-100000}"
+
+test -d "${BUILDDIR}/test" || mkdir "${BUILDDIR}/test/"
+
+program="${BUILDDIR}/test/bench-labels.g4a"
+
+awk -v blocks="${BLOCKS}" 'BEGIN {
+	srand(1);
+	names = blocks - int(blocks / 5);
+	for (i = 0; i < blocks; i++) {
+		printf("L%d:\n", i % names);
+		printf("mov (1) g0<1>UD g1<0,1,0>UD { align1 };\n");
+		printf("jmpi (1) L%d;\n", int(rand() * names));
+	}
+}' > "${program}"
+
+start=`date +%s%N`
+"${BUILDDIR}/intel-gen4asm" -o "${BUILDDIR}/test/bench-labels.out" "${program}" || exit 1
+end=`date +%s%N`
+
+echo "${BLOCKS} labels and relocations assembled in $(((end - start) / 1000000))ms"
@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# Assembles a test with and without instruction compaction (-c) and checks
+# that both disassemble to the same program, once every branch offset is
+# replaced by the instruction it lands on.
+
+SRCDIR="${srcdir-`pwd`}"
+BUILDDIR="${top_builddir-`pwd`}"
+
+test="$1"
+gen="${2-7}"
+
+# Haswell counts JMPI offsets in bytes, everything else in 8 bytes.
+jmpi_unit=8
+if [ "$gen" = "7.5" ] ; then
+	jmpi_unit=1
+fi
+
+out="${BUILDDIR}/${test}-gen${gen}"
+mkdir -p `dirname "$out"`
+
+# Prints the disassembly $2 of the program $1 without the alignment NOPs,
+# and with the branch offsets turned into @index of their target.
+normalize()
+{
+	awk -v jmpi_unit=$jmpi_unit '
+	FNR == NR {
+		if (index($0, "0x")) {
+			off[n++] = size
+			size += 4 * gsub(/0x/, "")
+		}
+		next
+	}
+	/^[ \t]/ { text[m - 1] = text[m - 1] $0; next }
+	{ text[m++] = $0 }
+	END {
+		off[n] = size
+		for (i = 0; i <= n; i++)
+			at[off[i]] = i
+		for (i = 0; i < m; i++) {
+			logical[i] = l
+			if (text[i] !~ /^nop/)
+				l++
+		}
+		logical[m] = l
+
+		for (i = 0; i < m; i++) {
+			if (text[i] ~ /^nop/)
+				continue
+
+			nf = split(text[i], f, " ")
+			o = f[1] ~ /^\(/ ? 2 : 1
+			op = f[o]
+			sub(/\(.*/, "", op)
+			if (op ~ /^(jmpi|if|else|endif|while|break|cont|halt|call)$/) {
+				base = off[i]
+				unit = 8
+				if (op == "jmpi") {
+					base = off[i + 1]
+					unit = jmpi_unit
+				}
+				for (k = o + 1; k <= nf && f[k] ~ /^-?[0-9]+$/; k++) {
+					t = base + f[k] * unit
+					f[k] = (t in at) ? "@" logical[at[t]] : "@?" t
+				}
+				# The operands hold the offsets again.
+				for (j = k; j <= nf && f[j] !~ /^{/; j++)
+					;
+				for (; j <= nf; j++)
+					f[k++] = f[j]
+				nf = k - 1
+			}
+
+			line = f[1]
+			for (k = 2; k <= nf; k++)
+				line = line " " f[k]
+			print line
+		}
+	}' "$1" "$2"
+}
+
+for variant in full compact ; do
+	flags=
+	if [ $variant = compact ] ; then
+		flags=-c
+	fi
+
+	"${BUILDDIR}/intel-gen4asm" -g $gen $flags -o "$out.$variant" "$SRCDIR/${test}.g4a" || exit 1
+	"${BUILDDIR}/intel-gen4disasm" -g ${gen%.*} -o "$out.$variant.dis" "$out.$variant" || exit 1
+	normalize "$out.$variant" "$out.$variant.dis" > "$out.$variant.txt"
+done
+
+full=`grep -o 0x "$out.full" | wc -l`
+compact=`grep -o 0x "$out.compact" | wc -l`
+echo "${test} (gen${gen}): $full dwords, $compact once compacted"
+
+if [ "$compact" -ge "$full" ] ; then
+	echo "Nothing compacted in ${test} (gen${gen})"
+	exit 1
+fi
+
+if cmp "$out.full.txt" "$out.compact.txt" > /dev/null ; then : ; else
+	echo "Compaction round-trip for ${test} (gen${gen})"
+	diff -u "$out.full.txt" "$out.compact.txt"
+	exit 1
+fi
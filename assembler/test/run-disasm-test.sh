@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Disassembles several programs at once, as separate inputs (batch mode)
+# and as one archive (-a), and checks that both print each program as it
+# is printed on its own, in input order. Then checks the JSON lines (-J)
+# of the programs against test/disasm/json.expected.
+
+SRCDIR="${srcdir-`pwd`}"
+BUILDDIR="${top_builddir-`pwd`}"
+
+disasm="${BUILDDIR}/intel-gen4disasm"
+out="${BUILDDIR}/test/disasm"
+mkdir -p "$out"
+
+# Program names are printed as given, relative to the source directory.
+cd "$SRCDIR" || exit 1
+programs="test/mov.expected test/not.expected test/immediate.expected
+	  test/regtype.expected test/lzd.expected test/disasm/send.hex"
+
+# Enough programs for the workers to finish out of order.
+inputs=
+for i in 1 2 3 4 ; do
+	inputs="$inputs $programs"
+done
+
+check()
+{
+	if cmp "$1" "$2" > /dev/null ; then : ; else
+		echo "$3"
+		diff -u "$1" "$2"
+		exit 1
+	fi
+}
+
+rm -f "$out/single.txt" "$out/archive"
+for program in $inputs ; do
+	echo "# $program" >> "$out/single.txt"
+	"$disasm" -o - "$program" >> "$out/single.txt" || exit 1
+	echo "# $program" >> "$out/archive"
+	cat "$program" >> "$out/archive"
+done
+
+for jobs in 1 4 ; do
+	"$disasm" -j $jobs -o "$out/batch-$jobs.txt" $inputs || exit 1
+	check "$out/single.txt" "$out/batch-$jobs.txt" \
+	      "Batch disassembly with $jobs jobs"
+
+	"$disasm" -j $jobs -a -o "$out/archive-$jobs.txt" "$out/archive" || exit 1
+	check "$out/single.txt" "$out/archive-$jobs.txt" \
+	      "Archive disassembly with $jobs jobs"
+done
+
+"$disasm" -J -o "$out/json.txt" $programs || exit 1
+check test/disasm/json.expected "$out/json.txt" "JSON disassembly"
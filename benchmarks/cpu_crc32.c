@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Checksums a buffer in plain memory with the byte at a time table loop
+ * igt_cpu_crc32() used to be, with each of the implementations returned
+ * by igt_crc32_get_impl() the cpu supports, and with
+ * igt_cpu_crc32_parallel(). Reports the throughput of each in MiB/s.
+ */
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "igt_crc.h"
+#include "igt_x86.h"
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static uint32_t crc32_bytewise(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint32_t crc = ~0U;
+
+	while (size--)
+		crc = igt_crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ ~0U;
+}
+
+static unsigned int threads;
+
+static uint32_t crc32_parallel(const void *buf, size_t size)
+{
+	return igt_cpu_crc32_parallel(buf, size, threads);
+}
+
+static void run(const char *name, igt_crc32_fn fn, const void *buf,
+		size_t size, unsigned int loops, uint32_t expected)
+{
+	struct timespec start, end;
+	uint32_t crc = 0;
+	unsigned int l;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (l = 0; l < loops; l++)
+		crc = fn(buf, size);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%-10s %8.0fMiB/s%s\n", name,
+	       (double)size * loops / elapsed(&start, &end) / (1 << 20),
+	       crc == expected ? "" : " (mismatch)");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int features = igt_x86_features();
+	unsigned int size_mib = 256, loops = 4, reps = 1;
+	uint32_t expected;
+	uint8_t *buf;
+	size_t size;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:l:r:t:")) != -1) {
+		switch (c) {
+		case 's':
+			size_mib = atoi(optarg);
+			if (size_mib < 1)
+				size_mib = 1;
+			break;
+
+		case 'l':
+			loops = atoi(optarg);
+			if (loops < 1)
+				loops = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	size = (size_t)size_mib << 20;
+	buf = malloc(size);
+	assert(buf);
+	for (size_t i = 0; i < size; i++)
+		buf[i] = i * 2654435761u >> 24;
+
+	expected = crc32_bytewise(buf, size);
+
+	while (reps--) {
+		run("bytewise", crc32_bytewise, buf, size, loops, expected);
+		run("slice8", igt_crc32_get_impl(0), buf, size, loops, expected);
+		if ((features & (PCLMUL | SSE4_1)) == (PCLMUL | SSE4_1))
+			run("pclmul", igt_crc32_get_impl(PCLMUL | SSE4_1),
+			    buf, size, loops, expected);
+		run("parallel", crc32_parallel, buf, size, loops, expected);
+	}
+
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Parses a corpus of drm fdinfo files, either captured ones from a directory
+ * given with -d or a synthetic i915 sample, with the per-file parser and with
+ * the batch parser. Reports the average cost per file in nanoseconds.
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "igt_drm_fdinfo.h"
+
+static const char sample[] =
+	"pos:\t0\n"
+	"flags:\t02100002\n"
+	"mnt_id:\t26\n"
+	"ino:\t1073\n"
+	"drm-driver:\ti915\n"
+	"drm-pdev:\t0000:03:00.0\n"
+	"drm-client-id:\t%u\n"
+	"drm-total-system0:\t4 MiB\n"
+	"drm-shared-system0:\t0\n"
+	"drm-active-system0:\t0\n"
+	"drm-resident-system0:\t4 MiB\n"
+	"drm-purgeable-system0:\t0\n"
+	"drm-total-local0:\t212 MiB\n"
+	"drm-shared-local0:\t0\n"
+	"drm-active-local0:\t0\n"
+	"drm-resident-local0:\t212 MiB\n"
+	"drm-purgeable-local0:\t0\n"
+	"drm-engine-render:\t%u ns\n"
+	"drm-engine-copy:\t0 ns\n"
+	"drm-engine-video:\t%u ns\n"
+	"drm-engine-capacity-video:\t2\n"
+	"drm-engine-video-enhance:\t0 ns\n";
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static unsigned int load_corpus(int dir, char ***names)
+{
+	unsigned int num = 0, max = 0;
+	struct dirent *dent;
+	DIR *d;
+
+	d = fdopendir(dup(dir));
+	assert(d);
+
+	while ((dent = readdir(d))) {
+		if (dent->d_type != DT_REG)
+			continue;
+
+		if (num == max) {
+			max = max ? 2 * max : 64;
+			*names = realloc(*names, max * sizeof(**names));
+			assert(*names);
+		}
+
+		(*names)[num++] = strdup(dent->d_name);
+	}
+
+	closedir(d);
+
+	return num;
+}
+
+static void make_corpus(int dir, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		char name[16], buf[2048];
+		int fd, len;
+
+		snprintf(name, sizeof(name), "%u", i);
+		len = snprintf(buf, sizeof(buf), sample, i, i * 1000, i * 10);
+
+		fd = openat(dir, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		assert(fd >= 0);
+		assert(write(fd, buf, len) == len);
+		close(fd);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char tmp[] = "/tmp/drm_fdinfo_parse.XXXXXX";
+	unsigned int count = 1000, reps = 1, loops = 100;
+	const char *corpus = NULL;
+	struct drm_client_batch batch;
+	char **names = NULL;
+	unsigned int num, i;
+	int dir, c;
+
+	while ((c = getopt (argc, argv, "d:n:l:r:")) != -1) {
+		switch (c) {
+		case 'd':
+			corpus = optarg;
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1)
+				count = 1;
+			break;
+
+		case 'l':
+			loops = atoi(optarg);
+			if (loops < 1)
+				loops = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (!corpus) {
+		corpus = mkdtemp(tmp);
+		assert(corpus);
+	}
+
+	dir = open(corpus, O_DIRECTORY | O_RDONLY);
+	assert(dir >= 0);
+
+	if (corpus == tmp)
+		make_corpus(dir, count);
+
+	num = load_corpus(dir, &names);
+	assert(num);
+
+	igt_drm_client_batch_init(&batch);
+
+	while (reps--) {
+		struct timespec start, end;
+		unsigned int parsed = 0;
+		double legacy, batched;
+		unsigned int l;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (l = 0; l < loops; l++) {
+			for (i = 0; i < num; i++) {
+				struct drm_client_fdinfo info = { };
+
+				parsed += !!__igt_parse_drm_fdinfo(dir, names[i],
+								   &info);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		legacy = elapsed(&start, &end) * 1e9 / loops / num;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (l = 0; l < loops; l++) {
+			igt_drm_client_batch_reset(&batch);
+			igt_parse_drm_fdinfo_batch(&batch, dir,
+						   (const char * const *)names,
+						   num);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		batched = elapsed(&start, &end) * 1e9 / loops / num;
+
+		printf("per-file: %.0fns, batch: %.0fns (%u/%u clients)\n",
+		       legacy, batched, batch.num_records, parsed / loops);
+	}
+
+	igt_drm_client_batch_fini(&batch);
+
+	if (corpus == tmp) {
+		for (i = 0; i < num; i++)
+			unlinkat(dir, names[i], 0);
+		rmdir(tmp);
+	}
+
+	for (i = 0; i < num; i++)
+		free(names[i]);
+	free(names);
+	close(dir);
+
+	return 0;
+}
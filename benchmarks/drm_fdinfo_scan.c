@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Compares the cost of a full /proc walk for DRM clients, as intel_gpu_top
+ * used to do on every refresh, against the incremental scanner. Runs against
+ * a synthetic /proc tree so no GPU or real DRM clients are required.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "igt_drm_fdinfo_scan.h"
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void write_file(const char *path, const char *buf)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	ret = write(fd, buf, strlen(buf));
+	assert(ret == strlen(buf));
+	close(fd);
+}
+
+static void make_proc(const char *root, unsigned int pid, unsigned int fds,
+		      bool drm, unsigned int *client_id)
+{
+	char path[PATH_MAX], buf[1024];
+	unsigned int fd;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%u", root, pid);
+	ret = mkdir(path, 0755);
+	assert(!ret);
+
+	snprintf(path, sizeof(path), "%s/%u/stat", root, pid);
+	snprintf(buf, sizeof(buf),
+		 "%u (proc%u) S 1 %u %u 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 1 0\n",
+		 pid, pid, pid, pid);
+	write_file(path, buf);
+
+	snprintf(path, sizeof(path), "%s/%u/fd", root, pid);
+	ret = mkdir(path, 0755);
+	assert(!ret);
+	snprintf(path, sizeof(path), "%s/%u/fdinfo", root, pid);
+	ret = mkdir(path, 0755);
+	assert(!ret);
+
+	for (fd = 0; fd < fds; fd++) {
+		bool is_drm = drm && fd == fds - 1;
+
+		/* /dev/null stands in for the DRM character device. */
+		snprintf(path, sizeof(path), "%s/%u/fd/%u", root, pid, fd);
+		ret = symlink(is_drm ? "/dev/null" : "/", path);
+		assert(!ret);
+
+		snprintf(path, sizeof(path), "%s/%u/fdinfo/%u", root, pid, fd);
+		if (is_drm)
+			snprintf(buf, sizeof(buf),
+				 "pos:\t0\nflags:\t02100002\nmnt_id:\t26\n"
+				 "drm-driver:\ti915\n"
+				 "drm-pdev:\t0000:00:02.0\n"
+				 "drm-client-id:\t%u\n"
+				 "drm-engine-render:\t%u ns\n"
+				 "drm-engine-copy:\t0 ns\n"
+				 "drm-engine-video:\t0 ns\n"
+				 "drm-engine-video-enhance:\t0 ns\n",
+				 (*client_id)++, pid * 1000);
+		else
+			snprintf(buf, sizeof(buf),
+				 "pos:\t0\nflags:\t02\nmnt_id:\t26\n");
+		write_file(path, buf);
+	}
+}
+
+static int rm_cb(const char *path, const struct stat *st, int flag,
+		 struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void count_client(unsigned int pid, const char *name,
+			 const struct drm_client_fdinfo *info, void *data)
+{
+	(*(unsigned int *)data)++;
+}
+
+static double run(struct igt_drm_fdinfo_scan *scan, bool full,
+		  unsigned int loops, unsigned int *clients)
+{
+	struct timespec start, end;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loops; i++) {
+		*clients = 0;
+		if (full)
+			igt_drm_fdinfo_scan_full(scan, count_client, clients);
+		else
+			igt_drm_fdinfo_scan(scan, count_client, clients);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed(&start, &end) / loops * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	char root[] = "/tmp/drm_fdinfo_scan.XXXXXX";
+	unsigned int num_procs = 2000, num_drm = 16, fds = 16;
+	unsigned int loops = 100, reps = 1, client_id = 1;
+	int max_open = -1;
+	unsigned int full_clients, inc_clients;
+	struct igt_drm_fdinfo_scan *scan;
+	unsigned int i, stride;
+	struct stat st;
+	char *tmp;
+	int c, ret;
+
+	while ((c = getopt (argc, argv, "p:d:f:l:r:o:")) != -1) {
+		switch (c) {
+		case 'p':
+			num_procs = atoi(optarg);
+			break;
+
+		case 'd':
+			num_drm = atoi(optarg);
+			break;
+
+		case 'f':
+			fds = atoi(optarg);
+			if (fds < 1)
+				fds = 1;
+			break;
+
+		case 'l':
+			loops = atoi(optarg);
+			if (loops < 1)
+				loops = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		case 'o':
+			max_open = atoi(optarg);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (num_drm > num_procs)
+		num_drm = num_procs;
+
+	stride = num_drm ? num_procs / num_drm : 0;
+
+	tmp = mkdtemp(root);
+	assert(tmp);
+	for (i = 0; i < num_procs; i++)
+		make_proc(root, i + 1, fds,
+			  stride && i % stride == 0 && client_id <= num_drm,
+			  &client_id);
+
+	ret = stat("/dev/null", &st);
+	assert(!ret);
+
+	scan = igt_drm_fdinfo_scan_create(root, NULL, NULL);
+	assert(scan);
+	scan->drm_major = major(st.st_rdev);
+	if (max_open >= 0)
+		scan->max_open = max_open;
+
+	while (reps--) {
+		double full, inc;
+
+		full = run(scan, true, loops, &full_clients);
+		inc = run(scan, false, loops, &inc_clients);
+		assert(full_clients == inc_clients);
+
+		printf("full: %.1fus, incremental: %.1fus (%u clients)\n",
+		       full, inc, inc_clients);
+	}
+
+	igt_drm_fdinfo_scan_destroy(scan);
+	nftw(root, rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+
+	return 0;
+}
@@ -135,6 +135,11 @@ struct working_set {
 };
 
 struct workload;
+struct sim_request;
+struct sim_fence_wait;
+struct latency_hist;
+struct latency_pending;
+struct trace_record;
 
 struct w_step
 {
@@ -175,6 +180,8 @@ struct w_step
 	struct igt_list_head rq_link;
 	unsigned int request;
 	unsigned int preempt_us;
+	unsigned int sim_seqno;
+	struct sim_request *sim_rq; /* Last request of this step (-x). */
 
 	struct drm_i915_gem_execbuffer2 eb;
 	struct drm_i915_gem_exec_object2 *obj;
@@ -192,6 +199,11 @@ struct ctx {
 	struct bond *bonds;
 	bool load_balance;
 	uint64_t sseu;
+
+	/* Simulation (-x) */
+	int sim_prio;
+	unsigned int sim_inflight;
+	struct sim_request *sim_last[NUM_ENGINES];
 };
 
 struct workload
@@ -226,12 +238,36 @@ struct workload
 
 	struct igt_list_head requests[NUM_ENGINES];
 	unsigned int nrequest[NUM_ENGINES];
+
+	/* Simulation (-x) */
+	pthread_cond_t sim_wake;
+	bool sim_done;
+	uint64_t sim_wake_at;
+	struct sim_request *sim_wait;
+	struct ctx *sim_wait_ctx;
+	uint32_t sim_timeline;
+	unsigned int nr_sim_fences;
+	struct sim_fence_wait *sim_fences;
+
+	/* Latency statistics (-l) and trace (-t) */
+	struct latency_hist *engine_latency; /* Indexed by engine */
+	struct latency_hist *step_latency; /* Indexed by step */
+	unsigned int inflight[NUM_ENGINES];
+	unsigned int nr_pending;
+	struct latency_pending *pending;
+	struct pollfd *pending_poll;
+	unsigned int nr_trace;
+	struct trace_record *trace;
 };
 
 static unsigned int master_prng;
 
 static int verbose = 1;
 static int fd;
+static bool simulate;
+static bool latency_stats;
+static FILE *trace_file;
+static int trace_errno; /* Of the first failed trace write */
 static struct drm_i915_gem_context_param_sseu device_sseu = {
 	.slice_mask = -1 /* Force read on first use. */
 };
@@ -261,6 +297,15 @@ static int read_timestamp_frequency(int i915)
 	return value;
 }
 
+static int device_gen(void)
+{
+	/* The simulation pretends to be a Gen12 part. */
+	if (simulate)
+		return 12;
+
+	return intel_gen(intel_get_drm_devid(fd));
+}
+
 static uint64_t div64_u64_round_up(uint64_t x, uint64_t y)
 {
 	return (x + y - 1) / y;
@@ -509,7 +554,20 @@ static void query_engines(void)
 
 	__engines_queried = true;
 
-	if (!has_engine_query(fd)) {
+	if (simulate) {
+		static const struct i915_engine_class_instance sim_engines[] = {
+			{ I915_ENGINE_CLASS_RENDER, 0 },
+			{ I915_ENGINE_CLASS_COPY, 0 },
+			{ I915_ENGINE_CLASS_VIDEO, 0 },
+			{ I915_ENGINE_CLASS_VIDEO, 1 },
+			{ I915_ENGINE_CLASS_VIDEO_ENHANCE, 0 },
+		};
+
+		num = ARRAY_SIZE(sim_engines);
+		engines = calloc(num, sizeof(*engines));
+		igt_assert(engines);
+		memcpy(engines, sim_engines, sizeof(sim_engines));
+	} else if (!has_engine_query(fd)) {
 		unsigned int num_bsd = gem_has_bsd(fd) + gem_has_bsd2(fd);
 		unsigned int i = 0;
 
@@ -1127,7 +1185,7 @@ parse_workload(struct w_arg *arg, unsigned int flags, double scale_dur,
 			fstart = NULL;
 
 			if (field[0] == '*') {
-				check_arg(intel_gen(intel_get_drm_devid(fd)) < 8,
+				check_arg(device_gen() < 8,
 					  "Infinite batch at step %u needs Gen8+!\n",
 					  nr_steps);
 				step.unbound_duration = true;
@@ -1211,7 +1269,7 @@ add_step:
 		nr_steps += app_w->nr_steps;
 	}
 
-	wrk = malloc(sizeof(*wrk));
+	wrk = calloc(1, sizeof(*wrk));
 	igt_assert(wrk);
 
 	wrk->nr_steps = nr_steps;
@@ -1336,7 +1394,8 @@ clone_workload(struct workload *_wrk)
 	/* Check if we need a sw sync timeline. */
 	for (i = 0; i < wrk->nr_steps; i++) {
 		if (wrk->steps[i].type == SW_FENCE) {
-			wrk->sync_timeline = sw_sync_timeline_create();
+			/* Simulated fences only need a non-zero timeline. */
+			wrk->sync_timeline = simulate ? 1 : sw_sync_timeline_create();
 			igt_assert(wrk->sync_timeline >= 0);
 			break;
 		}
@@ -1548,8 +1607,941 @@ get_ctxid(struct workload *wrk, struct w_step *w)
 	return wrk->ctx_list[w->context].id;
 }
 
+/*
+ * Latency statistics (-l) and submission trace (-t)
+ *
+ * Batches are timed from just before their execbuf to the completion of
+ * their request, as given by the signal timestamp of an out fence, or by
+ * the virtual clock when simulating. Out fences are collected without
+ * blocking on each submission and all of them once the workload ends.
+ *
+ * Latencies go into log-linear histograms, per engine and per step, with
+ * 16 buckets per power of two, so percentiles are within 6.25% of the
+ * measured values. The trace is a header followed by one fixed size
+ * record per batch, appended in completion order.
+ */
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS 40 /* Longer than ~18 minutes is clamped. */
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB)
+
+#define TRACE_MAGIC "WSIMTRC"
+#define TRACE_VERSION 1
+#define TRACE_BATCH 256 /* Records buffered per client between writes. */
+
+struct latency_hist {
+	uint64_t count, sum, max; /* ns */
+	uint64_t bucket[LAT_BUCKETS];
+};
+
+struct latency_pending {
+	struct w_step *w;
+	uint64_t submit;
+	unsigned int queued;
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t nr_engines;
+	uint32_t pad;
+	char engines[NUM_ENGINES][8];
+};
+
+struct trace_record {
+	uint64_t submit; /* ns, CLOCK_MONOTONIC or virtual */
+	uint64_t complete;
+	uint32_t client;
+	uint32_t context;
+	uint32_t step;
+	uint16_t engine; /* The one it ran on, see latency_complete() */
+	uint16_t queued; /* Requests of the client in flight on the step engine */
+};
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool measure_latency(void)
+{
+	return latency_stats || trace_file;
+}
+
+static unsigned int latency_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < LAT_SUB)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	if (msb >= LAT_MAX_BITS)
+		return LAT_BUCKETS - 1;
+
+	return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+	       ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Largest latency falling into the bucket. */
+static uint64_t latency_bucket_max(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < LAT_SUB)
+		return idx;
+
+	shift = idx / LAT_SUB - 1;
+
+	return ((uint64_t)(LAT_SUB + idx % LAT_SUB + 1) << shift) - 1;
+}
+
+static void latency_add(struct latency_hist *h, uint64_t ns)
+{
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->bucket[latency_bucket(ns)]++;
+}
+
+static void
+latency_merge(struct latency_hist *dst, const struct latency_hist *src)
+{
+	unsigned int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (i = 0; i < LAT_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+static uint64_t latency_percentile(const struct latency_hist *h, double pct)
+{
+	uint64_t target = ceil(h->count * pct / 100), seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen && seen >= target)
+			break;
+	}
+
+	return min(latency_bucket_max(i), h->max);
+}
+
+static void trace_flush(struct workload *wrk)
+{
+	if (!wrk->nr_trace)
+		return;
+
+	pthread_mutex_lock(&trace_mutex);
+	if (fwrite(wrk->trace, sizeof(*wrk->trace), wrk->nr_trace,
+		   trace_file) != wrk->nr_trace && !trace_errno)
+		trace_errno = errno ? errno : EIO;
+	pthread_mutex_unlock(&trace_mutex);
+
+	wrk->nr_trace = 0;
+}
+
+/* Returns how many requests of the client the new one queues behind. */
+static unsigned int latency_submit(struct workload *wrk, struct w_step *w)
+{
+	return wrk->inflight[w->engine]++;
+}
+
+/*
+ * Accounts the request under the engine it ran on. The simulation knows
+ * which engine of a balanced step that was, a fence on hardware does not,
+ * so there they stay under the logical engine of the step.
+ */
+static void
+latency_complete(struct workload *wrk, struct w_step *w, unsigned int engine,
+		 unsigned int queued, uint64_t submit, uint64_t complete)
+{
+	uint64_t ns = complete > submit ? complete - submit : 0;
+
+	wrk->inflight[w->engine]--;
+
+	latency_add(&wrk->engine_latency[engine], ns);
+	latency_add(&wrk->step_latency[w->idx], ns);
+
+	if (!trace_file)
+		return;
+
+	wrk->trace[wrk->nr_trace++] = (struct trace_record) {
+		.submit = submit,
+		.complete = complete,
+		.client = wrk->id,
+		.context = w->context,
+		.step = w->idx,
+		.engine = engine,
+		.queued = min_t(unsigned int, queued, UINT16_MAX),
+	};
+	if (wrk->nr_trace == TRACE_BATCH)
+		trace_flush(wrk);
+}
+
+/* Takes ownership of the out fence of a batch submitted at submit. */
+static void
+latency_track(struct workload *wrk, struct w_step *w, uint64_t submit,
+	      int fence)
+{
+	unsigned int n = wrk->nr_pending++;
+
+	if (!(n & (n - 1))) {
+		unsigned int sz = n ? 2 * n : 16;
+
+		wrk->pending = realloc(wrk->pending,
+				       sz * sizeof(*wrk->pending));
+		wrk->pending_poll = realloc(wrk->pending_poll,
+					    sz * sizeof(*wrk->pending_poll));
+		igt_assert(wrk->pending && wrk->pending_poll);
+	}
+
+	wrk->pending[n] = (struct latency_pending) {
+		.w = w,
+		.submit = submit,
+		.queued = latency_submit(wrk, w),
+	};
+	wrk->pending_poll[n] = (struct pollfd) { .fd = fence, .events = POLLIN };
+}
+
+/* Records the requests whose out fences signalled, polling for timeout ms. */
+static void latency_reap(struct workload *wrk, int timeout)
+{
+	unsigned int i;
+
+	if (!wrk->nr_pending ||
+	    poll(wrk->pending_poll, wrk->nr_pending, timeout) <= 0)
+		return;
+
+	for (i = 0; i < wrk->nr_pending; ) {
+		struct latency_pending *p = &wrk->pending[i];
+		int fence = wrk->pending_poll[i].fd;
+
+		if (!wrk->pending_poll[i].revents) {
+			i++;
+			continue;
+		}
+
+		latency_complete(wrk, p->w, p->w->engine, p->queued, p->submit,
+				 sync_fence_timestamp(fence));
+		close(fence);
+
+		wrk->nr_pending--;
+		wrk->pending[i] = wrk->pending[wrk->nr_pending];
+		wrk->pending_poll[i] = wrk->pending_poll[wrk->nr_pending];
+	}
+}
+
+static void print_latency_row(const char *name, const struct latency_hist *h)
+{
+	printf("%-20s %8"PRIu64" %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	       name, h->count, h->sum / 1e3 / h->count,
+	       latency_percentile(h, 50) / 1e3,
+	       latency_percentile(h, 90) / 1e3,
+	       latency_percentile(h, 99) / 1e3,
+	       latency_percentile(h, 99.9) / 1e3,
+	       h->max / 1e3);
+}
+
+/*
+ * Per engine percentiles over all clients, preceded by the engines and
+ * steps of the clients printing their statistics.
+ */
+static void print_latency(struct workload **w, unsigned int clients)
+{
+	struct latency_hist *total;
+	unsigned int i, j;
+	char name[32];
+
+	total = calloc(NUM_ENGINES, sizeof(*total));
+	igt_assert(total);
+
+	printf("%-20s %8s %10s %10s %10s %10s %10s %10s\n",
+	       "Latency (us)", "batches", "avg", "p50", "p90", "p99", "p99.9",
+	       "max");
+
+	for (i = 0; i < clients; i++) {
+		struct workload *wrk = w[i];
+
+		for (j = 0; j < NUM_ENGINES; j++) {
+			latency_merge(&total[j], &wrk->engine_latency[j]);
+
+			if (!wrk->print_stats || !wrk->engine_latency[j].count)
+				continue;
+
+			snprintf(name, sizeof(name), "%c%u: %s",
+				 wrk->background ? ' ' : '*', wrk->id,
+				 ring_str_map[j]);
+			print_latency_row(name, &wrk->engine_latency[j]);
+		}
+
+		for (j = 0; wrk->print_stats && j < wrk->nr_steps; j++) {
+			if (!wrk->step_latency[j].count)
+				continue;
+
+			snprintf(name, sizeof(name), "%c%u: %u.%s",
+				 wrk->background ? ' ' : '*', wrk->id, j,
+				 ring_str_map[wrk->steps[j].engine]);
+			print_latency_row(name, &wrk->step_latency[j]);
+		}
+	}
+
+	for (j = 0; j < NUM_ENGINES; j++) {
+		if (total[j].count)
+			print_latency_row(ring_str_map[j], &total[j]);
+	}
+
+	free(total);
+}
+
+static FILE *trace_open(const char *path)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+		.nr_engines = NUM_ENGINES,
+	};
+	FILE *file;
+	int i;
+
+	file = fopen(path, "w");
+	if (!file)
+		return NULL;
+
+	for (i = 0; i < NUM_ENGINES; i++)
+		strncpy(header.engines[i], ring_str_map[i],
+			sizeof(header.engines[i]) - 1);
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+/*
+ * Simulation backend (-x)
+ *
+ * Instead of submitting to i915, requests are run on a model of the engines
+ * in virtual time, using the step durations. Clients still run their
+ * run_workload() thread, but only one at a time, holding sim.mutex, and
+ * only until they block on a request, a sleep or a full ring. Then the
+ * lowest numbered client which can run goes next, or, with none left, the
+ * virtual clock jumps to the next request completion or client wakeup.
+ * Runs are therefore deterministic for a given random seed.
+ *
+ * The model: every physical engine runs one request at a time, picking
+ * the ready one with the highest context priority, oldest first, and
+ * preempting lower priority ones unless their context disabled preemption.
+ * Requests are ready once the previous request on their context timeline,
+ * the implicit fences of the buffers they use and their explicit in
+ * fences have signalled, and a submit fence once its master has started
+ * (following the context bonds to pick the engine). Load balanced
+ * requests go to the first idle engine from the context engine map.
+ */
+
+#define SIM_RING_SIZE 64 /* Requests in flight per context before blocking. */
+
+struct sim_waiter {
+	struct sim_request *rq;
+	bool submit;
+};
+
+struct sim_request {
+	unsigned int ref;
+	unsigned long seqno;
+	struct workload *wrk;
+	struct w_step *w;
+	struct ctx *ctx;
+	int prio;
+	uint64_t engines;
+	enum intel_engine_id engine;
+	uint64_t remaining; /* ns, UINT64_MAX until terminated if unbound */
+	uint64_t submit, start, end;
+	unsigned int queued;
+	unsigned int pending;
+	bool started, completed;
+	unsigned int nr_waiters;
+	struct sim_waiter *waiters;
+	struct sim_request *next;
+};
+
+struct sim_fence_wait {
+	struct sim_request *rq;
+	uint32_t seqno;
+};
+
+struct sim_bo {
+	struct sim_request *write;
+	unsigned int nr_reads;
+	struct sim_request **reads;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	uint64_t now;
+	unsigned long seqno;
+	struct workload **clients;
+	unsigned int nr_clients;
+	struct workload *running;
+	struct sim_request *ready;
+	struct sim_request *active[NUM_ENGINES];
+	uint32_t nr_bos;
+	struct sim_bo *bos;
+} sim = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint32_t sim_alloc_bo(void)
+{
+	sim.bos = realloc(sim.bos, (sim.nr_bos + 2) * sizeof(*sim.bos));
+	igt_assert(sim.bos);
+	memset(&sim.bos[++sim.nr_bos], 0, sizeof(*sim.bos));
+
+	return sim.nr_bos;
+}
+
+static struct sim_request *sim_get(struct sim_request *rq)
+{
+	if (rq)
+		rq->ref++;
+
+	return rq;
+}
+
+static void sim_put(struct sim_request *rq)
+{
+	if (rq && !--rq->ref) {
+		free(rq->waiters);
+		free(rq);
+	}
+}
+
+static void sim_set(struct sim_request **slot, struct sim_request *rq)
+{
+	sim_get(rq);
+	sim_put(*slot);
+	*slot = rq;
+}
+
+static void
+sim_add_dep(struct sim_request *rq, struct sim_request *signaler, bool submit)
+{
+	if (!signaler || signaler == rq || signaler->completed ||
+	    (submit && signaler->started))
+		return;
+
+	signaler->waiters = realloc(signaler->waiters,
+				    (signaler->nr_waiters + 1) *
+				    sizeof(*signaler->waiters));
+	igt_assert(signaler->waiters);
+	signaler->waiters[signaler->nr_waiters++] =
+		(struct sim_waiter){ rq, submit };
+	rq->pending++;
+}
+
+/* Ready requests are kept by priority, then in submission order. */
+static void sim_queue(struct sim_request *rq)
+{
+	struct sim_request **prev = &sim.ready;
+
+	while (*prev && ((*prev)->prio > rq->prio ||
+			 ((*prev)->prio == rq->prio &&
+			  (*prev)->seqno < rq->seqno)))
+		prev = &(*prev)->next;
+
+	rq->next = *prev;
+	*prev = rq;
+}
+
+static void sim_signal(struct sim_request *rq)
+{
+	if (!--rq->pending)
+		sim_queue(rq);
+}
+
+/* Bonds restrict the engines of a submit fence waiter to match its master. */
+static void sim_bond(struct sim_request *rq, enum intel_engine_id master)
+{
+	struct ctx *ctx = rq->ctx;
+	unsigned int i;
+
+	for (i = 0; i < ctx->bond_count; i++) {
+		if (ctx->bonds[i].master == master &&
+		    rq->engines & ctx->bonds[i].mask)
+			rq->engines &= ctx->bonds[i].mask;
+	}
+}
+
+static void sim_start(struct sim_request *rq, enum intel_engine_id engine)
+{
+	unsigned int i, n;
+
+	rq->engine = engine;
+	rq->start = sim.now;
+	sim.active[engine] = rq;
+
+	if (rq->started)
+		return;
+	rq->started = true;
+
+	for (i = 0, n = 0; i < rq->nr_waiters; i++) {
+		struct sim_request *waiter = rq->waiters[i].rq;
+
+		if (!rq->waiters[i].submit) {
+			rq->waiters[n++] = rq->waiters[i];
+			continue;
+		}
+
+		sim_bond(waiter, engine);
+		sim_signal(waiter);
+	}
+	rq->nr_waiters = n;
+}
+
+static void sim_complete(enum intel_engine_id engine)
+{
+	struct sim_request *rq = sim.active[engine];
+	unsigned int i;
+
+	sim.active[engine] = NULL;
+	rq->completed = true;
+	rq->end = sim.now;
+	rq->ctx->sim_inflight--;
+
+	if (measure_latency())
+		latency_complete(rq->wrk, rq->w, engine, rq->queued,
+				 rq->submit, rq->end);
+
+	for (i = 0; i < rq->nr_waiters; i++)
+		sim_signal(rq->waiters[i].rq);
+	rq->nr_waiters = 0;
+
+	sim_put(rq);
+}
+
+static bool sim_preemptible(const struct sim_request *rq)
+{
+	return rq->w->preempt_us;
+}
+
+static void sim_dispatch(void)
+{
+	struct sim_request **prev = &sim.ready, *rq;
+
+	while ((rq = *prev)) {
+		enum intel_engine_id engine, victim = NUM_ENGINES;
+		struct sim_request *active;
+
+		for (engine = RCS; engine < NUM_ENGINES; engine++) {
+			if (!(rq->engines & (1ull << engine)))
+				continue;
+
+			active = sim.active[engine];
+			if (!active)
+				break;
+
+			if (active->prio < rq->prio && sim_preemptible(active) &&
+			    (victim == NUM_ENGINES ||
+			     active->prio < sim.active[victim]->prio))
+				victim = engine;
+		}
+		if (engine == NUM_ENGINES)
+			engine = victim;
+		if (engine == NUM_ENGINES) {
+			prev = &rq->next;
+			continue;
+		}
+
+		*prev = rq->next;
+
+		active = sim.active[engine];
+		if (active) {
+			if (active->remaining != UINT64_MAX)
+				active->remaining -= sim.now - active->start;
+			sim.active[engine] = NULL;
+			sim_queue(active);
+		}
+
+		sim_start(rq, engine);
+
+		/* Preemption and submit fences may have reordered the list. */
+		prev = &sim.ready;
+	}
+}
+
+/* Physical engines a request may run on, and its timeline on the context. */
+static uint64_t
+sim_engines(struct ctx *ctx, enum intel_engine_id engine, unsigned int *timeline)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	if (ctx->engine_map) {
+		for (i = 0; i < ctx->engine_map_count; i++) {
+			if (ctx->engine_map[i] == engine) {
+				*timeline = engine;
+				return 1ull << engine;
+			}
+			mask |= 1ull << ctx->engine_map[i];
+		}
+
+		igt_assert(ctx->load_balance);
+		*timeline = DEFAULT;
+		return mask;
+	}
+
+	*timeline = engine;
+	switch (engine) {
+	case DEFAULT:
+		return 1ull << RCS;
+	case VCS:
+		return 1ull << VCS1 | 1ull << VCS2;
+	default:
+		return 1ull << engine;
+	}
+}
+
+static void
+sim_wait_fence(struct workload *wrk, struct sim_request *rq, uint32_t seqno)
+{
+	if ((int32_t)(wrk->sim_timeline - seqno) >= 0)
+		return;
+
+	wrk->sim_fences = realloc(wrk->sim_fences,
+				  (wrk->nr_sim_fences + 1) *
+				  sizeof(*wrk->sim_fences));
+	igt_assert(wrk->sim_fences);
+	wrk->sim_fences[wrk->nr_sim_fences++] =
+		(struct sim_fence_wait){ rq, seqno };
+	rq->pending++;
+}
+
+static void sim_advance_timeline(struct workload *wrk, unsigned int inc)
+{
+	unsigned int i, n;
+
+	wrk->sim_timeline += inc;
+
+	for (i = 0, n = 0; i < wrk->nr_sim_fences; i++) {
+		struct sim_fence_wait *wait = &wrk->sim_fences[i];
+
+		if ((int32_t)(wrk->sim_timeline - wait->seqno) >= 0)
+			sim_signal(wait->rq);
+		else
+			wrk->sim_fences[n++] = *wait;
+	}
+	wrk->nr_sim_fences = n;
+
+	sim_dispatch();
+}
+
+static bool sim_client_ready(const struct workload *wrk)
+{
+	return !wrk->sim_done &&
+	       wrk->sim_wake_at <= sim.now &&
+	       (!wrk->sim_wait || wrk->sim_wait->completed) &&
+	       (!wrk->sim_wait_ctx ||
+		wrk->sim_wait_ctx->sim_inflight < SIM_RING_SIZE);
+}
+
+/* Moves the virtual clock to the next event, false if there is none. */
+static bool sim_advance(void)
+{
+	uint64_t next = UINT64_MAX;
+	enum intel_engine_id engine;
+	unsigned int i;
+
+	for (engine = RCS; engine < NUM_ENGINES; engine++) {
+		struct sim_request *rq = sim.active[engine];
+
+		if (rq && rq->remaining != UINT64_MAX &&
+		    rq->start + rq->remaining < next)
+			next = rq->start + rq->remaining;
+	}
+
+	for (i = 0; i < sim.nr_clients; i++) {
+		struct workload *wrk = sim.clients[i];
+
+		if (!wrk->sim_done && wrk->sim_wake_at > sim.now &&
+		    wrk->sim_wake_at < next)
+			next = wrk->sim_wake_at;
+	}
+
+	if (next == UINT64_MAX)
+		return false;
+
+	sim.now = next;
+
+	for (engine = RCS; engine < NUM_ENGINES; engine++) {
+		struct sim_request *rq = sim.active[engine];
+
+		if (rq && rq->remaining != UINT64_MAX &&
+		    rq->start + rq->remaining == sim.now)
+			sim_complete(engine);
+	}
+
+	sim_dispatch();
+
+	return true;
+}
+
+/*
+ * With nothing else left to wait for, unbound batches which were never
+ * terminated get cancelled, as hangcheck would do.
+ */
+static bool sim_hang(void)
+{
+	enum intel_engine_id engine;
+	bool hung = false;
+
+	for (engine = RCS; engine < NUM_ENGINES; engine++) {
+		struct sim_request *rq = sim.active[engine];
+
+		if (!rq || rq->remaining != UINT64_MAX)
+			continue;
+
+		wsim_err("%u: Simulated GPU hang on %s at %.6fs!\n",
+			 rq->wrk->id, ring_str_map[engine], sim.now / 1e9);
+		rq->remaining = sim.now - rq->start;
+		hung = true;
+	}
+
+	return hung;
+}
+
+/*
+ * Hands over to the next client able to run, advancing the virtual clock
+ * as needed, and returns once wrk can run again.
+ */
+static void sim_schedule(struct workload *wrk)
+{
+	struct workload *next = NULL;
+	unsigned int i;
+
+	for (;;) {
+		bool done = true;
+
+		for (i = 0; i < sim.nr_clients; i++) {
+			if (!sim.clients[i]->sim_done)
+				done = false;
+			if (sim_client_ready(sim.clients[i])) {
+				next = sim.clients[i];
+				break;
+			}
+		}
+		if (next || done)
+			break;
+
+		if (!sim_advance() && !sim_hang()) {
+			wsim_err("Simulation stalled at %.6fs, waiting on a fence!\n",
+				 sim.now / 1e9);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sim.running = next;
+	if (next)
+		pthread_cond_signal(&next->sim_wake);
+
+	if (wrk->sim_done)
+		return;
+
+	while (sim.running != wrk)
+		pthread_cond_wait(&wrk->sim_wake, &sim.mutex);
+
+	sim_set(&wrk->sim_wait, NULL);
+	wrk->sim_wait_ctx = NULL;
+	wrk->sim_wake_at = 0;
+}
+
+static void sim_wait_request(struct workload *wrk, struct sim_request *rq)
+{
+	if (!rq || rq->completed)
+		return;
+
+	sim_set(&wrk->sim_wait, rq);
+	sim_schedule(wrk);
+}
+
+static void sim_sync(struct workload *wrk, uint32_t handle)
+{
+	struct sim_bo *bo = &sim.bos[handle];
+	struct sim_request **busy;
+	unsigned int i, n = 0;
+
+	/* Like gem_sync(), only wait for what was submitted so far. */
+	busy = calloc(bo->nr_reads + 1, sizeof(*busy));
+	igt_assert(busy);
+	if (bo->write && !bo->write->completed)
+		busy[n++] = sim_get(bo->write);
+	for (i = 0; i < bo->nr_reads; i++) {
+		if (!bo->reads[i]->completed)
+			busy[n++] = sim_get(bo->reads[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		sim_wait_request(wrk, busy[i]);
+		sim_put(busy[i]);
+	}
+	free(busy);
+}
+
+static void sim_sleep(struct workload *wrk, unsigned int us)
+{
+	wrk->sim_wake_at = sim.now + 1000ull * us;
+	sim_schedule(wrk);
+}
+
+static void sim_use_bo(struct sim_request *rq, uint32_t handle, bool write)
+{
+	struct sim_bo *bo = &sim.bos[handle];
+	unsigned int i, n;
+
+	sim_add_dep(rq, bo->write, false);
+
+	for (i = 0, n = 0; i < bo->nr_reads; i++) {
+		if (write)
+			sim_add_dep(rq, bo->reads[i], false);
+
+		if (write || bo->reads[i]->completed)
+			sim_put(bo->reads[i]);
+		else
+			bo->reads[n++] = bo->reads[i];
+	}
+	bo->nr_reads = n;
+
+	if (write) {
+		sim_set(&bo->write, rq);
+	} else {
+		bo->reads = realloc(bo->reads,
+				    (bo->nr_reads + 1) * sizeof(*bo->reads));
+		igt_assert(bo->reads);
+		bo->reads[bo->nr_reads++] = sim_get(rq);
+	}
+}
+
+static void
+sim_execbuf(struct workload *wrk, struct w_step *w, enum intel_engine_id engine)
+{
+	struct ctx *ctx = __get_ctx(wrk, w);
+	struct sim_request *rq;
+	unsigned int timeline, i;
+
+	while (ctx->sim_inflight >= SIM_RING_SIZE) {
+		wrk->sim_wait_ctx = ctx;
+		sim_schedule(wrk);
+	}
+
+	rq = calloc(1, sizeof(*rq));
+	igt_assert(rq);
+	rq->ref = 1; /* Dropped on completion. */
+	rq->seqno = ++sim.seqno;
+	rq->wrk = wrk;
+	rq->w = w;
+	rq->ctx = ctx;
+	rq->prio = ctx->sim_prio;
+	rq->engines = sim_engines(ctx, engine, &timeline);
+	rq->remaining = w->unbound_duration ?
+			UINT64_MAX : 1000ull * get_duration(wrk, w);
+	rq->submit = sim.now;
+	if (measure_latency())
+		rq->queued = latency_submit(wrk, w);
+	rq->pending = 1; /* Until all dependencies are added. */
+
+	sim_add_dep(rq, ctx->sim_last[timeline], false);
+	sim_set(&ctx->sim_last[timeline], rq);
+	sim_set(&w->sim_rq, rq);
+	ctx->sim_inflight++;
+
+	for (i = 0; i < w->eb.buffer_count; i++)
+		sim_use_bo(rq, w->obj[i].handle,
+			   w->obj[i].flags & EXEC_OBJECT_WRITE);
+
+	for (i = 0; i < w->fence_deps.nr; i++) {
+		struct w_step *tgt = &wrk->steps[w->idx +
+						 w->fence_deps.list[i].target];
+
+		struct sim_request *master;
+
+		if (tgt->type == SW_FENCE) {
+			sim_wait_fence(wrk, rq, tgt->sim_seqno);
+			continue;
+		}
+
+		master = tgt->sim_rq;
+		if (w->fence_deps.submit_fence && master && master->started)
+			sim_bond(rq, master->engine);
+		sim_add_dep(rq, master, w->fence_deps.submit_fence);
+	}
+
+	sim_signal(rq);
+	sim_dispatch();
+}
+
+/* Ends an unbound batch as if its loop had been broken out of right now. */
+static void sim_terminate(struct w_step *w)
+{
+	struct sim_request *rq = w->sim_rq;
+
+	if (!rq || rq->completed || rq->remaining != UINT64_MAX)
+		return;
+
+	if (sim.active[rq->engine] == rq)
+		rq->remaining = sim.now - rq->start;
+	else
+		rq->remaining = 0;
+}
+
+static void sim_init(struct workload **clients, unsigned int count)
+{
+	unsigned int i;
+
+	sim.clients = clients;
+	sim.nr_clients = count;
+	for (i = 0; i < count; i++)
+		pthread_cond_init(&clients[i]->sim_wake, NULL);
+
+	sim.running = clients[0];
+}
+
+static void *run_workload(void *data);
+
+static void *sim_run_workload(void *data)
+{
+	struct workload *wrk = data;
+	unsigned int i;
+
+	pthread_mutex_lock(&sim.mutex);
+	while (sim.running != wrk)
+		pthread_cond_wait(&wrk->sim_wake, &sim.mutex);
+
+	run_workload(wrk);
+
+	/* The end of the master workload stops the background ones. */
+	wrk->sim_done = true;
+	for (i = 0; !wrk->background && i < sim.nr_clients; i++) {
+		if (sim.clients[i]->background)
+			sim.clients[i]->run = false;
+	}
+
+	sim_schedule(wrk);
+	pthread_mutex_unlock(&sim.mutex);
+
+	return NULL;
+}
+
 static uint32_t alloc_bo(int i915, unsigned long size)
 {
+	if (simulate)
+		return sim_alloc_bo();
+
 	return gem_create(i915, size);
 }
 
@@ -1602,6 +2594,12 @@ alloc_step_batch(struct workload *wrk, struct w_step *w)
 		igt_assert(j < nr_obj);
 	}
 
+	/* The simulation only tracks the buffers, it has no batches to run. */
+	if (simulate) {
+		w->eb.buffer_count = j;
+		return;
+	}
+
 	w->bb_handle = w->obj[j].handle = gem_create(fd, 4096);
 	w->obj[j].relocation_count = create_bb(w, j);
 	igt_assert(w->obj[j].relocation_count <= ARRAY_SIZE(w->reloc));
@@ -1704,9 +2702,13 @@ static struct drm_i915_gem_context_param_sseu get_device_sseu(void)
 static uint64_t
 set_ctx_sseu(struct ctx *ctx, uint64_t slice_mask)
 {
-	struct drm_i915_gem_context_param_sseu sseu = get_device_sseu();
+	struct drm_i915_gem_context_param_sseu sseu;
 	struct drm_i915_gem_context_param param = { };
 
+	if (simulate)
+		return slice_mask;
+
+	sseu = get_device_sseu();
 	if (slice_mask == -1)
 		slice_mask = device_sseu.slice_mask;
 
@@ -1903,7 +2905,7 @@ static int prepare_workload(unsigned int id, struct workload *wrk)
 					wsim_err("Load balancing needs an engine map!\n");
 					return 1;
 				}
-				if (intel_gen(intel_get_drm_devid(fd)) < 11) {
+				if (device_gen() < 11) {
 					wsim_err("Load balancing needs relative mmio support, gen11+!\n");
 					return 1;
 				}
@@ -1940,6 +2942,12 @@ static int prepare_workload(unsigned int id, struct workload *wrk)
 
 		igt_assert(!ctx->id);
 
+		if (simulate) {
+			ctx->id = i + 1;
+			ctx->sim_prio = wrk->prio;
+			continue;
+		}
+
 		/* Find existing context to share ppgtt with. */
 		for (j = 0; !share_vm && j < wrk->nr_ctxs; j++) {
 			struct drm_i915_gem_context_param param = {
@@ -2084,7 +3092,7 @@ static int prepare_workload(unsigned int id, struct workload *wrk)
 	/*
 	 * Scan for SSEU control steps.
 	 */
-	for (i = 0, w = wrk->steps; i < wrk->nr_steps; i++, w++) {
+	for (i = 0, w = wrk->steps; !simulate && i < wrk->nr_steps; i++, w++) {
 		if (w->type == SSEU) {
 			get_device_sseu();
 			break;
@@ -2151,6 +3159,19 @@ static int prepare_workload(unsigned int id, struct workload *wrk)
 
 	measure_active_set(wrk);
 
+	if (measure_latency()) {
+		wrk->engine_latency = calloc(NUM_ENGINES,
+					     sizeof(*wrk->engine_latency));
+		wrk->step_latency = calloc(wrk->nr_steps,
+					   sizeof(*wrk->step_latency));
+		igt_assert(wrk->engine_latency && wrk->step_latency);
+	}
+
+	if (trace_file) {
+		wrk->trace = calloc(TRACE_BATCH, sizeof(*wrk->trace));
+		igt_assert(wrk->trace);
+	}
+
 	return 0;
 }
 
@@ -2178,6 +3199,32 @@ update_bb_start(struct workload *wrk, struct w_step *w)
 	*w->bb_duration = ticks;
 }
 
+static void wsim_clock(struct timespec *ts)
+{
+	if (simulate) {
+		ts->tv_sec = sim.now / NSEC_PER_SEC;
+		ts->tv_nsec = sim.now % NSEC_PER_SEC;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, ts);
+	}
+}
+
+static void w_sleep(struct workload *wrk, unsigned int us)
+{
+	if (simulate)
+		sim_sleep(wrk, us);
+	else
+		usleep(us);
+}
+
+static void w_sync(struct workload *wrk, struct w_step *w)
+{
+	if (simulate)
+		sim_sync(wrk, w->obj[0].handle);
+	else
+		gem_sync(fd, w->obj[0].handle);
+}
+
 static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
 {
 	if (target < 0)
@@ -2193,14 +3240,21 @@ static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
 	igt_assert(target < wrk->nr_steps);
 	igt_assert(wrk->steps[target].type == BATCH);
 
-	gem_sync(fd, wrk->steps[target].obj[0].handle);
+	w_sync(wrk, &wrk->steps[target]);
 }
 
 static void
 do_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine)
 {
+	struct timespec submit = {};
+	bool out_fence;
 	unsigned int i;
 
+	if (simulate) {
+		sim_execbuf(wrk, w, engine);
+		return;
+	}
+
 	eb_update_flags(wrk, w, engine);
 	update_bb_start(wrk, w);
 
@@ -2220,15 +3274,37 @@ do_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine)
 		w->eb.rsvd2 = wrk->steps[tgt].emit_fence;
 	}
 
+	/* Latency is measured with an out fence, if the step has none. */
+	out_fence = w->eb.flags & I915_EXEC_FENCE_OUT;
+	if (measure_latency()) {
+		latency_reap(wrk, 0);
+		w->eb.flags |= I915_EXEC_FENCE_OUT;
+		clock_gettime(CLOCK_MONOTONIC, &submit);
+	}
+
 	if (w->eb.flags & I915_EXEC_FENCE_OUT)
 		gem_execbuf_wr(fd, &w->eb);
 	else
 		gem_execbuf(fd, &w->eb);
 
-	if (w->eb.flags & I915_EXEC_FENCE_OUT) {
+	if (out_fence) {
 		w->emit_fence = w->eb.rsvd2 >> 32;
 		igt_assert(w->emit_fence > 0);
 	}
+
+	if (measure_latency()) {
+		int fence = w->eb.rsvd2 >> 32;
+
+		/* The step keeps its own out fence for its dependants. */
+		if (out_fence) {
+			fence = dup(fence);
+			igt_assert(fence >= 0);
+		}
+
+		latency_track(wrk, w,
+			      submit.tv_sec * NSEC_PER_SEC + submit.tv_nsec,
+			      fence);
+	}
 }
 
 static void sync_deps(struct workload *wrk, struct w_step *w)
@@ -2252,7 +3328,7 @@ static void sync_deps(struct workload *wrk, struct w_step *w)
 		igt_assert(dep_idx >= 0 && dep_idx < w->idx);
 		igt_assert(wrk->steps[dep_idx].type == BATCH);
 
-		gem_sync(fd, wrk->steps[dep_idx].obj[0].handle);
+		w_sync(wrk, &wrk->steps[dep_idx]);
 	}
 }
 
@@ -2267,13 +3343,13 @@ static void *run_workload(void *data)
 	unsigned long time_tot = 0, time_min = ULONG_MAX, time_max = 0;
 	int i;
 
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	wsim_clock(&t_start);
 
 	for (count = 0; wrk->run && (wrk->background || count < wrk->repeat);
 	     count++) {
 		unsigned int cur_seqno = wrk->sync_seqno;
 
-		clock_gettime(CLOCK_MONOTONIC, &wrk->repeat_start);
+		wsim_clock(&wrk->repeat_start);
 
 		for (i = 0, w = wrk->steps; wrk->run && (i < wrk->nr_steps);
 		     i++, w++) {
@@ -2286,7 +3362,7 @@ static void *run_workload(void *data)
 				struct timespec now;
 				int elapsed;
 
-				clock_gettime(CLOCK_MONOTONIC, &now);
+				wsim_clock(&now);
 				elapsed = elapsed_us(&wrk->repeat_start, &now);
 				do_sleep = w->period - elapsed;
 				time_tot += elapsed;
@@ -2306,7 +3382,7 @@ static void *run_workload(void *data)
 
 				igt_assert(s_idx >= 0 && s_idx < i);
 				igt_assert(wrk->steps[s_idx].type == BATCH);
-				gem_sync(fd, wrk->steps[s_idx].obj[0].handle);
+				w_sync(wrk, &wrk->steps[s_idx]);
 				continue;
 			} else if (w->type == THROTTLE) {
 				throttle = w->throttle;
@@ -2316,9 +3392,15 @@ static void *run_workload(void *data)
 				continue;
 			} else if (w->type == SW_FENCE) {
 				igt_assert(w->emit_fence < 0);
-				w->emit_fence =
-					sw_sync_timeline_create_fence(wrk->sync_timeline,
-								      cur_seqno + w->idx);
+				if (simulate) {
+					/* Waited upon by seqno, see sim_execbuf(). */
+					w->sim_seqno = cur_seqno + w->idx;
+					w->emit_fence = 1;
+				} else {
+					w->emit_fence =
+						sw_sync_timeline_create_fence(wrk->sync_timeline,
+									      cur_seqno + w->idx);
+				}
 				igt_assert(w->emit_fence > 0);
 				continue;
 			} else if (w->type == SW_FENCE_SIGNAL) {
@@ -2329,7 +3411,10 @@ static void *run_workload(void *data)
 				igt_assert(wrk->steps[tgt].type == SW_FENCE);
 				cur_seqno += wrk->steps[tgt].idx;
 				inc = cur_seqno - wrk->sync_seqno;
-				sw_sync_timeline_inc(wrk->sync_timeline, inc);
+				if (simulate)
+					sim_advance_timeline(wrk, inc);
+				else
+					sw_sync_timeline_inc(wrk->sync_timeline, inc);
 				continue;
 			} else if (w->type == CTX_PRIORITY) {
 				if (w->priority != wrk->ctx_list[w->context].priority) {
@@ -2339,7 +3424,11 @@ static void *run_workload(void *data)
 						.value = w->priority,
 					};
 
-					gem_context_set_param(fd, &param);
+					if (simulate)
+						wrk->ctx_list[w->context].sim_prio =
+									    w->priority;
+					else
+						gem_context_set_param(fd, &param);
 					wrk->ctx_list[w->context].priority =
 								    w->priority;
 				}
@@ -2351,6 +3440,11 @@ static void *run_workload(void *data)
 				igt_assert(wrk->steps[t_idx].type == BATCH);
 				igt_assert(wrk->steps[t_idx].unbound_duration);
 
+				if (simulate) {
+					sim_terminate(&wrk->steps[t_idx]);
+					continue;
+				}
+
 				*wrk->steps[t_idx].bb_duration = 0xffffffff;
 				__sync_synchronize();
 				continue;
@@ -2371,7 +3465,7 @@ static void *run_workload(void *data)
 			}
 
 			if (do_sleep || w->type == PERIOD) {
-				usleep(do_sleep);
+				w_sleep(wrk, do_sleep);
 				continue;
 			}
 
@@ -2397,7 +3491,7 @@ static void *run_workload(void *data)
 				break;
 
 			if (w->sync)
-				gem_sync(fd, w->obj[0].handle);
+				w_sync(wrk, w);
 
 			if (qd_throttle > 0) {
 				while (wrk->nrequest[engine] > qd_throttle) {
@@ -2406,7 +3500,7 @@ static void *run_workload(void *data)
 					s = igt_list_first_entry(&wrk->requests[engine],
 								 s, rq_link);
 
-					gem_sync(fd, s->obj[0].handle);
+					w_sync(wrk, s);
 
 					s->request = -1;
 					igt_list_del(&s->rq_link);
@@ -2419,7 +3513,10 @@ static void *run_workload(void *data)
 			int inc;
 
 			inc = wrk->nr_steps - (cur_seqno - wrk->sync_seqno);
-			sw_sync_timeline_inc(wrk->sync_timeline, inc);
+			if (simulate)
+				sim_advance_timeline(wrk, inc);
+			else
+				sw_sync_timeline_inc(wrk->sync_timeline, inc);
 			wrk->sync_seqno += wrk->nr_steps;
 		}
 
@@ -2427,7 +3524,8 @@ static void *run_workload(void *data)
 		for (i = 0, w = wrk->steps; wrk->run && (i < wrk->nr_steps);
 		     i++, w++) {
 			if (w->emit_fence > 0) {
-				close(w->emit_fence);
+				if (!simulate)
+					close(w->emit_fence);
 				w->emit_fence = -1;
 			}
 		}
@@ -2438,10 +3536,13 @@ static void *run_workload(void *data)
 			continue;
 
 		w = igt_list_last_entry(&wrk->requests[i], w, rq_link);
-		gem_sync(fd, w->obj[0].handle);
+		w_sync(wrk, w);
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	wsim_clock(&t_end);
+
+	while (wrk->nr_pending)
+		latency_reap(wrk, -1);
 
 	if (wrk->print_stats) {
 		double t = elapsed(&t_start, &t_end);
@@ -2460,6 +3561,11 @@ static void *run_workload(void *data)
 
 static void fini_workload(struct workload *wrk)
 {
+	free(wrk->engine_latency);
+	free(wrk->step_latency);
+	free(wrk->pending);
+	free(wrk->pending_poll);
+	free(wrk->trace);
 	free(wrk->steps);
 	free(wrk);
 }
@@ -2494,6 +3600,15 @@ static void print_help(void)
 "  -F <scale>        Scale factor for delays.\n"
 "  -L                List GPUs.\n"
 "  -D <gpu>          One of the GPUs from -L.\n"
+"  -x                Simulate the workloads in virtual time instead of running\n"
+"                    them on a GPU. Models rcs0, bcs0, vcs0, vcs1 and vecs0 on a\n"
+"                    Gen12 part.\n"
+"  -l                Print percentiles of the batch submit to completion\n"
+"                    latencies per engine and, with -v, per client and step.\n"
+"  -t <file>         Write a binary trace of every batch submission to a file.\n"
+"                    scripts/wsim-trace.py converts it to Chrome trace JSON.\n"
+"                    Both report load balanced batches under the engine they\n"
+"                    ran on with -x, under their logical engine on a GPU.\n"
 	);
 }
 
@@ -2555,6 +3670,7 @@ int main(int argc, char **argv)
 	int master_workload = -1;
 	char *append_workload_arg = NULL;
 	struct w_arg *w_args = NULL;
+	const char *trace_path = NULL;
 	int exitcode = EXIT_FAILURE;
 	char *device_arg = NULL;
 	double scale_time = 1.0f;
@@ -2567,7 +3683,7 @@ int main(int argc, char **argv)
 	master_prng = time(NULL);
 
 	while ((c = getopt(argc, argv,
-			   "LhqvsSdc:r:w:W:a:p:I:f:F:D:")) != -1) {
+			   "LhqvsSdxlc:r:w:W:a:p:I:f:F:D:t:")) != -1) {
 		switch (c) {
 		case 'L':
 			list_devices_arg = true;
@@ -2618,6 +3734,23 @@ int main(int argc, char **argv)
 		case 'd':
 			flags |= DEPSYNC;
 			break;
+		case 'x':
+			simulate = true;
+			break;
+		case 'l':
+			latency_stats = true;
+			break;
+		case 't':
+			if (trace_file)
+				fclose(trace_file);
+			trace_path = optarg;
+			trace_file = trace_open(optarg);
+			if (!trace_file) {
+				wsim_err("Failed to open trace file '%s'! (%s)\n",
+					 optarg, strerror(errno));
+				goto err;
+			}
+			break;
 		case 'I':
 			master_prng = strtol(optarg, NULL, 0);
 			break;
@@ -2635,54 +3768,63 @@ int main(int argc, char **argv)
 		}
 	}
 
-	igt_devices_scan(false);
+	if (simulate) {
+		if (list_devices_arg || device_arg) {
+			wsim_err("Simulation does not use a GPU!\n");
+			goto err;
+		}
+		if (verbose > 1)
+			printf("Simulating in virtual time.\n");
+	} else {
+		igt_devices_scan(false);
 
-	if (list_devices_arg) {
-		struct igt_devices_print_format fmt = {
-			.type = IGT_PRINT_USER,
-			.option = IGT_PRINT_DRM,
-		};
+		if (list_devices_arg) {
+			struct igt_devices_print_format fmt = {
+				.type = IGT_PRINT_USER,
+				.option = IGT_PRINT_DRM,
+			};
 
-		igt_devices_print(&fmt);
-		return EXIT_SUCCESS;
-	}
+			igt_devices_print(&fmt);
+			return EXIT_SUCCESS;
+		}
 
-	if (device_arg) {
-		ret = igt_device_card_match(device_arg, &card);
-		if (!ret) {
-			wsim_err("Requested device %s not found!\n",
-				 device_arg);
+		if (device_arg) {
+			ret = igt_device_card_match(device_arg, &card);
+			if (!ret) {
+				wsim_err("Requested device %s not found!\n",
+					 device_arg);
+				free(device_arg);
+				return EXIT_FAILURE;
+			}
 			free(device_arg);
-			return EXIT_FAILURE;
+		} else {
+			ret = igt_device_find_first_i915_discrete_card(&card);
+			if (!ret)
+				ret = igt_device_find_integrated_card(&card);
+			if (!ret) {
+				wsim_err("No device filter specified and no i915 devices found!\n");
+				return EXIT_FAILURE;
+			}
 		}
-		free(device_arg);
-	} else {
-		ret = igt_device_find_first_i915_discrete_card(&card);
-		if (!ret)
-			ret = igt_device_find_integrated_card(&card);
-		if (!ret) {
-			wsim_err("No device filter specified and no i915 devices found!\n");
+
+		if (strlen(card.card)) {
+			drm_dev = card.card;
+		} else if (strlen(card.render)) {
+			drm_dev = card.render;
+		} else {
+			wsim_err("Failed to detect device!\n");
 			return EXIT_FAILURE;
 		}
-	}
-
-	if (strlen(card.card)) {
-		drm_dev = card.card;
-	} else if (strlen(card.render)) {
-		drm_dev = card.render;
-	} else {
-		wsim_err("Failed to detect device!\n");
-		return EXIT_FAILURE;
-	}
 
-	fd = open(drm_dev, O_RDWR);
-	if (fd < 0) {
-		wsim_err("Failed to open '%s'! (%s)\n",
-			 drm_dev, strerror(errno));
-		return EXIT_FAILURE;
+		fd = open(drm_dev, O_RDWR);
+		if (fd < 0) {
+			wsim_err("Failed to open '%s'! (%s)\n",
+				 drm_dev, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if (verbose > 1)
+			printf("Using device %s\n", drm_dev);
 	}
-	if (verbose > 1)
-		printf("Using device %s\n", drm_dev);
 
 	if (!nr_w_args) {
 		wsim_err("No workload descriptor(s)!\n");
@@ -2763,10 +3905,15 @@ int main(int argc, char **argv)
 		}
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	if (simulate)
+		sim_init(w, clients);
+
+	wsim_clock(&t_start);
 
 	for (i = 0; i < clients; i++) {
-		ret = pthread_create(&w[i]->thread, NULL, run_workload, w[i]);
+		ret = pthread_create(&w[i]->thread, NULL,
+				     simulate ? sim_run_workload : run_workload,
+				     w[i]);
 		igt_assert_eq(ret, 0);
 	}
 
@@ -2774,7 +3921,8 @@ int main(int argc, char **argv)
 		ret = pthread_join(w[master_workload]->thread, NULL);
 		igt_assert_eq(ret, 0);
 
-		for (i = 0; i < clients; i++)
+		/* The simulation already stopped them, in virtual time. */
+		for (i = 0; !simulate && i < clients; i++)
 			w[i]->run = false;
 	}
 
@@ -2785,13 +3933,26 @@ int main(int argc, char **argv)
 		}
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	wsim_clock(&t_end);
 
 	t = elapsed(&t_start, &t_end);
 	if (verbose)
 		printf("%.3fs elapsed (%.3f workloads/s)\n",
 		       t, clients * repeat / t);
 
+	if (latency_stats && verbose)
+		print_latency(w, clients);
+
+	if (trace_file) {
+		for (i = 0; i < clients; i++)
+			trace_flush(w[i]);
+		if (fclose(trace_file) && !trace_errno)
+			trace_errno = errno;
+		if (trace_errno)
+			wsim_err("Failed to write trace file '%s'! (%s)\n",
+				 trace_path, strerror(trace_errno));
+	}
+
 	for (i = 0; i < clients; i++)
 		fini_workload(w[i]);
 	free(w);
@@ -2799,6 +3960,9 @@ int main(int argc, char **argv)
 		fini_workload(wrk[i]);
 	free(w_args);
 
+	if (trace_errno)
+		goto err;
+
 out:
 	exitcode = EXIT_SUCCESS;
 err:
@@ -0,0 +1,265 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Accumulates the OA reports of an i915-perf recording, either one
+ * given with -i or a synthetic Tigerlake RenderBasic one, in windows of
+ * -w reports. Compares a call to intel_perf_accumulate_reports() per
+ * pair of reports with one intel_perf_accumulate_reports_batch() call
+ * per window, using the scalar and the SIMD kernels.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i915_drm.h"
+#include "i915/perf.h"
+#include "i915/perf_data.h"
+#include "i915/perf_data_reader.h"
+
+#define REPORT_SIZE 256
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void write_record(FILE *file, uint32_t type,
+			 const void *data, size_t size)
+{
+	struct drm_i915_perf_record_header header = {
+		.type = type,
+		.size = sizeof(header) + size,
+	};
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(data, size, 1, file);
+}
+
+/* Counters step by random small amounts, the 40bit ones carry. */
+static void write_recording(FILE *file, unsigned int n_samples)
+{
+	struct intel_perf_record_version version = {
+		.version = INTEL_PERF_RECORD_VERSION,
+	};
+	struct intel_perf_record_device_info info = {
+		.timestamp_frequency = 19200000,
+		.device_id = 0x9a49,
+		.gt_min_frequency = 300,
+		.gt_max_frequency = 1300,
+		.oa_format = I915_OA_FORMAT_A32u40_A4u32_B8_C8,
+		.metric_set_name = "RenderBasic",
+		.metric_set_uuid = "0fc397c0-4833-492c-9ccd-4929d574d5b8",
+	};
+	struct {
+		struct drm_i915_query_topology_info topology;
+		uint8_t data[8];
+	} topology = {
+		.topology = {
+			.max_slices = 1,
+			.max_subslices = 1,
+			.max_eus_per_subslice = 8,
+			.subslice_offset = 1,
+			.subslice_stride = 1,
+			.eu_offset = 2,
+			.eu_stride = 1,
+		},
+		.data = { 0x1, 0x1, 0xff },
+	};
+	struct intel_perf_record_timestamp_correlation corr = {};
+	uint32_t report[REPORT_SIZE / 4] = {};
+	uint8_t *high = (uint8_t *)(report + 40);
+
+	write_record(file, INTEL_PERF_RECORD_TYPE_VERSION,
+		     &version, sizeof(version));
+	write_record(file, INTEL_PERF_RECORD_TYPE_DEVICE_INFO,
+		     &info, sizeof(info));
+	write_record(file, INTEL_PERF_RECORD_TYPE_DEVICE_TOPOLOGY,
+		     &topology, sizeof(topology));
+	write_record(file, INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION,
+		     &corr, sizeof(corr));
+
+	for (unsigned int i = 0; i < n_samples; i++) {
+		for (int dw = 3; dw < 64; dw++) {
+			uint32_t prev = report[dw];
+
+			if (dw >= 40 && dw < 48)
+				continue;
+
+			report[dw] += random() % 0x100000;
+			if (dw >= 4 && dw < 36 && report[dw] < prev)
+				high[dw - 4]++;
+		}
+		report[1] = i * 1000;
+
+		write_record(file, DRM_I915_PERF_RECORD_SAMPLE,
+			     report, sizeof(report));
+	}
+
+	corr.cpu_timestamp = n_samples * 1000ull * 1000000000 / 19200000;
+	corr.gpu_timestamp = n_samples * 1000ull;
+	write_record(file, INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION,
+		     &corr, sizeof(corr));
+}
+
+int main(int argc, char **argv)
+{
+	const char *input = NULL;
+	char path[] = "/tmp/i915_perf_accumulate.XXXXXX";
+	unsigned int n_samples = 1000000, window = 1000, reps = 1;
+	struct intel_perf_data_stream stream;
+	struct intel_perf_data_iter iter;
+	const struct drm_i915_perf_record_header **records;
+	uint8_t *data;
+	uint64_t n_records = 0;
+	intel_perf_accumulate_fn kernels[2];
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "i:n:w:r:")) != -1) {
+		switch (c) {
+		case 'i':
+			input = optarg;
+			break;
+
+		case 'n':
+			n_samples = atoi(optarg);
+			if (n_samples < 2)
+				n_samples = 2;
+			break;
+
+		case 'w':
+			window = atoi(optarg);
+			if (window < 2)
+				window = 2;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (input) {
+		fd = open(input, O_RDONLY);
+	} else {
+		FILE *file;
+
+		fd = mkstemp(path);
+		assert(fd >= 0);
+		file = fdopen(dup(fd), "w");
+		assert(file);
+		write_recording(file, n_samples);
+		fclose(file);
+		unlink(path);
+	}
+	assert(fd >= 0);
+
+	if (!intel_perf_data_stream_open(&stream, fd, NULL)) {
+		fprintf(stderr, "Unable to read recording: %s\n", stream.error_msg);
+		return EXIT_FAILURE;
+	}
+
+	/* Pull the samples in memory to only time the accumulation. */
+	records = calloc(stream.n_samples, sizeof(*records));
+	data = malloc(stream.n_samples * (sizeof(**records) + REPORT_SIZE));
+	assert(records && data);
+
+	if (!intel_perf_data_iter_init(&iter, &stream, 0, UINT64_MAX))
+		return EXIT_FAILURE;
+	while (intel_perf_data_iter_next(&iter)) {
+		uint8_t *record = data + n_records * (sizeof(**records) + REPORT_SIZE);
+
+		memcpy(record, iter.record, sizeof(**records) + REPORT_SIZE);
+		records[n_records++] = (const void *)record;
+	}
+	intel_perf_data_iter_fini(&iter);
+
+	kernels[0] = intel_perf_get_accumulate_fn(stream.metric_set->perf_oa_format, false);
+	kernels[1] = intel_perf_get_accumulate_fn(stream.metric_set->perf_oa_format, true);
+	assert(kernels[0] && kernels[1]);
+
+	while (reps--) {
+		struct intel_perf_metric_set metric_set = *stream.metric_set;
+		struct intel_perf_accumulator acc;
+		struct timespec start, end;
+		uint64_t sum = 0, batch_sum[2] = {};
+		double pairs, batch[2];
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint64_t i = 1; i < n_records; i++) {
+			intel_perf_accumulate_reports(&acc, stream.perf, &metric_set,
+						      records[i - 1], records[i]);
+			sum += acc.deltas[2];
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		pairs = elapsed(&start, &end);
+
+		for (int k = 0; k < 2; k++) {
+			metric_set.accumulate_reports = kernels[k];
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint64_t i = 0; i + 1 < n_records; i += window - 1) {
+				uint64_t n = n_records - i < window ? n_records - i : window;
+
+				intel_perf_accumulate_reports_batch(&acc, stream.perf,
+								    &metric_set,
+								    records + i, n);
+				batch_sum[k] += acc.deltas[2];
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			batch[k] = elapsed(&start, &end);
+
+			/* Each window starts on the last report of the previous one. */
+			assert(batch_sum[k] == sum);
+		}
+
+		printf("%s, %"PRIu64" reports in windows of %u: "
+		       "per-pair %.1fM/s, batch scalar %.1fM/s, batch simd %.1fM/s\n",
+		       stream.metric_set->symbol_name, n_records, window,
+		       1e-6 * n_records / pairs,
+		       1e-6 * n_records / batch[0],
+		       1e-6 * n_records / batch[1]);
+	}
+
+	free(data);
+	free(records);
+	intel_perf_data_stream_close(&stream);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Measures the multiprocess allocator round trip: forked children hammer the
+ * allocator thread with alloc/free requests through each of the message
+ * channels. Allocators are opened for a fake fd with an explicit address
+ * range and alignment, so no GPU is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "igt_core.h"
+#include "intel_allocator.h"
+
+static const char *channels[] = { "msgqueue", "shmem" };
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static double run(const char *chan, int nchild, unsigned long ops,
+		  unsigned int live, bool shared)
+{
+	struct timespec start, end;
+
+	setenv("IGT_ALLOCATOR_CHANNEL", chan, 1);
+	intel_allocator_multiprocess_start();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	igt_fork(child, nchild) {
+		uint32_t base = shared ? child * live + 1 : 1;
+		uint64_t ahnd;
+		unsigned long n;
+
+		/* Either a vm per child or all children in one */
+		ahnd = intel_allocator_open_full(-1, shared ? 0 : child + 1,
+						 1ull << 20, 1ull << 40,
+						 INTEL_ALLOCATOR_SIMPLE,
+						 ALLOC_STRATEGY_HIGH_TO_LOW,
+						 4096);
+
+		for (n = 0; n < ops; n++) {
+			uint32_t handle = base + n % live;
+
+			if (n / live % 2 == 0)
+				igt_assert(intel_allocator_alloc(ahnd, handle,
+								 4096, 0) !=
+					   ALLOC_INVALID_ADDRESS);
+			else
+				intel_allocator_free(ahnd, handle);
+		}
+
+		for (n = 0; n < live; n++)
+			intel_allocator_free(ahnd, base + n);
+
+		intel_allocator_close(ahnd);
+	}
+	igt_waitchildren();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	intel_allocator_multiprocess_stop();
+
+	return nchild * ops / elapsed(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ops = 100000;
+	unsigned int live = 1000, reps = 1, i;
+	int nchild = 1;
+	bool shared = false;
+	int c;
+
+	while ((c = getopt (argc, argv, "c:n:o:r:sf")) != -1) {
+		switch (c) {
+		case 'c':
+			nchild = atoi(optarg);
+			if (nchild < 1)
+				nchild = 1;
+			break;
+
+		case 'f':
+			nchild = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			if (ops < 1)
+				ops = 1;
+			break;
+
+		case 'o':
+			live = atoi(optarg);
+			if (live < 1)
+				live = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		case 's':
+			shared = true;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	while (reps--) {
+		for (i = 0; i < sizeof(channels) / sizeof(channels[0]); i++)
+			printf("%-8s %d children: %10.0f ops/s\n", channels[i],
+			       nchild, run(channels[i], nchild, ops, live, shared));
+	}
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+/*
+ * Drives the simple allocator with random alloc/free sequences, keeping a
+ * fixed number of objects of mixed sizes alive, for each allocation
+ * strategy. No GPU is needed as the allocator is used directly and never
+ * touches the device. Reports the throughput in operations per second.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intel_allocator.h"
+
+struct intel_allocator *
+intel_allocator_simple_create(int fd, uint64_t start, uint64_t end,
+			      enum allocator_strategy strategy);
+
+static const struct {
+	const char *name;
+	enum allocator_strategy strategy;
+} strategies[] = {
+	{ "high-to-low", ALLOC_STRATEGY_HIGH_TO_LOW },
+	{ "low-to-high", ALLOC_STRATEGY_LOW_TO_HIGH },
+	{ "best-fit", ALLOC_STRATEGY_BEST_FIT },
+};
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t random_size(void)
+{
+	/* Mostly small objects with the occasional large one */
+	if (random() % 16)
+		return (1 + random() % 16) << 12;
+
+	return (1 + random() % 256) << 16;
+}
+
+static double run(enum allocator_strategy strategy, unsigned long ops,
+		  unsigned int live, unsigned long *failed)
+{
+	struct intel_allocator *ial;
+	struct timespec start, end;
+	uint32_t next = 1, *handles;
+	unsigned int i;
+	unsigned long n;
+
+	handles = calloc(live, sizeof(*handles));
+	assert(handles);
+
+	ial = intel_allocator_simple_create(-1, 0, 1ull << 48, strategy);
+	assert(ial);
+
+	srandom(0x1234);
+	*failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; n < ops; n++) {
+		i = random() % live;
+
+		if (handles[i]) {
+			ial->free(ial, handles[i]);
+			handles[i] = 0;
+		} else {
+			uint64_t offset;
+
+			offset = ial->alloc(ial, next, random_size(),
+					    4096 << (random() % 4),
+					    ALLOC_STRATEGY_NONE);
+			if (offset == ALLOC_INVALID_ADDRESS)
+				(*failed)++;
+			else
+				handles[i] = next++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ial->destroy(ial);
+	free(handles);
+
+	return ops / elapsed(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ops = 4000000, failed;
+	unsigned int live = 100000, reps = 1;
+	unsigned int i;
+	int c;
+
+	while ((c = getopt (argc, argv, "n:o:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			if (ops < 1)
+				ops = 1;
+			break;
+
+		case 'o':
+			live = atoi(optarg);
+			if (live < 1)
+				live = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	while (reps--) {
+		for (i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+			double rate;
+
+			rate = run(strategies[i].strategy, ops, live, &failed);
+			printf("%-12s %10.0f ops/s (%lu failed)\n",
+			       strategies[i].name, rate, failed);
+		}
+	}
+
+	return 0;
+}
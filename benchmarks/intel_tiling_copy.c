@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Tiles and detiles a 32bpp surface in plain memory, one pixel at a time
+ * through intel_tiled_pixel_ptr() as the software tiling in intel_bufops
+ * used to, and a chunk at a time with intel_linear_to_tiled() and
+ * intel_tiled_to_linear(). Reports the throughput of each in MiB/s.
+ */
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "i915_drm.h"
+#include "intel_batchbuffer.h"
+#include "intel_tiling.h"
+
+static const struct {
+	const char *name;
+	uint32_t tiling;
+	unsigned int width;
+	unsigned int height;
+} tilings[] = {
+	{ "X", I915_TILING_X, 512, 8 },
+	{ "Y", I915_TILING_Y, 128, 32 },
+	{ "Yf", I915_TILING_Yf, 128, 32 },
+	{ "Tile4", I915_TILING_4, 128, 32 },
+};
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static double mibps(unsigned int width, unsigned int height, unsigned int loops,
+		    const struct timespec *start, const struct timespec *end)
+{
+	return 4.0 * width * height * loops / elapsed(start, end) / (1 << 20);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width = 1920, height = 1080, loops = 10, reps = 1;
+	uint32_t swizzle = I915_BIT_6_SWIZZLE_NONE;
+	uint32_t *linear;
+	void *tiled;
+	int c;
+
+	while ((c = getopt(argc, argv, "w:h:l:r:s")) != -1) {
+		switch (c) {
+		case 'w':
+			width = atoi(optarg);
+			if (width < 1)
+				width = 1;
+			break;
+
+		case 'h':
+			height = atoi(optarg);
+			if (height < 1)
+				height = 1;
+			break;
+
+		case 'l':
+			loops = atoi(optarg);
+			if (loops < 1)
+				loops = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		case 's':
+			swizzle = I915_BIT_6_SWIZZLE_9_10;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	linear = malloc(4ul * width * height);
+	tiled = aligned_alloc(4096, 4ul * (width + 128) * (height + 32));
+	assert(linear && tiled);
+	memset(linear, 0x5a, 4ul * width * height);
+
+	while (reps--) {
+		for (int t = 0; t < sizeof(tilings) / sizeof(tilings[0]); t++) {
+			unsigned int stride = (4 * width + tilings[t].width - 1) /
+					      tilings[t].width * tilings[t].width;
+			uint32_t tiling = tilings[t].tiling;
+			struct timespec start, end;
+			double pixel, pixel_rd, chunk, chunk_rd;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned int l = 0; l < loops; l++)
+				for (unsigned int y = 0; y < height; y++)
+					for (unsigned int x = 0; x < width; x++)
+						*(uint32_t *)intel_tiled_pixel_ptr(tiled, tiling, swizzle,
+										   x, y, stride, 4) =
+							linear[y * width + x];
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			pixel = mibps(width, height, loops, &start, &end);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned int l = 0; l < loops; l++)
+				for (unsigned int y = 0; y < height; y++)
+					for (unsigned int x = 0; x < width; x++)
+						linear[y * width + x] =
+							*(uint32_t *)intel_tiled_pixel_ptr(tiled, tiling, swizzle,
+											   x, y, stride, 4);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			pixel_rd = mibps(width, height, loops, &start, &end);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned int l = 0; l < loops; l++)
+				intel_linear_to_tiled(tiled, stride, linear, 4 * width,
+						      width, height, 4, tiling, swizzle);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			chunk = mibps(width, height, loops, &start, &end);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned int l = 0; l < loops; l++)
+				intel_tiled_to_linear(linear, 4 * width, tiled, stride,
+						      width, height, 4, tiling, swizzle);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			chunk_rd = mibps(width, height, loops, &start, &end);
+
+			printf("%-6s to tiled: per-pixel %.0fMiB/s, chunked %.0fMiB/s; "
+			       "to linear: per-pixel %.0fMiB/s, chunked %.0fMiB/s\n",
+			       tilings[t].name, pixel, chunk, pixel_rd, chunk_rd);
+		}
+	}
+
+	free(tiled);
+	free(linear);
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Runs a workload in virtual time (-x) with a fixed seed and compares the
+# statistics printed by gem_wsim with the expected ones, from test.expected.
+#
+# Usage: run-sim-test.sh gem_wsim test workload seed [extra gem_wsim options]
+
+SRCDIR="${srcdir-`pwd`}"
+BUILDDIR="${top_builddir-`pwd`}"
+
+wsim="$1"
+test="$2"
+workload="$3"
+seed="$4"
+shift 4
+
+expected="${SRCDIR}/wsim/test/${test}.expected"
+out="${BUILDDIR}/wsim/test/${test}"
+mkdir -p `dirname "$out"`
+
+"$wsim" -x -I "$seed" -v "$@" -w "${SRCDIR}/wsim/${workload}.wsim" \
+	> "$out.out" || exit 1
+
+if cmp "$expected" "$out.out" > /dev/null ; then : ; else
+	echo "Output of ${test} changed"
+	diff -u "$expected" "$out.out"
+	exit 1
+fi
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Traces (-t) a workload run in virtual time with a fixed seed, converts the
+# trace with wsim-trace.py and compares the events with test.expected.
+#
+# Usage: run-trace-test.sh gem_wsim wsim-trace.py test workload seed \
+#			   [extra gem_wsim options]
+
+SRCDIR="${srcdir-`pwd`}"
+BUILDDIR="${top_builddir-`pwd`}"
+PYTHON="${PYTHON-python3}"
+
+wsim="$1"
+convert="$2"
+test="$3"
+workload="$4"
+seed="$5"
+shift 5
+
+expected="${SRCDIR}/wsim/test/${test}.expected"
+out="${BUILDDIR}/wsim/test/${test}"
+mkdir -p `dirname "$out"`
+
+rm -f "$out.bin"
+"$wsim" -x -I "$seed" -t "$out.bin" "$@" \
+	-w "${SRCDIR}/wsim/${workload}.wsim" > /dev/null || exit 1
+"$PYTHON" "$convert" "$out.bin" "$out.json" || exit 1
+
+# One event per line, so that a change reads as a diff of events.
+"$PYTHON" -c '
+import json, sys
+for event in json.load(open(sys.argv[1]))["traceEvents"]:
+	print(json.dumps(event, sort_keys=True))
+' "$out.json" > "$out.out" || exit 1
+
+if cmp "$expected" "$out.out" > /dev/null ; then : ; else
+	echo "Trace of ${test} changed"
+	diff -u "$expected" "$out.out"
+	exit 1
+fi
@@ -77,11 +77,12 @@ struct intel_decode {
 	bool overflowed;
 };
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+/* Per decode state, thread local so that contexts can decode in parallel. */
+static __thread FILE *out;
+static __thread uint32_t saved_s2 = 0, saved_s4 = 0;
+static __thread char saved_s2_set = 0, saved_s4_set = 0;
+static __thread uint32_t head_offset = 0xffffffff;	/* undefined */
+static __thread uint32_t tail_offset = 0xffffffff;	/* undefined */
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
@@ -3900,6 +3901,7 @@ intel_decode(struct intel_decode *ctx)
 	head_offset = ctx->head;
 	tail_offset = ctx->tail;
 	out = ctx->out;
+	ctx->overflowed = false;
 
 	saved_s2_set = 0;
 	saved_s4_set = 1;
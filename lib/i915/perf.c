@@ -702,6 +702,9 @@ intel_perf_add_metric_set(struct intel_perf *perf,
 			  struct intel_perf_metric_set *metric_set)
 {
 	igt_list_add_tail(&metric_set->link, &perf->metric_sets);
+
+	metric_set->accumulate_reports =
+		intel_perf_get_accumulate_fn(metric_set->perf_oa_format, true);
 }
 
 static void
@@ -820,92 +823,362 @@ accumulate_uint40(int a_index,
 	*deltas += delta;
 }
 
-void intel_perf_accumulate_reports(struct intel_perf_accumulator *acc,
-				   const struct intel_perf *perf,
-				   const struct intel_perf_metric_set *metric_set,
-				   const struct drm_i915_perf_record_header *record0,
-				   const struct drm_i915_perf_record_header *record1)
+static uint32_t
+timestamp_delta(int32_t shift, const uint32_t *start, const uint32_t *end)
+{
+	if (shift >= 0)
+		return (end[1] - start[1]) << shift;
+	else
+		return (end[1] - start[1]) >> (-shift);
+}
+
+static void
+accumulate_a24u40_a14u32_b8_c8(uint64_t *deltas, int32_t shift,
+			       const uint32_t *start, const uint32_t *end)
 {
-	const uint32_t *start = (const uint32_t *)(record0 + 1);
-	const uint32_t *end = (const uint32_t *)(record1 + 1);
-	uint64_t *deltas = acc->deltas;
 	int idx = 0;
 	int i;
 
-	memset(acc, 0, sizeof(*acc));
+	/* timestamp */
+	deltas[idx++] += timestamp_delta(shift, start, end);
+	accumulate_uint32(start + 3, end + 3, deltas + idx++); /* clock */
 
-	switch (metric_set->perf_oa_format) {
-	case I915_OA_FORMAT_A24u40_A14u32_B8_C8:
-		/* timestamp */
-		if (perf->devinfo.oa_timestamp_shift >= 0)
-			deltas[idx++] += (end[1] - start[1]) << perf->devinfo.oa_timestamp_shift;
-		else
-			deltas[idx++] += (end[1] - start[1]) >> (-perf->devinfo.oa_timestamp_shift);
-		accumulate_uint32(start + 3, end + 3, deltas + idx++); /* clock */
+	/* 4x 32bit A0-3 counters... */
+	for (i = 0; i < 4; i++)
+		accumulate_uint32(start + 4 + i, end + 4 + i, deltas + idx++);
 
-		/* 4x 32bit A0-3 counters... */
-		for (i = 0; i < 4; i++)
-			accumulate_uint32(start + 4 + i, end + 4 + i, deltas + idx++);
+	/* 20x 40bit A4-23 counters... */
+	for (i = 0; i < 20; i++)
+		accumulate_uint40(i + 4, start, end, deltas + idx++);
 
-		/* 20x 40bit A4-23 counters... */
-		for (i = 0; i < 20; i++)
-			accumulate_uint40(i + 4, start, end, deltas + idx++);
+	/* 4x 32bit A24-27 counters... */
+	for (i = 0; i < 4; i++)
+		accumulate_uint32(start + 28 + i, end + 28 + i, deltas + idx++);
 
-		/* 4x 32bit A24-27 counters... */
-		for (i = 0; i < 4; i++)
-			accumulate_uint32(start + 28 + i, end + 28 + i, deltas + idx++);
+	/* 4x 40bit A28-31 counters... */
+	for (i = 0; i < 4; i++)
+		accumulate_uint40(i + 28, start, end, deltas + idx++);
 
-		/* 4x 40bit A28-31 counters... */
-		for (i = 0; i < 4; i++)
-			accumulate_uint40(i + 28, start, end, deltas + idx++);
+	/* 5x 32bit A32-36 counters... */
+	for (i = 0; i < 5; i++)
+		accumulate_uint32(start + 36 + i, end + 36 + i, deltas + idx++);
 
-		/* 5x 32bit A32-36 counters... */
-		for (i = 0; i < 5; i++)
-			accumulate_uint32(start + 36 + i, end + 36 + i, deltas + idx++);
+	/* 1x 32bit A37 counter... */
+	accumulate_uint32(start + 46, end + 46, deltas + idx++);
 
-		/* 1x 32bit A37 counter... */
-		accumulate_uint32(start + 46, end + 46, deltas + idx++);
+	/* 8x 32bit B counters + 8x 32bit C counters... */
+	for (i = 0; i < 16; i++)
+		accumulate_uint32(start + 48 + i, end + 48 + i, deltas + idx++);
+}
 
-		/* 8x 32bit B counters + 8x 32bit C counters... */
-		for (i = 0; i < 16; i++)
-			accumulate_uint32(start + 48 + i, end + 48 + i, deltas + idx++);
-		break;
+static void
+accumulate_a32u40_a4u32_b8_c8(uint64_t *deltas, int32_t shift,
+			      const uint32_t *start, const uint32_t *end)
+{
+	int idx = 0;
+	int i;
 
-	case I915_OAR_FORMAT_A32u40_A4u32_B8_C8:
-	case I915_OA_FORMAT_A32u40_A4u32_B8_C8:
-		if (perf->devinfo.oa_timestamp_shift >= 0)
-			deltas[idx++] += (end[1] - start[1]) << perf->devinfo.oa_timestamp_shift;
-		else
-			deltas[idx++] += (end[1] - start[1]) >> (-perf->devinfo.oa_timestamp_shift);
-		accumulate_uint32(start + 3, end + 3, deltas + idx++); /* clock */
+	deltas[idx++] += timestamp_delta(shift, start, end);
+	accumulate_uint32(start + 3, end + 3, deltas + idx++); /* clock */
 
-		/* 32x 40bit A counters... */
-		for (i = 0; i < 32; i++)
-			accumulate_uint40(i, start, end, deltas + idx++);
+	/* 32x 40bit A counters... */
+	for (i = 0; i < 32; i++)
+		accumulate_uint40(i, start, end, deltas + idx++);
 
-		/* 4x 32bit A counters... */
-		for (i = 0; i < 4; i++)
-			accumulate_uint32(start + 36 + i, end + 36 + i, deltas + idx++);
+	/* 4x 32bit A counters... */
+	for (i = 0; i < 4; i++)
+		accumulate_uint32(start + 36 + i, end + 36 + i, deltas + idx++);
 
-		/* 8x 32bit B counters + 8x 32bit C counters... */
-		for (i = 0; i < 16; i++)
-			accumulate_uint32(start + 48 + i, end + 48 + i, deltas + idx++);
-		break;
+	/* 8x 32bit B counters + 8x 32bit C counters... */
+	for (i = 0; i < 16; i++)
+		accumulate_uint32(start + 48 + i, end + 48 + i, deltas + idx++);
+}
 
-	case I915_OA_FORMAT_A45_B8_C8:
-		/* timestamp */
-		if (perf->devinfo.oa_timestamp_shift >= 0)
-			deltas[0] += (end[1] - start[1]) << perf->devinfo.oa_timestamp_shift;
-		else
-			deltas[0] += (end[1] - start[1]) >> (-perf->devinfo.oa_timestamp_shift);
+static void
+accumulate_a45_b8_c8(uint64_t *deltas, int32_t shift,
+		     const uint32_t *start, const uint32_t *end)
+{
+	int i;
+
+	/* timestamp */
+	deltas[0] += timestamp_delta(shift, start, end);
+
+	for (i = 0; i < 61; i++)
+		accumulate_uint32(start + 3 + i, end + 3 + i, deltas + 1 + i);
+}
+
+static inline __attribute__((always_inline)) void
+accumulate_batch(struct intel_perf_accumulator *acc,
+		 const struct intel_perf *perf,
+		 const struct drm_i915_perf_record_header * const *records,
+		 uint32_t n_records,
+		 void (*accumulate)(uint64_t *deltas, int32_t shift,
+				    const uint32_t *start, const uint32_t *end))
+{
+	for (uint32_t i = 1; i < n_records; i++)
+		accumulate(acc->deltas, perf->devinfo.oa_timestamp_shift,
+			   (const uint32_t *)(records[i - 1] + 1),
+			   (const uint32_t *)(records[i] + 1));
+}
+
+#define DEFINE_ACCUMULATE_SCALAR(format) \
+static void \
+accumulate_##format##_scalar(struct intel_perf_accumulator *acc, \
+			     const struct intel_perf *perf, \
+			     const struct drm_i915_perf_record_header * const *records, \
+			     uint32_t n_records) \
+{ \
+	accumulate_batch(acc, perf, records, n_records, accumulate_##format); \
+}
+
+DEFINE_ACCUMULATE_SCALAR(a24u40_a14u32_b8_c8)
+DEFINE_ACCUMULATE_SCALAR(a32u40_a4u32_b8_c8)
+DEFINE_ACCUMULATE_SCALAR(a45_b8_c8)
+
+/*
+ * Where each raw counter lives in a report, as a run of @count dwords
+ * starting at @src landing in deltas[@dst...]. For 40bit counters the
+ * high bytes are at byte 160 + (@src - 4).
+ */
+struct accumulate_run {
+	uint8_t dst;
+	uint8_t src;
+	uint8_t count;
+	bool u40;
+};
+
+static const struct accumulate_run a24u40_a14u32_b8_c8_runs[] = {
+	{  1,  3,  5, false },
+	{  6,  8, 20, true },
+	{ 26, 28,  4, false },
+	{ 30, 32,  4, true },
+	{ 34, 36,  5, false },
+	{ 39, 46,  1, false },
+	{ 40, 48, 16, false },
+};
+
+static const struct accumulate_run a32u40_a4u32_b8_c8_runs[] = {
+	{  1,  3,  1, false },
+	{  2,  4, 32, true },
+	{ 34, 36,  4, false },
+	{ 38, 48, 16, false },
+};
+
+static const struct accumulate_run a45_b8_c8_runs[] = {
+	{  1,  3, 61, false },
+};
+
+#if defined(__x86_64__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#include <immintrin.h>
+
+/* Keeps the reports of a block in L1 and the 40bit high byte sums in 16bit. */
+#define ACCUMULATE_BLOCK 64
+
+static inline __attribute__((always_inline)) const uint32_t *
+report_dwords(const struct drm_i915_perf_record_header * const *records,
+	      uint32_t i)
+{
+	return (const uint32_t *)(records[i] + 1);
+}
+
+/* 0xffffffff in the lanes where @report1 < @report0 */
+static inline __attribute__((always_inline)) __m256i
+borrow_epi32(const uint32_t *report0, const uint32_t *report1)
+{
+	const __m256i bias = _mm256_set1_epi32(0x80000000);
+	__m256i lo0 = _mm256_loadu_si256((const __m256i *)report0);
+	__m256i lo1 = _mm256_loadu_si256((const __m256i *)report1);
 
-		for (i = 0; i < 61; i++)
-			accumulate_uint32(start + 3 + i, end + 3 + i, deltas + 1 + i);
-		break;
+	return _mm256_cmpgt_epi32(_mm256_xor_si256(lo0, bias),
+				  _mm256_xor_si256(lo1, bias));
+}
+
+/*
+ * Every dword of the reports gets its 32bit delta summed up in 64bit
+ * lanes, the 40bit counters additionally sum the delta of their high
+ * byte (minus the borrow from the low dword). The runs then pick the
+ * sums of the dwords which hold counters.
+ */
+static inline __attribute__((always_inline)) void
+accumulate_avx2(struct intel_perf_accumulator *acc,
+		const struct intel_perf *perf,
+		const struct drm_i915_perf_record_header * const *records,
+		uint32_t n_records,
+		const struct accumulate_run *runs, int n_runs, bool has_u40)
+{
+	uint64_t lo[64] __attribute__((aligned(32))) = {};
+	uint64_t hi[32] = {};
+	int32_t shift = perf->devinfo.oa_timestamp_shift;
+	uint64_t ts = 0;
+
+	for (uint32_t begin = 1; begin < n_records; begin += ACCUMULATE_BLOCK) {
+		uint32_t end = begin + ACCUMULATE_BLOCK < n_records ?
+			begin + ACCUMULATE_BLOCK : n_records;
+
+		for (int g = 0; g < 64; g += 8) {
+			__m256i sum0 = _mm256_setzero_si256();
+			__m256i sum1 = _mm256_setzero_si256();
+
+			for (uint32_t i = begin; i < end; i++) {
+				__m256i r0 = _mm256_loadu_si256((const __m256i *)(report_dwords(records, i - 1) + g));
+				__m256i r1 = _mm256_loadu_si256((const __m256i *)(report_dwords(records, i) + g));
+				__m256i d = _mm256_sub_epi32(r1, r0);
+
+				sum0 = _mm256_add_epi64(sum0, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(d)));
+				sum1 = _mm256_add_epi64(sum1, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(d, 1)));
+			}
+
+			_mm256_store_si256((__m256i *)&lo[g],
+					   _mm256_add_epi64(_mm256_load_si256((const __m256i *)&lo[g]), sum0));
+			_mm256_store_si256((__m256i *)&lo[g + 4],
+					   _mm256_add_epi64(_mm256_load_si256((const __m256i *)&lo[g + 4]), sum1));
+		}
+
+		if (has_u40) {
+			const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+			__m256i sum0 = _mm256_setzero_si256();
+			__m256i sum1 = _mm256_setzero_si256();
+			uint16_t sums[32];
+
+			for (uint32_t i = begin; i < end; i++) {
+				const uint32_t *r0 = report_dwords(records, i - 1);
+				const uint32_t *r1 = report_dwords(records, i);
+				__m256i b01 = _mm256_packs_epi32(borrow_epi32(r0 + 4, r1 + 4),
+								 borrow_epi32(r0 + 12, r1 + 12));
+				__m256i b23 = _mm256_packs_epi32(borrow_epi32(r0 + 20, r1 + 20),
+								 borrow_epi32(r0 + 28, r1 + 28));
+				__m256i borrow = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(b01, b23),
+									     order);
+				__m256i h0 = _mm256_loadu_si256((const __m256i *)(r0 + 40));
+				__m256i h1 = _mm256_loadu_si256((const __m256i *)(r1 + 40));
+				__m256i d = _mm256_add_epi8(_mm256_sub_epi8(h1, h0), borrow);
+
+				sum0 = _mm256_add_epi16(sum0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d)));
+				sum1 = _mm256_add_epi16(sum1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d, 1)));
+			}
+
+			_mm256_storeu_si256((__m256i *)&sums[0], sum0);
+			_mm256_storeu_si256((__m256i *)&sums[16], sum1);
+			for (int a = 0; a < 32; a++)
+				hi[a] += sums[a];
+		}
+
+		for (uint32_t i = begin; i < end; i++)
+			ts += timestamp_delta(shift, report_dwords(records, i - 1),
+					      report_dwords(records, i));
+	}
+
+	acc->deltas[0] += ts;
+	for (int r = 0; r < n_runs; r++) {
+		for (int c = 0; c < runs[r].count; c++) {
+			int src = runs[r].src + c;
+
+			acc->deltas[runs[r].dst + c] += lo[src];
+			if (runs[r].u40)
+				acc->deltas[runs[r].dst + c] += hi[src - 4] << 32;
+		}
+	}
+}
+
+#define DEFINE_ACCUMULATE_AVX2(format, has_u40) \
+static void \
+accumulate_##format##_avx2(struct intel_perf_accumulator *acc, \
+			   const struct intel_perf *perf, \
+			   const struct drm_i915_perf_record_header * const *records, \
+			   uint32_t n_records) \
+{ \
+	accumulate_avx2(acc, perf, records, n_records, format##_runs, \
+			ARRAY_SIZE(format##_runs), has_u40); \
+}
+
+DEFINE_ACCUMULATE_AVX2(a24u40_a14u32_b8_c8, true)
+DEFINE_ACCUMULATE_AVX2(a32u40_a4u32_b8_c8, true)
+DEFINE_ACCUMULATE_AVX2(a45_b8_c8, false)
+
+#pragma GCC pop_options
+#endif
+
+/**
+ * intel_perf_get_accumulate_fn:
+ * @oa_format: OA report format of the reports to accumulate
+ * @simd: whether to use vector instructions when the CPU has them
+ *
+ * Returns: the kernel accumulating deltas of @oa_format reports, or
+ * NULL for an unknown format.
+ */
+intel_perf_accumulate_fn
+intel_perf_get_accumulate_fn(int oa_format, bool simd)
+{
+#if defined(__x86_64__) && !defined(__clang__)
+	__builtin_cpu_init();
+	if (simd && __builtin_cpu_supports("avx2")) {
+		switch (oa_format) {
+		case I915_OA_FORMAT_A24u40_A14u32_B8_C8:
+			return accumulate_a24u40_a14u32_b8_c8_avx2;
+		case I915_OAR_FORMAT_A32u40_A4u32_B8_C8:
+		case I915_OA_FORMAT_A32u40_A4u32_B8_C8:
+			return accumulate_a32u40_a4u32_b8_c8_avx2;
+		case I915_OA_FORMAT_A45_B8_C8:
+			return accumulate_a45_b8_c8_avx2;
+		}
+	}
+#endif
+
+	switch (oa_format) {
+	case I915_OA_FORMAT_A24u40_A14u32_B8_C8:
+		return accumulate_a24u40_a14u32_b8_c8_scalar;
+	case I915_OAR_FORMAT_A32u40_A4u32_B8_C8:
+	case I915_OA_FORMAT_A32u40_A4u32_B8_C8:
+		return accumulate_a32u40_a4u32_b8_c8_scalar;
+	case I915_OA_FORMAT_A45_B8_C8:
+		return accumulate_a45_b8_c8_scalar;
 	default:
-		assert(0);
+		return NULL;
 	}
+}
+
+void intel_perf_accumulate_reports(struct intel_perf_accumulator *acc,
+				   const struct intel_perf *perf,
+				   const struct intel_perf_metric_set *metric_set,
+				   const struct drm_i915_perf_record_header *record0,
+				   const struct drm_i915_perf_record_header *record1)
+{
+	const struct drm_i915_perf_record_header *records[] = { record0, record1 };
+
+	intel_perf_accumulate_reports_batch(acc, perf, metric_set, records, 2);
+}
+
+/**
+ * intel_perf_accumulate_reports_batch:
+ * @acc: accumulator receiving the deltas
+ * @perf: perf instance the metric set belongs to
+ * @metric_set: metric set the reports were captured with
+ * @records: consecutive sample records
+ * @n_records: number of records
+ *
+ * Sums up the deltas between each of the @n_records - 1 pairs of
+ * consecutive reports into @acc. Counters wrapping between two reports
+ * are accounted for, unlike when accumulating the first and last
+ * reports directly.
+ */
+void intel_perf_accumulate_reports_batch(struct intel_perf_accumulator *acc,
+					 const struct intel_perf *perf,
+					 const struct intel_perf_metric_set *metric_set,
+					 const struct drm_i915_perf_record_header * const *records,
+					 uint32_t n_records)
+{
+	intel_perf_accumulate_fn accumulate = metric_set->accumulate_reports;
+
+	memset(acc, 0, sizeof(*acc));
+
+	if (!accumulate)
+		accumulate = intel_perf_get_accumulate_fn(metric_set->perf_oa_format, true);
+	assert(accumulate);
 
+	accumulate(acc, perf, records, n_records);
 }
 
 uint64_t intel_perf_read_record_timestamp(const struct intel_perf *perf,
@@ -202,6 +202,14 @@ struct intel_perf_accumulator {
 
 struct intel_perf;
 struct intel_perf_metric_set;
+struct drm_i915_perf_record_header;
+
+/* Adds up the deltas between each pair of consecutive records. */
+typedef void (*intel_perf_accumulate_fn)(struct intel_perf_accumulator *acc,
+					 const struct intel_perf *perf,
+					 const struct drm_i915_perf_record_header * const *records,
+					 uint32_t n_records);
+
 struct intel_perf_logical_counter {
 	const struct intel_perf_metric_set *metric_set;
 	const char *name;
@@ -266,6 +274,9 @@ struct intel_perf_metric_set {
 	uint32_t n_flex_regs;
 
 	struct igt_list_head link;
+
+	/* Picked by intel_perf_add_metric_set() for perf_oa_format. */
+	intel_perf_accumulate_fn accumulate_reports;
 };
 
 /* A tree structure with group having subgroups and counters. */
@@ -339,6 +350,12 @@ void intel_perf_accumulate_reports(struct intel_perf_accumulator *acc,
 				   const struct intel_perf_metric_set *metric_set,
 				   const struct drm_i915_perf_record_header *record0,
 				   const struct drm_i915_perf_record_header *record1);
+void intel_perf_accumulate_reports_batch(struct intel_perf_accumulator *acc,
+					 const struct intel_perf *perf,
+					 const struct intel_perf_metric_set *metric_set,
+					 const struct drm_i915_perf_record_header * const *records,
+					 uint32_t n_records);
+intel_perf_accumulate_fn intel_perf_get_accumulate_fn(int oa_format, bool simd);
 
 uint64_t intel_perf_read_record_timestamp(const struct intel_perf *perf,
 					  const struct intel_perf_metric_set *metric_set,
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -374,3 +375,645 @@ intel_perf_data_reader_fini(struct intel_perf_data_reader *reader)
 	free(reader->correlations);
 	munmap((void *)reader->mmap_data, reader->mmap_size);
 }
+
+/* Streaming reader */
+
+#define CHUNK_SIZE (4 << 20)
+
+#define INDEX_MAGIC "i915idx"
+#define INDEX_VERSION (1)
+
+struct index_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_correlations;
+	uint32_t n_index;
+	uint32_t pad;
+	uint64_t file_size;
+	int64_t file_mtime_sec;
+	int64_t file_mtime_nsec;
+	uint64_t n_samples;
+	struct intel_perf_data_index_entry last;
+};
+
+/* Returns the timestamp whose lower bits are ts that is the closest
+ * to ref.
+ */
+static uint64_t
+unwrap_timestamp(uint64_t ref, uint64_t ts, uint64_t mask)
+{
+	uint64_t period = mask + 1;
+	uint64_t full = (ref & ~mask) | (ts & mask);
+
+	if (full + period / 2 < ref)
+		full += period;
+	else if (full > ref + period / 2 && full >= period)
+		full -= period;
+
+	return full;
+}
+
+static void
+iter_reset(struct intel_perf_data_iter *iter, uint64_t offset)
+{
+	iter->chunk_offset = offset;
+	iter->chunk_len = 0;
+	iter->pos = 0;
+}
+
+/* Moves what is left of the chunk to its beginning and reads more of
+ * the file behind it.
+ */
+static bool
+iter_fill(struct intel_perf_data_iter *iter)
+{
+	uint32_t avail = iter->chunk_len - iter->pos;
+	ssize_t ret;
+
+	memmove(iter->chunk, iter->chunk + iter->pos, avail);
+	iter->chunk_offset += iter->pos;
+	iter->chunk_len = avail;
+	iter->pos = 0;
+
+	while (iter->chunk_len < CHUNK_SIZE) {
+		ret = pread(iter->stream->fd, iter->chunk + iter->chunk_len,
+			    CHUNK_SIZE - iter->chunk_len,
+			    iter->chunk_offset + iter->chunk_len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		iter->chunk_len += ret;
+	}
+
+	return iter->chunk_len > avail;
+}
+
+static const struct drm_i915_perf_record_header *
+iter_next_record(struct intel_perf_data_iter *iter, uint64_t *offset)
+{
+	const struct drm_i915_perf_record_header *header =
+		(const struct drm_i915_perf_record_header *) (iter->chunk + iter->pos);
+	uint32_t avail = iter->chunk_len - iter->pos;
+
+	if (avail < sizeof(*header) || avail < header->size) {
+		if (!iter_fill(iter))
+			return NULL;
+
+		header = (const struct drm_i915_perf_record_header *) iter->chunk;
+		avail = iter->chunk_len;
+		if (avail < sizeof(*header))
+			return NULL;
+	}
+
+	/* Truncated or corrupted recording */
+	if (header->size < sizeof(*header) || header->size > avail)
+		return NULL;
+
+	*offset = iter->chunk_offset + iter->pos;
+	iter->pos += header->size;
+
+	return header;
+}
+
+static const struct intel_perf_data_correlation *
+find_correlation(const struct intel_perf_data_stream *stream, uint64_t cpu_ts)
+{
+	uint32_t lo = 0, hi = stream->n_correlations;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (stream->correlations[mid].cpu_ts < cpu_ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < stream->n_correlations &&
+	    stream->correlations[lo].cpu_ts == cpu_ts)
+		return &stream->correlations[lo];
+
+	return NULL;
+}
+
+static void
+append_correlation(struct intel_perf_data_stream *stream,
+		   uint64_t cpu_ts, uint64_t gpu_ts)
+{
+	if (stream->n_correlations >= stream->n_allocated_correlations) {
+		stream->n_allocated_correlations = MAX(100, 2 * stream->n_allocated_correlations);
+		stream->correlations =
+			(struct intel_perf_data_correlation *)
+			realloc((void *) stream->correlations,
+				stream->n_allocated_correlations *
+				sizeof(*stream->correlations));
+		assert(stream->correlations);
+	}
+
+	stream->correlations[stream->n_correlations].cpu_ts = cpu_ts;
+	stream->correlations[stream->n_correlations].gpu_ts = gpu_ts;
+	stream->n_correlations++;
+}
+
+static void
+append_index_entry(struct intel_perf_data_stream *stream,
+		   const struct intel_perf_data_index_entry *entry)
+{
+	if (stream->n_index >= stream->n_allocated_index) {
+		stream->n_allocated_index = MAX(100, 2 * stream->n_allocated_index);
+		stream->index =
+			(struct intel_perf_data_index_entry *)
+			realloc((void *) stream->index,
+				stream->n_allocated_index *
+				sizeof(*stream->index));
+		assert(stream->index);
+	}
+
+	stream->index[stream->n_index++] = *entry;
+}
+
+static bool
+setup_perf(struct intel_perf_data_stream *stream)
+{
+	const struct intel_perf_record_device_info *record_info = &stream->record_info;
+
+	if (!record_info->device_id || !stream->topology) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Invalid file, missing device or topology info");
+		return false;
+	}
+
+	stream->perf = intel_perf_for_devinfo(record_info->device_id,
+					      record_info->device_revision,
+					      record_info->timestamp_frequency,
+					      record_info->gt_min_frequency,
+					      record_info->gt_max_frequency,
+					      stream->topology);
+	if (!stream->perf) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Recording occured on unsupported device (0x%x)",
+			 record_info->device_id);
+		return false;
+	}
+
+	stream->devinfo = stream->perf->devinfo;
+
+	stream->metric_set_name = record_info->metric_set_name;
+	stream->metric_set_uuid = record_info->metric_set_uuid;
+	stream->metric_set = find_metric_set(stream->perf, record_info->metric_set_name);
+	if (!stream->metric_set) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Unknown metric set '%.200s'", record_info->metric_set_name);
+		return false;
+	}
+
+	return true;
+}
+
+/* Walks the recording once, picking up the metadata. Unless
+ * metadata_only is set, this also gathers the correlation points and
+ * builds the sparse index of the samples.
+ */
+static bool
+parse_stream(struct intel_perf_data_stream *stream, bool metadata_only)
+{
+	struct intel_perf_data_iter iter = { .stream = stream };
+	const struct drm_i915_perf_record_header *header;
+	uint64_t offset, ref_ts = 0;
+	bool has_ref = false;
+	bool ret = false;
+
+	iter.chunk = malloc(CHUNK_SIZE);
+	if (!iter.chunk) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Unable to allocate read buffer");
+		return false;
+	}
+
+	while ((header = iter_next_record(&iter, &offset))) {
+		if (metadata_only && stream->record_info.device_id && stream->topology)
+			break;
+
+		switch (header->type) {
+		case DRM_I915_PERF_RECORD_SAMPLE: {
+			struct intel_perf_data_index_entry entry;
+			uint64_t ts;
+
+			if (!stream->perf && !setup_perf(stream))
+				goto out;
+
+			ts = intel_perf_read_record_timestamp(stream->perf,
+							      stream->metric_set,
+							      header);
+			ref_ts = has_ref ?
+				unwrap_timestamp(ref_ts, ts, stream->devinfo.oa_timestamp_mask) :
+				(ts & stream->devinfo.oa_timestamp_mask);
+			has_ref = true;
+
+			entry.gpu_ts = ref_ts;
+			entry.offset = offset;
+			entry.sample = stream->n_samples++;
+
+			if (!stream->n_index ||
+			    offset - stream->index[stream->n_index - 1].offset >=
+			    INTEL_PERF_DATA_INDEX_STRIDE)
+				append_index_entry(stream, &entry);
+			stream->last = entry;
+			break;
+		}
+
+		case INTEL_PERF_RECORD_TYPE_VERSION: {
+			const struct intel_perf_record_version *version =
+				(const struct intel_perf_record_version *) (header + 1);
+			if (version->version != INTEL_PERF_RECORD_VERSION) {
+				snprintf(stream->error_msg, sizeof(stream->error_msg),
+					 "Unsupported recording version (%u, expected %u)",
+					 version->version, INTEL_PERF_RECORD_VERSION);
+				goto out;
+			}
+			break;
+		}
+
+		case INTEL_PERF_RECORD_TYPE_DEVICE_INFO:
+			if (header->size != sizeof(stream->record_info) + sizeof(*header)) {
+				snprintf(stream->error_msg, sizeof(stream->error_msg),
+					 "Invalid device info record");
+				goto out;
+			}
+			memcpy(&stream->record_info, header + 1, sizeof(stream->record_info));
+			break;
+
+		case INTEL_PERF_RECORD_TYPE_DEVICE_TOPOLOGY:
+			free(stream->topology);
+			stream->topology = malloc(header->size - sizeof(*header));
+			assert(stream->topology);
+			memcpy(stream->topology, header + 1, header->size - sizeof(*header));
+			break;
+
+		case INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION: {
+			const struct intel_perf_record_timestamp_correlation *corr =
+				(const struct intel_perf_record_timestamp_correlation *) (header + 1);
+			uint64_t mask;
+
+			if (!stream->perf && !setup_perf(stream))
+				goto out;
+
+			/* The GPU timestamp register wraps too, predict
+			 * where this point lands from the CPU time elapsed
+			 * since the previous one.
+			 */
+			mask = stream->devinfo.oa_timestamp_mask;
+			if (stream->n_correlations) {
+				const struct intel_perf_data_correlation *last =
+					&stream->correlations[stream->n_correlations - 1];
+				int64_t cpu_delta = corr->cpu_timestamp - last->cpu_ts;
+
+				ref_ts = unwrap_timestamp(last->gpu_ts +
+							  (int64_t) ((double) cpu_delta *
+								     stream->devinfo.timestamp_frequency /
+								     1000000000ull),
+							  corr->gpu_timestamp, mask);
+			} else if (has_ref) {
+				ref_ts = unwrap_timestamp(ref_ts, corr->gpu_timestamp, mask);
+			} else {
+				ref_ts = corr->gpu_timestamp;
+			}
+			has_ref = true;
+
+			append_correlation(stream, corr->cpu_timestamp, ref_ts);
+			break;
+		}
+		}
+	}
+
+	if (!stream->perf && !setup_perf(stream))
+		goto out;
+
+	ret = true;
+
+ out:
+	free(iter.chunk);
+	return ret;
+}
+
+static bool
+load_index(struct intel_perf_data_stream *stream, const char *path,
+	   const struct stat *st)
+{
+	struct index_file_header header;
+	bool ret = false;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) ||
+	    header.version != INDEX_VERSION ||
+	    header.file_size != st->st_size ||
+	    header.file_mtime_sec != st->st_mtim.tv_sec ||
+	    header.file_mtime_nsec != st->st_mtim.tv_nsec)
+		goto out;
+
+	stream->correlations = calloc(header.n_correlations, sizeof(*stream->correlations));
+	stream->index = calloc(header.n_index, sizeof(*stream->index));
+	if ((header.n_correlations && !stream->correlations) ||
+	    (header.n_index && !stream->index))
+		goto out;
+
+	if (fread(stream->correlations, sizeof(*stream->correlations),
+		  header.n_correlations, file) != header.n_correlations ||
+	    fread(stream->index, sizeof(*stream->index),
+		  header.n_index, file) != header.n_index)
+		goto out;
+
+	stream->n_correlations = stream->n_allocated_correlations = header.n_correlations;
+	stream->n_index = stream->n_allocated_index = header.n_index;
+	stream->n_samples = header.n_samples;
+	stream->last = header.last;
+	ret = true;
+
+ out:
+	if (!ret) {
+		free(stream->correlations);
+		free(stream->index);
+		stream->correlations = NULL;
+		stream->index = NULL;
+	}
+	fclose(file);
+
+	return ret;
+}
+
+/* The index is only a cache, failing to write it is not an error. */
+static void
+save_index(const struct intel_perf_data_stream *stream, const char *path,
+	   const struct stat *st)
+{
+	struct index_file_header header = {
+		.magic = INDEX_MAGIC,
+		.version = INDEX_VERSION,
+		.n_correlations = stream->n_correlations,
+		.n_index = stream->n_index,
+		.file_size = st->st_size,
+		.file_mtime_sec = st->st_mtim.tv_sec,
+		.file_mtime_nsec = st->st_mtim.tv_nsec,
+		.n_samples = stream->n_samples,
+		.last = stream->last,
+	};
+	char tmp_path[PATH_MAX];
+	FILE *file;
+	bool ok;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path))
+		return;
+
+	file = fopen(tmp_path, "w");
+	if (!file)
+		return;
+
+	ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(stream->correlations, sizeof(*stream->correlations),
+		       stream->n_correlations, file) == stream->n_correlations &&
+		fwrite(stream->index, sizeof(*stream->index),
+		       stream->n_index, file) == stream->n_index;
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok || rename(tmp_path, path) != 0)
+		unlink(tmp_path);
+}
+
+/**
+ * intel_perf_data_stream_open:
+ * @stream: stream to initialize
+ * @perf_file_fd: file descriptor of the recording
+ * @index_path: where to cache the index of the recording, or NULL
+ *
+ * Scans the recording to build its index, unless a valid one is found
+ * at @index_path. Memory usage does not depend on the number of
+ * samples in the recording.
+ *
+ * Returns: true on success, on failure stream->error_msg describes
+ * the problem.
+ */
+bool
+intel_perf_data_stream_open(struct intel_perf_data_stream *stream,
+			    int perf_file_fd, const char *index_path)
+{
+	struct stat st;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->fd = perf_file_fd;
+
+	if (fstat(perf_file_fd, &st) != 0) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Unable to access file (%s)", strerror(errno));
+		return false;
+	}
+
+	stream->file_size = st.st_size;
+
+	if (index_path && load_index(stream, index_path, &st)) {
+		if (parse_stream(stream, true))
+			return true;
+	} else if (parse_stream(stream, false)) {
+		if (index_path)
+			save_index(stream, index_path, &st);
+		return true;
+	}
+
+	intel_perf_data_stream_close(stream);
+	return false;
+}
+
+void
+intel_perf_data_stream_close(struct intel_perf_data_stream *stream)
+{
+	if (stream->perf)
+		intel_perf_free(stream->perf);
+	free(stream->topology);
+	free(stream->correlations);
+	free(stream->index);
+
+	stream->perf = NULL;
+	stream->topology = NULL;
+	stream->correlations = NULL;
+	stream->index = NULL;
+}
+
+/**
+ * intel_perf_data_stream_cpu_timestamp:
+ * @stream: an opened stream
+ * @gpu_ts: unwrapped GPU timestamp
+ *
+ * Returns: the CPU time matching @gpu_ts, interpolated between the
+ * surrounding correlation points.
+ */
+uint64_t
+intel_perf_data_stream_cpu_timestamp(const struct intel_perf_data_stream *stream,
+				     uint64_t gpu_ts)
+{
+	const struct intel_perf_data_correlation *corr = stream->correlations;
+	uint32_t lo = 0, hi = stream->n_correlations - 1;
+
+	assert(stream->n_correlations >= 2);
+
+	/* Outside of the correlated range, extrapolate from the first
+	 * or last pair of points.
+	 */
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (corr[mid].gpu_ts <= gpu_ts)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (corr[hi].gpu_ts == corr[lo].gpu_ts)
+		return corr[lo].cpu_ts;
+
+	return corr[lo].cpu_ts +
+		(int64_t) ((double) (int64_t) (gpu_ts - corr[lo].gpu_ts) *
+			   (int64_t) (corr[hi].cpu_ts - corr[lo].cpu_ts) /
+			   (int64_t) (corr[hi].gpu_ts - corr[lo].gpu_ts));
+}
+
+uint32_t
+intel_perf_data_stream_ctx_id(const struct intel_perf_data_stream *stream,
+			      const struct drm_i915_perf_record_header *record)
+{
+	return oa_report_ctx_id(&stream->devinfo, (const uint8_t *) (record + 1));
+}
+
+/**
+ * intel_perf_data_iter_init:
+ * @iter: iterator to initialize
+ * @stream: an opened stream
+ * @gpu_ts_begin: first unwrapped GPU timestamp of the range
+ * @gpu_ts_end: end of the range (exclusive)
+ *
+ * Prepares @iter to walk the samples of @stream that fall into
+ * [@gpu_ts_begin, @gpu_ts_end), starting the read from the closest
+ * index entry.
+ */
+bool
+intel_perf_data_iter_init(struct intel_perf_data_iter *iter,
+			  struct intel_perf_data_stream *stream,
+			  uint64_t gpu_ts_begin, uint64_t gpu_ts_end)
+{
+	uint32_t lo = 0, hi = stream->n_index;
+
+	memset(iter, 0, sizeof(*iter));
+	iter->stream = stream;
+	iter->gpu_ts_begin = gpu_ts_begin;
+	iter->gpu_ts_end = gpu_ts_end;
+
+	iter->chunk = malloc(CHUNK_SIZE);
+	if (!iter->chunk) {
+		snprintf(stream->error_msg, sizeof(stream->error_msg),
+			 "Unable to allocate read buffer");
+		return false;
+	}
+
+	if (!stream->n_index) {
+		iter_reset(iter, stream->file_size);
+		return true;
+	}
+
+	/* Last index entry not past the beginning of the range. */
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (stream->index[mid].gpu_ts <= gpu_ts_begin)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	intel_perf_data_iter_seek(iter, &stream->index[lo]);
+
+	return true;
+}
+
+/**
+ * intel_perf_data_iter_seek:
+ * @iter: an initialized iterator
+ * @pos: an index entry or a previously returned iter->current
+ *
+ * Makes the sample at @pos the next one returned by
+ * intel_perf_data_iter_next(), provided it falls in the range. Seeking
+ * within the data read last doesn't read the file again.
+ */
+void
+intel_perf_data_iter_seek(struct intel_perf_data_iter *iter,
+			  const struct intel_perf_data_index_entry *pos)
+{
+	/* No need to read the file again when the chunk holds the sample. */
+	if (pos->offset >= iter->chunk_offset &&
+	    pos->offset < iter->chunk_offset + iter->chunk_len)
+		iter->pos = pos->offset - iter->chunk_offset;
+	else
+		iter_reset(iter, pos->offset);
+	iter->ref_ts = pos->gpu_ts;
+	iter->sample = pos->sample;
+	iter->record = NULL;
+}
+
+const struct drm_i915_perf_record_header *
+intel_perf_data_iter_next(struct intel_perf_data_iter *iter)
+{
+	const struct intel_perf_data_stream *stream = iter->stream;
+	const struct drm_i915_perf_record_header *header;
+	uint64_t offset, ts;
+
+	while ((header = iter_next_record(iter, &offset))) {
+		if (header->type == INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION) {
+			const struct intel_perf_record_timestamp_correlation *corr =
+				(const struct intel_perf_record_timestamp_correlation *) (header + 1);
+			const struct intel_perf_data_correlation *point =
+				find_correlation(stream, corr->cpu_timestamp);
+
+			if (point)
+				iter->ref_ts = point->gpu_ts;
+			continue;
+		}
+
+		if (header->type != DRM_I915_PERF_RECORD_SAMPLE)
+			continue;
+
+		ts = unwrap_timestamp(iter->ref_ts,
+				      intel_perf_read_record_timestamp(stream->perf,
+								       stream->metric_set,
+								       header),
+				      stream->devinfo.oa_timestamp_mask);
+		if (ts >= iter->gpu_ts_end) {
+			/* Stay on this sample so we keep hitting the end. */
+			iter->pos -= header->size;
+			break;
+		}
+
+		iter->ref_ts = ts;
+		iter->current.gpu_ts = ts;
+		iter->current.offset = offset;
+		iter->current.sample = iter->sample++;
+
+		if (ts < iter->gpu_ts_begin)
+			continue;
+
+		iter->record = header;
+		return header;
+	}
+
+	iter->record = NULL;
+	return NULL;
+}
+
+void
+intel_perf_data_iter_fini(struct intel_perf_data_iter *iter)
+{
+	free(iter->chunk);
+	iter->chunk = NULL;
+}
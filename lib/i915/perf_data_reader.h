@@ -98,6 +98,98 @@ bool intel_perf_data_reader_init(struct intel_perf_data_reader *reader,
 				 int perf_file_fd);
 void intel_perf_data_reader_fini(struct intel_perf_data_reader *reader);
 
+/* Streaming access to a recording. Only the metadata, the timestamp
+ * correlation points and a sparse index are kept in memory, samples
+ * are read back from the file in chunks as they are iterated.
+ *
+ * GPU timestamps are unwrapped into a monotonic 64bit timeline, in
+ * units of intel_perf_devinfo.timestamp_frequency.
+ */
+
+struct intel_perf_data_correlation {
+	uint64_t cpu_ts;
+	uint64_t gpu_ts;
+};
+
+/* A position in the recording, the index holds one of these about
+ * every INTEL_PERF_DATA_INDEX_STRIDE bytes of file.
+ */
+struct intel_perf_data_index_entry {
+	uint64_t gpu_ts;
+	uint64_t offset;
+	uint64_t sample;
+};
+
+#define INTEL_PERF_DATA_INDEX_STRIDE (1 << 20)
+
+struct intel_perf_data_stream {
+	int fd;
+	uint64_t file_size;
+
+	struct intel_perf_record_device_info record_info;
+	struct drm_i915_query_topology_info *topology;
+
+	struct intel_perf_data_correlation *correlations;
+	uint32_t n_correlations;
+	uint32_t n_allocated_correlations;
+
+	struct intel_perf_data_index_entry *index;
+	uint32_t n_index;
+	uint32_t n_allocated_index;
+
+	/* Number of samples and position of the last one */
+	uint64_t n_samples;
+	struct intel_perf_data_index_entry last;
+
+	const char *metric_set_uuid;
+	const char *metric_set_name;
+
+	struct intel_perf_devinfo devinfo;
+
+	struct intel_perf *perf;
+	struct intel_perf_metric_set *metric_set;
+
+	char error_msg[256];
+};
+
+struct intel_perf_data_iter {
+	struct intel_perf_data_stream *stream;
+
+	uint8_t *chunk;
+	uint64_t chunk_offset;
+	uint32_t chunk_len;
+	uint32_t pos;
+
+	uint64_t gpu_ts_begin;
+	uint64_t gpu_ts_end;
+	uint64_t ref_ts;
+	uint64_t sample;
+
+	/* Current sample, the record is only valid until the next call
+	 * to intel_perf_data_iter_next().
+	 */
+	const struct drm_i915_perf_record_header *record;
+	struct intel_perf_data_index_entry current;
+};
+
+bool intel_perf_data_stream_open(struct intel_perf_data_stream *stream,
+				 int perf_file_fd, const char *index_path);
+void intel_perf_data_stream_close(struct intel_perf_data_stream *stream);
+
+uint64_t intel_perf_data_stream_cpu_timestamp(const struct intel_perf_data_stream *stream,
+					      uint64_t gpu_ts);
+uint32_t intel_perf_data_stream_ctx_id(const struct intel_perf_data_stream *stream,
+				       const struct drm_i915_perf_record_header *record);
+
+bool intel_perf_data_iter_init(struct intel_perf_data_iter *iter,
+			       struct intel_perf_data_stream *stream,
+			       uint64_t gpu_ts_begin, uint64_t gpu_ts_end);
+void intel_perf_data_iter_seek(struct intel_perf_data_iter *iter,
+			       const struct intel_perf_data_index_entry *pos);
+const struct drm_i915_perf_record_header *
+intel_perf_data_iter_next(struct intel_perf_data_iter *iter);
+void intel_perf_data_iter_fini(struct intel_perf_data_iter *iter);
+
 #ifdef __cplusplus
 };
 #endif
@@ -42,9 +42,15 @@
  * CRC32 code derived from work by Gary S. Brown.
  */
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "igt_crc.h"
+#include "igt_x86.h"
 
 const uint32_t igt_crc32_tab[256] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -92,16 +98,368 @@ const uint32_t igt_crc32_tab[256] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t igt_cpu_crc32(const void *buf, size_t size)
+#define CRC32_POLY 0xedb88320
+
+/*
+ * Slicing-by-8: crc32_slice_tab[k][i] is the crc of byte i followed by k
+ * zero bytes, which lets 8 input bytes be folded in with 8 independent
+ * lookups. crc32_x2n_tab[k] is x^(2^k) modulo the polynomial, used to
+ * shift a crc over a run of zeroes when combining.
+ */
+static uint32_t crc32_slice_tab[8][256];
+static uint32_t crc32_x2n_tab[32];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static uint32_t multmodp(uint32_t a, uint32_t b);
+
+static void crc32_init(void)
 {
+	uint32_t p;
+	int i, k;
 
-	const uint8_t *p = buf;
-	uint32_t crc;
+	for (i = 0; i < 256; i++) {
+		uint32_t c = igt_crc32_tab[i];
+
+		crc32_slice_tab[0][i] = c;
+		for (k = 1; k < 8; k++) {
+			c = igt_crc32_tab[c & 0xff] ^ (c >> 8);
+			crc32_slice_tab[k][i] = c;
+		}
+	}
 
-	crc = ~0U;
+	p = 1u << 30; /* x^1 */
+	crc32_x2n_tab[0] = p;
+	for (k = 1; k < 32; k++)
+		crc32_x2n_tab[k] = p = multmodp(p, p);
+}
 
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *p, size_t size)
+{
 	while (size--)
 		crc = igt_crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
 
-	return crc ^ ~0U;
+	return crc;
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const uint32_t (*t)[256] = crc32_slice_tab;
+
+	pthread_once(&crc32_once, crc32_init);
+
+	while (size && ((uintptr_t)p & 7)) {
+		crc = igt_crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		size--;
+	}
+
+	while (size >= 8) {
+		uint32_t a = load_le32(p) ^ crc;
+		uint32_t b = load_le32(p + 4);
+
+		crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^
+		      t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^
+		      t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^
+		      t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+
+		p += 8;
+		size -= 8;
+	}
+
+	return crc32_bytewise(crc, p, size);
+}
+
+static uint32_t cpu_crc32_slice8(const void *buf, size_t size)
+{
+	return crc32_slice8(~0U, buf, size) ^ ~0U;
+}
+
+#if defined(__x86_64__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1,pclmul")
+
+#include <smmintrin.h>
+#include <wmmintrin.h>
+
+/*
+ * Folding with carry-less multiplication, as described in Intel's "Fast
+ * CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction",
+ * with the bit-reflected constants for the crc32 polynomial. Four 128 bit
+ * lanes are folded in parallel over 64 byte blocks, then reduced to one
+ * lane and finally to 32 bits with a Barrett reduction. Takes at least 64
+ * bytes, a multiple of 16.
+ */
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64;
+	size -= 64;
+
+	while (size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				   _mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				   _mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				   _mm_loadu_si128((const __m128i *)(p + 0x30)));
+
+		p += 64;
+		size -= 64;
+	}
+
+	/* Fold the four lanes into one */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (size >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)p));
+
+		p += 16;
+		size -= 16;
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_and_si128(x1, mask);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+	x0 = _mm_and_si128(x0, mask);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x0);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+#pragma GCC pop_options
+
+static uint32_t cpu_crc32_pclmul(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint32_t crc = ~0U;
+
+	if (size >= 64) {
+		size_t bulk = size & ~(size_t)15;
+
+		crc = crc32_fold_pclmul(crc, p, bulk);
+		p += bulk;
+		size -= bulk;
+	}
+
+	return crc32_slice8(crc, p, size) ^ ~0U;
+}
+
+static uint32_t (*resolve_cpu_crc32(void))(const void *, size_t)
+{
+	return igt_crc32_get_impl(igt_x86_features());
+}
+
+uint32_t igt_cpu_crc32(const void *buf, size_t size)
+	__attribute__((ifunc("resolve_cpu_crc32")));
+
+/**
+ * igt_crc32_get_impl:
+ * @features: igt_x86_features() flags to select the implementation for
+ *
+ * Returns:
+ * The fastest crc32 implementation for @features, carry-less
+ * multiplication when both PCLMUL and SSE4_1 are set, slicing-by-8
+ * otherwise. The results are identical to those of igt_cpu_crc32().
+ */
+igt_crc32_fn igt_crc32_get_impl(unsigned int features)
+{
+	if ((features & (PCLMUL | SSE4_1)) == (PCLMUL | SSE4_1))
+		return cpu_crc32_pclmul;
+
+	return cpu_crc32_slice8;
+}
+
+#else
+igt_crc32_fn igt_crc32_get_impl(unsigned int features)
+{
+	return cpu_crc32_slice8;
+}
+
+uint32_t igt_cpu_crc32(const void *buf, size_t size)
+{
+	return cpu_crc32_slice8(buf, size);
+}
+#endif
+
+/* Product of @a and @b modulo the crc32 polynomial, bit reflected */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31, p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+	}
+
+	return p;
+}
+
+/**
+ * igt_crc32_combine:
+ * @crc1: igt_cpu_crc32() of a first buffer
+ * @crc2: igt_cpu_crc32() of a second buffer
+ * @len2: Size in bytes of the second buffer
+ *
+ * Returns:
+ * The crc32 of the concatenation of both buffers, computed from their
+ * individual crcs in O(log(@len2)).
+ */
+uint32_t igt_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	uint32_t p = 1u << 31; /* x^0 */
+	int k;
+
+	pthread_once(&crc32_once, crc32_init);
+
+	/* crc1 * x^(8 * len2) */
+	for (k = 3; len2; len2 >>= 1, k++)
+		if (len2 & 1)
+			p = multmodp(crc32_x2n_tab[k & 31], p);
+
+	return multmodp(p, crc1) ^ crc2;
+}
+
+struct crc32_slice {
+	pthread_t thread;
+	bool threaded;
+	const uint8_t *buf;
+	size_t size;
+	uint32_t crc;
+};
+
+static void *crc32_slice_thread(void *data)
+{
+	struct crc32_slice *slice = data;
+
+	slice->crc = igt_cpu_crc32(slice->buf, slice->size);
+
+	return NULL;
+}
+
+#define CRC32_MIN_SLICE (4 << 20)
+
+/**
+ * igt_cpu_crc32_parallel:
+ * @buf: Buffer to checksum
+ * @size: Size of @buf in bytes
+ * @threads: Maximum number of threads to use, 0 for one per online cpu
+ *
+ * Same as igt_cpu_crc32(), splitting large buffers in slices checksummed
+ * by separate threads and combined with igt_crc32_combine(). Slices are
+ * at least a few MiB, so small buffers are handled by the calling thread.
+ *
+ * Returns:
+ * The crc32 of @buf.
+ */
+uint32_t igt_cpu_crc32_parallel(const void *buf, size_t size,
+				unsigned int threads)
+{
+	struct crc32_slice *slices;
+	size_t slice_size;
+	unsigned int n, i;
+	uint32_t crc;
+
+	if (!threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	n = size / CRC32_MIN_SLICE;
+	if (n > threads)
+		n = threads;
+	if (n <= 1)
+		return igt_cpu_crc32(buf, size);
+
+	slices = calloc(n, sizeof(*slices));
+	if (!slices)
+		return igt_cpu_crc32(buf, size);
+
+	/* Keep the slices 64 byte aligned for the folding loop */
+	slice_size = (size / n + 63) & ~(size_t)63;
+	for (i = 0; i < n; i++) {
+		size_t offset = i * slice_size;
+
+		slices[i].buf = (const uint8_t *)buf + offset;
+		slices[i].size = offset >= size ? 0 :
+				 size - offset < slice_size ? size - offset :
+				 slice_size;
+
+		/* The first slice is done by the caller */
+		if (i)
+			slices[i].threaded =
+				!pthread_create(&slices[i].thread, NULL,
+						crc32_slice_thread, &slices[i]);
+	}
+
+	crc32_slice_thread(&slices[0]);
+	crc = slices[0].crc;
+
+	for (i = 1; i < n; i++) {
+		if (slices[i].threaded)
+			pthread_join(slices[i].thread, NULL);
+		else
+			crc32_slice_thread(&slices[i]);
+
+		crc = igt_crc32_combine(crc, slices[i].crc, slices[i].size);
+	}
+
+	free(slices);
+
+	return crc;
 }
@@ -26,6 +26,12 @@
 
 extern const uint32_t igt_crc32_tab[256];
 
+typedef uint32_t (*igt_crc32_fn)(const void *buf, size_t size);
+
 uint32_t igt_cpu_crc32(const void *buf, size_t size);
+uint32_t igt_cpu_crc32_parallel(const void *buf, size_t size,
+				unsigned int threads);
+uint32_t igt_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+igt_crc32_fn igt_crc32_get_impl(unsigned int features);
 
 #endif
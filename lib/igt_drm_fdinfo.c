@@ -22,7 +22,9 @@
  *
  */
 
+#include <assert.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -37,7 +39,7 @@
 
 static size_t read_fdinfo(char *buf, const size_t sz, int at, const char *name)
 {
-	size_t count;
+	ssize_t count;
 	int fd;
 
 	fd = openat(at, name, O_RDONLY);
@@ -46,124 +48,265 @@ static size_t read_fdinfo(char *buf, const size_t sz, int at, const char *name)
 
 	count = read(fd, buf, sz - 1);
 	if (count > 0)
-		buf[count - 1] = 0;
+		buf[count] = 0;
 	close(fd);
 
 	return count > 0 ? count : 0;
 }
 
-static int parse_engine(char *line, struct drm_client_fdinfo *info,
-			size_t prefix_len, uint64_t *val)
+static const char *e2class[] = {
+	"render",
+	"copy",
+	"video",
+	"video-enhance",
+};
+
+static int engine_class(const char *name, size_t len)
 {
-	static const char *e2class[] = {
-		"render",
-		"copy",
-		"video",
-		"video-enhance",
-	};
-	ssize_t name_len;
-	char *name, *p;
-	int found = -1;
 	unsigned int i;
 
-	p = index(line, ':');
-	if (!p || p == line)
-		return -1;
+	for (i = 0; i < ARRAY_SIZE(e2class); i++) {
+		if (strlen(e2class[i]) == len && !memcmp(name, e2class[i], len))
+			return i;
+	}
+
+	return -1;
+}
 
-	name_len = p - line - prefix_len;
-	if (name_len < 1)
-		return -1;
+static uint64_t parse_u64(const char *p, const char *end, const char **next)
+{
+	uint64_t val = 0;
 
-	name = line + prefix_len;
+	for (; p < end && isdigit(*p); p++)
+		val = val * 10 + (*p - '0');
 
-	for (i = 0; i < ARRAY_SIZE(e2class); i++) {
-		if (!strncmp(name, e2class[i], name_len)) {
-			found = i;
+	if (next)
+		*next = p;
+
+	return val;
+}
+
+static uint64_t parse_mem(const char *p, const char *end)
+{
+	uint64_t val = parse_u64(p, end, &p);
+
+	while (p < end && isspace(*p))
+		p++;
+
+	if (end - p >= 3) {
+		if (!memcmp(p, "KiB", 3))
+			val <<= 10;
+		else if (!memcmp(p, "MiB", 3))
+			val <<= 20;
+		else if (!memcmp(p, "GiB", 3))
+			val <<= 30;
+	}
+
+	return val;
+}
+
+/* Unparsed strings of a record, pointing into the fdinfo text. */
+struct fdinfo_view {
+	const char *driver;
+	size_t driver_len;
+	const char *pdev;
+	size_t pdev_len;
+
+	const char *region[DRM_CLIENT_RECORD_MAX_REGIONS];
+	size_t region_len[DRM_CLIENT_RECORD_MAX_REGIONS];
+
+	bool has_id;
+	unsigned int good; /* Of client-id and driver, each counted once */
+	unsigned int num_capacity;
+};
+
+static void set_mem(struct drm_client_record *rec, struct fdinfo_view *view,
+		    const char *name, size_t len, size_t offset,
+		    const char *v, const char *end)
+{
+	unsigned int i;
+
+	for (i = 0; i < rec->num_regions; i++) {
+		if (view->region_len[i] == len &&
+		    !memcmp(view->region[i], name, len))
 			break;
-		}
 	}
 
-	if (found >= 0) {
-		while (*++p && isspace(*p));
-		*val = strtoull(p, NULL, 10);
+	if (i == rec->num_regions) {
+		if (i == DRM_CLIENT_RECORD_MAX_REGIONS)
+			return;
+
+		view->region[i] = name;
+		view->region_len[i] = len;
+		rec->num_regions++;
 	}
 
-	return found;
+	*(uint64_t *)((char *)&rec->mem[i] + offset) = parse_mem(v, end);
 }
 
-static const char *find_kv(const char *buf, const char *key, size_t keylen)
+#define KEY(k) (klen == sizeof(k) - 1 && !memcmp(key, k, sizeof(k) - 1))
+#define PREFIX(k) (klen > sizeof(k) - 1 && !memcmp(key, k, sizeof(k) - 1))
+#define SUFFIX(k) key + sizeof(k) - 1, klen - (sizeof(k) - 1)
+#define MEM(k, field) \
+	set_mem(rec, view, SUFFIX(k), \
+		offsetof(struct drm_client_meminfo, field), v, eol)
+
+/*
+ * Single pass over the fdinfo text. Each line is split at the first colon
+ * and the key dispatched on its first character after the "drm-" prefix, so
+ * every line is only looked at once and the buffer is never modified.
+ */
+static void parse_fdinfo(const char *buf, size_t len,
+			 struct drm_client_record *rec,
+			 struct fdinfo_view *view)
 {
-	const char *p = buf;
+	const char *end = buf + len, *l, *eol;
 
-	if (strncmp(buf, key, keylen))
-		return NULL;
+	for (l = buf; l < end; l = eol + 1) {
+		const char *colon, *key, *v;
+		size_t klen;
+		int idx;
 
-	p = index(buf, ':');
-	if (!p || p == buf)
-		return NULL;
-	if ((p - buf) != keylen)
-		return NULL;
+		eol = memchr(l, '\n', end - l);
+		if (!eol)
+			eol = end;
 
-	p++;
-	while (*p && isspace(*p))
-		p++;
+		colon = memchr(l, ':', eol - l);
+		if (!colon || colon - l <= 4 || memcmp(l, "drm-", 4))
+			continue;
 
-	return *p ? p : NULL;
+		key = l + 4;
+		klen = colon - key;
+
+		v = colon + 1;
+		while (v < eol && isspace(*v))
+			v++;
+		if (v == eol)
+			continue;
+
+		switch (key[0]) {
+		case 'a':
+			if (PREFIX("active-"))
+				MEM("active-", active);
+			break;
+		case 'c':
+			if (KEY("client-id")) {
+				rec->id = parse_u64(v, eol, NULL);
+				if (!view->has_id)
+					view->good++;
+				view->has_id = true;
+			} else if (PREFIX("cycles-")) {
+				idx = engine_class(SUFFIX("cycles-"));
+				if (idx >= 0)
+					rec->cycles[idx] = parse_u64(v, eol, NULL);
+			}
+			break;
+		case 'd':
+			if (KEY("driver")) {
+				if (!view->driver)
+					view->good++;
+				view->driver = v;
+				view->driver_len = eol - v;
+			}
+			break;
+		case 'e':
+			if (PREFIX("engine-capacity-")) {
+				idx = engine_class(SUFFIX("engine-capacity-"));
+				if (idx >= 0) {
+					rec->capacity[idx] = parse_u64(v, eol, NULL);
+					view->num_capacity++;
+				}
+			} else if (PREFIX("engine-")) {
+				idx = engine_class(SUFFIX("engine-"));
+				if (idx >= 0) {
+					if (!rec->capacity[idx])
+						rec->capacity[idx] = 1;
+					rec->busy[idx] = parse_u64(v, eol, NULL);
+					rec->num_engines++;
+				}
+			}
+			break;
+		case 'm':
+			/* Legacy name for drm-resident-. */
+			if (PREFIX("memory-"))
+				MEM("memory-", resident);
+			break;
+		case 'p':
+			if (KEY("pdev")) {
+				view->pdev = v;
+				view->pdev_len = eol - v;
+			} else if (PREFIX("purgeable-")) {
+				MEM("purgeable-", purgeable);
+			}
+			break;
+		case 'r':
+			if (PREFIX("resident-"))
+				MEM("resident-", resident);
+			break;
+		case 's':
+			if (PREFIX("shared-"))
+				MEM("shared-", shared);
+			break;
+		case 't':
+			if (PREFIX("total-cycles-")) {
+				idx = engine_class(SUFFIX("total-cycles-"));
+				if (idx >= 0)
+					rec->total_cycles[idx] =
+						parse_u64(v, eol, NULL);
+			} else if (PREFIX("total-")) {
+				MEM("total-", total);
+			}
+			break;
+		}
+	}
+}
+
+#undef MEM
+#undef SUFFIX
+#undef PREFIX
+#undef KEY
+
+static void copy_view(char *dst, size_t sz, const char *src, size_t len)
+{
+	if (len >= sz)
+		len = sz - 1;
+
+	memcpy(dst, src, len);
+	dst[len] = 0;
 }
 
 unsigned int
 __igt_parse_drm_fdinfo(int dir, const char *fd, struct drm_client_fdinfo *info)
 {
-	char buf[4096], *_buf = buf;
-	char *l, *ctx = NULL;
-	unsigned int good = 0, num_capacity = 0;
+	struct drm_client_record rec = { };
+	struct fdinfo_view view = { };
+	unsigned int i;
+	char buf[4096];
 	size_t count;
 
 	count = read_fdinfo(buf, sizeof(buf), dir, fd);
 	if (!count)
 		return 0;
 
-	while ((l = strtok_r(_buf, "\n", &ctx))) {
-		uint64_t val = 0;
-		const char *v;
-		int idx;
+	parse_fdinfo(buf, count, &rec, &view);
 
-		_buf = NULL;
-
-		if ((v = find_kv(l, "drm-driver", strlen("drm-driver")))) {
-			strncpy(info->driver, v, sizeof(info->driver) - 1);
-			good++;
-		} else if ((v = find_kv(l, "drm-pdev", strlen("drm-pdev")))) {
-			strncpy(info->pdev, v, sizeof(info->pdev) - 1);
-		}  else if ((v = find_kv(l, "drm-client-id",
-					 strlen("drm-client-id")))) {
-			info->id = atol(v);
-			good++;
-		} else if (!strncmp(l, "drm-engine-", 11) &&
-			   strncmp(l, "drm-engine-capacity-", 20)) {
-			idx = parse_engine(l, info, strlen("drm-engine-"),
-					   &val);
-			if (idx >= 0) {
-				if (!info->capacity[idx])
-					info->capacity[idx] = 1;
-				info->busy[idx] = val;
-				info->num_engines++;
-			}
-		} else if (!strncmp(l, "drm-engine-capacity-", 20)) {
-			idx = parse_engine(l, info,
-					   strlen("drm-engine-capacity-"),
-					   &val);
-			if (idx >= 0) {
-				info->capacity[idx] = val;
-				num_capacity++;
-			}
-		}
-	}
-
-	if (good < 2 || !info->num_engines)
+	if (view.good < 2 || !rec.num_engines)
 		return 0; /* fdinfo format not as expected */
 
-	return good + info->num_engines + num_capacity;
+	copy_view(info->driver, sizeof(info->driver),
+		  view.driver, view.driver_len);
+	if (view.pdev)
+		copy_view(info->pdev, sizeof(info->pdev),
+			  view.pdev, view.pdev_len);
+	info->id = rec.id;
+
+	info->num_engines = rec.num_engines;
+	for (i = 0; i < DRM_CLIENT_RECORD_MAX_ENGINES; i++) {
+		info->capacity[i] = rec.capacity[i];
+		info->busy[i] = rec.busy[i];
+	}
+
+	return view.good + rec.num_engines + view.num_capacity;
 }
 
 unsigned int igt_parse_drm_fdinfo(int drm_fd, struct drm_client_fdinfo *info)
@@ -186,3 +329,147 @@ unsigned int igt_parse_drm_fdinfo(int drm_fd, struct drm_client_fdinfo *info)
 
 	return res;
 }
+
+void igt_drm_client_batch_init(struct drm_client_batch *batch)
+{
+	memset(batch, 0, sizeof(*batch));
+}
+
+void igt_drm_client_batch_reset(struct drm_client_batch *batch)
+{
+	batch->num_records = 0;
+	batch->num_strings = 0;
+	batch->strings_size = 0;
+}
+
+void igt_drm_client_batch_fini(struct drm_client_batch *batch)
+{
+	free(batch->records);
+	free(batch->string_offset);
+	free(batch->strings);
+	free(batch->buf);
+	memset(batch, 0, sizeof(*batch));
+}
+
+static uint16_t
+intern(struct drm_client_batch *batch, const char *str, size_t len)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num_strings; i++) {
+		const char *s = drm_client_batch_string(batch, i);
+
+		if (!strncmp(s, str, len) && !s[len])
+			return i;
+	}
+
+	assert(i < UINT16_MAX);
+
+	if (batch->num_strings == batch->max_strings) {
+		batch->max_strings = batch->max_strings ?
+				     2 * batch->max_strings : 8;
+		batch->string_offset = realloc(batch->string_offset,
+					       batch->max_strings *
+					       sizeof(*batch->string_offset));
+		assert(batch->string_offset);
+	}
+
+	while (batch->strings_size + len + 1 > batch->strings_max) {
+		batch->strings_max = batch->strings_max ?
+				     2 * batch->strings_max : 256;
+		batch->strings = realloc(batch->strings, batch->strings_max);
+		assert(batch->strings);
+	}
+
+	batch->string_offset[i] = batch->strings_size;
+	memcpy(batch->strings + batch->strings_size, str, len);
+	batch->strings[batch->strings_size + len] = 0;
+	batch->strings_size += len + 1;
+	batch->num_strings++;
+
+	return i;
+}
+
+struct drm_client_record *
+__igt_parse_drm_client_record(struct drm_client_batch *batch,
+			      const char *buf, size_t len)
+{
+	struct drm_client_record *rec;
+	struct fdinfo_view view = { };
+	unsigned int i;
+
+	if (batch->num_records == batch->max_records) {
+		batch->max_records = batch->max_records ?
+				     2 * batch->max_records : 16;
+		batch->records = realloc(batch->records,
+					 batch->max_records *
+					 sizeof(*batch->records));
+		assert(batch->records);
+	}
+
+	rec = &batch->records[batch->num_records];
+	memset(rec, 0, sizeof(*rec));
+
+	parse_fdinfo(buf, len, rec, &view);
+	if (view.good < 2)
+		return NULL;
+
+	rec->driver = intern(batch, view.driver, view.driver_len);
+	rec->pdev = intern(batch, view.pdev ?: "", view.pdev_len);
+	for (i = 0; i < rec->num_regions; i++)
+		rec->region[i] = intern(batch, view.region[i],
+					view.region_len[i]);
+
+	batch->num_records++;
+
+	return rec;
+}
+
+static size_t read_fdinfo_batch(struct drm_client_batch *batch, int dir,
+				const char *name)
+{
+	size_t count = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = openat(dir, name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	do {
+		if (count == batch->buf_size) {
+			batch->buf_size = batch->buf_size ?
+					  2 * batch->buf_size : 4096;
+			batch->buf = realloc(batch->buf, batch->buf_size);
+			assert(batch->buf);
+		}
+
+		ret = read(fd, batch->buf + count, batch->buf_size - count);
+		if (ret > 0)
+			count += ret;
+	} while (ret > 0);
+
+	close(fd);
+
+	return count;
+}
+
+unsigned int igt_parse_drm_fdinfo_batch(struct drm_client_batch *batch,
+					int dir, const char * const *fds,
+					unsigned int count)
+{
+	unsigned int i, parsed = 0;
+
+	for (i = 0; i < count; i++) {
+		size_t len;
+
+		len = read_fdinfo_batch(batch, dir, fds[i]);
+		if (!len)
+			continue;
+
+		if (__igt_parse_drm_client_record(batch, batch->buf, len))
+			parsed++;
+	}
+
+	return parsed;
+}
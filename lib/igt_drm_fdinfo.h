@@ -32,6 +32,9 @@
 
 #define DRM_CLIENT_FDINFO_MAX_ENGINES 16
 
+#define DRM_CLIENT_RECORD_MAX_ENGINES 8
+#define DRM_CLIENT_RECORD_MAX_REGIONS 8
+
 struct drm_client_fdinfo {
 	char driver[128];
 	char pdev[128];
@@ -66,4 +69,114 @@ unsigned int igt_parse_drm_fdinfo(int drm_fd, struct drm_client_fdinfo *info);
 unsigned int __igt_parse_drm_fdinfo(int dir, const char *fd,
 				    struct drm_client_fdinfo *info);
 
+struct drm_client_meminfo {
+	uint64_t total;
+	uint64_t shared;
+	uint64_t resident;
+	uint64_t purgeable;
+	uint64_t active;
+};
+
+/*
+ * Compact per client record used by the batch parser. Strings are interned
+ * in the owning struct drm_client_batch and referenced by index.
+ */
+struct drm_client_record {
+	unsigned long id;
+	uint16_t driver;
+	uint16_t pdev;
+
+	uint8_t num_engines;
+	uint8_t num_regions;
+
+	uint32_t capacity[DRM_CLIENT_RECORD_MAX_ENGINES];
+	uint64_t busy[DRM_CLIENT_RECORD_MAX_ENGINES];
+	uint64_t cycles[DRM_CLIENT_RECORD_MAX_ENGINES];
+	uint64_t total_cycles[DRM_CLIENT_RECORD_MAX_ENGINES];
+
+	uint16_t region[DRM_CLIENT_RECORD_MAX_REGIONS];
+	struct drm_client_meminfo mem[DRM_CLIENT_RECORD_MAX_REGIONS];
+};
+
+struct drm_client_batch {
+	unsigned int num_records;
+	unsigned int max_records;
+	struct drm_client_record *records;
+
+	unsigned int num_strings;
+	unsigned int max_strings;
+	uint32_t *string_offset;
+
+	size_t strings_size;
+	size_t strings_max;
+	char *strings;
+
+	size_t buf_size;
+	char *buf;
+};
+
+static inline const char *
+drm_client_batch_string(const struct drm_client_batch *batch, uint16_t idx)
+{
+	return batch->strings + batch->string_offset[idx];
+}
+
+/**
+ * igt_drm_client_batch_init: Initialises an empty batch
+ *
+ * @batch: Batch to initialise.
+ */
+void igt_drm_client_batch_init(struct drm_client_batch *batch);
+
+/**
+ * igt_drm_client_batch_reset: Empties the batch keeping its allocations
+ *
+ * @batch: Batch to reset.
+ *
+ * Drops all records and interned strings so the batch can be refilled
+ * without reallocating.
+ */
+void igt_drm_client_batch_reset(struct drm_client_batch *batch);
+
+/**
+ * igt_drm_client_batch_fini: Releases all memory owned by the batch
+ *
+ * @batch: Batch to release.
+ */
+void igt_drm_client_batch_fini(struct drm_client_batch *batch);
+
+/**
+ * __igt_parse_drm_client_record: Parses fdinfo text into a batch
+ *
+ * @batch: Batch to append the record to.
+ * @buf: Contents of a drm fdinfo file, not necessarily NUL terminated.
+ * @len: Length of @buf.
+ *
+ * Parses @buf in a single pass without modifying or copying it and appends a
+ * new record to @batch.
+ *
+ * Returns the new record or NULL if the mandatory drm-driver and
+ * drm-client-id keys were not present.
+ */
+struct drm_client_record *
+__igt_parse_drm_client_record(struct drm_client_batch *batch,
+			      const char *buf, size_t len);
+
+/**
+ * igt_parse_drm_fdinfo_batch: Parses a set of drm fdinfo files
+ *
+ * @batch: Batch to append the records to.
+ * @dir: File descriptor pointing to a /proc/pid/fdinfo directory.
+ * @fds: Array of file descriptor numbers, as strings, to parse.
+ * @count: Number of entries in @fds.
+ *
+ * All files are read through a single buffer owned by @batch which is only
+ * reallocated when a larger file is encountered.
+ *
+ * Returns the number of records appended to @batch.
+ */
+unsigned int igt_parse_drm_fdinfo_batch(struct drm_client_batch *batch,
+					int dir, const char * const *fds,
+					unsigned int count);
+
 #endif /* IGT_DRM_FDINFO_H */
@@ -0,0 +1,494 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "igt_drm_fdinfo_scan.h"
+
+#define DRM_MAJOR 226
+
+static size_t readat2buf(int at, const char *name, char *buf, const size_t sz)
+{
+	ssize_t count;
+	int fd;
+
+	fd = openat(at, name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	count = read(fd, buf, sz - 1);
+	close(fd);
+
+	if (count > 0) {
+		buf[count] = 0;
+
+		return count;
+	} else {
+		buf[0] = 0;
+
+		return 0;
+	}
+}
+
+static DIR *opendirat(int at, const char *name)
+{
+	DIR *dir;
+	int fd;
+
+	fd = openat(at, name, O_DIRECTORY);
+	if (fd < 0)
+		return NULL;
+
+	dir = fdopendir(fd);
+	if (!dir)
+		close(fd);
+
+	return dir;
+}
+
+static bool get_task_name(const char *buffer, char *out, unsigned long sz)
+{
+	char *s = index(buffer, '(');
+	char *e = rindex(buffer, ')');
+	unsigned int len;
+
+	if (!s || !e)
+		return false;
+	assert(e >= s);
+
+	len = e - ++s;
+	if (!len || (len + 1) >= sz)
+		return false;
+
+	strncpy(out, s, len);
+	out[len] = 0;
+
+	return true;
+}
+
+static bool read_task_name(struct igt_drm_fdinfo_scan_pid *p)
+{
+	char buf[4096];
+
+	if (!readat2buf(p->pid_dir, "stat", buf, sizeof(buf)))
+		return false;
+
+	return get_task_name(buf, p->name, sizeof(p->name));
+}
+
+static void pid_close_dirs(struct igt_drm_fdinfo_scan *scan,
+			   struct igt_drm_fdinfo_scan_pid *p)
+{
+	if (p->pid_dir < 0)
+		return;
+
+	if (p->fdinfo_dir)
+		closedir(p->fdinfo_dir);
+	if (p->fd_dir >= 0)
+		close(p->fd_dir);
+	close(p->pid_dir);
+
+	p->fdinfo_dir = NULL;
+	p->pid_dir = p->fd_dir = -1;
+	scan->num_open--;
+}
+
+static void pid_close(struct igt_drm_fdinfo_scan *scan,
+		      struct igt_drm_fdinfo_scan_pid *p)
+{
+	pid_close_dirs(scan, p);
+
+	free(p->fds);
+	memset(p, 0, sizeof(*p));
+	p->pid_dir = p->fd_dir = -1;
+}
+
+static bool pid_open_dirs(struct igt_drm_fdinfo_scan *scan,
+			  struct igt_drm_fdinfo_scan_pid *p, int proc_dir,
+			  const char *name)
+{
+	p->pid_dir = openat(proc_dir, name, O_DIRECTORY | O_RDONLY);
+	if (p->pid_dir < 0)
+		return false;
+
+	scan->num_open++;
+
+	p->fd_dir = openat(p->pid_dir, "fd", O_DIRECTORY | O_RDONLY);
+	if (p->fd_dir < 0)
+		goto err;
+
+	p->fdinfo_dir = opendirat(p->pid_dir, "fdinfo");
+	if (!p->fdinfo_dir)
+		goto err;
+
+	return true;
+
+err:
+	pid_close_dirs(scan, p);
+	return false;
+}
+
+static bool pid_open(struct igt_drm_fdinfo_scan *scan,
+		     struct igt_drm_fdinfo_scan_pid *p, int proc_dir,
+		     const char *name)
+{
+	char buf[4096];
+
+	memset(p, 0, sizeof(*p));
+	p->pid_dir = p->fd_dir = -1;
+
+	if (!pid_open_dirs(scan, p, proc_dir, name))
+		return false;
+
+	if (!readat2buf(p->pid_dir, "stat", buf, sizeof(buf)))
+		goto err;
+
+	p->pid = atoi(buf);
+	if (!p->pid)
+		goto err;
+
+	if (!get_task_name(buf, p->name, sizeof(p->name)))
+		goto err;
+
+	return true;
+
+err:
+	pid_close(scan, p);
+	return false;
+}
+
+/* Reopens the directories of a known process which were not kept open. */
+static bool pid_reopen(struct igt_drm_fdinfo_scan *scan,
+		       struct igt_drm_fdinfo_scan_pid *p, int proc_dir)
+{
+	char name[16];
+
+	if (p->pid_dir >= 0)
+		return true;
+
+	snprintf(name, sizeof(name), "%u", p->pid);
+
+	return pid_open_dirs(scan, p, proc_dir, name);
+}
+
+/*
+ * Keeps the directories of a DRM client open for the next scan, as long as
+ * that does not hold more than max_open processes open.
+ */
+static void pid_park(struct igt_drm_fdinfo_scan *scan,
+		     struct igt_drm_fdinfo_scan_pid *p)
+{
+	if (scan->num_open > scan->max_open)
+		pid_close_dirs(scan, p);
+}
+
+static struct igt_drm_fdinfo_scan_fd *
+pid_get_fd(struct igt_drm_fdinfo_scan_pid *p, unsigned int fd, bool *found)
+{
+	struct igt_drm_fdinfo_scan_fd *f;
+	unsigned int i;
+
+	for (i = 0; i < p->num_fds; i++) {
+		if (p->fds[i].fd == fd) {
+			*found = true;
+			return &p->fds[i];
+		}
+	}
+
+	*found = false;
+
+	if (p->num_fds == p->alloc_fds) {
+		p->alloc_fds = p->alloc_fds ? 2 * p->alloc_fds : 4;
+		p->fds = realloc(p->fds, p->alloc_fds * sizeof(*p->fds));
+		assert(p->fds);
+	}
+
+	f = &p->fds[p->num_fds++];
+	memset(f, 0, sizeof(*f));
+	f->fd = fd;
+
+	return f;
+}
+
+/*
+ * Walks the fdinfo directory of a process, parsing fdinfo only for DRM file
+ * descriptors which either matched the filter last time or are new. Returns
+ * the number of DRM file descriptors held by the process, with zero meaning
+ * the process is gone or no longer interesting.
+ */
+static unsigned int
+pid_scan(struct igt_drm_fdinfo_scan *scan, struct igt_drm_fdinfo_scan_pid *p,
+	 igt_drm_fdinfo_client_t fn, void *data)
+{
+	struct dirent *dent;
+	unsigned int i, j;
+
+	if (!read_task_name(p))
+		return 0;
+
+	rewinddir(p->fdinfo_dir);
+
+	for (i = 0; i < p->num_fds; i++)
+		p->fds[i].seen = false;
+
+	while ((dent = readdir(p->fdinfo_dir)) != NULL) {
+		struct drm_client_fdinfo info = { };
+		struct igt_drm_fdinfo_scan_fd *f;
+		struct stat st;
+		bool found;
+
+		if (dent->d_type != DT_REG)
+			continue;
+		if (!isdigit(dent->d_name[0]))
+			continue;
+
+		if (fstatat(p->fd_dir, dent->d_name, &st, 0) ||
+		    (st.st_mode & S_IFMT) != S_IFCHR ||
+		    major(st.st_rdev) != scan->drm_major)
+			continue;
+
+		f = pid_get_fd(p, atoi(dent->d_name), &found);
+		f->seen = true;
+
+		/* Same device as last time which did not match, skip parsing. */
+		if (found && f->rdev == st.st_rdev && !f->match)
+			continue;
+
+		f->rdev = st.st_rdev;
+		f->match = false;
+
+		if (!__igt_parse_drm_fdinfo(dirfd(p->fdinfo_dir), dent->d_name,
+					    &info))
+			continue;
+
+		if (scan->filter && !scan->filter(&info, scan->filter_data))
+			continue;
+
+		f->match = true;
+		fn(p->pid, p->name, &info, data);
+	}
+
+	for (i = 0, j = 0; i < p->num_fds; i++) {
+		if (p->fds[i].seen)
+			p->fds[j++] = p->fds[i];
+	}
+	p->num_fds = j;
+
+	return p->num_fds;
+}
+
+static int pid_cmp(const void *_a, const void *_b)
+{
+	const unsigned int *a = _a, *b = _b;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+static int scan_pid_cmp(const void *_a, const void *_b)
+{
+	const struct igt_drm_fdinfo_scan_pid *a = _a, *b = _b;
+
+	return pid_cmp(&a->pid, &b->pid);
+}
+
+static void add_seen(unsigned int **seen, unsigned int *num,
+		     unsigned int *alloc, unsigned int pid)
+{
+	if (*num == *alloc) {
+		*alloc = *alloc ? 2 * *alloc : 256;
+		*seen = realloc(*seen, *alloc * sizeof(**seen));
+		assert(*seen);
+	}
+
+	(*seen)[(*num)++] = pid;
+}
+
+static struct igt_drm_fdinfo_scan_pid *
+add_pid(struct igt_drm_fdinfo_scan *scan)
+{
+	if (scan->num_pids == scan->alloc_pids) {
+		scan->alloc_pids = scan->alloc_pids ? 2 * scan->alloc_pids : 16;
+		scan->pids = realloc(scan->pids,
+				     scan->alloc_pids * sizeof(*scan->pids));
+		assert(scan->pids);
+	}
+
+	return &scan->pids[scan->num_pids++];
+}
+
+static void
+__igt_drm_fdinfo_scan(struct igt_drm_fdinfo_scan *scan, bool all,
+		      igt_drm_fdinfo_client_t fn, void *data)
+{
+	unsigned int num_seen = 0, alloc_seen = scan->alloc_seen;
+	unsigned int *seen = NULL;
+	unsigned int i, j, known;
+	struct dirent *dent;
+	DIR *proc_dir;
+
+	proc_dir = opendir(scan->proc);
+	if (!proc_dir)
+		return;
+
+	/* Re-read only the already known DRM clients first. */
+	for (i = 0, j = 0; i < scan->num_pids; i++) {
+		struct igt_drm_fdinfo_scan_pid *p = &scan->pids[i];
+
+		if (pid_reopen(scan, p, dirfd(proc_dir)) &&
+		    pid_scan(scan, p, fn, data)) {
+			pid_park(scan, p);
+			scan->pids[j++] = *p;
+		} else {
+			pid_close(scan, p);
+		}
+	}
+	scan->num_pids = known = j;
+
+	if (alloc_seen) {
+		seen = malloc(alloc_seen * sizeof(*seen));
+		assert(seen);
+	}
+
+	/*
+	 * Then list all pids, probing only the ones which appeared since the
+	 * previous listing, or all of them if asked for a full probe.
+	 */
+	while ((dent = readdir(proc_dir)) != NULL) {
+		struct igt_drm_fdinfo_scan_pid *p;
+		unsigned int pid;
+
+		if (dent->d_type != DT_DIR)
+			continue;
+		if (!isdigit(dent->d_name[0]))
+			continue;
+
+		pid = atoi(dent->d_name);
+		add_seen(&seen, &num_seen, &alloc_seen, pid);
+
+		if (bsearch(&pid, scan->pids, known, sizeof(*scan->pids),
+			    scan_pid_cmp))
+			continue;
+
+		if (!all && bsearch(&pid, scan->seen, scan->num_seen,
+				    sizeof(*scan->seen), pid_cmp))
+			continue;
+
+		p = add_pid(scan);
+		if (pid_open(scan, p, dirfd(proc_dir), dent->d_name) &&
+		    pid_scan(scan, p, fn, data)) {
+			pid_park(scan, p);
+		} else {
+			pid_close(scan, p);
+			scan->num_pids--;
+		}
+	}
+
+	closedir(proc_dir);
+
+	qsort(scan->pids, scan->num_pids, sizeof(*scan->pids), scan_pid_cmp);
+	qsort(seen, num_seen, sizeof(*seen), pid_cmp);
+
+	free(scan->seen);
+	scan->seen = seen;
+	scan->num_seen = num_seen;
+	scan->alloc_seen = alloc_seen;
+}
+
+struct igt_drm_fdinfo_scan *
+igt_drm_fdinfo_scan_create(const char *proc, igt_drm_fdinfo_filter_t filter,
+			   void *data)
+{
+	struct igt_drm_fdinfo_scan *scan;
+	struct rlimit rlim;
+
+	scan = calloc(1, sizeof(*scan));
+	if (!scan)
+		return NULL;
+
+	strncpy(scan->proc, proc ?: "/proc", sizeof(scan->proc) - 1);
+	scan->drm_major = DRM_MAJOR;
+	scan->filter = filter;
+	scan->filter_data = data;
+	scan->full_interval = IGT_DRM_FDINFO_SCAN_FULL_INTERVAL;
+	scan->max_open = IGT_DRM_FDINFO_SCAN_MAX_OPEN;
+
+	/* Leave most of the descriptors to the caller. */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) &&
+	    rlim.rlim_cur / 4 / 3 < scan->max_open)
+		scan->max_open = rlim.rlim_cur / 4 / 3;
+
+	return scan;
+}
+
+void igt_drm_fdinfo_scan(struct igt_drm_fdinfo_scan *scan,
+			 igt_drm_fdinfo_client_t fn, void *data)
+{
+	bool all;
+
+	all = !scan->full_interval || !(scan->scans % scan->full_interval);
+	scan->scans++;
+
+	__igt_drm_fdinfo_scan(scan, all, fn, data);
+}
+
+static void drop_cache(struct igt_drm_fdinfo_scan *scan)
+{
+	unsigned int i;
+
+	for (i = 0; i < scan->num_pids; i++)
+		pid_close(scan, &scan->pids[i]);
+	scan->num_pids = 0;
+	scan->num_seen = 0;
+}
+
+void igt_drm_fdinfo_scan_full(struct igt_drm_fdinfo_scan *scan,
+			      igt_drm_fdinfo_client_t fn, void *data)
+{
+	drop_cache(scan);
+	scan->scans++;
+
+	__igt_drm_fdinfo_scan(scan, true, fn, data);
+}
+
+void igt_drm_fdinfo_scan_destroy(struct igt_drm_fdinfo_scan *scan)
+{
+	if (!scan)
+		return;
+
+	drop_cache(scan);
+	free(scan->pids);
+	free(scan->seen);
+	free(scan);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef IGT_DRM_FDINFO_SCAN_H
+#define IGT_DRM_FDINFO_SCAN_H
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "igt_drm_fdinfo.h"
+
+#define IGT_DRM_FDINFO_SCAN_FULL_INTERVAL 10
+#define IGT_DRM_FDINFO_SCAN_MAX_OPEN 64
+
+/*
+ * Returns true if the client described by info is of interest to the caller.
+ * Only file descriptors for which the filter returned true are re-parsed on
+ * subsequent incremental scans.
+ */
+typedef bool (*igt_drm_fdinfo_filter_t)(const struct drm_client_fdinfo *info,
+					void *data);
+
+/*
+ * Called once for every matching DRM file descriptor found during a scan.
+ */
+typedef void (*igt_drm_fdinfo_client_t)(unsigned int pid, const char *name,
+					const struct drm_client_fdinfo *info,
+					void *data);
+
+struct igt_drm_fdinfo_scan_fd {
+	unsigned int fd;
+	dev_t rdev;
+	bool match;
+	bool seen;
+};
+
+struct igt_drm_fdinfo_scan_pid {
+	unsigned int pid;
+	char name[64];
+
+	int pid_dir;
+	int fd_dir;
+	DIR *fdinfo_dir;
+
+	unsigned int num_fds;
+	unsigned int alloc_fds;
+	struct igt_drm_fdinfo_scan_fd *fds;
+};
+
+struct igt_drm_fdinfo_scan {
+	char proc[4096];
+	unsigned int drm_major;
+
+	igt_drm_fdinfo_filter_t filter;
+	void *filter_data;
+
+	/* Full probe of every pid each full_interval scans, zero for always. */
+	unsigned int full_interval;
+	unsigned int scans;
+
+	/*
+	 * Clients whose directories (three descriptors each) are kept open
+	 * between scans, the others are reopened by pid on every scan. At most
+	 * IGT_DRM_FDINFO_SCAN_MAX_OPEN, using up to a quarter of RLIMIT_NOFILE.
+	 */
+	unsigned int max_open;
+	unsigned int num_open;
+
+	/* Sorted list of all pids seen in the last /proc listing. */
+	unsigned int num_seen;
+	unsigned int alloc_seen;
+	unsigned int *seen;
+
+	/* Processes known to hold at least one DRM file descriptor. */
+	unsigned int num_pids;
+	unsigned int alloc_pids;
+	struct igt_drm_fdinfo_scan_pid *pids;
+};
+
+/**
+ * igt_drm_fdinfo_scan_create: Creates an incremental DRM client scanner
+ *
+ * @proc: Root of the procfs tree to scan, NULL for "/proc".
+ * @filter: Callback selecting interesting clients, NULL to accept all.
+ * @data: Opaque pointer passed to @filter.
+ *
+ * Returns a new scanner or NULL on allocation failure.
+ */
+struct igt_drm_fdinfo_scan *
+igt_drm_fdinfo_scan_create(const char *proc, igt_drm_fdinfo_filter_t filter,
+			   void *data);
+
+/**
+ * igt_drm_fdinfo_scan: Finds DRM clients using cached /proc state
+ *
+ * @scan: Scanner created with igt_drm_fdinfo_scan_create().
+ * @fn: Callback invoked for every matching client.
+ * @data: Opaque pointer passed to @fn.
+ *
+ * Only processes already known to hold DRM file descriptors, plus pids which
+ * appeared since the previous scan, are inspected. Every full_interval scans
+ * all processes are probed again to pick up existing processes which have
+ * since opened a DRM device.
+ */
+void igt_drm_fdinfo_scan(struct igt_drm_fdinfo_scan *scan,
+			 igt_drm_fdinfo_client_t fn, void *data);
+
+/**
+ * igt_drm_fdinfo_scan_full: Finds DRM clients by probing every process
+ *
+ * @scan: Scanner created with igt_drm_fdinfo_scan_create().
+ * @fn: Callback invoked for every matching client.
+ * @data: Opaque pointer passed to @fn.
+ *
+ * Same as igt_drm_fdinfo_scan() but unconditionally probes every process and
+ * re-parses every DRM fdinfo file, discarding and rebuilding the cached state.
+ */
+void igt_drm_fdinfo_scan_full(struct igt_drm_fdinfo_scan *scan,
+			      igt_drm_fdinfo_client_t fn, void *data);
+
+/**
+ * igt_drm_fdinfo_scan_destroy: Frees the scanner and all cached state
+ *
+ * @scan: Scanner created with igt_drm_fdinfo_scan_create().
+ */
+void igt_drm_fdinfo_scan_destroy(struct igt_drm_fdinfo_scan *scan);
+
+#endif /* IGT_DRM_FDINFO_SCAN_H */
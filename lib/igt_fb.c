@@ -31,6 +31,8 @@
 #include <wchar.h>
 #include <inttypes.h>
 #include <pixman.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "drmtest.h"
 #include "i915/gem_create.h"
@@ -44,6 +46,7 @@
 #include "igt_vc4.h"
 #include "igt_amd.h"
 #include "igt_x86.h"
+#include "igt_yuv.h"
 #include "igt_nouveau.h"
 #include "ioctl_wrappers.h"
 #include "intel_batchbuffer.h"
@@ -1404,26 +1407,129 @@ static uint16_t update_crc16_dp(uint16_t crc_old, uint16_t d)
 	return crc_new;
 }
 
-/**
- * igt_fb_calc_crc:
- * @fb: pointer to an #igt_fb structure
- * @crc: pointer to an #igt_crc_t structure
- *
- * This function calculate the 16-bit frame CRC of RGB components over all
- * the active pixels.
+/*
+ * update_crc16_dp() is linear over GF(2) in both the crc and the data, and
+ * the data is a single 8 bit component once zero padded. So a step is the
+ * xor of lookups on each byte of the old crc and on the component, and
+ * running over n pixels from a given crc is the run from zero xored with
+ * the crc shifted by n steps.
  */
-void igt_fb_calc_crc(struct igt_fb *fb, igt_crc_t *crc)
+struct crc16_dp_tables {
+	uint16_t crc_lo[256];
+	uint16_t crc_hi[256];
+	uint16_t data[256];
+};
+
+static struct crc16_dp_tables crc16_dp;
+static pthread_once_t crc16_dp_once = PTHREAD_ONCE_INIT;
+
+static void crc16_dp_init(void)
 {
-	int x, y, i;
-	void *ptr;
-	uint8_t *data;
-	uint16_t din;
+	int i;
 
-	igt_assert(fb && crc);
+	for (i = 0; i < 256; i++) {
+		crc16_dp.crc_lo[i] = update_crc16_dp(i, 0);
+		crc16_dp.crc_hi[i] = update_crc16_dp(i << 8, 0);
+		crc16_dp.data[i] = update_crc16_dp(0, i << 8);
+	}
+}
+
+static inline uint16_t crc16_dp_step(uint16_t crc, uint8_t c)
+{
+	return crc16_dp.crc_lo[crc & 0xff] ^ crc16_dp.crc_hi[crc >> 8] ^
+	       crc16_dp.data[c];
+}
+
+/* Feeds a row of XRGB8888 pixels to the R, G and B crcs */
+static void crc16_dp_row(uint16_t crc[3], const uint8_t *row, int width)
+{
+	uint16_t r = crc[0], g = crc[1], b = crc[2];
+	int x;
+
+	for (x = 0; x < width; x++, row += 4) {
+		r = crc16_dp_step(r, row[2]);
+		g = crc16_dp_step(g, row[1]);
+		b = crc16_dp_step(b, row[0]);
+	}
+
+	crc[0] = r;
+	crc[1] = g;
+	crc[2] = b;
+}
+
+/* The crc update over @n pixels of zeroes, as lookups on each crc byte */
+struct crc16_dp_shift {
+	uint16_t lo[256];
+	uint16_t hi[256];
+};
+
+static void crc16_dp_shift_init(struct crc16_dp_shift *shift, int n)
+{
+	uint16_t col[16];
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		uint16_t v = 1 << i;
+
+		for (j = 0; j < n; j++)
+			v = crc16_dp.crc_lo[v & 0xff] ^ crc16_dp.crc_hi[v >> 8];
+
+		col[i] = v;
+	}
+
+	for (i = 0; i < 256; i++) {
+		shift->lo[i] = 0;
+		shift->hi[i] = 0;
+
+		for (j = 0; j < 8; j++) {
+			if (i & (1 << j)) {
+				shift->lo[i] ^= col[j];
+				shift->hi[i] ^= col[j + 8];
+			}
+		}
+	}
+}
+
+static void fb_crc_check_rect(struct igt_fb *fb, int x, int y,
+			      int width, int height)
+{
+	igt_assert_f(fb->drm_format == DRM_FORMAT_XRGB8888,
+		     "DRM Format Invalid");
+	igt_assert(x >= 0 && y >= 0 && width >= 0 && height >= 0);
+	igt_assert(x + width <= fb->width && y + height <= fb->height);
+}
+
+/* Runs each row of the rectangle from a zero crc into @rows */
+static void fb_crc_rows(struct igt_fb *fb, int x, int y,
+			int width, int height, uint16_t (*rows)[3])
+{
+	uint8_t *ptr, *data, *line;
+	int i;
+
+	pthread_once(&crc16_dp_once, crc16_dp_init);
 
 	ptr = igt_fb_map_buffer(fb->fd, fb);
 	igt_assert(ptr);
 
+	/* Uncached reads are slow, crc a cached copy of each row instead */
+	line = malloc(width * 4 + 1);
+	igt_assert(line);
+
+	data = ptr + fb->offsets[0] + x * 4;
+	for (i = 0; i < height; i++) {
+		igt_memcpy_from_wc(line, data + (y + i) * fb->strides[0],
+				   width * 4);
+
+		rows[i][0] = rows[i][1] = rows[i][2] = 0;
+		crc16_dp_row(rows[i], line, width);
+	}
+
+	free(line);
+	igt_fb_unmap_buffer(fb, ptr);
+}
+
+static void fb_crc_init(igt_crc_t *crc)
+{
 	/* set for later CRC comparison */
 	crc->has_valid_frame = true;
 	crc->frame = 0;
@@ -1431,33 +1537,171 @@ void igt_fb_calc_crc(struct igt_fb *fb, igt_crc_t *crc)
 	crc->crc[0] = 0;	/* R */
 	crc->crc[1] = 0;	/* G */
 	crc->crc[2] = 0;	/* B */
+}
 
-	data = ptr + fb->offsets[0];
-	for (y = 0; y < fb->height; ++y) {
-		for (x = 0; x < fb->width; ++x) {
-			switch (fb->drm_format) {
-			case DRM_FORMAT_XRGB8888:
-				i = x * 4 + y * fb->strides[0];
+/**
+ * igt_fb_calc_crc_rect:
+ * @fb: pointer to an #igt_fb structure
+ * @x: left edge of the rectangle
+ * @y: top edge of the rectangle
+ * @width: width of the rectangle
+ * @height: height of the rectangle
+ * @crc: pointer to an #igt_crc_t structure
+ *
+ * This function calculates the 16-bit CRC of RGB components over the
+ * pixels of the given rectangle of @fb, as igt_fb_calc_crc() does over the
+ * whole frame.
+ */
+void igt_fb_calc_crc_rect(struct igt_fb *fb, int x, int y,
+			  int width, int height, igt_crc_t *crc)
+{
+	struct crc16_dp_shift *shift;
+	uint16_t (*rows)[3];
+	uint16_t state[3] = {};
+	int i, c;
 
-				din = data[i + 2] << 8; /* padding-zeros */
-				crc->crc[0] = update_crc16_dp(crc->crc[0], din);
+	igt_assert(fb && crc);
+	fb_crc_check_rect(fb, x, y, width, height);
 
-				/* Green-component */
-				din = data[i + 1] << 8;
-				crc->crc[1] = update_crc16_dp(crc->crc[1], din);
+	fb_crc_init(crc);
+	if (!width || !height)
+		return;
 
-				/* Blue-component */
-				din = data[i] << 8;
-				crc->crc[2] = update_crc16_dp(crc->crc[2], din);
-				break;
-			default:
-				igt_assert_f(0, "DRM Format Invalid");
-				break;
-			}
-		}
-	}
+	rows = calloc(height, sizeof(*rows));
+	shift = malloc(sizeof(*shift));
+	igt_assert(rows && shift);
 
-	igt_fb_unmap_buffer(fb, ptr);
+	fb_crc_rows(fb, x, y, width, height, rows);
+
+	crc16_dp_shift_init(shift, width);
+	for (i = 0; i < height; i++)
+		for (c = 0; c < 3; c++)
+			state[c] = shift->lo[state[c] & 0xff] ^
+				   shift->hi[state[c] >> 8] ^ rows[i][c];
+
+	for (c = 0; c < 3; c++)
+		crc->crc[c] = state[c];
+
+	free(shift);
+	free(rows);
+}
+
+/**
+ * igt_fb_calc_crc:
+ * @fb: pointer to an #igt_fb structure
+ * @crc: pointer to an #igt_crc_t structure
+ *
+ * This function calculate the 16-bit frame CRC of RGB components over all
+ * the active pixels.
+ */
+void igt_fb_calc_crc(struct igt_fb *fb, igt_crc_t *crc)
+{
+	igt_fb_calc_crc_rect(fb, 0, 0, fb->width, fb->height, crc);
+}
+
+struct igt_fb_crc_rows {
+	int width;
+	int height;
+	struct crc16_dp_shift shift;
+	uint16_t (*rows)[3];
+};
+
+/**
+ * igt_fb_crc_rows_create:
+ * @fb: pointer to an #igt_fb structure
+ *
+ * Computes and keeps the contribution of each row of @fb to the frame CRC
+ * of igt_fb_calc_crc(). After drawing to only some rows of @fb, updating
+ * them with igt_fb_crc_rows_update() and calling igt_fb_crc_rows_get() is
+ * enough to get the new frame CRC.
+ *
+ * Returns:
+ * The row CRCs, to be freed with igt_fb_crc_rows_destroy().
+ */
+struct igt_fb_crc_rows *igt_fb_crc_rows_create(struct igt_fb *fb)
+{
+	struct igt_fb_crc_rows *rows;
+
+	igt_assert(fb);
+	fb_crc_check_rect(fb, 0, 0, fb->width, fb->height);
+
+	rows = calloc(1, sizeof(*rows));
+	igt_assert(rows);
+
+	rows->width = fb->width;
+	rows->height = fb->height;
+	rows->rows = calloc(fb->height ?: 1, sizeof(*rows->rows));
+	igt_assert(rows->rows);
+
+	pthread_once(&crc16_dp_once, crc16_dp_init);
+	crc16_dp_shift_init(&rows->shift, fb->width);
+
+	igt_fb_crc_rows_update(rows, fb, 0, fb->height);
+
+	return rows;
+}
+
+/**
+ * igt_fb_crc_rows_update:
+ * @rows: row CRCs from igt_fb_crc_rows_create()
+ * @fb: the #igt_fb @rows were created for
+ * @y: first changed row
+ * @height: number of changed rows
+ *
+ * Recomputes the CRCs of rows @y to @y + @height - 1 of @fb.
+ */
+void igt_fb_crc_rows_update(struct igt_fb_crc_rows *rows, struct igt_fb *fb,
+			    int y, int height)
+{
+	igt_assert(rows && fb);
+	igt_assert(fb->width == rows->width && fb->height == rows->height);
+	fb_crc_check_rect(fb, 0, y, fb->width, height);
+
+	if (!fb->width || !height)
+		return;
+
+	fb_crc_rows(fb, 0, y, fb->width, height, rows->rows + y);
+}
+
+/**
+ * igt_fb_crc_rows_get:
+ * @rows: row CRCs from igt_fb_crc_rows_create()
+ * @crc: pointer to an #igt_crc_t structure
+ *
+ * Combines the row CRCs into the frame CRC igt_fb_calc_crc() would return.
+ */
+void igt_fb_crc_rows_get(const struct igt_fb_crc_rows *rows, igt_crc_t *crc)
+{
+	uint16_t state[3] = {};
+	int i, c;
+
+	igt_assert(rows && crc);
+
+	fb_crc_init(crc);
+	if (!rows->width)
+		return;
+
+	for (i = 0; i < rows->height; i++)
+		for (c = 0; c < 3; c++)
+			state[c] = rows->shift.lo[state[c] & 0xff] ^
+				   rows->shift.hi[state[c] >> 8] ^
+				   rows->rows[i][c];
+
+	for (c = 0; c < 3; c++)
+		crc->crc[c] = state[c];
+}
+
+/**
+ * igt_fb_crc_rows_destroy:
+ * @rows: row CRCs from igt_fb_crc_rows_create()
+ */
+void igt_fb_crc_rows_destroy(struct igt_fb_crc_rows *rows)
+{
+	if (!rows)
+		return;
+
+	free(rows->rows);
+	free(rows);
 }
 
 /**
@@ -3018,26 +3262,6 @@ static void igt_fb_destroy_cairo_shadow_buffer(struct igt_fb *shadow,
 	munmap(ptr, shadow->size);
 }
 
-static uint8_t clamprgb(float val)
-{
-	return clamp((int)(val + 0.5f), 0, 255);
-}
-
-static void read_rgb(struct igt_vec4 *rgb, const uint8_t *rgb24)
-{
-	rgb->d[0] = rgb24[2];
-	rgb->d[1] = rgb24[1];
-	rgb->d[2] = rgb24[0];
-	rgb->d[3] = 1.0f;
-}
-
-static void write_rgb(uint8_t *rgb24, const struct igt_vec4 *rgb)
-{
-	rgb24[2] = clamprgb(rgb->d[0]);
-	rgb24[1] = clamprgb(rgb->d[1]);
-	rgb24[0] = clamprgb(rgb->d[2]);
-}
-
 struct fb_convert_buf {
 	void			*ptr;
 	struct igt_fb		*fb;
@@ -3049,6 +3273,91 @@ struct fb_convert {
 	struct fb_convert_buf	src;
 };
 
+/*
+ * Scratch buffers used during a conversion are kept per thread and grow
+ * as needed, so that back to back conversions, and the row bands of a
+ * single conversion, don't go through malloc each time. Buffers larger
+ * than CONVERT_SCRATCH_KEEP, which a band never needs, are given back as
+ * soon as the conversion using them is done.
+ */
+#define CONVERT_SCRATCH_KEEP	(2 << 20)
+
+enum convert_scratch_id {
+	SCRATCH_SRC,
+	SCRATCH_ROW,
+	NUM_SCRATCH,
+};
+
+struct convert_arena {
+	void *ptr[NUM_SCRATCH];
+	size_t size[NUM_SCRATCH];
+};
+
+static pthread_key_t convert_arena_key;
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static void convert_arena_free(void *data)
+{
+	struct convert_arena *arena = data;
+	int i;
+
+	for (i = 0; i < NUM_SCRATCH; i++)
+		free(arena->ptr[i]);
+	free(arena);
+}
+
+static void convert_pool_atfork_child(void);
+
+static void convert_init(void)
+{
+	igt_assert(!pthread_key_create(&convert_arena_key, convert_arena_free));
+	pthread_atfork(NULL, NULL, convert_pool_atfork_child);
+}
+
+static void *convert_scratch(enum convert_scratch_id id, size_t size)
+{
+	struct convert_arena *arena;
+
+	pthread_once(&convert_once, convert_init);
+
+	arena = pthread_getspecific(convert_arena_key);
+	if (!arena) {
+		arena = calloc(1, sizeof(*arena));
+		if (!arena)
+			return NULL;
+		pthread_setspecific(convert_arena_key, arena);
+	}
+
+	if (arena->size[id] < size) {
+		free(arena->ptr[id]);
+		arena->ptr[id] = malloc(size);
+		arena->size[id] = arena->ptr[id] ? size : 0;
+	}
+
+	return arena->ptr[id];
+}
+
+static void convert_scratch_trim(void)
+{
+	struct convert_arena *arena;
+	int i;
+
+	pthread_once(&convert_once, convert_init);
+
+	arena = pthread_getspecific(convert_arena_key);
+	if (!arena)
+		return;
+
+	for (i = 0; i < NUM_SCRATCH; i++) {
+		if (arena->size[i] <= CONVERT_SCRATCH_KEEP)
+			continue;
+
+		free(arena->ptr[i]);
+		arena->ptr[i] = NULL;
+		arena->size[i] = 0;
+	}
+}
+
 static void *convert_src_get(const struct fb_convert *cvt)
 {
 	void *buf;
@@ -3061,7 +3370,7 @@ static void *convert_src_get(const struct fb_convert *cvt)
 	 * it's faster to copy the whole BO to a temporary buffer and convert
 	 * from there.
 	 */
-	buf = malloc(cvt->src.fb->size);
+	buf = convert_scratch(SCRATCH_SRC, cvt->src.fb->size);
 	if (!buf)
 		return cvt->src.ptr;
 
@@ -3073,8 +3382,8 @@ static void *convert_src_get(const struct fb_convert *cvt)
 static void convert_src_put(const struct fb_convert *cvt,
 			    void *src_buf)
 {
-	if (src_buf != cvt->src.ptr)
-		free(src_buf);
+	/* A copy of band size stays in the arena for the next conversion */
+	convert_scratch_trim();
 }
 
 struct yuv_parameters {
@@ -3257,21 +3566,29 @@ static void convert_yuv_to_rgb24(struct fb_convert *cvt)
 {
 	const struct format_desc_struct *src_fmt =
 		lookup_drm_format(cvt->src.fb->drm_format);
+	int hsub = src_fmt->hsub;
 	int i, j;
-	uint8_t bpp = 4;
 	uint8_t *y, *u, *v;
 	uint8_t *rgb24 = cvt->dst.ptr;
 	unsigned int rgb24_stride = cvt->dst.fb->strides[0];
+	int width = cvt->dst.fb->width;
 	struct igt_mat4 m = igt_ycbcr_to_rgb_matrix(cvt->src.fb->drm_format,
 						    cvt->dst.fb->drm_format,
 						    cvt->src.fb->color_encoding,
 						    cvt->src.fb->color_range);
-	uint8_t *buf;
+	struct igt_yuv_coeffs coeffs;
+	uint8_t *buf, *row;
 	struct yuv_parameters params = { };
 
 	igt_assert(cvt->dst.fb->drm_format == DRM_FORMAT_XRGB8888 &&
 		   igt_format_is_yuv(cvt->src.fb->drm_format));
 
+	igt_yuv_coeffs_init(&coeffs, &m);
+
+	/* Y, U and V of a row gathered into one sample per pixel each */
+	row = convert_scratch(SCRATCH_ROW, 3 * width);
+	igt_assert(row);
+
 	buf = convert_src_get(cvt);
 	get_yuv_parameters(cvt->src.fb, &params);
 	y = buf + params.y_offset;
@@ -3282,28 +3599,31 @@ static void convert_yuv_to_rgb24(struct fb_convert *cvt)
 		const uint8_t *y_tmp = y;
 		const uint8_t *u_tmp = u;
 		const uint8_t *v_tmp = v;
-		uint8_t *rgb_tmp = rgb24;
-
-		for (j = 0; j < cvt->dst.fb->width; j++) {
-			struct igt_vec4 rgb, yuv;
+		uint8_t *y_row = row;
+		uint8_t *u_row = row + width;
+		uint8_t *v_row = row + 2 * width;
 
-			yuv.d[0] = *y_tmp;
-			yuv.d[1] = *u_tmp;
-			yuv.d[2] = *v_tmp;
-			yuv.d[3] = 1.0f;
-
-			rgb = igt_matrix_transform(&m, &yuv);
-			write_rgb(rgb_tmp, &rgb);
-
-			rgb_tmp += bpp;
+		for (j = 0; j < width; j++) {
+			y_row[j] = *y_tmp;
 			y_tmp += params.ay_inc;
+		}
+
+		/* Replicate each chroma sample across its hsub pixels */
+		for (j = 0; j < width; j += hsub) {
+			int k, n = min(hsub, width - j);
 
-			if ((src_fmt->hsub == 1) || (j % src_fmt->hsub)) {
-				u_tmp += params.uv_inc;
-				v_tmp += params.uv_inc;
+			for (k = 0; k < n; k++) {
+				u_row[j + k] = *u_tmp;
+				v_row[j + k] = *v_tmp;
 			}
+
+			u_tmp += params.uv_inc;
+			v_tmp += params.uv_inc;
 		}
 
+		igt_yuv_to_rgb_row(&coeffs, y_row, u_row, v_row,
+				   (uint32_t *)rgb24, width);
+
 		rgb24 += rgb24_stride;
 		y += params.ay_stride;
 
@@ -3316,6 +3636,12 @@ static void convert_yuv_to_rgb24(struct fb_convert *cvt)
 	convert_src_put(cvt, buf);
 }
 
+struct yuv_row {
+	uint8_t *y;
+	float *u;
+	float *v;
+};
+
 static void convert_rgb24_to_yuv(struct fb_convert *cvt)
 {
 	const struct format_desc_struct *dst_fmt =
@@ -3323,75 +3649,90 @@ static void convert_rgb24_to_yuv(struct fb_convert *cvt)
 	int i, j;
 	uint8_t *y, *u, *v;
 	const uint8_t *rgb24 = cvt->src.ptr;
-	uint8_t bpp = 4;
 	unsigned rgb24_stride = cvt->src.fb->strides[0];
+	int width = cvt->dst.fb->width;
 	struct igt_mat4 m = igt_rgb_to_ycbcr_matrix(cvt->src.fb->drm_format,
 						    cvt->dst.fb->drm_format,
 						    cvt->dst.fb->color_encoding,
 						    cvt->dst.fb->color_range);
+	struct igt_yuv_coeffs coeffs;
 	struct yuv_parameters params = { };
+	struct yuv_row rows[2];
+	uint8_t *row_buf;
 
 	igt_assert(cvt->src.fb->drm_format == DRM_FORMAT_XRGB8888 &&
 		   igt_format_is_yuv(cvt->dst.fb->drm_format));
 
+	igt_yuv_coeffs_init(&coeffs, &m);
+
+	/* The current row and the one holding the vertical chroma pair */
+	row_buf = convert_scratch(SCRATCH_ROW, 2 * 9 * width);
+	igt_assert(row_buf);
+	for (i = 0; i < 2; i++) {
+		rows[i].u = (float *)row_buf + 2 * i * width;
+		rows[i].v = rows[i].u + width;
+		rows[i].y = row_buf + 16 * width + i * width;
+	}
+
 	get_yuv_parameters(cvt->dst.fb, &params);
 	y = cvt->dst.ptr + params.y_offset;
 	u = cvt->dst.ptr + params.u_offset;
 	v = cvt->dst.ptr + params.v_offset;
 
 	for (i = 0; i < cvt->dst.fb->height; i++) {
-		const uint8_t *rgb_tmp = rgb24;
+		const struct yuv_row *pair = &rows[0];
 		uint8_t *y_tmp = y;
 		uint8_t *u_tmp = u;
 		uint8_t *v_tmp = v;
 
-		for (j = 0; j < cvt->dst.fb->width; j++) {
-			const uint8_t *pair_rgb24 = rgb_tmp;
-			struct igt_vec4 pair_rgb, rgb;
-			struct igt_vec4 pair_yuv, yuv;
-
-			read_rgb(&rgb, rgb_tmp);
-			yuv = igt_matrix_transform(&m, &rgb);
-
-			rgb_tmp += bpp;
+		igt_rgb_to_yuv_row(&coeffs, (const uint32_t *)rgb24,
+				   rows[0].y, rows[0].u, rows[0].v, width);
 
-			*y_tmp = yuv.d[0];
+		for (j = 0; j < width; j++) {
+			*y_tmp = rows[0].y[j];
 			y_tmp += params.ay_inc;
+		}
 
-			if ((i % dst_fmt->vsub) || (j % dst_fmt->hsub))
-				continue;
+		if (i % dst_fmt->vsub)
+			goto next;
 
-			/*
-			 * We assume the MPEG2 chroma siting convention, where
-			 * pixel center for Cb'Cr' is between the left top and
-			 * bottom pixel in a 2x2 block, so take the average.
-			 *
-			 * Therefore, if we use subsampling, we only really care
-			 * about two pixels all the time, either the two
-			 * subsequent pixels horizontally, vertically, or the
-			 * two corners in a 2x2 block.
-			 *
-			 * The only corner case is when we have an odd number of
-			 * pixels, but this can be handled pretty easily by not
-			 * incrementing the paired pixel pointer in the
-			 * direction it's odd in.
-			 */
-			if (j != (cvt->dst.fb->width - 1))
-				pair_rgb24 += (dst_fmt->hsub - 1) * bpp;
+		/*
+		 * We assume the MPEG2 chroma siting convention, where
+		 * pixel center for Cb'Cr' is between the left top and
+		 * bottom pixel in a 2x2 block, so take the average.
+		 *
+		 * Therefore, if we use subsampling, we only really care
+		 * about two pixels all the time, either the two
+		 * subsequent pixels horizontally, vertically, or the
+		 * two corners in a 2x2 block.
+		 *
+		 * The only corner case is when we have an odd number of
+		 * pixels, but this can be handled pretty easily by not
+		 * incrementing the paired pixel pointer in the
+		 * direction it's odd in.
+		 */
+		if (dst_fmt->vsub > 1 && i != (cvt->dst.fb->height - 1)) {
+			pair = &rows[1];
+			igt_rgb_to_yuv_row(&coeffs,
+					   (const uint32_t *)(rgb24 + rgb24_stride * (dst_fmt->vsub - 1)),
+					   rows[1].y, rows[1].u, rows[1].v,
+					   width);
+		}
 
-			if (i != (cvt->dst.fb->height - 1))
-				pair_rgb24 += rgb24_stride * (dst_fmt->vsub - 1);
+		for (j = 0; j < width; j += dst_fmt->hsub) {
+			int k = j;
 
-			read_rgb(&pair_rgb, pair_rgb24);
-			pair_yuv = igt_matrix_transform(&m, &pair_rgb);
+			if (j != (width - 1))
+				k += dst_fmt->hsub - 1;
 
-			*u_tmp = (yuv.d[1] + pair_yuv.d[1]) / 2.0f;
-			*v_tmp = (yuv.d[2] + pair_yuv.d[2]) / 2.0f;
+			*u_tmp = (rows[0].u[j] + pair->u[k]) / 2.0f;
+			*v_tmp = (rows[0].v[j] + pair->v[k]) / 2.0f;
 
 			u_tmp += params.uv_inc;
 			v_tmp += params.uv_inc;
 		}
 
+next:
 		rgb24 += rgb24_stride;
 		y += params.ay_stride;
 
@@ -3421,6 +3762,8 @@ static void convert_yuv16_to_float(struct fb_convert *cvt, bool alpha)
 {
 	const struct format_desc_struct *src_fmt =
 		lookup_drm_format(cvt->src.fb->drm_format);
+	int hsub = src_fmt->hsub;
+	int width = cvt->dst.fb->width;
 	int i, j;
 	uint8_t fpp = alpha ? 4 : 3;
 	uint16_t *a, *y, *u, *v;
@@ -3454,29 +3797,32 @@ static void convert_yuv16_to_float(struct fb_convert *cvt, bool alpha)
 		const uint16_t *v_tmp = v;
 		float *rgb_tmp = ptr;
 
-		for (j = 0; j < cvt->dst.fb->width; j++) {
-			struct igt_vec4 rgb, yuv;
+		for (j = 0; j < width; j += hsub) {
+			int k, n = min(hsub, width - j);
 
-			yuv.d[0] = *y_tmp;
-			yuv.d[1] = *u_tmp;
-			yuv.d[2] = *v_tmp;
-			yuv.d[3] = 1.0f;
+			/* Every pixel of the group shares one chroma sample */
+			for (k = 0; k < n; k++) {
+				struct igt_vec4 rgb, yuv;
 
-			rgb = igt_matrix_transform(&m, &yuv);
-			write_rgbf(rgb_tmp, &rgb);
+				yuv.d[0] = *y_tmp;
+				yuv.d[1] = *u_tmp;
+				yuv.d[2] = *v_tmp;
+				yuv.d[3] = 1.0f;
 
-			if (alpha) {
-				rgb_tmp[3] = ((float)*a_tmp) / 65535.f;
-				a_tmp += params.ay_inc;
-			}
+				rgb = igt_matrix_transform(&m, &yuv);
+				write_rgbf(rgb_tmp, &rgb);
 
-			rgb_tmp += fpp;
-			y_tmp += params.ay_inc;
+				if (alpha) {
+					rgb_tmp[3] = ((float)*a_tmp) / 65535.f;
+					a_tmp += params.ay_inc;
+				}
 
-			if ((src_fmt->hsub == 1) || (j % src_fmt->hsub)) {
-				u_tmp += params.uv_inc;
-				v_tmp += params.uv_inc;
+				rgb_tmp += fpp;
+				y_tmp += params.ay_inc;
 			}
+
+			u_tmp += params.uv_inc;
+			v_tmp += params.uv_inc;
 		}
 
 		ptr += float_stride;
@@ -3911,7 +4257,7 @@ static void convert_pixman(struct fb_convert *cvt)
 	convert_src_put(cvt, src_ptr);
 }
 
-static void fb_convert(struct fb_convert *cvt)
+static void __fb_convert(struct fb_convert *cvt)
 {
 	if ((drm_format_to_pixman(cvt->src.fb->drm_format) != PIXMAN_invalid) &&
 	    (drm_format_to_pixman(cvt->dst.fb->drm_format) != PIXMAN_invalid)) {
@@ -4032,6 +4378,290 @@ static void fb_convert(struct fb_convert *cvt)
 		     IGT_FORMAT_ARGS(cvt->dst.fb->drm_format));
 }
 
+/*
+ * Large framebuffers are converted in bands of rows, spread over a pool of
+ * worker threads and the calling thread. With slow reads each band is first
+ * copied into the converting thread's arena, so the WC read of a band by
+ * one thread overlaps with the conversion of the previous band by another,
+ * and the band is still in the cache when converted.
+ */
+#define FB_CONVERT_MAX_THREADS	16
+#define FB_CONVERT_BAND_SIZE	(512 << 10)
+
+struct fb_convert_job {
+	const struct fb_convert *cvt;
+	unsigned int band_rows;
+	unsigned int num_bands;
+	unsigned int next;
+};
+
+static struct {
+	pthread_mutex_t busy;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	bool started;
+	unsigned int num_threads;
+	unsigned int active;
+	unsigned long seqno;
+	struct fb_convert_job *job;
+} convert_pool = {
+	.busy = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+static void convert_pool_atfork_child(void)
+{
+	/* Only the forking thread survives, start over with a fresh pool */
+	pthread_mutex_init(&convert_pool.busy, NULL);
+	pthread_mutex_init(&convert_pool.lock, NULL);
+	pthread_cond_init(&convert_pool.wake, NULL);
+	pthread_cond_init(&convert_pool.idle, NULL);
+	convert_pool.started = false;
+	convert_pool.num_threads = 0;
+	convert_pool.active = 0;
+	convert_pool.job = NULL;
+}
+
+static unsigned int fb_plane_vsub(const struct igt_fb *fb, int plane)
+{
+	const struct format_desc_struct *f = lookup_drm_format(fb->drm_format);
+
+	return plane && f ? f->vsub : 1;
+}
+
+static void fb_band_resize(struct igt_fb *fb, unsigned int height)
+{
+	int i;
+
+	fb->height = height;
+	for (i = 0; i < fb->num_planes; i++)
+		fb->plane_height[i] = DIV_ROUND_UP(height, fb_plane_vsub(fb, i));
+}
+
+/*
+ * Turns @fb into a view of the rows [y, y + height) of the framebuffer
+ * mapped at @ptr, returning the pointer to convert from. Some of the
+ * single plane converters don't look at offsets[0], so those get the
+ * pointer moved instead.
+ */
+static void *fb_band_view(struct igt_fb *fb, void *ptr,
+			  unsigned int y, unsigned int height)
+{
+	int i;
+
+	if (fb->num_planes == 1) {
+		ptr = (uint8_t *)ptr + (uint64_t)y * fb->strides[0];
+	} else {
+		for (i = 0; i < fb->num_planes; i++)
+			fb->offsets[i] += (uint64_t)(y / fb_plane_vsub(fb, i)) *
+					  fb->strides[i];
+	}
+
+	fb_band_resize(fb, height);
+
+	return ptr;
+}
+
+/* Like fb_band_view(), reading the band out of WC memory into the arena */
+static void *fb_band_copy(struct igt_fb *fb, void *ptr,
+			  unsigned int y, unsigned int height)
+{
+	uint64_t offset = 0, size;
+	uint8_t *buf;
+	int i;
+
+	if (fb->num_planes == 1) {
+		offset = (uint64_t)y * fb->strides[0];
+		size = fb->offsets[0] + (uint64_t)height * fb->strides[0];
+		size = min(size, fb->size - offset);
+	} else {
+		size = 0;
+		for (i = 0; i < fb->num_planes; i++)
+			size += (uint64_t)DIV_ROUND_UP(height, fb_plane_vsub(fb, i)) *
+				fb->strides[i];
+	}
+
+	buf = convert_scratch(SCRATCH_SRC, size);
+	if (!buf)
+		return fb_band_view(fb, ptr, y, height);
+
+	if (fb->num_planes == 1) {
+		igt_memcpy_from_wc(buf, (uint8_t *)ptr + offset, size);
+	} else {
+		for (i = 0; i < fb->num_planes; i++) {
+			unsigned int vsub = fb_plane_vsub(fb, i);
+			uint64_t len = (uint64_t)DIV_ROUND_UP(height, vsub) *
+				       fb->strides[i];
+
+			igt_memcpy_from_wc(buf + offset,
+					   (uint8_t *)ptr + fb->offsets[i] +
+					   (uint64_t)(y / vsub) * fb->strides[i],
+					   len);
+			fb->offsets[i] = offset;
+			offset += len;
+		}
+	}
+
+	fb->size = size;
+	fb_band_resize(fb, height);
+
+	return buf;
+}
+
+static void fb_convert_band(const struct fb_convert_job *job,
+			    unsigned int band)
+{
+	const struct fb_convert *cvt = job->cvt;
+	struct igt_fb src = *cvt->src.fb, dst = *cvt->dst.fb;
+	unsigned int y = band * job->band_rows;
+	unsigned int height = min_t(unsigned int, job->band_rows, dst.height - y);
+	struct fb_convert band_cvt = {
+		.dst	= {
+			.fb	= &dst,
+		},
+
+		.src	= {
+			.fb	= &src,
+		},
+	};
+
+	band_cvt.dst.ptr = fb_band_view(&dst, cvt->dst.ptr, y, height);
+	if (cvt->src.slow_reads)
+		band_cvt.src.ptr = fb_band_copy(&src, cvt->src.ptr, y, height);
+	else
+		band_cvt.src.ptr = fb_band_view(&src, cvt->src.ptr, y, height);
+
+	__fb_convert(&band_cvt);
+}
+
+static void fb_convert_job_run(struct fb_convert_job *job)
+{
+	unsigned int band;
+
+	while ((band = __atomic_fetch_add(&job->next, 1,
+					  __ATOMIC_RELAXED)) < job->num_bands)
+		fb_convert_band(job, band);
+}
+
+static void *convert_worker(void *arg)
+{
+	unsigned long seqno = (unsigned long)arg;
+
+	pthread_mutex_lock(&convert_pool.lock);
+	for (;;) {
+		struct fb_convert_job *job;
+
+		while (convert_pool.seqno == seqno)
+			pthread_cond_wait(&convert_pool.wake, &convert_pool.lock);
+
+		seqno = convert_pool.seqno;
+		job = convert_pool.job;
+		pthread_mutex_unlock(&convert_pool.lock);
+
+		fb_convert_job_run(job);
+
+		pthread_mutex_lock(&convert_pool.lock);
+		if (!--convert_pool.active)
+			pthread_cond_signal(&convert_pool.idle);
+	}
+
+	return NULL;
+}
+
+/* Called with the pool busy lock held, so no job is in flight */
+static void convert_pool_start(void)
+{
+	unsigned long seqno = convert_pool.seqno;
+	sigset_t all, old;
+	long cpus;
+
+	if (convert_pool.started)
+		return;
+
+	/* Registers the reset of the pool in forked children */
+	pthread_once(&convert_once, convert_init);
+
+	convert_pool.started = true;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpus = min_t(long, cpus, FB_CONVERT_MAX_THREADS);
+
+	/* Leave signal handling to the test's own threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	while (convert_pool.num_threads < cpus - 1) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, convert_worker,
+				   (void *)seqno))
+			break;
+
+		pthread_detach(thread);
+		convert_pool.num_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	igt_debug("fb conversion using %u worker threads\n",
+		  convert_pool.num_threads);
+}
+
+static void fb_convert(struct fb_convert *cvt)
+{
+	unsigned int height = cvt->dst.fb->height;
+	struct fb_convert_job job = { .cvt = cvt };
+	uint64_t row_size;
+
+	/* Even bands keep vertically subsampled chroma rows within a band */
+	row_size = max_t(uint64_t,
+			 cvt->src.fb->strides[0] + cvt->dst.fb->strides[0], 1);
+	job.band_rows = ALIGN(max_t(uint64_t, FB_CONVERT_BAND_SIZE / row_size, 2), 2);
+	job.num_bands = DIV_ROUND_UP(height, job.band_rows);
+
+	if (job.num_bands <= 1) {
+		__fb_convert(cvt);
+		return;
+	}
+
+	/*
+	 * The first band is converted by the caller before involving the
+	 * pool, so that unsupported conversions fail in the test's thread.
+	 */
+	fb_convert_band(&job, 0);
+	job.next = 1;
+
+	if (pthread_mutex_trylock(&convert_pool.busy)) {
+		/* Nested or concurrent conversion, do it in this thread */
+		fb_convert_job_run(&job);
+		return;
+	}
+
+	convert_pool_start();
+
+	if (convert_pool.num_threads) {
+		pthread_mutex_lock(&convert_pool.lock);
+		convert_pool.job = &job;
+		convert_pool.active = convert_pool.num_threads;
+		convert_pool.seqno++;
+		pthread_cond_broadcast(&convert_pool.wake);
+		pthread_mutex_unlock(&convert_pool.lock);
+	}
+
+	fb_convert_job_run(&job);
+
+	pthread_mutex_lock(&convert_pool.lock);
+	while (convert_pool.active)
+		pthread_cond_wait(&convert_pool.idle, &convert_pool.lock);
+	convert_pool.job = NULL;
+	pthread_mutex_unlock(&convert_pool.lock);
+
+	pthread_mutex_unlock(&convert_pool.busy);
+}
+
 static void destroy_cairo_surface__convert(void *arg)
 {
 	struct fb_convert_blit_upload *blit = arg;
@@ -4434,15 +5064,38 @@ bool igt_fb_supported_format(uint32_t drm_format)
  * 32 bit FNV_prime = 224 + 28 + 0x93 = 16777619
  */
 int igt_fb_get_fnv1a_crc(struct igt_fb *fb, igt_crc_t *crc)
+{
+	return igt_fb_get_fnv1a_crc_rect(fb, 0, 0, fb->width, fb->height, crc);
+}
+
+/**
+ * igt_fb_get_fnv1a_crc_rect:
+ * @fb: pointer to an #igt_fb structure
+ * @x: left edge of the rectangle
+ * @y: top edge of the rectangle
+ * @width: width of the rectangle
+ * @height: height of the rectangle
+ * @crc: pointer to an #igt_crc_t structure
+ *
+ * Hashes the given rectangle of @fb with FNV-1a, as igt_fb_get_fnv1a_crc()
+ * does over the whole frame.
+ *
+ * Returns:
+ * 0 on success, a negative error code if @fb can't be hashed.
+ */
+int igt_fb_get_fnv1a_crc_rect(struct igt_fb *fb, int x, int y,
+			      int width, int height, igt_crc_t *crc)
 {
 	const uint32_t FNV1a_OFFSET_BIAS = 2166136261;
 	const uint32_t FNV1a_PRIME = 16777619;
-	uint32_t *line = NULL;
+	/* The masked off X byte is always 0, leaving only the multiply */
+	const uint32_t FNV1a_PRIME2 = FNV1a_PRIME * FNV1a_PRIME;
+	uint8_t *line = NULL;
 	uint32_t hash;
 	void *map;
 	char *ptr;
-	int x, y, cpp = igt_drm_format_to_bpp(fb->drm_format) / 8;
-	uint32_t stride = calc_plane_stride(fb, 0);
+	int i, j, cpp = igt_drm_format_to_bpp(fb->drm_format) / 8;
+	uint32_t stride = fb->strides[0];
 
 	if (fb->num_planes != 1)
 		return -EINVAL;
@@ -4450,6 +5103,10 @@ int igt_fb_get_fnv1a_crc(struct igt_fb *fb, igt_crc_t *crc)
 	if (fb->drm_format != DRM_FORMAT_XRGB8888)
 		return -EINVAL;
 
+	if (x < 0 || y < 0 || width < 0 || height < 0 ||
+	    x + width > fb->width || y + height > fb->height)
+		return -EINVAL;
+
 	ptr = igt_fb_map_buffer(fb->fd, fb);
 	igt_assert(ptr);
 	map = ptr;
@@ -4459,29 +5116,25 @@ int igt_fb_get_fnv1a_crc(struct igt_fb *fb, igt_crc_t *crc)
 	 * very slow. We copy each line of the FB into a local buffer to speed
 	 * up the hashing.
 	 */
-	line = malloc(stride);
+	line = malloc(width * cpp + 1);
 	if (!line) {
-		munmap(map, fb->size);
+		igt_fb_unmap_buffer(fb, map);
 		return -ENOMEM;
 	}
 
 	hash = FNV1a_OFFSET_BIAS;
 
-	for (y = 0; y < fb->height; y++, ptr += stride) {
-
-		igt_memcpy_from_wc(line, ptr, fb->width * cpp);
+	ptr += fb->offsets[0] + (uint64_t)y * stride + x * cpp;
+	for (i = 0; i < height; i++, ptr += stride) {
+		const uint8_t *pixel = line;
 
-		for (x = 0; x < fb->width; x++) {
-			unsigned int i;
-			uint32_t pixel = le32_to_cpu(line[x]);
-			pixel &= 0x00ffffff;
+		igt_memcpy_from_wc(line, ptr, width * cpp);
 
-			for (i = 0; i < sizeof(pixel); i++) {
-				uint8_t component = (pixel >> (i * 8)) & 0xff;
-
-				hash ^= component;
-				hash *= FNV1a_PRIME;
-			}
+		/* Little endian XRGB, so B, G, R and X in memory order */
+		for (j = 0; j < width; j++, pixel += 4) {
+			hash = (hash ^ pixel[0]) * FNV1a_PRIME;
+			hash = (hash ^ pixel[1]) * FNV1a_PRIME;
+			hash = (hash ^ pixel[2]) * FNV1a_PRIME2;
 		}
 	}
 
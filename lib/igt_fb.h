@@ -177,6 +177,15 @@ int igt_create_bo_with_dimensions(int fd, int width, int height, uint32_t format
 				  uint64_t *size_ret, unsigned *stride_ret,
 				  bool *is_dumb);
 void igt_fb_calc_crc(struct igt_fb *fb, igt_crc_t *crc);
+void igt_fb_calc_crc_rect(struct igt_fb *fb, int x, int y,
+			  int width, int height, igt_crc_t *crc);
+
+struct igt_fb_crc_rows;
+struct igt_fb_crc_rows *igt_fb_crc_rows_create(struct igt_fb *fb);
+void igt_fb_crc_rows_update(struct igt_fb_crc_rows *rows, struct igt_fb *fb,
+			    int y, int height);
+void igt_fb_crc_rows_get(const struct igt_fb_crc_rows *rows, igt_crc_t *crc);
+void igt_fb_crc_rows_destroy(struct igt_fb_crc_rows *rows);
 
 uint64_t igt_fb_mod_to_tiling(uint64_t modifier);
 uint64_t igt_fb_tiling_to_mod(uint64_t tiling);
@@ -225,6 +234,8 @@ int igt_fill_cts_color_square_framebuffer(uint32_t *pixmap,
 		uint32_t bitdepth, int alpha);
 
 int igt_fb_get_fnv1a_crc(struct igt_fb *fb, igt_crc_t *crc);
+int igt_fb_get_fnv1a_crc_rect(struct igt_fb *fb, int x, int y,
+			      int width, int height, igt_crc_t *crc);
 const char *igt_fb_modifier_name(uint64_t modifier);
 
 #endif /* __IGT_FB_H__ */
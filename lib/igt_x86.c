@@ -68,6 +68,10 @@
 #define bit_SSE3	(1 << 0)
 #endif
 
+#ifndef bit_PCLMUL
+#define bit_PCLMUL	(1 << 1)
+#endif
+
 #ifndef bit_SSSE3
 #define bit_SSSE3	(1 << 9)
 #endif
@@ -115,6 +119,9 @@ unsigned igt_x86_features(void)
 		if (ecx & bit_SSE3)
 			features |= SSE3;
 
+		if (ecx & bit_PCLMUL)
+			features |= PCLMUL;
+
 		if (ecx & bit_SSSE3)
 			features |= SSSE3;
 
@@ -183,6 +190,8 @@ char *igt_x86_features_to_string(unsigned features, char *line)
 		line += sprintf(line, ", avx2");
 	if (features & F16C)
 		line += sprintf(line, ", f16c");
+	if (features & PCLMUL)
+		line += sprintf(line, ", pclmul");
 
 	(void)line;
 
@@ -40,6 +40,7 @@
 #define AVX	0x80
 #define AVX2	0x100
 #define F16C	0x200
+#define PCLMUL	0x400
 
 #if defined(__x86_64__) || defined(__i386__)
 unsigned igt_x86_features(void);
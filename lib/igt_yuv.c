@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include "igt_x86.h"
+#include "igt_yuv.h"
+
+/*
+ * All variants evaluate the single precision expressions of
+ * igt_matrix_transform(), term by term in the same order, and round or
+ * truncate the results like the float conversions in igt_fb did. Their
+ * output is thus bit-identical to the scalar reference below and to the
+ * float path.
+ */
+
+/**
+ * igt_yuv_coeffs_init:
+ * @c: Coefficients to fill
+ * @m: Conversion matrix
+ *
+ * Extracts the upper 3x4 part of @m for the row kernels.
+ */
+void igt_yuv_coeffs_init(struct igt_yuv_coeffs *c, const struct igt_mat4 *m)
+{
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++)
+			c->m[i][j] = m->d[m(i, j)];
+
+		c->ofs[i] = m->d[m(i, 3)];
+	}
+}
+
+static inline int32_t clamp_i32(int32_t val, int32_t lo, int32_t hi)
+{
+	return val < lo ? lo : val > hi ? hi : val;
+}
+
+static inline float dot(const struct igt_yuv_coeffs *c, int i,
+			float a, float b, float d)
+{
+	return c->m[i][0] * a + c->m[i][1] * b + c->m[i][2] * d + c->ofs[i];
+}
+
+static inline uint32_t yuv_to_rgb_pixel(const struct igt_yuv_coeffs *c,
+					float y, float u, float v)
+{
+	int32_t r = clamp_i32(dot(c, 0, y, u, v) + 0.5f, 0, 255);
+	int32_t g = clamp_i32(dot(c, 1, y, u, v) + 0.5f, 0, 255);
+	int32_t b = clamp_i32(dot(c, 2, y, u, v) + 0.5f, 0, 255);
+
+	return r << 16 | g << 8 | b;
+}
+
+static inline void rgb_to_yuv_pixel(const struct igt_yuv_coeffs *c,
+				    uint32_t xrgb,
+				    uint8_t *y, float *u, float *v)
+{
+	float r = (xrgb >> 16) & 0xff;
+	float g = (xrgb >> 8) & 0xff;
+	float b = xrgb & 0xff;
+
+	*y = clamp_i32(dot(c, 0, r, g, b), 0, 255);
+	*u = dot(c, 1, r, g, b);
+	*v = dot(c, 2, r, g, b);
+}
+
+static void yuv_to_rgb_row_c(const struct igt_yuv_coeffs *c,
+			     const uint8_t *y, const uint8_t *u,
+			     const uint8_t *v, uint32_t *xrgb,
+			     unsigned int width)
+{
+	unsigned int i;
+
+	for (i = 0; i < width; i++)
+		xrgb[i] = yuv_to_rgb_pixel(c, y[i], u[i], v[i]);
+}
+
+static void rgb_to_yuv_row_c(const struct igt_yuv_coeffs *c,
+			     const uint32_t *xrgb,
+			     uint8_t *y, float *u, float *v,
+			     unsigned int width)
+{
+	unsigned int i;
+
+	for (i = 0; i < width; i++)
+		rgb_to_yuv_pixel(c, xrgb[i], &y[i], &u[i], &v[i]);
+}
+
+static const struct igt_yuv_kernels kernels_c = {
+	.yuv_to_rgb = yuv_to_rgb_row_c,
+	.rgb_to_yuv = rgb_to_yuv_row_c,
+};
+
+#if defined(__x86_64__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+#include <smmintrin.h>
+
+#define SSE41_DOT(c, i, a, b, d) \
+	_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps((c)->m[i][0]), a), \
+					 _mm_mul_ps(_mm_set1_ps((c)->m[i][1]), b)), \
+			      _mm_mul_ps(_mm_set1_ps((c)->m[i][2]), d)), \
+		   _mm_set1_ps((c)->ofs[i]))
+
+/* Truncates toward zero and clamps, like clamp_i32() of a float */
+static inline __m128i sse41_clamp(__m128 val, int32_t hi)
+{
+	return _mm_min_epi32(_mm_max_epi32(_mm_cvttps_epi32(val),
+					   _mm_setzero_si128()),
+			     _mm_set1_epi32(hi));
+}
+
+static inline __m128 sse41_load4(const uint8_t *p)
+{
+	int32_t v;
+
+	__builtin_memcpy(&v, p, sizeof(v));
+
+	return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+}
+
+static void yuv_to_rgb_row_sse41(const struct igt_yuv_coeffs *c,
+				 const uint8_t *y, const uint8_t *u,
+				 const uint8_t *v, uint32_t *xrgb,
+				 unsigned int width)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	unsigned int i;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		__m128 Y = sse41_load4(y + i);
+		__m128 U = sse41_load4(u + i);
+		__m128 V = sse41_load4(v + i);
+		__m128i r, g, b;
+
+		r = sse41_clamp(_mm_add_ps(SSE41_DOT(c, 0, Y, U, V), half), 255);
+		g = sse41_clamp(_mm_add_ps(SSE41_DOT(c, 1, Y, U, V), half), 255);
+		b = sse41_clamp(_mm_add_ps(SSE41_DOT(c, 2, Y, U, V), half), 255);
+
+		_mm_storeu_si128((__m128i *)(xrgb + i),
+				 _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16),
+							   _mm_slli_epi32(g, 8)),
+					      b));
+	}
+
+	for (; i < width; i++)
+		xrgb[i] = yuv_to_rgb_pixel(c, y[i], u[i], v[i]);
+}
+
+static void rgb_to_yuv_row_sse41(const struct igt_yuv_coeffs *c,
+				 const uint32_t *xrgb,
+				 uint8_t *y, float *u, float *v,
+				 unsigned int width)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	unsigned int i;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(xrgb + i));
+		__m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+		__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+		__m128 b = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+		__m128i Y;
+		int32_t y4;
+
+		Y = sse41_clamp(SSE41_DOT(c, 0, r, g, b), 255);
+		Y = _mm_packus_epi32(Y, Y);
+		y4 = _mm_cvtsi128_si32(_mm_packus_epi16(Y, Y));
+		__builtin_memcpy(y + i, &y4, sizeof(y4));
+		_mm_storeu_ps(u + i, SSE41_DOT(c, 1, r, g, b));
+		_mm_storeu_ps(v + i, SSE41_DOT(c, 2, r, g, b));
+	}
+
+	for (; i < width; i++)
+		rgb_to_yuv_pixel(c, xrgb[i], &y[i], &u[i], &v[i]);
+}
+
+static const struct igt_yuv_kernels kernels_sse41 = {
+	.yuv_to_rgb = yuv_to_rgb_row_sse41,
+	.rgb_to_yuv = rgb_to_yuv_row_sse41,
+};
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#include <immintrin.h>
+
+#define AVX2_DOT(c, i, a, b, d) \
+	_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps((c)->m[i][0]), a), \
+						  _mm256_mul_ps(_mm256_set1_ps((c)->m[i][1]), b)), \
+				    _mm256_mul_ps(_mm256_set1_ps((c)->m[i][2]), d)), \
+		      _mm256_set1_ps((c)->ofs[i]))
+
+static inline __m256i avx2_clamp(__m256 val, int32_t hi)
+{
+	return _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(val),
+						 _mm256_setzero_si256()),
+				_mm256_set1_epi32(hi));
+}
+
+static inline __m256 avx2_load8(const uint8_t *p)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+static void yuv_to_rgb_row_avx2(const struct igt_yuv_coeffs *c,
+				const uint8_t *y, const uint8_t *u,
+				const uint8_t *v, uint32_t *xrgb,
+				unsigned int width)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	unsigned int i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		__m256 Y = avx2_load8(y + i);
+		__m256 U = avx2_load8(u + i);
+		__m256 V = avx2_load8(v + i);
+		__m256i r, g, b;
+
+		r = avx2_clamp(_mm256_add_ps(AVX2_DOT(c, 0, Y, U, V), half), 255);
+		g = avx2_clamp(_mm256_add_ps(AVX2_DOT(c, 1, Y, U, V), half), 255);
+		b = avx2_clamp(_mm256_add_ps(AVX2_DOT(c, 2, Y, U, V), half), 255);
+
+		_mm256_storeu_si256((__m256i *)(xrgb + i),
+				    _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 16),
+								    _mm256_slli_epi32(g, 8)),
+						    b));
+	}
+
+	for (; i < width; i++)
+		xrgb[i] = yuv_to_rgb_pixel(c, y[i], u[i], v[i]);
+}
+
+static void rgb_to_yuv_row_avx2(const struct igt_yuv_coeffs *c,
+				const uint32_t *xrgb,
+				uint8_t *y, float *u, float *v,
+				unsigned int width)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	unsigned int i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		__m256i p = _mm256_loadu_si256((const __m256i *)(xrgb + i));
+		__m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+		__m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(p, mask));
+		__m256i Y;
+		__m128i y16;
+
+		Y = avx2_clamp(AVX2_DOT(c, 0, r, g, b), 255);
+
+		/* Packing works per 128 bit lane, so narrow the halves */
+		y16 = _mm_packus_epi32(_mm256_castsi256_si128(Y),
+				       _mm256_extracti128_si256(Y, 1));
+
+		_mm_storel_epi64((__m128i *)(y + i), _mm_packus_epi16(y16, y16));
+		_mm256_storeu_ps(u + i, AVX2_DOT(c, 1, r, g, b));
+		_mm256_storeu_ps(v + i, AVX2_DOT(c, 2, r, g, b));
+	}
+
+	for (; i < width; i++)
+		rgb_to_yuv_pixel(c, xrgb[i], &y[i], &u[i], &v[i]);
+}
+
+static const struct igt_yuv_kernels kernels_avx2 = {
+	.yuv_to_rgb = yuv_to_rgb_row_avx2,
+	.rgb_to_yuv = rgb_to_yuv_row_avx2,
+};
+
+#pragma GCC pop_options
+
+/**
+ * igt_yuv_get_kernels:
+ * @features: Mask of igt_x86_features() the kernels may use
+ *
+ * Returns the fastest row kernels limited to @features, the scalar
+ * reference for 0.
+ */
+const struct igt_yuv_kernels *igt_yuv_get_kernels(unsigned int features)
+{
+	if (features & AVX2)
+		return &kernels_avx2;
+
+	if (features & SSE4_1)
+		return &kernels_sse41;
+
+	return &kernels_c;
+}
+
+static void (*resolve_yuv_to_rgb_row(void))(const struct igt_yuv_coeffs *,
+					    const uint8_t *, const uint8_t *,
+					    const uint8_t *, uint32_t *,
+					    unsigned int)
+{
+	return igt_yuv_get_kernels(igt_x86_features())->yuv_to_rgb;
+}
+
+static void (*resolve_rgb_to_yuv_row(void))(const struct igt_yuv_coeffs *,
+					    const uint32_t *, uint8_t *,
+					    float *, float *,
+					    unsigned int)
+{
+	return igt_yuv_get_kernels(igt_x86_features())->rgb_to_yuv;
+}
+
+void igt_yuv_to_rgb_row(const struct igt_yuv_coeffs *c,
+			const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			uint32_t *xrgb, unsigned int width)
+	__attribute__((ifunc("resolve_yuv_to_rgb_row")));
+
+void igt_rgb_to_yuv_row(const struct igt_yuv_coeffs *c,
+			const uint32_t *xrgb,
+			uint8_t *y, float *u, float *v,
+			unsigned int width)
+	__attribute__((ifunc("resolve_rgb_to_yuv_row")));
+
+#else
+const struct igt_yuv_kernels *igt_yuv_get_kernels(unsigned int features)
+{
+	return &kernels_c;
+}
+
+void igt_yuv_to_rgb_row(const struct igt_yuv_coeffs *c,
+			const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			uint32_t *xrgb, unsigned int width)
+{
+	yuv_to_rgb_row_c(c, y, u, v, xrgb, width);
+}
+
+void igt_rgb_to_yuv_row(const struct igt_yuv_coeffs *c,
+			const uint32_t *xrgb,
+			uint8_t *y, float *u, float *v,
+			unsigned int width)
+{
+	rgb_to_yuv_row_c(c, xrgb, y, u, v, width);
+}
+#endif
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef __IGT_YUV_H__
+#define __IGT_YUV_H__
+
+#include <stdint.h>
+
+#include "igt_matrix.h"
+
+/**
+ * igt_yuv_coeffs:
+ * @m: 3x3 matrix
+ * @ofs: per output channel offset
+ *
+ * Upper 3x4 part of a 4x4 color conversion matrix as returned by
+ * igt_ycbcr_to_rgb_matrix() or igt_rgb_to_ycbcr_matrix(), laid out row by
+ * row for the row kernels.
+ */
+struct igt_yuv_coeffs {
+	float m[3][3];
+	float ofs[3];
+};
+
+/**
+ * igt_yuv_kernels:
+ * @yuv_to_rgb: Converts a row of 8 bit Y, U and V samples, one of each per
+ * pixel, to XRGB8888 rounding to nearest. The X channel is zeroed.
+ * @rgb_to_yuv: Converts a row of XRGB8888 pixels to 8 bit Y, truncated, and
+ * to unrounded U and V to be averaged by the caller for subsampling.
+ */
+struct igt_yuv_kernels {
+	void (*yuv_to_rgb)(const struct igt_yuv_coeffs *c,
+			   const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			   uint32_t *xrgb, unsigned int width);
+	void (*rgb_to_yuv)(const struct igt_yuv_coeffs *c,
+			   const uint32_t *xrgb,
+			   uint8_t *y, float *u, float *v,
+			   unsigned int width);
+};
+
+void igt_yuv_coeffs_init(struct igt_yuv_coeffs *c, const struct igt_mat4 *m);
+
+const struct igt_yuv_kernels *igt_yuv_get_kernels(unsigned int features);
+
+void igt_yuv_to_rgb_row(const struct igt_yuv_coeffs *c,
+			const uint8_t *y, const uint8_t *u, const uint8_t *v,
+			uint32_t *xrgb, unsigned int width);
+void igt_rgb_to_yuv_row(const struct igt_yuv_coeffs *c,
+			const uint32_t *xrgb,
+			uint8_t *y, float *u, float *v,
+			unsigned int width);
+
+#endif /* __IGT_YUV_H__ */
@@ -868,26 +868,31 @@ void intel_allocator_multiprocess_start(void)
  * stopping allocator thread and deinitializing its data.
  */
 #define STOP_TIMEOUT_MS 100
-void intel_allocator_multiprocess_stop(void)
+static void __intel_allocator_multiprocess_stop(void)
 {
 	int time_left = STOP_TIMEOUT_MS;
 
-	alloc_info("allocator multiprocess stop\n");
+	send_alloc_stop(channel);
 
-	if (multiprocess) {
-		send_alloc_stop(channel);
+	/* Give allocator thread time to complete */
+	while (time_left-- > 0 && READ_ONCE(allocator_thread_running))
+		usleep(1000); /* coarse calculation */
 
-		/* Give allocator thread time to complete */
-		while (time_left-- > 0 && READ_ONCE(allocator_thread_running))
-			usleep(1000); /* coarse calculation */
+	/* Deinit, this should stop all blocked syscalls, if any */
+	channel->deinit(channel);
+	pthread_join(allocator_thread, NULL);
+	multiprocess = false;
+}
+
+void intel_allocator_multiprocess_stop(void)
+{
+	alloc_info("allocator multiprocess stop\n");
 
-		/* Deinit, this should stop all blocked syscalls, if any */
-		channel->deinit(channel);
-		pthread_join(allocator_thread, NULL);
+	if (multiprocess) {
+		__intel_allocator_multiprocess_stop();
 
 		/* But we're not sure does child will stuck */
 		igt_waitchildren_timeout(5, "Stopping children");
-		multiprocess = false;
 	}
 }
 
@@ -968,7 +973,9 @@ static uint64_t __intel_allocator_open_full(int fd, uint32_t ctx,
  * For SIMPLE allocator:
  * - ALLOC_STRATEGY_HIGH_TO_LOW means topmost addresses are allocated first,
  * - ALLOC_STRATEGY_LOW_TO_HIGH opposite, allocation starts from lowest
- *   addresses.
+ *   addresses,
+ * - ALLOC_STRATEGY_BEST_FIT picks the smallest hole the object fits in,
+ *   keeping large holes intact for large objects.
  *
  * For RANDOM allocator:
  * - no strategy is currently implemented.
@@ -1458,11 +1465,24 @@ static void __free_maps(struct igt_map *map, bool close_allocators)
  * Function initializes the allocators infrastructure. The second call will
  * override current infra and destroy existing there allocators. It is called
  * in igt_constructor.
+ *
+ * Children talk to the allocator thread over a SysV message queue, setting
+ * IGT_ALLOCATOR_CHANNEL=shmem in the environment selects the shared memory
+ * rings instead.
  **/
 void intel_allocator_init(void)
 {
+	const char *chan = getenv("IGT_ALLOCATOR_CHANNEL");
+
 	alloc_info("Prepare an allocator infrastructure\n");
 
+	/*
+	 * A subtest which failed in multiprocess mode never got to stop the
+	 * allocator thread, which still uses the channel we are replacing.
+	 */
+	if (multiprocess && allocator_pid == getpid())
+		__intel_allocator_multiprocess_stop();
+
 	allocator_pid = getpid();
 	alloc_info("Allocator pid: %ld\n", (long) allocator_pid);
 
@@ -1476,7 +1496,10 @@ void intel_allocator_init(void)
 	vm_map = igt_map_create(hash_instance, equal_vm);
 	igt_assert(handles && ctx_map && vm_map);
 
-	channel = intel_allocator_get_msgchannel(CHANNEL_SYSVIPC_MSGQUEUE);
+	if (chan && !strcmp(chan, "shmem"))
+		channel = intel_allocator_get_msgchannel(CHANNEL_SHMEM_RING);
+	else
+		channel = intel_allocator_get_msgchannel(CHANNEL_SYSVIPC_MSGQUEUE);
 }
 
 igt_constructor {
@@ -126,7 +126,8 @@
 enum allocator_strategy {
 	ALLOC_STRATEGY_NONE,
 	ALLOC_STRATEGY_LOW_TO_HIGH,
-	ALLOC_STRATEGY_HIGH_TO_LOW
+	ALLOC_STRATEGY_HIGH_TO_LOW,
+	ALLOC_STRATEGY_BEST_FIT
 };
 
 struct intel_allocator {
@@ -5,9 +5,16 @@
 
 #include <sys/types.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/msg.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include "igt.h"
 #include "intel_allocator_msgchannel.h"
 
@@ -182,6 +189,368 @@ static struct msg_channel msgqueue_channel = {
 	.recv_resp = msgqueue_recv_resp,
 };
 
+/* ----- SHARED MEMORY RINGS ----- */
+
+/*
+ * Every client thread owns a slot holding a request ring it produces into
+ * and a response ring the allocator thread produces into. The mapping is
+ * created in the main process and inherited over fork, so a round trip
+ * costs no syscalls as long as neither side has to sleep. The allocator
+ * thread drains the rings of all slots round-robin and only sleeps on the
+ * shared doorbell once all of them are empty.
+ *
+ * The allocator API stays synchronous: a client waits for the response
+ * before it sends its next request, so there is at most one request in
+ * flight per slot and the only batching is across clients.
+ */
+
+#define SHM_SLOTS 1024
+#define SHM_RING_SIZE 4
+#define SHM_SPIN 2000
+
+struct shm_ring {
+	_Atomic(uint32_t) head;
+	_Atomic(uint32_t) tail;
+	_Atomic(uint32_t) waiting;
+};
+
+struct shm_slot {
+	_Atomic(pid_t) owner;
+	uint64_t seq;
+
+	struct shm_ring req_ring;
+	struct {
+		uint64_t seq;
+		struct alloc_req request;
+	} req[SHM_RING_SIZE];
+
+	struct shm_ring resp_ring;
+	struct {
+		uint64_t seq;
+		struct alloc_resp response;
+	} resp[SHM_RING_SIZE];
+} __attribute__((aligned(64)));
+
+struct shm_channel {
+	_Atomic(uint32_t) doorbell;
+	_Atomic(uint32_t) waiting;
+	_Atomic(uint32_t) stopped;
+	_Atomic(uint32_t) num_slots;
+
+	struct shm_slot slots[SHM_SLOTS];
+};
+
+struct shmem_data {
+	struct shm_channel *shm;
+
+	/* Allocator thread state */
+	unsigned int next_slot;
+	unsigned int cur_slot;
+	uint64_t cur_seq;
+};
+
+/* Kept for the process lifetime, the allocator thread is joined after deinit */
+static struct shm_channel *shm_mapping;
+
+static __thread struct shm_channel *client_shm;
+static __thread pid_t client_tid;
+static __thread unsigned int client_slot;
+static __thread uint64_t client_seq;
+
+static void shm_futex_wait(_Atomic(uint32_t) *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void shm_futex_wake(_Atomic(uint32_t) *addr, int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static bool shm_ring_empty(struct shm_ring *ring)
+{
+	return atomic_load(&ring->tail) == atomic_load(&ring->head);
+}
+
+/* Waits until the producer wrote past head, false if the channel went down */
+static bool shm_ring_wait(struct shm_channel *shm, struct shm_ring *ring)
+{
+	uint32_t head = atomic_load(&ring->head);
+	int spin = SHM_SPIN;
+
+	while (atomic_load(&ring->tail) == head) {
+		if (atomic_load(&shm->stopped))
+			return false;
+
+		if (spin) {
+			spin--;
+			continue;
+		}
+
+		atomic_store(&ring->waiting, 1);
+		if (atomic_load(&ring->tail) == head &&
+		    !atomic_load(&shm->stopped))
+			shm_futex_wait(&ring->tail, head);
+		atomic_store(&ring->waiting, 0);
+	}
+
+	return true;
+}
+
+/* Returns the index of the entry to fill, false if the channel went down */
+static bool shm_ring_reserve(struct shm_channel *shm, struct shm_ring *ring,
+			     uint32_t *idx)
+{
+	uint32_t tail = atomic_load(&ring->tail);
+
+	/*
+	 * Clients have a single request in flight, so the rings fill up
+	 * only with leftovers of a dead previous slot owner.
+	 */
+	while (tail - atomic_load(&ring->head) == SHM_RING_SIZE) {
+		if (atomic_load(&shm->stopped))
+			return false;
+		sched_yield();
+	}
+
+	*idx = tail % SHM_RING_SIZE;
+
+	return true;
+}
+
+static void shm_ring_commit(struct shm_ring *ring)
+{
+	atomic_fetch_add(&ring->tail, 1);
+	if (atomic_load(&ring->waiting))
+		shm_futex_wake(&ring->tail, 1);
+}
+
+static struct shm_slot *shm_client_slot(struct shm_channel *shm)
+{
+	pid_t tid = gettid(), owner;
+	unsigned int i, num;
+
+	if (client_shm == shm && client_tid == tid)
+		return &shm->slots[client_slot];
+
+	num = atomic_load(&shm->num_slots);
+	for (i = 0; i < num; i++)
+		if (atomic_load(&shm->slots[i].owner) == tid)
+			goto found;
+
+	for (i = 0; i < SHM_SLOTS; i++) {
+		owner = 0;
+		if (atomic_compare_exchange_strong(&shm->slots[i].owner,
+						   &owner, tid))
+			goto found;
+	}
+
+	/* Take over the slot of a client which is gone */
+	for (i = 0; i < SHM_SLOTS; i++) {
+		owner = atomic_load(&shm->slots[i].owner);
+		if (kill(owner, 0) && errno == ESRCH &&
+		    atomic_compare_exchange_strong(&shm->slots[i].owner,
+						   &owner, tid))
+			goto found;
+	}
+
+	igt_assert_f(0, "No free allocator channel slot for tid %d\n", tid);
+
+found:
+	num = atomic_load(&shm->num_slots);
+	while (num <= i &&
+	       !atomic_compare_exchange_weak(&shm->num_slots, &num, i + 1))
+		;
+
+	client_shm = shm;
+	client_tid = tid;
+	client_slot = i;
+
+	return &shm->slots[i];
+}
+
+static void shmem_init(struct msg_channel *channel)
+{
+	struct shmem_data *shmdata;
+
+	igt_debug("Init shared memory rings\n");
+
+	if (!shm_mapping) {
+		shm_mapping = mmap(NULL, sizeof(*shm_mapping),
+				   PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		igt_assert(shm_mapping != MAP_FAILED);
+	} else {
+		memset(shm_mapping, 0, sizeof(*shm_mapping));
+	}
+
+	shmdata = calloc(1, sizeof(*shmdata));
+	igt_assert(shmdata);
+	shmdata->shm = shm_mapping;
+	channel->priv = shmdata;
+	channel->ready = true;
+}
+
+static void shmem_deinit(struct msg_channel *channel)
+{
+	struct shmem_data *shmdata = channel->priv;
+	struct shm_channel *shm = shmdata->shm;
+	unsigned int i;
+
+	igt_debug("Deinit shared memory rings\n");
+
+	/* Unblock everyone still waiting, like removing the msgqueue does */
+	atomic_store(&shm->stopped, 1);
+	atomic_fetch_add(&shm->doorbell, 1);
+	shm_futex_wake(&shm->doorbell, INT_MAX);
+	for (i = 0; i < atomic_load(&shm->num_slots); i++)
+		shm_futex_wake(&shm->slots[i].resp_ring.tail, INT_MAX);
+
+	free(channel->priv);
+	channel->ready = false;
+}
+
+static int shmem_send_req(struct msg_channel *channel,
+			  struct alloc_req *request)
+{
+	struct shmem_data *shmdata = channel->priv;
+	struct shm_channel *shm = shmdata->shm;
+	struct shm_slot *slot;
+	uint32_t idx;
+
+	/* Fake message to stop the allocator thread */
+	if (request->request_type == REQ_STOP) {
+		atomic_store(&shm->stopped, 1);
+		atomic_fetch_add(&shm->doorbell, 1);
+		shm_futex_wake(&shm->doorbell, 1);
+		return 0;
+	}
+
+	slot = shm_client_slot(shm);
+	if (!shm_ring_reserve(shm, &slot->req_ring, &idx)) {
+		errno = EIDRM;
+		return -1;
+	}
+
+	client_seq = ++slot->seq;
+	slot->req[idx].seq = client_seq;
+	memcpy(&slot->req[idx].request, request, sizeof(*request));
+	atomic_fetch_add(&slot->req_ring.tail, 1);
+
+	atomic_fetch_add(&shm->doorbell, 1);
+	if (atomic_load(&shm->waiting))
+		shm_futex_wake(&shm->doorbell, 1);
+
+	return 0;
+}
+
+static int shmem_recv_req(struct msg_channel *channel,
+			  struct alloc_req *request)
+{
+	struct shmem_data *shmdata = channel->priv;
+	struct shm_channel *shm = shmdata->shm;
+	int spin = SHM_SPIN;
+
+	while (1) {
+		uint32_t doorbell = atomic_load(&shm->doorbell);
+		unsigned int num = atomic_load(&shm->num_slots);
+		unsigned int i, n;
+
+		for (n = 0; n < num; n++) {
+			struct shm_slot *slot;
+			uint32_t head;
+
+			i = (shmdata->next_slot + n) % num;
+			slot = &shm->slots[i];
+			if (shm_ring_empty(&slot->req_ring))
+				continue;
+
+			head = atomic_load(&slot->req_ring.head);
+			memcpy(request, &slot->req[head % SHM_RING_SIZE].request,
+			       sizeof(*request));
+			shmdata->cur_seq = slot->req[head % SHM_RING_SIZE].seq;
+			shmdata->cur_slot = i;
+			shmdata->next_slot = i + 1;
+			atomic_store(&slot->req_ring.head, head + 1);
+
+			return sizeof(*request);
+		}
+
+		if (atomic_load(&shm->stopped)) {
+			memset(request, 0, sizeof(*request));
+			request->request_type = REQ_STOP;
+			return sizeof(*request);
+		}
+
+		if (spin) {
+			spin--;
+			continue;
+		}
+
+		atomic_store(&shm->waiting, 1);
+		if (atomic_load(&shm->doorbell) == doorbell)
+			shm_futex_wait(&shm->doorbell, doorbell);
+		atomic_store(&shm->waiting, 0);
+		spin = SHM_SPIN;
+	}
+}
+
+static int shmem_send_resp(struct msg_channel *channel,
+			   struct alloc_resp *response)
+{
+	struct shmem_data *shmdata = channel->priv;
+	struct shm_channel *shm = shmdata->shm;
+	struct shm_slot *slot = &shm->slots[shmdata->cur_slot];
+	uint32_t idx;
+
+	if (!shm_ring_reserve(shm, &slot->resp_ring, &idx)) {
+		errno = EIDRM;
+		return -1;
+	}
+
+	slot->resp[idx].seq = shmdata->cur_seq;
+	memcpy(&slot->resp[idx].response, response, sizeof(*response));
+	shm_ring_commit(&slot->resp_ring);
+
+	return 0;
+}
+
+static int shmem_recv_resp(struct msg_channel *channel,
+			   struct alloc_resp *response)
+{
+	struct shmem_data *shmdata = channel->priv;
+	struct shm_channel *shm = shmdata->shm;
+	struct shm_slot *slot = shm_client_slot(shm);
+
+	while (shm_ring_wait(shm, &slot->resp_ring)) {
+		uint32_t head = atomic_load(&slot->resp_ring.head);
+		uint64_t seq = slot->resp[head % SHM_RING_SIZE].seq;
+
+		if (seq == client_seq)
+			memcpy(response,
+			       &slot->resp[head % SHM_RING_SIZE].response,
+			       sizeof(*response));
+		atomic_store(&slot->resp_ring.head, head + 1);
+
+		/* Skip responses to requests of a previous slot owner */
+		if (seq == client_seq)
+			return sizeof(*response);
+	}
+
+	errno = EIDRM;
+	return -1;
+}
+
+static struct msg_channel shmem_channel = {
+	.priv = NULL,
+	.init = shmem_init,
+	.deinit = shmem_deinit,
+	.send_req = shmem_send_req,
+	.recv_req = shmem_recv_req,
+	.send_resp = shmem_send_resp,
+	.recv_resp = shmem_recv_resp,
+};
+
 struct msg_channel *intel_allocator_get_msgchannel(enum msg_channel_type type)
 {
 	struct msg_channel *channel = NULL;
@@ -189,6 +558,10 @@ struct msg_channel *intel_allocator_get_msgchannel(enum msg_channel_type type)
 	switch (type) {
 	case CHANNEL_SYSVIPC_MSGQUEUE:
 		channel = &msgqueue_channel;
+		break;
+	case CHANNEL_SHMEM_RING:
+		channel = &shmem_channel;
+		break;
 	}
 
 	igt_assert(channel);
@@ -151,7 +151,8 @@ struct msg_channel {
 };
 
 enum msg_channel_type {
-	CHANNEL_SYSVIPC_MSGQUEUE
+	CHANNEL_SYSVIPC_MSGQUEUE,
+	CHANNEL_SHMEM_RING,
 };
 
 struct msg_channel *intel_allocator_get_msgchannel(enum msg_channel_type type);
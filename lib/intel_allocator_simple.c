@@ -17,8 +17,22 @@ struct intel_allocator *
 intel_allocator_simple_create(int fd, uint64_t start, uint64_t end,
 			      enum allocator_strategy strategy);
 
+/*
+ * Holes are kept in a list ordered from high to low addresses and, to
+ * avoid walking that list, in two treaps sharing the node priority:
+ * one ordered by offset and augmented with the largest hole size of
+ * each subtree, one ordered by size (then offset) for best fit.
+ */
+enum {
+	SIMPLE_VMA_TREE_ADDR,
+	SIMPLE_VMA_TREE_SIZE,
+	SIMPLE_VMA_TREE_COUNT
+};
+
 struct simple_vma_heap {
 	struct igt_list_head holes;
+	struct simple_vma_hole *root[SIMPLE_VMA_TREE_COUNT];
+	uint32_t seed;
 	enum allocator_strategy strategy;
 };
 
@@ -26,6 +40,10 @@ struct simple_vma_hole {
 	struct igt_list_head link;
 	uint64_t offset;
 	uint64_t size;
+
+	struct simple_vma_hole *child[SIMPLE_VMA_TREE_COUNT][2];
+	uint64_t max_size;
+	uint32_t priority;
 };
 
 struct intel_allocator_simple {
@@ -104,10 +122,191 @@ static void map_entry_free_func(struct igt_map_entry *entry)
 #define GEN8_GTT_ADDRESS_WIDTH 48
 #define DECANONICAL(offset) (offset & ((1ull << GEN8_GTT_ADDRESS_WIDTH) - 1))
 
+/* Is a ordered after b in the given tree? */
+static bool simple_vma_hole_after(int tree, const struct simple_vma_hole *a,
+				  const struct simple_vma_hole *b)
+{
+	if (tree == SIMPLE_VMA_TREE_SIZE && a->size != b->size)
+		return a->size > b->size;
+
+	return a->offset > b->offset;
+}
+
+static void simple_vma_hole_update(int tree, struct simple_vma_hole *hole)
+{
+	int i;
+
+	if (tree != SIMPLE_VMA_TREE_ADDR)
+		return;
+
+	hole->max_size = hole->size;
+	for (i = 0; i < 2; i++)
+		if (hole->child[tree][i] &&
+		    hole->child[tree][i]->max_size > hole->max_size)
+			hole->max_size = hole->child[tree][i]->max_size;
+}
+
+/* Lifts the child in direction dir above hole, returns the new subtree root */
+static struct simple_vma_hole *
+simple_vma_tree_rotate(int tree, struct simple_vma_hole *hole, int dir)
+{
+	struct simple_vma_hole *child = hole->child[tree][dir];
+
+	hole->child[tree][dir] = child->child[tree][!dir];
+	child->child[tree][!dir] = hole;
+	simple_vma_hole_update(tree, hole);
+	simple_vma_hole_update(tree, child);
+
+	return child;
+}
+
+static struct simple_vma_hole *
+simple_vma_tree_insert(int tree, struct simple_vma_hole *root,
+		       struct simple_vma_hole *hole)
+{
+	int dir;
+
+	if (!root) {
+		hole->child[tree][0] = hole->child[tree][1] = NULL;
+		simple_vma_hole_update(tree, hole);
+		return hole;
+	}
+
+	dir = simple_vma_hole_after(tree, hole, root);
+	root->child[tree][dir] = simple_vma_tree_insert(tree, root->child[tree][dir], hole);
+	if (root->child[tree][dir]->priority > root->priority)
+		return simple_vma_tree_rotate(tree, root, dir);
+
+	simple_vma_hole_update(tree, root);
+	return root;
+}
+
+static struct simple_vma_hole *
+simple_vma_tree_remove(int tree, struct simple_vma_hole *root,
+		       struct simple_vma_hole *hole)
+{
+	int dir;
+
+	igt_assert(root);
+
+	if (root == hole) {
+		if (!root->child[tree][0])
+			return root->child[tree][1];
+		if (!root->child[tree][1])
+			return root->child[tree][0];
+
+		/* Rotate the hole down until it has at most one child */
+		dir = root->child[tree][1]->priority > root->child[tree][0]->priority;
+		root = simple_vma_tree_rotate(tree, root, dir);
+		root->child[tree][!dir] = simple_vma_tree_remove(tree, root->child[tree][!dir], hole);
+	} else {
+		dir = simple_vma_hole_after(tree, hole, root);
+		root->child[tree][dir] = simple_vma_tree_remove(tree, root->child[tree][dir], hole);
+	}
+
+	simple_vma_hole_update(tree, root);
+	return root;
+}
+
+/*
+ * Holes must be unlinked from the trees before their offset or size
+ * changes, and linked back afterwards.
+ */
+static void simple_vma_hole_link(struct simple_vma_heap *heap,
+				 struct simple_vma_hole *hole)
+{
+	int tree;
+
+	for (tree = 0; tree < SIMPLE_VMA_TREE_COUNT; tree++)
+		heap->root[tree] = simple_vma_tree_insert(tree, heap->root[tree], hole);
+}
+
+static void simple_vma_hole_unlink(struct simple_vma_heap *heap,
+				   struct simple_vma_hole *hole)
+{
+	int tree;
+
+	for (tree = 0; tree < SIMPLE_VMA_TREE_COUNT; tree++)
+		heap->root[tree] = simple_vma_tree_remove(tree, heap->root[tree], hole);
+}
+
+static struct simple_vma_hole *simple_vma_hole_new(struct simple_vma_heap *heap,
+						   uint64_t offset, uint64_t size)
+{
+	struct simple_vma_hole *hole;
+
+	hole = calloc(1, sizeof(*hole));
+	igt_assert(hole);
+
+	hole->offset = offset;
+	hole->size = size;
+
+	/* xorshift32 */
+	heap->seed ^= heap->seed << 13;
+	heap->seed ^= heap->seed >> 17;
+	heap->seed ^= heap->seed << 5;
+	hole->priority = heap->seed;
+
+	return hole;
+}
+
+/* Returns the highest hole starting at or below offset */
+static struct simple_vma_hole *simple_vma_heap_find(struct simple_vma_heap *heap,
+						    uint64_t offset)
+{
+	struct simple_vma_hole *hole = heap->root[SIMPLE_VMA_TREE_ADDR];
+	struct simple_vma_hole *found = NULL;
+
+	while (hole) {
+		if (hole->offset <= offset) {
+			found = hole;
+			hole = hole->child[SIMPLE_VMA_TREE_ADDR][1];
+		} else {
+			hole = hole->child[SIMPLE_VMA_TREE_ADDR][0];
+		}
+	}
+
+	return found;
+}
+
+#ifdef IGT_DEBUG_BUILD
+static size_t simple_vma_tree_validate(int tree, struct simple_vma_hole *hole)
+{
+	size_t count = 1;
+	int i;
+
+	if (!hole)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		struct simple_vma_hole *child = hole->child[tree][i];
+
+		if (!child)
+			continue;
+
+		igt_assert(child->priority <= hole->priority);
+		igt_assert(simple_vma_hole_after(tree, child, hole) == i);
+		if (tree == SIMPLE_VMA_TREE_ADDR)
+			igt_assert(child->max_size <= hole->max_size);
+
+		count += simple_vma_tree_validate(tree, child);
+	}
+
+	if (tree == SIMPLE_VMA_TREE_ADDR)
+		igt_assert(hole->max_size >= hole->size);
+
+	return count;
+}
+#endif
+
+/* Walks the whole heap, only done in debug builds */
 static void simple_vma_heap_validate(struct simple_vma_heap *heap)
 {
+#ifdef IGT_DEBUG_BUILD
 	uint64_t prev_offset = 0;
 	struct simple_vma_hole *hole;
+	size_t count = 0;
+	int tree;
 
 	simple_vma_foreach_hole(hole, heap) {
 		igt_assert(hole->size > 0);
@@ -130,14 +329,19 @@ static void simple_vma_heap_validate(struct simple_vma_heap *heap)
 				   hole->size + hole->offset < prev_offset);
 		}
 		prev_offset = hole->offset;
+		count++;
 	}
+
+	for (tree = 0; tree < SIMPLE_VMA_TREE_COUNT; tree++)
+		igt_assert_eq(simple_vma_tree_validate(tree, heap->root[tree]), count);
+#endif
 }
 
 
 static void simple_vma_heap_free(struct simple_vma_heap *heap,
 				 uint64_t offset, uint64_t size)
 {
-	struct simple_vma_hole *high_hole = NULL, *low_hole = NULL, *hole;
+	struct simple_vma_hole *high_hole = NULL, *low_hole, *hole;
 	bool high_adjacent, low_adjacent;
 
 	/* Freeing something with a size of 0 is not valid. */
@@ -151,13 +355,17 @@ static void simple_vma_heap_free(struct simple_vma_heap *heap,
 
 	simple_vma_heap_validate(heap);
 
-	/* Find immediately higher and lower holes if they exist. */
-	simple_vma_foreach_hole(hole, heap) {
-		if (hole->offset <= offset) {
-			low_hole = hole;
-			break;
-		}
-		high_hole = hole;
+	/*
+	 * Find immediately higher and lower holes if they exist. The list
+	 * is ordered from high to low, so the higher hole precedes the lower
+	 * one, or is the last one if there's no lower hole.
+	 */
+	low_hole = simple_vma_heap_find(heap, offset);
+	if (low_hole) {
+		if (low_hole->link.prev != &heap->holes)
+			high_hole = igt_container_of(low_hole->link.prev, high_hole, link);
+	} else if (!igt_list_empty(&heap->holes)) {
+		high_hole = igt_list_last_entry(&heap->holes, high_hole, link);
 	}
 
 	if (high_hole)
@@ -172,23 +380,26 @@ static void simple_vma_heap_free(struct simple_vma_heap *heap,
 
 	if (low_adjacent && high_adjacent) {
 		/* Merge the two holes */
+		simple_vma_hole_unlink(heap, low_hole);
+		simple_vma_hole_unlink(heap, high_hole);
 		low_hole->size += size + high_hole->size;
+		simple_vma_hole_link(heap, low_hole);
 		igt_list_del(&high_hole->link);
 		free(high_hole);
 	} else if (low_adjacent) {
 		/* Merge into the low hole */
+		simple_vma_hole_unlink(heap, low_hole);
 		low_hole->size += size;
+		simple_vma_hole_link(heap, low_hole);
 	} else if (high_adjacent) {
 		/* Merge into the high hole */
+		simple_vma_hole_unlink(heap, high_hole);
 		high_hole->offset = offset;
 		high_hole->size += size;
+		simple_vma_hole_link(heap, high_hole);
 	} else {
 		/* Neither hole is adjacent; make a new one */
-		hole = calloc(1, sizeof(*hole));
-		igt_assert(hole);
-
-		hole->offset = offset;
-		hole->size = size;
+		hole = simple_vma_hole_new(heap, offset, size);
 		/*
 		 * Add it after the high hole so we maintain high-to-low
 		 * ordering
@@ -197,6 +408,7 @@ static void simple_vma_heap_free(struct simple_vma_heap *heap,
 			igt_list_add(&hole->link, &high_hole->link);
 		else
 			igt_list_add(&hole->link, &heap->holes);
+		simple_vma_hole_link(heap, hole);
 	}
 
 	simple_vma_heap_validate(heap);
@@ -207,10 +419,13 @@ static void simple_vma_heap_init(struct simple_vma_heap *heap,
 				 enum allocator_strategy strategy)
 {
 	IGT_INIT_LIST_HEAD(&heap->holes);
+	memset(heap->root, 0, sizeof(heap->root));
+	heap->seed = 0x9e3779b9;
 	simple_vma_heap_free(heap, start, size);
 
-	/* Use LOW_TO_HIGH or HIGH_TO_LOW strategy only */
-	if (strategy == ALLOC_STRATEGY_LOW_TO_HIGH)
+	/* Use LOW_TO_HIGH, HIGH_TO_LOW or BEST_FIT strategy only */
+	if (strategy == ALLOC_STRATEGY_LOW_TO_HIGH ||
+	    strategy == ALLOC_STRATEGY_BEST_FIT)
 		heap->strategy = strategy;
 	else
 		heap->strategy = ALLOC_STRATEGY_HIGH_TO_LOW;
@@ -224,7 +439,8 @@ static void simple_vma_heap_finish(struct simple_vma_heap *heap)
 		free(hole);
 }
 
-static void simple_vma_hole_alloc(struct simple_vma_hole *hole,
+static void simple_vma_hole_alloc(struct simple_vma_heap *heap,
+				  struct simple_vma_hole *hole,
 				  uint64_t offset, uint64_t size)
 {
 	struct simple_vma_hole *high_hole;
@@ -233,6 +449,8 @@ static void simple_vma_hole_alloc(struct simple_vma_hole *hole,
 	igt_assert(hole->offset <= offset);
 	igt_assert(hole->size >= offset - hole->offset + size);
 
+	simple_vma_hole_unlink(heap, hole);
+
 	if (offset == hole->offset && size == hole->size) {
 		/* Just get rid of the hole. */
 		igt_list_del(&hole->link);
@@ -245,6 +463,7 @@ static void simple_vma_hole_alloc(struct simple_vma_hole *hole,
 	if (waste == 0) {
 		/* We allocated at the top->  Shrink the hole down. */
 		hole->size -= size;
+		simple_vma_hole_link(heap, hole);
 		return;
 	}
 
@@ -252,6 +471,7 @@ static void simple_vma_hole_alloc(struct simple_vma_hole *hole,
 		/* We allocated at the bottom. Shrink the hole up-> */
 		hole->offset += size;
 		hole->size -= size;
+		simple_vma_hole_link(heap, hole);
 		return;
 	}
 
@@ -259,23 +479,126 @@ static void simple_vma_hole_alloc(struct simple_vma_hole *hole,
 	 * We allocated in the middle.  We need to split the old hole into two
 	 * holes, one high and one low.
 	 */
-	high_hole = calloc(1, sizeof(*hole));
-	igt_assert(high_hole);
-
-	high_hole->offset = offset + size;
-	high_hole->size = waste;
+	high_hole = simple_vma_hole_new(heap, offset + size, waste);
 
 	/*
 	 * Adjust the hole to be the amount of space left at he bottom of the
 	 * original hole.
 	 */
 	hole->size = offset - hole->offset;
+	simple_vma_hole_link(heap, hole);
 
 	/*
 	 * Place the new hole before the old hole so that the list is in order
 	 * from high to low.
 	 */
 	igt_list_add_tail(&high_hole->link, &hole->link);
+	simple_vma_hole_link(heap, high_hole);
+}
+
+/* Highest aligned offset a chunk of size fits at in the hole */
+static bool simple_vma_hole_fit_high(const struct simple_vma_hole *hole,
+				     uint64_t size, uint64_t alignment,
+				     uint64_t *offset)
+{
+	if (size > hole->size)
+		return false;
+
+	/*
+	 * Compute the offset as the highest address where a chunk of the
+	 * given size can be without going over the top of the hole.
+	 *
+	 * This calculation is known to not overflow because we know that
+	 * hole->size + hole->offset can only overflow to 0 and size > 0.
+	 */
+	*offset = (hole->size - size) + hole->offset;
+
+	/*
+	 * Align the offset.  We align down and not up because we are
+	 *
+	 * allocating from the top of the hole and not the bottom.
+	 */
+	*offset = (*offset / alignment) * alignment;
+
+	return *offset >= hole->offset;
+}
+
+/* Lowest aligned offset a chunk of size fits at in the hole */
+static bool simple_vma_hole_fit_low(const struct simple_vma_hole *hole,
+				    uint64_t size, uint64_t alignment,
+				    uint64_t *offset)
+{
+	uint64_t misalign;
+
+	if (size > hole->size)
+		return false;
+
+	*offset = hole->offset;
+
+	/* Align the offset */
+	misalign = *offset % alignment;
+	if (misalign) {
+		uint64_t pad = alignment - misalign;
+
+		if (pad > hole->size - size)
+			return false;
+
+		*offset += pad;
+	}
+
+	return true;
+}
+
+/*
+ * Address ordered search for the first hole that fits, skipping
+ * subtrees without a hole large enough.
+ */
+static struct simple_vma_hole *
+simple_vma_find_by_addr(struct simple_vma_hole *hole, bool high,
+			uint64_t size, uint64_t alignment, uint64_t *offset)
+{
+	struct simple_vma_hole *found;
+
+	if (!hole || hole->max_size < size)
+		return NULL;
+
+	found = simple_vma_find_by_addr(hole->child[SIMPLE_VMA_TREE_ADDR][high],
+					high, size, alignment, offset);
+	if (found)
+		return found;
+
+	if (high ? simple_vma_hole_fit_high(hole, size, alignment, offset) :
+		   simple_vma_hole_fit_low(hole, size, alignment, offset))
+		return hole;
+
+	return simple_vma_find_by_addr(hole->child[SIMPLE_VMA_TREE_ADDR][!high],
+				       high, size, alignment, offset);
+}
+
+/* Smallest hole that fits, lowest one among equally sized holes */
+static struct simple_vma_hole *
+simple_vma_find_best_fit(struct simple_vma_hole *hole,
+			 uint64_t size, uint64_t alignment, uint64_t *offset)
+{
+	struct simple_vma_hole *found;
+
+	if (!hole)
+		return NULL;
+
+	if (hole->size < size)
+		return simple_vma_find_best_fit(hole->child[SIMPLE_VMA_TREE_SIZE][1],
+						size, alignment, offset);
+
+	found = simple_vma_find_best_fit(hole->child[SIMPLE_VMA_TREE_SIZE][0],
+					 size, alignment, offset);
+	if (found)
+		return found;
+
+	if (simple_vma_hole_fit_low(hole, size, alignment, offset))
+		return hole;
+
+	return simple_vma_find_best_fit(hole->child[SIMPLE_VMA_TREE_SIZE][1],
+					size, alignment, offset);
 }
 
 static bool simple_vma_heap_alloc(struct simple_vma_heap *heap,
@@ -283,8 +606,7 @@ static bool simple_vma_heap_alloc(struct simple_vma_heap *heap,
 				  uint64_t alignment,
 				  enum allocator_strategy strategy)
 {
-	struct simple_vma_hole *hole, *tmp;
-	uint64_t misalign;
+	struct simple_vma_hole *hole;
 
 	/* The caller is expected to reject zero-size allocations */
 	igt_assert(size > 0);
@@ -292,68 +614,31 @@ static bool simple_vma_heap_alloc(struct simple_vma_heap *heap,
 
 	simple_vma_heap_validate(heap);
 
-	/* Ensure we support only NONE/LOW_TO_HIGH/HIGH_TO_LOW strategies */
+	/* Ensure we support only NONE/LOW_TO_HIGH/HIGH_TO_LOW/BEST_FIT strategies */
 	igt_assert(strategy == ALLOC_STRATEGY_NONE ||
 		   strategy == ALLOC_STRATEGY_LOW_TO_HIGH ||
-		   strategy == ALLOC_STRATEGY_HIGH_TO_LOW);
+		   strategy == ALLOC_STRATEGY_HIGH_TO_LOW ||
+		   strategy == ALLOC_STRATEGY_BEST_FIT);
 
 	/* Use default strategy chosen on open */
 	if (strategy == ALLOC_STRATEGY_NONE)
 		strategy = heap->strategy;
 
-	if (strategy == ALLOC_STRATEGY_HIGH_TO_LOW) {
-		simple_vma_foreach_hole_safe(hole, heap, tmp) {
-			if (size > hole->size)
-				continue;
-			/*
-			 * Compute the offset as the highest address where a chunk of the
-			 * given size can be without going over the top of the hole.
-			 *
-			 * This calculation is known to not overflow because we know that
-			 * hole->size + hole->offset can only overflow to 0 and size > 0.
-			 */
-			*offset = (hole->size - size) + hole->offset;
-
-			/*
-			 * Align the offset.  We align down and not up because we are
-			 *
-			 * allocating from the top of the hole and not the bottom.
-			 */
-			*offset = (*offset / alignment) * alignment;
-
-			if (*offset < hole->offset)
-				continue;
-
-			simple_vma_hole_alloc(hole, *offset, size);
-			simple_vma_heap_validate(heap);
-			return true;
-		}
-	} else {
-		simple_vma_foreach_hole_safe_rev(hole, heap, tmp) {
-			if (size > hole->size)
-				continue;
-
-			*offset = hole->offset;
-
-			/* Align the offset */
-			misalign = *offset % alignment;
-			if (misalign) {
-				uint64_t pad = alignment - misalign;
-
-				if (pad > hole->size - size)
-					continue;
-
-				*offset += pad;
-			}
-
-			simple_vma_hole_alloc(hole, *offset, size);
-			simple_vma_heap_validate(heap);
-			return true;
-		}
-	}
+	if (strategy == ALLOC_STRATEGY_BEST_FIT)
+		hole = simple_vma_find_best_fit(heap->root[SIMPLE_VMA_TREE_SIZE],
+						size, alignment, offset);
+	else
+		hole = simple_vma_find_by_addr(heap->root[SIMPLE_VMA_TREE_ADDR],
+					       strategy == ALLOC_STRATEGY_HIGH_TO_LOW,
+					       size, alignment, offset);
 
 	/* Failed to allocate */
-	return false;
+	if (!hole)
+		return false;
+
+	simple_vma_hole_alloc(heap, hole, *offset, size);
+	simple_vma_heap_validate(heap);
+	return true;
 }
 
 static void intel_allocator_simple_get_address_range(struct intel_allocator *ial,
@@ -373,7 +658,7 @@ static bool simple_vma_heap_alloc_addr(struct intel_allocator_simple *ials,
 				       uint64_t offset, uint64_t size)
 {
 	struct simple_vma_heap *heap = &ials->heap;
-	struct simple_vma_hole *hole, *tmp;
+	struct simple_vma_hole *hole;
 
 	/* Allocating something with a size of 0 is not valid. */
 	igt_assert(size > 0);
@@ -384,26 +669,21 @@ static bool simple_vma_heap_alloc_addr(struct intel_allocator_simple *ials,
 	 */
 	igt_assert(offset + size == 0 || offset + size > offset);
 
-	/* Find the hole if one exists. */
-	simple_vma_foreach_hole_safe(hole, heap, tmp) {
-		if (hole->offset > offset)
-			continue;
-
-		/*
-		 * Holes are ordered high-to-low so the first hole we find with
-		 * hole->offset <= is our hole.  If it's not big enough to contain the
-		 * requested range, then the allocation fails.
-		 */
-		igt_assert(hole->offset <= offset);
-		if (hole->size < offset - hole->offset + size)
-			return false;
+	/*
+	 * Find the hole if one exists: the highest hole starting at or
+	 * below offset. If it's not big enough to contain the requested
+	 * range, then the allocation fails.
+	 */
+	hole = simple_vma_heap_find(heap, offset);
+	if (!hole)
+		return false;
 
-		simple_vma_hole_alloc(hole, offset, size);
-		return true;
-	}
+	igt_assert(hole->offset <= offset);
+	if (hole->size < offset - hole->offset + size)
+		return false;
 
-	/* We didn't find a suitable hole */
-	return false;
+	simple_vma_hole_alloc(heap, hole, offset, size);
+	return true;
 }
 
 static uint64_t intel_allocator_simple_alloc(struct intel_allocator *ial,
@@ -29,6 +29,7 @@
 #include "igt.h"
 #include "igt_x86.h"
 #include "intel_bufops.h"
+#include "intel_tiling.h"
 
 /**
  * SECTION:intel_bufops
@@ -246,186 +247,6 @@ static void set_hw_tiled(struct buf_ops *bops, struct intel_buf *buf)
 	buf->swizzle_mode = ret_swizzle;
 }
 
-static unsigned long swizzle_bit(unsigned int bit, unsigned long offset)
-{
-	return (offset & (1ul << bit)) >> (bit - 6);
-}
-
-static unsigned long swizzle_addr(void *ptr, uint32_t swizzle)
-{
-	unsigned long addr = to_user_pointer(ptr);
-
-	switch (swizzle) {
-	case I915_BIT_6_SWIZZLE_NONE:
-		return addr;
-	case I915_BIT_6_SWIZZLE_9:
-		return addr ^ swizzle_bit(9, addr);
-	case I915_BIT_6_SWIZZLE_9_10:
-		return addr ^ swizzle_bit(9, addr) ^ swizzle_bit(10, addr);
-	case I915_BIT_6_SWIZZLE_9_11:
-		return addr ^ swizzle_bit(9, addr) ^ swizzle_bit(11, addr);
-	case I915_BIT_6_SWIZZLE_9_10_11:
-		return (addr ^
-			swizzle_bit(9, addr) ^
-			swizzle_bit(10, addr) ^
-			swizzle_bit(11, addr));
-
-	case I915_BIT_6_SWIZZLE_UNKNOWN:
-	case I915_BIT_6_SWIZZLE_9_17:
-	case I915_BIT_6_SWIZZLE_9_10_17:
-	default:
-		igt_skip("physical swizzling mode impossible to handle in userspace\n");
-		return addr;
-	}
-}
-
-static void *x_ptr(void *ptr,
-		   unsigned int x, unsigned int y,
-		   unsigned int stride, unsigned int cpp)
-{
-	const int tile_width = 512;
-	const int tile_height = 8;
-	const int tile_size = tile_width * tile_height;
-	int offset_x, offset_y, pos;
-	int tile_x, tile_y;
-
-	x *= cpp;
-	tile_x = x / tile_width;
-	tile_y = y / tile_height;
-	offset_x = tile_x * tile_size;
-	offset_y = tile_y * stride * tile_height;
-
-	pos = (offset_y + (y % tile_height * tile_width) +
-	       offset_x + (x % tile_width));
-
-	return ptr + pos;
-}
-
-static void *y_ptr(void *ptr,
-		   unsigned int x, unsigned int y,
-		   unsigned int stride, unsigned int cpp)
-{
-	const int tile_width = 128;
-	const int tile_height = 32;
-	const int owords = 16;
-	const int tile_size = tile_width * tile_height;
-	int offset_x, offset_y, pos;
-	int shift_x, shift_y;
-	int tile_x, tile_y;
-
-	x *= cpp;
-	tile_x = x / tile_width;
-	tile_y = y / tile_height;
-	offset_x = tile_x * tile_size;
-	offset_y = tile_y * stride * tile_height;
-	shift_x = x % owords + (x % tile_width) / owords * tile_width * cpp;
-	shift_y = y % tile_height * owords;
-
-	pos = offset_y + offset_x + shift_x + shift_y;
-
-	return ptr + pos;
-}
-
-/*
- * (x,y) to memory location in tiled-4 surface
- *
- * coverted those divisions and multiplications to shifts and masks
- * in hope this wouldn't be so slow.
- */
-static void *tile4_ptr(void *ptr,
-			unsigned int x, unsigned int y,
-			unsigned int stride, unsigned int cpp)
-{
-	const int tile_width = 128;
-	const int tile_height = 32;
-	const int subtile_size = 64;
-	const int owords = 16;
-	int base, _x, _y, subtile, tile_x, tile_y;
-	int x_loc = x << __builtin_ctz(cpp);
-	int pos;
-
-	/* Pixel in tile via masks */
-	tile_x = x_loc & (tile_width - 1);
-	tile_y = y & (tile_height - 1);
-
-	/* subtile in 4k tile */
-	_x = tile_x >> __builtin_ctz(owords);
-	_y = tile_y >> 2;
-
-	/* tile-4 swizzle */
-	subtile = ((_y >> 1) << 4) + ((_y & 1) << 2) + (_x & 3) + ((_x & 4) << 1);
-
-	/* memory location */
-	base = (y >> __builtin_ctz(tile_height)) *
-		(stride << __builtin_ctz(tile_height)) +
-		(((x_loc >> __builtin_ctz(tile_width)) << __builtin_ctz(4096)));
-
-	pos = base + (subtile << __builtin_ctz(subtile_size)) +
-		((tile_y & 3) << __builtin_ctz(owords)) +
-		(tile_x & (owords - 1));
-	igt_assert((pos & (cpp - 1)) == 0);
-	pos = pos >> __builtin_ctz(cpp);
-
-	return ptr + pos;
-}
-
-
-static void *yf_ptr(void *ptr,
-		    unsigned int x, unsigned int y,
-		    unsigned int stride, unsigned int cpp)
-{
-	const int tile_size = 4 * 1024;
-	const int tile_width = 128;
-	int row_size = stride / tile_width * tile_size;
-
-	x *= cpp; /* convert to Byte offset */
-
-	/*
-	 * Within a 4k Yf tile, the byte swizzling pattern is
-	 * msb......lsb
-	 * xyxyxyyyxxxx
-	 * The tiles themselves are laid out in row major order.
-	 */
-	return ptr +
-		((x & 0xf) * 1) + /* 4x1 pixels(32bpp) = 16B */
-		((y & 0x3) * 16) + /* 4x4 pixels = 64B */
-		(((y & 0x4) >> 2) * 64) + /* 1x2 64B blocks */
-		(((x & 0x10) >> 4) * 128) + /* 2x2 64B blocks = 256B block */
-		(((y & 0x8) >> 3) * 256) + /* 2x1 256B blocks */
-		(((x & 0x20) >> 5) * 512) + /* 2x2 256B blocks */
-		(((y & 0x10) >> 4) * 1024) + /* 4x2 256 blocks */
-		(((x & 0x40) >> 6) * 2048) + /* 4x4 256B blocks = 4k tile */
-		(((x & ~0x7f) >> 7) * tile_size) + /* row of tiles */
-		(((y & ~0x1f) >> 5) * row_size);
-}
-
-typedef void *(*tile_fn)(void *, unsigned int, unsigned int,
-			unsigned int, unsigned int);
-static tile_fn __get_tile_fn_ptr(int tiling)
-{
-	tile_fn fn = NULL;
-
-	switch (tiling) {
-	case I915_TILING_X:
-		fn = x_ptr;
-		break;
-	case I915_TILING_Y:
-		fn = y_ptr;
-		break;
-	case I915_TILING_Yf:
-		fn = yf_ptr;
-		break;
-	case I915_TILING_4:
-		fn = tile4_ptr;
-	case I915_TILING_Ys:
-		/* To be implemented */
-		break;
-	}
-
-	igt_require_f(fn, "Can't find tile function for tiling: %d\n", tiling);
-	return fn;
-}
-
 static bool is_cache_coherent(int fd, uint32_t handle)
 {
 	return gem_get_caching(fd, handle) != I915_CACHING_NONE;
@@ -561,22 +382,20 @@ static void __copy_linear_to(int fd, struct intel_buf *buf,
 			     const uint32_t *linear,
 			     int tiling, uint32_t swizzle)
 {
-	const tile_fn fn = __get_tile_fn_ptr(tiling);
 	int height = intel_buf_height(buf);
 	int width = intel_buf_width(buf);
-	void *map = mmap_write(fd, buf);
-
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			uint32_t *ptr = fn(map, x, y, buf->surface[0].stride, buf->bpp/8);
+	int cpp = buf->bpp / 8;
+	void *map;
 
-			if (swizzle)
-				ptr = from_user_pointer(swizzle_addr(ptr,
-								     swizzle));
-			*ptr = linear[y * width + x];
-		}
-	}
+	igt_require_f(intel_tiling_is_supported(tiling),
+		      "Can't find tile function for tiling: %d\n", tiling);
+	if (!intel_tiling_swizzle_is_supported(swizzle))
+		igt_skip("physical swizzling mode impossible to handle in userspace\n");
 
+	map = mmap_write(fd, buf);
+	intel_linear_to_tiled(map, buf->surface[0].stride,
+			      linear, width * cpp, width, height, cpp,
+			      tiling, swizzle);
 	munmap(map, buf->surface[0].size);
 }
 
@@ -618,22 +437,19 @@ static void copy_linear_to_tile4(struct buf_ops *bops, struct intel_buf *buf,
 static void __copy_to_linear(int fd, struct intel_buf *buf,
 			     uint32_t *linear, int tiling, uint32_t swizzle)
 {
-	const tile_fn fn = __get_tile_fn_ptr(tiling);
 	int height = intel_buf_height(buf);
 	int width = intel_buf_width(buf);
-	void *map = mmap_write(fd, buf);
-
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			uint32_t *ptr = fn(map, x, y, buf->surface[0].stride, buf->bpp/8);
+	int cpp = buf->bpp / 8;
+	void *map;
 
-			if (swizzle)
-				ptr = from_user_pointer(swizzle_addr(ptr,
-								     swizzle));
-			linear[y * width + x] = *ptr;
-		}
-	}
+	igt_require_f(intel_tiling_is_supported(tiling),
+		      "Can't find tile function for tiling: %d\n", tiling);
+	if (!intel_tiling_swizzle_is_supported(swizzle))
+		igt_skip("physical swizzling mode impossible to handle in userspace\n");
 
+	map = mmap_write(fd, buf);
+	intel_tiled_to_linear(linear, width * cpp, map, buf->surface[0].stride,
+			      width, height, cpp, tiling, swizzle);
 	munmap(map, buf->surface[0].size);
 }
 
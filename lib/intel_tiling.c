@@ -0,0 +1,503 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "i915_drm.h"
+#include "igt_core.h"
+#include "intel_batchbuffer.h"
+#include "intel_tiling.h"
+
+/**
+ * SECTION:intel_tiling
+ * @short_description: Software tiling of plain memory
+ * @title: Software tiling
+ * @include: intel_tiling.h
+ *
+ * Converts between linear and X, Y, Yf and Tile4 tiled layouts in plain
+ * memory, optionally applying the bit 6 swizzling of the tiled addresses.
+ *
+ * All supported tilings use 4KiB tiles made of 64 byte chunks, either 64
+ * bytes of a single row (X) or 16 byte OWords of 4 consecutive rows (Y, Yf
+ * and Tile4). intel_linear_to_tiled() and intel_tiled_to_linear() walk the
+ * tiled side chunk by chunk, in memory order, and only the chunks on the
+ * right and bottom edges of the surface need clipping.
+ * intel_tiled_pixel_ptr() is the per pixel reference of the same layouts.
+ */
+
+#define TILE_SIZE	4096
+#define CHUNK_SIZE	64
+#define NUM_CHUNKS	(TILE_SIZE / CHUNK_SIZE)
+
+struct tile_layout {
+	unsigned int width;	/* in bytes */
+	unsigned int height;
+	unsigned int chunk_width;
+	unsigned int chunk_height;
+	/* Position in the tile of the i-th 64 byte chunk of tiled memory */
+	uint16_t x[NUM_CHUNKS];
+	uint16_t y[NUM_CHUNKS];
+};
+
+/**
+ * intel_tiling_is_supported:
+ * @tiling: I915_TILING_* tiling mode
+ *
+ * Returns:
+ * True if @tiling can be handled by the software tiling functions.
+ */
+bool intel_tiling_is_supported(uint32_t tiling)
+{
+	switch (tiling) {
+	case I915_TILING_X:
+	case I915_TILING_Y:
+	case I915_TILING_Yf:
+	case I915_TILING_4:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * intel_tiling_swizzle_is_supported:
+ * @swizzle: I915_BIT_6_SWIZZLE_* swizzling mode
+ *
+ * Returns:
+ * True if @swizzle only depends on the address bits visible to userspace,
+ * so can be applied by the software tiling functions.
+ */
+bool intel_tiling_swizzle_is_supported(uint32_t swizzle)
+{
+	switch (swizzle) {
+	case I915_BIT_6_SWIZZLE_NONE:
+	case I915_BIT_6_SWIZZLE_9:
+	case I915_BIT_6_SWIZZLE_9_10:
+	case I915_BIT_6_SWIZZLE_9_11:
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned long swizzle_bit(unsigned int bit, unsigned long offset)
+{
+	return (offset & (1ul << bit)) >> (bit - 6);
+}
+
+static unsigned long swizzle_addr(unsigned long addr, uint32_t swizzle)
+{
+	switch (swizzle) {
+	case I915_BIT_6_SWIZZLE_NONE:
+		return addr;
+	case I915_BIT_6_SWIZZLE_9:
+		return addr ^ swizzle_bit(9, addr);
+	case I915_BIT_6_SWIZZLE_9_10:
+		return addr ^ swizzle_bit(9, addr) ^ swizzle_bit(10, addr);
+	case I915_BIT_6_SWIZZLE_9_11:
+		return addr ^ swizzle_bit(9, addr) ^ swizzle_bit(11, addr);
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		return (addr ^
+			swizzle_bit(9, addr) ^
+			swizzle_bit(10, addr) ^
+			swizzle_bit(11, addr));
+	}
+
+	igt_assert_f(false, "Unsupported swizzling mode %u\n", swizzle);
+	return addr;
+}
+
+static void *x_ptr(void *ptr,
+		   unsigned int x, unsigned int y,
+		   unsigned int stride, unsigned int cpp)
+{
+	const int tile_width = 512;
+	const int tile_height = 8;
+	const int tile_size = tile_width * tile_height;
+	int offset_x, offset_y, pos;
+	int tile_x, tile_y;
+
+	x *= cpp;
+	tile_x = x / tile_width;
+	tile_y = y / tile_height;
+	offset_x = tile_x * tile_size;
+	offset_y = tile_y * stride * tile_height;
+
+	pos = (offset_y + (y % tile_height * tile_width) +
+	       offset_x + (x % tile_width));
+
+	return ptr + pos;
+}
+
+static void *y_ptr(void *ptr,
+		   unsigned int x, unsigned int y,
+		   unsigned int stride, unsigned int cpp)
+{
+	const int tile_width = 128;
+	const int tile_height = 32;
+	const int owords = 16;
+	const int tile_size = tile_width * tile_height;
+	int offset_x, offset_y, pos;
+	int shift_x, shift_y;
+	int tile_x, tile_y;
+
+	x *= cpp;
+	tile_x = x / tile_width;
+	tile_y = y / tile_height;
+	offset_x = tile_x * tile_size;
+	offset_y = tile_y * stride * tile_height;
+	shift_x = x % owords + (x % tile_width) / owords * tile_height * owords;
+	shift_y = y % tile_height * owords;
+
+	pos = offset_y + offset_x + shift_x + shift_y;
+
+	return ptr + pos;
+}
+
+/*
+ * (x,y) to memory location in tiled-4 surface
+ *
+ * coverted those divisions and multiplications to shifts and masks
+ * in hope this wouldn't be so slow.
+ */
+static void *tile4_ptr(void *ptr,
+			unsigned int x, unsigned int y,
+			unsigned int stride, unsigned int cpp)
+{
+	const int tile_width = 128;
+	const int tile_height = 32;
+	const int subtile_size = 64;
+	const int owords = 16;
+	int base, _x, _y, subtile, tile_x, tile_y;
+	int x_loc = x << __builtin_ctz(cpp);
+	int pos;
+
+	/* Pixel in tile via masks */
+	tile_x = x_loc & (tile_width - 1);
+	tile_y = y & (tile_height - 1);
+
+	/* subtile in 4k tile */
+	_x = tile_x >> __builtin_ctz(owords);
+	_y = tile_y >> 2;
+
+	/* tile-4 swizzle */
+	subtile = ((_y >> 1) << 4) + ((_y & 1) << 2) + (_x & 3) + ((_x & 4) << 1);
+
+	/* memory location */
+	base = (y >> __builtin_ctz(tile_height)) *
+		(stride << __builtin_ctz(tile_height)) +
+		(((x_loc >> __builtin_ctz(tile_width)) << __builtin_ctz(4096)));
+
+	pos = base + (subtile << __builtin_ctz(subtile_size)) +
+		((tile_y & 3) << __builtin_ctz(owords)) +
+		(tile_x & (owords - 1));
+
+	return ptr + pos;
+}
+
+static void *yf_ptr(void *ptr,
+		    unsigned int x, unsigned int y,
+		    unsigned int stride, unsigned int cpp)
+{
+	const int tile_size = 4 * 1024;
+	const int tile_width = 128;
+	int row_size = stride / tile_width * tile_size;
+
+	x *= cpp; /* convert to Byte offset */
+
+	/*
+	 * Within a 4k Yf tile, the byte swizzling pattern is
+	 * msb......lsb
+	 * xyxyxyyyxxxx
+	 * The tiles themselves are laid out in row major order.
+	 */
+	return ptr +
+		((x & 0xf) * 1) + /* 4x1 pixels(32bpp) = 16B */
+		((y & 0x3) * 16) + /* 4x4 pixels = 64B */
+		(((y & 0x4) >> 2) * 64) + /* 1x2 64B blocks */
+		(((x & 0x10) >> 4) * 128) + /* 2x2 64B blocks = 256B block */
+		(((y & 0x8) >> 3) * 256) + /* 2x1 256B blocks */
+		(((x & 0x20) >> 5) * 512) + /* 2x2 256B blocks */
+		(((y & 0x10) >> 4) * 1024) + /* 4x2 256 blocks */
+		(((x & 0x40) >> 6) * 2048) + /* 4x4 256B blocks = 4k tile */
+		(((x & ~0x7f) >> 7) * tile_size) + /* row of tiles */
+		(((y & ~0x1f) >> 5) * row_size);
+}
+
+/**
+ * intel_tiled_pixel_ptr:
+ * @tiled: Start of the tiled surface
+ * @tiling: I915_TILING_* tiling mode
+ * @swizzle: I915_BIT_6_SWIZZLE_* swizzling mode
+ * @x: Pixel column
+ * @y: Pixel row
+ * @stride: Stride of the tiled surface in bytes
+ * @cpp: Bytes per pixel
+ *
+ * Per pixel reference of the layouts used by intel_linear_to_tiled() and
+ * intel_tiled_to_linear(). Swizzling is applied to the CPU address, as for
+ * a mapping of the tiled object.
+ *
+ * Returns:
+ * The address of pixel (@x, @y) in @tiled.
+ */
+void *intel_tiled_pixel_ptr(void *tiled, uint32_t tiling, uint32_t swizzle,
+			    unsigned int x, unsigned int y,
+			    unsigned int stride, unsigned int cpp)
+{
+	void *ptr;
+
+	switch (tiling) {
+	case I915_TILING_X:
+		ptr = x_ptr(tiled, x, y, stride, cpp);
+		break;
+	case I915_TILING_Y:
+		ptr = y_ptr(tiled, x, y, stride, cpp);
+		break;
+	case I915_TILING_Yf:
+		ptr = yf_ptr(tiled, x, y, stride, cpp);
+		break;
+	case I915_TILING_4:
+		ptr = tile4_ptr(tiled, x, y, stride, cpp);
+		break;
+	default:
+		igt_assert_f(false, "Unsupported tiling %u\n", tiling);
+		return NULL;
+	}
+
+	if (swizzle)
+		ptr = (void *)swizzle_addr((unsigned long)ptr, swizzle);
+
+	return ptr;
+}
+
+static unsigned int chunk_index(uint32_t tiling, unsigned int ox,
+				unsigned int oy)
+{
+	switch (tiling) {
+	case I915_TILING_Y:
+		return ox * 8 + oy;
+	case I915_TILING_Yf:
+		return (oy & 1) | (ox & 1) << 1 | (oy & 2) << 1 |
+		       (ox & 2) << 2 | (oy & 4) << 2 | (ox & 4) << 3;
+	case I915_TILING_4:
+		return ((oy >> 1) << 4) + ((oy & 1) << 2) +
+		       (ox & 3) + ((ox & 4) << 1);
+	}
+
+	return 0;
+}
+
+static void get_tile_layout(uint32_t tiling, struct tile_layout *l)
+{
+	unsigned int i, ox, oy;
+
+	igt_assert_f(intel_tiling_is_supported(tiling),
+		     "Unsupported tiling %u\n", tiling);
+
+	if (tiling == I915_TILING_X) {
+		l->width = 512;
+		l->height = 8;
+		l->chunk_width = CHUNK_SIZE;
+		l->chunk_height = 1;
+
+		for (i = 0; i < NUM_CHUNKS; i++) {
+			l->x[i] = i % 8 * CHUNK_SIZE;
+			l->y[i] = i / 8;
+		}
+
+		return;
+	}
+
+	l->width = 128;
+	l->height = 32;
+	l->chunk_width = 16;
+	l->chunk_height = 4;
+
+	/* 8x8 chunks, each an OWord wide and 4 rows high */
+	for (ox = 0; ox < 8; ox++) {
+		for (oy = 0; oy < 8; oy++) {
+			i = chunk_index(tiling, ox, oy);
+			l->x[i] = ox * 16;
+			l->y[i] = oy * 4;
+		}
+	}
+}
+
+static inline void copy16(void *dst, const void *src)
+{
+#ifdef __SSE2__
+	_mm_storeu_si128(dst, _mm_loadu_si128(src));
+#else
+	memcpy(dst, src, 16);
+#endif
+}
+
+static inline void copy64(void *dst, const void *src)
+{
+#ifdef __SSE2__
+	__m128i a = _mm_loadu_si128(src);
+	__m128i b = _mm_loadu_si128(src + 16);
+	__m128i c = _mm_loadu_si128(src + 32);
+	__m128i d = _mm_loadu_si128(src + 48);
+
+	_mm_storeu_si128(dst, a);
+	_mm_storeu_si128(dst + 16, b);
+	_mm_storeu_si128(dst + 32, c);
+	_mm_storeu_si128(dst + 48, d);
+#else
+	memcpy(dst, src, 64);
+#endif
+}
+
+/* Copies a whole chunk, @pitch being the linear stride */
+static inline void copy_chunk(void *chunk, void *linear, unsigned int pitch,
+			      const struct tile_layout *l, bool to_tiled)
+{
+	unsigned int r;
+
+	if (l->chunk_height == 1) {
+		if (to_tiled)
+			copy64(chunk, linear);
+		else
+			copy64(linear, chunk);
+		return;
+	}
+
+	for (r = 0; r < 4; r++) {
+		if (to_tiled)
+			copy16(chunk + r * 16, linear + r * pitch);
+		else
+			copy16(linear + r * pitch, chunk + r * 16);
+	}
+}
+
+static void copy_chunk_clipped(void *chunk, void *linear, unsigned int pitch,
+			       const struct tile_layout *l,
+			       unsigned int bytes, unsigned int rows,
+			       bool to_tiled)
+{
+	unsigned int r;
+
+	for (r = 0; r < rows; r++) {
+		void *c = chunk + r * l->chunk_width;
+		void *p = linear + r * pitch;
+
+		if (to_tiled)
+			memcpy(c, p, bytes);
+		else
+			memcpy(p, c, bytes);
+	}
+}
+
+static void tiled_copy(void *tiled, unsigned int tiled_stride,
+		       void *linear, unsigned int linear_stride,
+		       unsigned int width, unsigned int height,
+		       unsigned int cpp, uint32_t tiling, uint32_t swizzle,
+		       bool to_tiled)
+{
+	unsigned int tx, ty, i, row_bytes = width * cpp;
+	struct tile_layout l;
+
+	get_tile_layout(tiling, &l);
+	igt_assert_f(tiled_stride % l.width == 0,
+		     "Stride %u not a multiple of the tile width\n",
+		     tiled_stride);
+	igt_assert_f(intel_tiling_swizzle_is_supported(swizzle),
+		     "Unsupported swizzling mode %u\n", swizzle);
+
+	for (ty = 0; ty * l.height < height; ty++) {
+		unsigned int y0 = ty * l.height;
+
+		for (tx = 0; tx * l.width < row_bytes; tx++) {
+			unsigned int x0 = tx * l.width;
+			void *tile = tiled + (uint64_t)ty * tiled_stride * l.height +
+				     (uint64_t)tx * TILE_SIZE;
+			void *base = linear + (uint64_t)y0 * linear_stride + x0;
+			bool full = x0 + l.width <= row_bytes &&
+				    y0 + l.height <= height;
+
+			for (i = 0; i < NUM_CHUNKS; i++) {
+				void *chunk = tile + i * CHUNK_SIZE;
+				void *lin = base + l.y[i] * linear_stride + l.x[i];
+
+				/* Bits 9-11 are the same over the whole chunk */
+				if (swizzle)
+					chunk = (void *)swizzle_addr((unsigned long)chunk,
+								     swizzle);
+
+				if (full) {
+					copy_chunk(chunk, lin, linear_stride,
+						   &l, to_tiled);
+				} else if (x0 + l.x[i] < row_bytes &&
+					   y0 + l.y[i] < height) {
+					unsigned int bytes = row_bytes - x0 - l.x[i];
+					unsigned int rows = height - y0 - l.y[i];
+
+					copy_chunk_clipped(chunk, lin,
+							   linear_stride, &l,
+							   bytes < l.chunk_width ?
+							   bytes : l.chunk_width,
+							   rows < l.chunk_height ?
+							   rows : l.chunk_height,
+							   to_tiled);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * intel_linear_to_tiled:
+ * @tiled: Destination tiled surface
+ * @tiled_stride: Stride of @tiled in bytes, a multiple of the tile width
+ * @linear: Source linear surface
+ * @linear_stride: Stride of @linear in bytes
+ * @width: Width in pixels
+ * @height: Height in pixels
+ * @cpp: Bytes per pixel
+ * @tiling: I915_TILING_* tiling mode of @tiled
+ * @swizzle: I915_BIT_6_SWIZZLE_* swizzling mode of @tiled
+ *
+ * Tiles @linear into @tiled a 64 byte chunk at a time. Tiled memory outside
+ * of @width and @height is left untouched. The result is the same as
+ * storing each pixel at intel_tiled_pixel_ptr(). When swizzling, @tiled
+ * should be at least 64 byte aligned, as are mappings of the object.
+ */
+void intel_linear_to_tiled(void *tiled, unsigned int tiled_stride,
+			   const void *linear, unsigned int linear_stride,
+			   unsigned int width, unsigned int height,
+			   unsigned int cpp, uint32_t tiling, uint32_t swizzle)
+{
+	tiled_copy(tiled, tiled_stride, (void *)linear, linear_stride,
+		   width, height, cpp, tiling, swizzle, true);
+}
+
+/**
+ * intel_tiled_to_linear:
+ * @linear: Destination linear surface
+ * @linear_stride: Stride of @linear in bytes
+ * @tiled: Source tiled surface
+ * @tiled_stride: Stride of @tiled in bytes, a multiple of the tile width
+ * @width: Width in pixels
+ * @height: Height in pixels
+ * @cpp: Bytes per pixel
+ * @tiling: I915_TILING_* tiling mode of @tiled
+ * @swizzle: I915_BIT_6_SWIZZLE_* swizzling mode of @tiled
+ *
+ * The inverse of intel_linear_to_tiled().
+ */
+void intel_tiled_to_linear(void *linear, unsigned int linear_stride,
+			   const void *tiled, unsigned int tiled_stride,
+			   unsigned int width, unsigned int height,
+			   unsigned int cpp, uint32_t tiling, uint32_t swizzle)
+{
+	tiled_copy((void *)tiled, tiled_stride, linear, linear_stride,
+		   width, height, cpp, tiling, swizzle, false);
+}
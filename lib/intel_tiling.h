@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef __INTEL_TILING_H__
+#define __INTEL_TILING_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool intel_tiling_is_supported(uint32_t tiling);
+bool intel_tiling_swizzle_is_supported(uint32_t swizzle);
+
+void *intel_tiled_pixel_ptr(void *tiled, uint32_t tiling, uint32_t swizzle,
+			    unsigned int x, unsigned int y,
+			    unsigned int stride, unsigned int cpp);
+
+void intel_linear_to_tiled(void *tiled, unsigned int tiled_stride,
+			   const void *linear, unsigned int linear_stride,
+			   unsigned int width, unsigned int height,
+			   unsigned int cpp, uint32_t tiling, uint32_t swizzle);
+void intel_tiled_to_linear(void *linear, unsigned int linear_stride,
+			   const void *tiled, unsigned int tiled_stride,
+			   unsigned int width, unsigned int height,
+			   unsigned int cpp, uint32_t tiling, uint32_t swizzle);
+
+#endif /* __INTEL_TILING_H__ */
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "igt_core.h"
+
+#include "i915/perf.h"
+#include "i915_drm.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+#define REPORT_SIZE 256
+#define N_RECORDS 1000
+
+static const struct {
+	const char *name;
+	int oa_format;
+} formats[] = {
+	{ "a24u40-a14u32-b8-c8", I915_OA_FORMAT_A24u40_A14u32_B8_C8 },
+	{ "a32u40-a4u32-b8-c8", I915_OA_FORMAT_A32u40_A4u32_B8_C8 },
+	{ "a45-b8-c8", I915_OA_FORMAT_A45_B8_C8 },
+};
+
+struct record {
+	struct drm_i915_perf_record_header header;
+	uint32_t report[REPORT_SIZE / 4];
+};
+
+static struct record *records;
+static const struct drm_i915_perf_record_header *headers[N_RECORDS];
+
+/*
+ * Counters only ever go up, by small steps mostly and now and then by
+ * enough to wrap the 32bit and 40bit counters.
+ */
+static void fill_records(void)
+{
+	records = calloc(N_RECORDS, sizeof(*records));
+	igt_assert(records);
+
+	for (int i = 0; i < N_RECORDS; i++) {
+		uint8_t *high = (uint8_t *)(records[i].report + 40);
+
+		records[i].header.type = DRM_I915_PERF_RECORD_SAMPLE;
+		records[i].header.size = sizeof(records[i]);
+		headers[i] = &records[i].header;
+
+		for (int dw = 0; dw < REPORT_SIZE / 4; dw++) {
+			uint32_t step = random() % 8 ? random() % 0x10000 : random();
+
+			records[i].report[dw] = i ? records[i - 1].report[dw] + step : random();
+		}
+
+		/* Carry the low dword of the 40bit counters into the high bytes. */
+		for (int a = 0; a < 32; a++) {
+			const uint8_t *prev_high;
+
+			if (!i) {
+				high[a] = random();
+				continue;
+			}
+
+			prev_high = (const uint8_t *)(records[i - 1].report + 40);
+			high[a] = prev_high[a] +
+				(records[i].report[4 + a] < records[i - 1].report[4 + a]);
+		}
+	}
+}
+
+static void check_accumulate(int f, int32_t oa_timestamp_shift)
+{
+	struct intel_perf perf = {
+		.devinfo.oa_timestamp_shift = oa_timestamp_shift,
+	};
+	struct intel_perf_metric_set metric_set = {
+		.perf_oa_format = formats[f].oa_format,
+	};
+	intel_perf_accumulate_fn scalar, simd;
+	static const uint32_t counts[] = { 0, 1, 2, 3, 64, 65, 66, 129, N_RECORDS };
+
+	scalar = intel_perf_get_accumulate_fn(formats[f].oa_format, false);
+	simd = intel_perf_get_accumulate_fn(formats[f].oa_format, true);
+	igt_assert(scalar && simd);
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		struct intel_perf_accumulator pairwise = {}, acc;
+		const struct drm_i915_perf_record_header * const *first =
+			headers + (N_RECORDS - counts[c]) / 2;
+
+		metric_set.accumulate_reports = scalar;
+		for (uint32_t i = 1; i < counts[c]; i++) {
+			intel_perf_accumulate_reports(&acc, &perf, &metric_set,
+						      first[i - 1], first[i]);
+			for (int d = 0; d < ARRAY_SIZE(acc.deltas); d++)
+				pairwise.deltas[d] += acc.deltas[d];
+		}
+
+		intel_perf_accumulate_reports_batch(&acc, &perf, &metric_set,
+						    first, counts[c]);
+		igt_assert_f(!memcmp(&acc, &pairwise, sizeof(acc)),
+			     "scalar batch of %u reports differs\n", counts[c]);
+
+		metric_set.accumulate_reports = simd;
+		intel_perf_accumulate_reports_batch(&acc, &perf, &metric_set,
+						    first, counts[c]);
+		for (int d = 0; d < ARRAY_SIZE(acc.deltas); d++)
+			igt_assert_f(acc.deltas[d] == pairwise.deltas[d],
+				     "simd batch of %u reports differs in delta %d: %"PRIu64" vs %"PRIu64"\n",
+				     counts[c], d, acc.deltas[d], pairwise.deltas[d]);
+	}
+}
+
+igt_main
+{
+	igt_fixture {
+		srandom(0xdeadbeef);
+		fill_records();
+	}
+
+	for (int f = 0; f < ARRAY_SIZE(formats); f++) {
+		igt_subtest(formats[f].name) {
+			check_accumulate(f, 0);
+			check_accumulate(f, -1);
+			check_accumulate(f, 1);
+		}
+	}
+
+	igt_fixture
+		free(records);
+}
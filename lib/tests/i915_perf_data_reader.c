@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "igt_core.h"
+
+#include "i915/perf.h"
+#include "i915/perf_data.h"
+#include "i915/perf_data_reader.h"
+
+#define N_SAMPLES 50000
+#define REPORT_SIZE 256
+#define TS_FREQUENCY 19200000ull
+#define TS_BEGIN 0xf0000000ull
+#define TS_STEP 0x40000ull /* wraps the 32bit OA timestamps a few times */
+#define CORRELATION_PERIOD 1000
+#define CPU_BASE 1000000000000ull
+
+static char dir[] = "/tmp/igt_perf_data_reader.XXXXXX";
+static char path[64], index_path[64];
+
+static uint64_t sample_ts(uint64_t i)
+{
+	return TS_BEGIN + i * TS_STEP;
+}
+
+static uint64_t cpu_ts(uint64_t gpu_ts)
+{
+	return CPU_BASE + (gpu_ts - TS_BEGIN) * 1000000000ull / TS_FREQUENCY;
+}
+
+static uint32_t sample_ctx_id(uint64_t i)
+{
+	return (i / 37) % 5;
+}
+
+static void write_record(FILE *file, uint32_t type,
+			 const void *data, size_t size)
+{
+	struct drm_i915_perf_record_header header = {
+		.type = type,
+		.size = sizeof(header) + size,
+	};
+
+	igt_assert(fwrite(&header, sizeof(header), 1, file) == 1);
+	igt_assert(fwrite(data, size, 1, file) == 1);
+}
+
+static void write_correlation(FILE *file, uint64_t gpu_ts)
+{
+	struct intel_perf_record_timestamp_correlation corr = {
+		.cpu_timestamp = cpu_ts(gpu_ts),
+		.gpu_timestamp = gpu_ts & 0xfffffffffull,
+	};
+
+	write_record(file, INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION,
+		     &corr, sizeof(corr));
+}
+
+static void write_recording(void)
+{
+	struct intel_perf_record_version version = {
+		.version = INTEL_PERF_RECORD_VERSION,
+	};
+	struct intel_perf_record_device_info info = {
+		.timestamp_frequency = TS_FREQUENCY,
+		.device_id = 0x9a49,
+		.gt_min_frequency = 300,
+		.gt_max_frequency = 1300,
+		.oa_format = I915_OA_FORMAT_A32u40_A4u32_B8_C8,
+		.metric_set_name = "RenderBasic",
+		.metric_set_uuid = "0fc397c0-4833-492c-9ccd-4929d574d5b8",
+	};
+	/* 1 slice, 1 subslice, 8 EUs */
+	struct {
+		struct drm_i915_query_topology_info topology;
+		uint8_t data[8];
+	} topology = {
+		.topology = {
+			.max_slices = 1,
+			.max_subslices = 1,
+			.max_eus_per_subslice = 8,
+			.subslice_offset = 1,
+			.subslice_stride = 1,
+			.eu_offset = 2,
+			.eu_stride = 1,
+		},
+		.data = { 0x1, 0x1, 0xff },
+	};
+	uint32_t report[REPORT_SIZE / 4] = {};
+	FILE *file;
+
+	file = fopen(path, "w");
+	igt_assert(file);
+
+	write_record(file, INTEL_PERF_RECORD_TYPE_VERSION,
+		     &version, sizeof(version));
+	write_record(file, INTEL_PERF_RECORD_TYPE_DEVICE_INFO,
+		     &info, sizeof(info));
+	write_record(file, INTEL_PERF_RECORD_TYPE_DEVICE_TOPOLOGY,
+		     &topology, sizeof(topology));
+
+	for (uint64_t i = 0; i < N_SAMPLES; i++) {
+		if (i % CORRELATION_PERIOD == 0)
+			write_correlation(file, sample_ts(i));
+
+		report[1] = sample_ts(i);
+		report[2] = sample_ctx_id(i);
+		write_record(file, DRM_I915_PERF_RECORD_SAMPLE,
+			     report, sizeof(report));
+	}
+	write_correlation(file, sample_ts(N_SAMPLES));
+
+	igt_assert(fclose(file) == 0);
+}
+
+static int open_stream(struct intel_perf_data_stream *stream,
+		       const char *index)
+{
+	int fd = open(path, O_RDONLY);
+
+	igt_assert(fd >= 0);
+	igt_assert_f(intel_perf_data_stream_open(stream, fd, index),
+		     "%s\n", stream->error_msg);
+
+	return fd;
+}
+
+static void close_stream(struct intel_perf_data_stream *stream, int fd)
+{
+	intel_perf_data_stream_close(stream);
+	close(fd);
+}
+
+static void check_range(struct intel_perf_data_stream *stream,
+			uint64_t begin, uint64_t end)
+{
+	struct intel_perf_data_iter iter;
+	uint64_t i = 0, n = 0;
+
+	while (i < N_SAMPLES && sample_ts(i) < begin)
+		i++;
+
+	igt_assert(intel_perf_data_iter_init(&iter, stream, begin, end));
+
+	while (intel_perf_data_iter_next(&iter)) {
+		const uint32_t *report = (const uint32_t *)(iter.record + 1);
+
+		igt_assert_eq_u64(iter.current.sample, i);
+		igt_assert_eq_u64(iter.current.gpu_ts, sample_ts(i));
+		igt_assert_eq_u32(report[2], sample_ctx_id(i));
+		igt_assert_eq_u32(intel_perf_data_stream_ctx_id(stream, iter.record),
+				  sample_ctx_id(i));
+		i++;
+		n++;
+	}
+
+	/* Hitting the end is sticky */
+	igt_assert(!intel_perf_data_iter_next(&iter));
+
+	igt_assert(i == N_SAMPLES || sample_ts(i) >= end);
+	igt_assert(n == 0 || sample_ts(i - n) >= begin);
+
+	intel_perf_data_iter_fini(&iter);
+}
+
+static void test_scan(void)
+{
+	struct intel_perf_data_stream stream;
+	int fd = open_stream(&stream, NULL);
+
+	igt_assert_eq_u64(stream.n_samples, N_SAMPLES);
+	igt_assert_eq_u32(stream.n_correlations, N_SAMPLES / CORRELATION_PERIOD + 1);
+	igt_assert(stream.n_index > 1);
+	igt_assert_eq_u64(stream.last.sample, N_SAMPLES - 1);
+	igt_assert_eq_u64(stream.last.gpu_ts, sample_ts(N_SAMPLES - 1));
+
+	for (uint32_t i = 1; i < stream.n_index; i++) {
+		igt_assert(stream.index[i].gpu_ts > stream.index[i - 1].gpu_ts);
+		igt_assert(stream.index[i].offset - stream.index[i - 1].offset >=
+			   INTEL_PERF_DATA_INDEX_STRIDE);
+	}
+
+	check_range(&stream, 0, UINT64_MAX);
+
+	close_stream(&stream, fd);
+}
+
+static void test_range(void)
+{
+	struct intel_perf_data_stream stream;
+	int fd = open_stream(&stream, NULL);
+
+	check_range(&stream, sample_ts(0), sample_ts(1));
+	check_range(&stream, sample_ts(N_SAMPLES - 1), UINT64_MAX);
+	check_range(&stream, sample_ts(N_SAMPLES), UINT64_MAX);
+	check_range(&stream, 0, sample_ts(0));
+
+	for (int i = 0; i < 100; i++) {
+		uint64_t begin = sample_ts(0) + random() % (N_SAMPLES * TS_STEP);
+		uint64_t end = begin + random() % (N_SAMPLES * TS_STEP / 10);
+
+		check_range(&stream, begin, end);
+	}
+
+	close_stream(&stream, fd);
+}
+
+static void test_seek(void)
+{
+	struct intel_perf_data_stream stream;
+	struct intel_perf_data_index_entry pos;
+	struct intel_perf_data_iter iter;
+	int fd = open_stream(&stream, NULL);
+	uint64_t chunk_offset;
+
+	igt_assert(intel_perf_data_iter_init(&iter, &stream, 0, UINT64_MAX));
+
+	for (int i = 0; i < 12345; i++)
+		igt_assert(intel_perf_data_iter_next(&iter));
+	pos = iter.current;
+
+	for (int i = 0; i < 20000; i++)
+		igt_assert(intel_perf_data_iter_next(&iter));
+
+	intel_perf_data_iter_seek(&iter, &pos);
+	igt_assert(intel_perf_data_iter_next(&iter));
+	igt_assert_eq_u64(iter.current.sample, 12344);
+	igt_assert_eq_u64(iter.current.gpu_ts, sample_ts(12344));
+
+	/* Back within what was read, the chunk stays */
+	for (int i = 0; i < 50; i++)
+		igt_assert(intel_perf_data_iter_next(&iter));
+	pos = iter.current;
+	chunk_offset = iter.chunk_offset;
+	igt_assert(pos.offset > chunk_offset);
+
+	for (int i = 0; i < 100; i++)
+		igt_assert(intel_perf_data_iter_next(&iter));
+
+	intel_perf_data_iter_seek(&iter, &pos);
+	igt_assert_eq_u64(iter.chunk_offset, chunk_offset);
+	for (int i = 0; i < 2; i++) {
+		igt_assert(intel_perf_data_iter_next(&iter));
+		igt_assert_eq_u64(iter.current.sample, 12394 + i);
+		igt_assert_eq_u64(iter.current.gpu_ts, sample_ts(12394 + i));
+	}
+
+	intel_perf_data_iter_fini(&iter);
+	close_stream(&stream, fd);
+}
+
+static void test_index(void)
+{
+	struct intel_perf_data_stream built, loaded;
+	int fd0, fd1;
+
+	unlink(index_path);
+
+	fd0 = open_stream(&built, index_path);
+	igt_assert(access(index_path, R_OK) == 0);
+	fd1 = open_stream(&loaded, index_path);
+
+	igt_assert_eq_u64(loaded.n_samples, built.n_samples);
+	igt_assert(!memcmp(&loaded.last, &built.last, sizeof(built.last)));
+	igt_assert_eq_u32(loaded.n_index, built.n_index);
+	igt_assert(!memcmp(loaded.index, built.index,
+			   built.n_index * sizeof(*built.index)));
+	igt_assert_eq_u32(loaded.n_correlations, built.n_correlations);
+	igt_assert(!memcmp(loaded.correlations, built.correlations,
+			   built.n_correlations * sizeof(*built.correlations)));
+	igt_assert(!strcmp(loaded.metric_set->symbol_name, "RenderBasic"));
+
+	check_range(&loaded, sample_ts(N_SAMPLES / 3), sample_ts(N_SAMPLES / 2));
+
+	close_stream(&loaded, fd1);
+	close_stream(&built, fd0);
+}
+
+static void test_cpu_timestamp(void)
+{
+	struct intel_perf_data_stream stream;
+	int fd = open_stream(&stream, NULL);
+
+	for (uint64_t i = 0; i < N_SAMPLES; i += 97) {
+		uint64_t cpu = intel_perf_data_stream_cpu_timestamp(&stream,
+								    sample_ts(i));
+
+		igt_assert_f(llabs((long long)(cpu - cpu_ts(sample_ts(i)))) <= 1,
+			     "sample %" PRIu64 ": %" PRIu64 " vs %" PRIu64 "\n",
+			     i, cpu, cpu_ts(sample_ts(i)));
+	}
+
+	close_stream(&stream, fd);
+}
+
+igt_main
+{
+	igt_fixture {
+		srandom(0xdeadbeef);
+		igt_assert(mkdtemp(dir));
+		snprintf(path, sizeof(path), "%s/recording", dir);
+		snprintf(index_path, sizeof(index_path), "%s/recording.idx", dir);
+		write_recording();
+	}
+
+	igt_subtest("scan")
+		test_scan();
+
+	igt_subtest("range")
+		test_range();
+
+	igt_subtest("seek")
+		test_seek();
+
+	igt_subtest("index")
+		test_index();
+
+	igt_subtest("cpu-timestamp")
+		test_cpu_timestamp();
+
+	igt_fixture {
+		unlink(index_path);
+		unlink(path);
+		rmdir(dir);
+	}
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "igt_core.h"
+#include "igt_crc.h"
+#include "igt_x86.h"
+
+static uint32_t crc32_ref(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint32_t crc = ~0U;
+
+	while (size--)
+		crc = igt_crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ ~0U;
+}
+
+static uint8_t *random_buf(size_t size)
+{
+	uint8_t *buf = malloc(size);
+	size_t i;
+
+	igt_assert(buf);
+	for (i = 0; i < size; i++)
+		buf[i] = random();
+
+	return buf;
+}
+
+static void test_check_value(void)
+{
+	igt_assert_eq_u32(igt_cpu_crc32("123456789", 9), 0xcbf43926);
+	igt_assert_eq_u32(igt_cpu_crc32("", 0), 0);
+}
+
+static void test_impl(unsigned int features)
+{
+	igt_crc32_fn fn = igt_crc32_get_impl(features);
+	const size_t size = 4096;
+	uint8_t *buf = random_buf(size + 16);
+	size_t offset, len;
+
+	/* All alignments and the lengths around the folding block sizes */
+	for (offset = 0; offset < 16; offset++)
+		for (len = 0; len <= 300; len++)
+			igt_assert_eq_u32(fn(buf + offset, len),
+					  crc32_ref(buf + offset, len));
+
+	for (len = size - 80; len <= size; len++)
+		igt_assert_eq_u32(fn(buf + 3, len), crc32_ref(buf + 3, len));
+
+	free(buf);
+}
+
+static void test_combine(void)
+{
+	const size_t size = 1 << 16;
+	uint8_t *buf = random_buf(size);
+	uint32_t crc = crc32_ref(buf, size);
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		size_t split = i < 8 ? i : random() % size;
+
+		igt_assert_eq_u32(igt_crc32_combine(igt_cpu_crc32(buf, split),
+						    igt_cpu_crc32(buf + split,
+								  size - split),
+						    size - split),
+				  crc);
+	}
+
+	free(buf);
+}
+
+static void test_parallel(void)
+{
+	const size_t size = (64 << 20) + 13;
+	uint8_t *buf = random_buf(size);
+	uint32_t crc = igt_cpu_crc32(buf, size);
+	unsigned int threads;
+
+	for (threads = 0; threads <= 5; threads++)
+		igt_assert_eq_u32(igt_cpu_crc32_parallel(buf, size, threads),
+				  crc);
+
+	free(buf);
+}
+
+igt_main
+{
+	igt_fixture
+		srandom(0xdeadbeef);
+
+	igt_subtest("check-value")
+		test_check_value();
+
+	igt_subtest("slice8")
+		test_impl(0);
+
+	igt_subtest("pclmul") {
+		igt_require((igt_x86_features() & (PCLMUL | SSE4_1)) ==
+			    (PCLMUL | SSE4_1));
+		test_impl(PCLMUL | SSE4_1);
+	}
+
+	igt_subtest("combine")
+		test_combine();
+
+	igt_subtest("parallel")
+		test_parallel();
+}
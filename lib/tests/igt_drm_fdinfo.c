@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2023 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "igt_core.h"
+#include "igt_drm_fdinfo.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static const char i915_fdinfo[] =
+	"pos:\t0\n"
+	"flags:\t02100002\n"
+	"mnt_id:\t26\n"
+	"ino:\t1073\n"
+	"drm-driver:\ti915\n"
+	"drm-pdev:\t0000:00:02.0\n"
+	"drm-client-id:\t42\n"
+	"drm-engine-render:\t1000 ns\n"
+	"drm-engine-copy:\t2000 ns\n"
+	"drm-engine-video:\t3000 ns\n"
+	"drm-engine-capacity-video:\t2\n"
+	"drm-engine-video-enhance:\t4000 ns\n"
+	"drm-cycles-render:\t500\n"
+	"drm-total-cycles-render:\t100000\n"
+	"drm-total-system0:\t4 KiB\n"
+	"drm-resident-system0:\t2 MiB\n"
+	"drm-shared-system0:\t0\n"
+	"drm-total-local0:\t8192\n"
+	"drm-purgeable-local0:\t1 KiB\n"
+	"drm-active-local0:\t0";
+
+static void test_record(void)
+{
+	struct drm_client_record *rec;
+	struct drm_client_batch batch;
+
+	igt_drm_client_batch_init(&batch);
+
+	rec = __igt_parse_drm_client_record(&batch, i915_fdinfo,
+					    strlen(i915_fdinfo));
+	igt_assert(rec);
+
+	igt_assert_eq(rec->id, 42);
+	igt_assert(!strcmp(drm_client_batch_string(&batch, rec->driver),
+			   "i915"));
+	igt_assert(!strcmp(drm_client_batch_string(&batch, rec->pdev),
+			   "0000:00:02.0"));
+
+	igt_assert_eq(rec->num_engines, 4);
+	igt_assert_eq(rec->busy[0], 1000);
+	igt_assert_eq(rec->busy[1], 2000);
+	igt_assert_eq(rec->busy[2], 3000);
+	igt_assert_eq(rec->busy[3], 4000);
+	igt_assert_eq(rec->capacity[0], 1);
+	igt_assert_eq(rec->capacity[2], 2);
+	igt_assert_eq(rec->cycles[0], 500);
+	igt_assert_eq(rec->total_cycles[0], 100000);
+
+	igt_assert_eq(rec->num_regions, 2);
+	igt_assert(!strcmp(drm_client_batch_string(&batch, rec->region[0]),
+			   "system0"));
+	igt_assert(!strcmp(drm_client_batch_string(&batch, rec->region[1]),
+			   "local0"));
+	igt_assert_eq(rec->mem[0].total, 4096);
+	igt_assert_eq(rec->mem[0].resident, 2 << 20);
+	igt_assert_eq(rec->mem[1].total, 8192);
+	igt_assert_eq(rec->mem[1].purgeable, 1024);
+
+	igt_drm_client_batch_fini(&batch);
+}
+
+static void test_intern(void)
+{
+	struct drm_client_record *a, *b;
+	struct drm_client_batch batch;
+
+	igt_drm_client_batch_init(&batch);
+
+	a = __igt_parse_drm_client_record(&batch, i915_fdinfo,
+					  strlen(i915_fdinfo));
+	igt_assert(a);
+	b = __igt_parse_drm_client_record(&batch, i915_fdinfo,
+					  strlen(i915_fdinfo));
+	igt_assert(b);
+	a = &batch.records[0];
+
+	igt_assert_eq(batch.num_records, 2);
+	igt_assert_eq(a->driver, b->driver);
+	igt_assert_eq(a->pdev, b->pdev);
+	igt_assert_eq(a->region[1], b->region[1]);
+	igt_assert_eq(batch.num_strings, 4);
+
+	igt_drm_client_batch_reset(&batch);
+	igt_assert_eq(batch.num_records, 0);
+	igt_assert_eq(batch.num_strings, 0);
+
+	igt_drm_client_batch_fini(&batch);
+}
+
+static void test_invalid(void)
+{
+	static const char no_id[] =
+		"drm-driver:\ti915\n"
+		"drm-engine-render:\t1000 ns\n";
+	static const char no_driver[] =
+		"drm-client-id:\t1\n"
+		"drm-engine-render:\t1000 ns\n";
+	static const char not_drm[] =
+		"pos:\t0\n"
+		"flags:\t02\n";
+	/* Repeated keys must not stand in for missing ones */
+	static const char twice_id[] =
+		"drm-client-id:\t1\n"
+		"drm-client-id:\t1\n"
+		"drm-engine-render:\t1000 ns\n";
+	static const char twice_driver[] =
+		"drm-driver:\ti915\n"
+		"drm-driver:\ti915\n"
+		"drm-engine-render:\t1000 ns\n";
+	struct drm_client_batch batch;
+
+	igt_drm_client_batch_init(&batch);
+
+	igt_assert(!__igt_parse_drm_client_record(&batch, no_id,
+						  strlen(no_id)));
+	igt_assert(!__igt_parse_drm_client_record(&batch, no_driver,
+						  strlen(no_driver)));
+	igt_assert(!__igt_parse_drm_client_record(&batch, not_drm,
+						  strlen(not_drm)));
+	igt_assert(!__igt_parse_drm_client_record(&batch, twice_id,
+						  strlen(twice_id)));
+	igt_assert(!__igt_parse_drm_client_record(&batch, twice_driver,
+						  strlen(twice_driver)));
+	igt_assert_eq(batch.num_records, 0);
+
+	igt_drm_client_batch_fini(&batch);
+}
+
+static void test_batch(void)
+{
+	const char *names[] = { "3", "4", "5" };
+	char dir[] = "/tmp/igt_drm_fdinfo.XXXXXX";
+	struct drm_client_fdinfo info = { };
+	struct drm_client_batch batch;
+	unsigned int i;
+	int dirfd;
+
+	igt_assert(mkdtemp(dir));
+	dirfd = open(dir, O_DIRECTORY | O_RDONLY);
+	igt_assert_fd(dirfd);
+
+	/* The last one is left missing on purpose. */
+	for (i = 0; i < ARRAY_SIZE(names) - 1; i++) {
+		int fd;
+
+		fd = openat(dirfd, names[i], O_WRONLY | O_CREAT, 0644);
+		igt_assert_fd(fd);
+		igt_assert_eq(write(fd, i915_fdinfo, strlen(i915_fdinfo)),
+			      strlen(i915_fdinfo));
+		close(fd);
+	}
+
+	igt_drm_client_batch_init(&batch);
+	igt_assert_eq(igt_parse_drm_fdinfo_batch(&batch, dirfd, names,
+						 ARRAY_SIZE(names)), 2);
+	igt_assert_eq(batch.records[1].busy[3], 4000);
+	igt_drm_client_batch_fini(&batch);
+
+	/* Legacy parser must agree with the batch one. */
+	igt_assert(__igt_parse_drm_fdinfo(dirfd, names[0], &info));
+	igt_assert(!strcmp(info.driver, "i915"));
+	igt_assert(!strcmp(info.pdev, "0000:00:02.0"));
+	igt_assert_eq(info.id, 42);
+	igt_assert_eq(info.num_engines, 4);
+	igt_assert_eq(info.busy[3], 4000);
+	igt_assert_eq(info.capacity[2], 2);
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		unlinkat(dirfd, names[i], 0);
+	close(dirfd);
+	rmdir(dir);
+}
+
+igt_main
+{
+	igt_subtest("record")
+		test_record();
+
+	igt_subtest("intern")
+		test_intern();
+
+	igt_subtest("invalid")
+		test_invalid();
+
+	igt_subtest("batch")
+		test_batch();
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <drm_fourcc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drmtest.h"
+#include "igt_core.h"
+#include "igt_fb.h"
+#include "igt_kms.h"
+
+/* Big enough to be converted in bands on the worker pool */
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static int fd = -1;
+
+/* Limited range grey ramp, one level per row */
+static uint8_t luma(int y)
+{
+	return 16 + y % 220;
+}
+
+/*
+ * Converts an NV12 dumb buffer to XRGB8888 and back, as drawing to it
+ * with cairo does. Neither needs slow reads, so the bands are converted
+ * without asking for scratch memory.
+ */
+static void convert_nv12(void)
+{
+	struct igt_fb fb;
+	cairo_surface_t *surface;
+	uint8_t *ptr, *rgb;
+	int stride, x, y;
+
+	igt_create_bo_for_fb(fd, WIDTH, HEIGHT, DRM_FORMAT_NV12,
+			     DRM_FORMAT_MOD_LINEAR, &fb);
+
+	ptr = igt_fb_map_buffer(fd, &fb);
+	for (y = 0; y < HEIGHT; y++)
+		memset(ptr + fb.offsets[0] + y * fb.strides[0], luma(y), WIDTH);
+	memset(ptr + fb.offsets[1], 0x80, fb.strides[1] * (HEIGHT / 2));
+	igt_fb_unmap_buffer(&fb, ptr);
+
+	surface = igt_get_cairo_surface(fd, &fb);
+	rgb = cairo_image_surface_get_data(surface);
+	stride = cairo_image_surface_get_stride(surface);
+
+	for (y = 0; y < HEIGHT; y++) {
+		int grey = ((luma(y) - 16) * 255 + 109) / 219;
+
+		for (x = 0; x < WIDTH; x += WIDTH / 4 - 1) {
+			uint8_t *pixel = rgb + y * stride + x * 4;
+
+			igt_assert_f(abs(pixel[0] - grey) <= 1 &&
+				     abs(pixel[1] - grey) <= 1 &&
+				     abs(pixel[2] - grey) <= 1,
+				     "(%d, %d) is %02x%02x%02x, expected %02x\n",
+				     x, y, pixel[2], pixel[1], pixel[0], grey);
+		}
+	}
+
+	/* Converts back to NV12 */
+	cairo_surface_destroy(surface);
+
+	kmstest_dumb_destroy(fd, fb.gem_handle);
+}
+
+igt_main
+{
+	igt_fixture
+		fd = drm_open_driver(DRIVER_VGEM);
+
+	igt_subtest("convert")
+		convert_nv12();
+
+	igt_subtest("convert-in-child") {
+		/* The pool of the parent must not be used in the child */
+		convert_nv12();
+
+		igt_fork(child, 1)
+			convert_nv12();
+		igt_waitchildren_timeout(60, "conversion deadlocked");
+	}
+
+	igt_fixture
+		close(fd);
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <drm_fourcc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drmtest.h"
+#include "igt_core.h"
+#include "igt_fb.h"
+#include "igt_kms.h"
+#include "igt_rand.h"
+
+/* Odd sizes, so no row or rectangle is a multiple of anything */
+#define WIDTH 67
+#define HEIGHT 45
+
+static const struct {
+	int x, y, width, height;
+} rects[] = {
+	{ 0, 0, WIDTH, HEIGHT },
+	{ 0, 0, 1, 1 },
+	{ 1, 2, 3, 5 },
+	{ WIDTH - 1, 0, 1, HEIGHT },
+	{ 0, HEIGHT - 1, WIDTH, 1 },
+	{ 5, 7, WIDTH - 6, HEIGHT - 8 },
+	{ 3, 3, 0, 4 },
+	{ 3, 3, 4, 0 },
+};
+
+static int fd = -1;
+static struct igt_fb fb;
+static uint8_t *pixels; /* What the buffer holds */
+
+/*
+ * The DP CRC16 one bit at a time, MSB first. This is what the parallel
+ * equations of update_crc16_dp() in igt_fb.c compute for 16 data bits.
+ */
+static uint16_t crc16_dp_bitwise(uint16_t crc, uint16_t d)
+{
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		bool feedback = (crc >> 15 ^ d >> i) & 1;
+
+		crc <<= 1;
+		if (feedback)
+			crc ^= 0x8005;
+	}
+
+	return crc;
+}
+
+static void ref_crc(int x, int y, int width, int height, uint16_t crc[3])
+{
+	int i, j;
+
+	crc[0] = crc[1] = crc[2] = 0;
+	for (i = y; i < y + height; i++) {
+		for (j = x; j < x + width; j++) {
+			const uint8_t *p = pixels + i * fb.strides[0] + j * 4;
+
+			/* Components are zero padded at the LSB */
+			crc[0] = crc16_dp_bitwise(crc[0], p[2] << 8);
+			crc[1] = crc16_dp_bitwise(crc[1], p[1] << 8);
+			crc[2] = crc16_dp_bitwise(crc[2], p[0] << 8);
+		}
+	}
+}
+
+static uint32_t ref_fnv1a(int x, int y, int width, int height)
+{
+	uint32_t hash = 2166136261;
+	int i, j, k;
+
+	for (i = y; i < y + height; i++) {
+		for (j = x; j < x + width; j++) {
+			const uint8_t *p = pixels + i * fb.strides[0] + j * 4;
+
+			/* X is masked off */
+			for (k = 0; k < 4; k++) {
+				hash ^= k < 3 ? p[k] : 0;
+				hash *= 16777619;
+			}
+		}
+	}
+
+	return hash;
+}
+
+/* Redraws rows [y, y + height) with random pixels, X included */
+static void draw_rows(int y, int height, uint32_t *seed)
+{
+	uint8_t *ptr;
+	int i;
+
+	for (i = y * fb.strides[0]; i < (y + height) * fb.strides[0]; i++)
+		pixels[i] = hars_petruska_f54_1_random(seed);
+
+	ptr = igt_fb_map_buffer(fd, &fb);
+	memcpy(ptr + fb.offsets[0] + y * fb.strides[0],
+	       pixels + y * fb.strides[0], height * fb.strides[0]);
+	igt_fb_unmap_buffer(&fb, ptr);
+}
+
+static void check_crc(const igt_crc_t *crc, const uint16_t ref[3],
+		      const char *what)
+{
+	int c;
+
+	igt_assert_eq(crc->n_words, 3);
+	for (c = 0; c < 3; c++)
+		igt_assert_f(crc->crc[c] == ref[c],
+			     "%s: component %d is %04x, expected %04x\n",
+			     what, c, crc->crc[c], ref[c]);
+}
+
+static void test_crc_rect(void)
+{
+	igt_crc_t crc;
+	uint16_t ref[3];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(rects); i++) {
+		igt_fb_calc_crc_rect(&fb, rects[i].x, rects[i].y,
+				     rects[i].width, rects[i].height, &crc);
+		ref_crc(rects[i].x, rects[i].y,
+			rects[i].width, rects[i].height, ref);
+
+		igt_debug("%dx%d at (%d, %d)\n", rects[i].width,
+			  rects[i].height, rects[i].x, rects[i].y);
+		check_crc(&crc, ref, "rect");
+	}
+
+	igt_fb_calc_crc(&fb, &crc);
+	ref_crc(0, 0, WIDTH, HEIGHT, ref);
+	check_crc(&crc, ref, "frame");
+}
+
+static void test_crc_rows(void)
+{
+	struct igt_fb_crc_rows *rows;
+	uint32_t seed = 0x5eed;
+	igt_crc_t crc;
+	uint16_t ref[3];
+
+	rows = igt_fb_crc_rows_create(&fb);
+	igt_fb_crc_rows_get(rows, &crc);
+	ref_crc(0, 0, WIDTH, HEIGHT, ref);
+	check_crc(&crc, ref, "rows");
+
+	/* Only the updated rows are recomputed */
+	draw_rows(10, 3, &seed);
+	igt_fb_crc_rows_update(rows, &fb, 10, 3);
+	igt_fb_crc_rows_get(rows, &crc);
+	ref_crc(0, 0, WIDTH, HEIGHT, ref);
+	check_crc(&crc, ref, "rows 10-12 redrawn");
+
+	draw_rows(0, 1, &seed);
+	draw_rows(HEIGHT - 1, 1, &seed);
+	igt_fb_crc_rows_update(rows, &fb, 0, 1);
+	igt_fb_crc_rows_update(rows, &fb, HEIGHT - 1, 1);
+	igt_fb_crc_rows_update(rows, &fb, 5, 0);
+	igt_fb_crc_rows_get(rows, &crc);
+	ref_crc(0, 0, WIDTH, HEIGHT, ref);
+	check_crc(&crc, ref, "first and last rows redrawn");
+
+	igt_fb_crc_rows_destroy(rows);
+}
+
+static void test_fnv1a_rect(void)
+{
+	igt_crc_t crc;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(rects); i++) {
+		igt_assert_eq(igt_fb_get_fnv1a_crc_rect(&fb, rects[i].x,
+							rects[i].y,
+							rects[i].width,
+							rects[i].height,
+							&crc), 0);
+		igt_assert_eq(crc.n_words, 1);
+		igt_assert_eq_u32(crc.crc[0],
+				  ref_fnv1a(rects[i].x, rects[i].y,
+					    rects[i].width, rects[i].height));
+	}
+
+	igt_assert_eq(igt_fb_get_fnv1a_crc(&fb, &crc), 0);
+	igt_assert_eq_u32(crc.crc[0], ref_fnv1a(0, 0, WIDTH, HEIGHT));
+
+	igt_assert_eq(igt_fb_get_fnv1a_crc_rect(&fb, 1, 0, WIDTH, 1, &crc),
+		      -EINVAL);
+}
+
+igt_main
+{
+	igt_fixture {
+		uint32_t seed = 0x1234;
+
+		fd = drm_open_driver(DRIVER_VGEM);
+		igt_create_bo_for_fb(fd, WIDTH, HEIGHT, DRM_FORMAT_XRGB8888,
+				     DRM_FORMAT_MOD_LINEAR, &fb);
+
+		pixels = calloc(HEIGHT, fb.strides[0]);
+		igt_assert(pixels);
+		draw_rows(0, HEIGHT, &seed);
+	}
+
+	igt_subtest("crc-rect")
+		test_crc_rect();
+
+	igt_subtest("crc-rows")
+		test_crc_rows();
+
+	igt_subtest("fnv1a-rect")
+		test_fnv1a_rect();
+
+	igt_fixture {
+		kmstest_dumb_destroy(fd, fb.gem_handle);
+		free(pixels);
+		close(fd);
+	}
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "igt_color_encoding.h"
+#include "igt_aux.h"
+#include "igt_core.h"
+#include "igt_x86.h"
+#include "igt_yuv.h"
+
+#define WIDTH 1027 /* odd to exercise the scalar tails */
+
+static const unsigned int variants[] = { SSE4_1, AVX2 };
+
+static void for_each_matrix(void (*fn)(const struct igt_mat4 *m, bool to_rgb))
+{
+	enum igt_color_encoding e;
+	enum igt_color_range r;
+
+	for (e = IGT_COLOR_YCBCR_BT601; e < IGT_NUM_COLOR_ENCODINGS; e++) {
+		for (r = IGT_COLOR_YCBCR_LIMITED_RANGE; r < IGT_NUM_COLOR_RANGES; r++) {
+			struct igt_mat4 m;
+
+			m = igt_ycbcr_to_rgb_matrix(DRM_FORMAT_NV12,
+						    DRM_FORMAT_XRGB8888, e, r);
+			fn(&m, true);
+
+			m = igt_rgb_to_ycbcr_matrix(DRM_FORMAT_XRGB8888,
+						    DRM_FORMAT_NV12, e, r);
+			fn(&m, false);
+		}
+	}
+}
+
+static void fill_random(void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	while (len--)
+		*p++ = random();
+}
+
+static void check_variants(const struct igt_mat4 *m, bool to_rgb)
+{
+	const struct igt_yuv_kernels *ref = igt_yuv_get_kernels(0);
+	uint8_t in[3][WIDTH], y[2][WIDTH];
+	float u[2][WIDTH], v[2][WIDTH];
+	uint32_t xrgb[2][WIDTH];
+	struct igt_yuv_coeffs c;
+	unsigned int i, w;
+
+	igt_yuv_coeffs_init(&c, m);
+
+	fill_random(in, sizeof(in));
+	fill_random(xrgb[0], sizeof(xrgb[0]));
+
+	for (i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		const struct igt_yuv_kernels *k;
+
+		if (!(igt_x86_features() & variants[i]))
+			continue;
+
+		k = igt_yuv_get_kernels(variants[i]);
+
+		for (w = WIDTH - 16; w <= WIDTH; w++) {
+			if (to_rgb) {
+				memset(xrgb, 0, sizeof(xrgb));
+				ref->yuv_to_rgb(&c, in[0], in[1], in[2],
+						xrgb[0], w);
+				k->yuv_to_rgb(&c, in[0], in[1], in[2],
+					      xrgb[1], w);
+				igt_assert(!memcmp(xrgb[0], xrgb[1],
+						   sizeof(xrgb[0])));
+			} else {
+				memset(y, 0, sizeof(y));
+				memset(u, 0, sizeof(u));
+				memset(v, 0, sizeof(v));
+				ref->rgb_to_yuv(&c, xrgb[0],
+						y[0], u[0], v[0], w);
+				k->rgb_to_yuv(&c, xrgb[0],
+					      y[1], u[1], v[1], w);
+				igt_assert(!memcmp(y[0], y[1], sizeof(y[0])));
+				igt_assert(!memcmp(u[0], u[1], sizeof(u[0])));
+				igt_assert(!memcmp(v[0], v[1], sizeof(v[0])));
+			}
+		}
+	}
+}
+
+static void check_reference(const struct igt_mat4 *m, bool to_rgb)
+{
+	const struct igt_yuv_kernels *ref = igt_yuv_get_kernels(0);
+	uint8_t in[3][256], y[256];
+	float u[256], v[256];
+	uint32_t xrgb[256];
+	struct igt_yuv_coeffs c;
+	unsigned int a, b, i;
+
+	igt_yuv_coeffs_init(&c, m);
+
+	/*
+	 * Against the float conversions igt_fb used before, on every input:
+	 * yuv to rgb rounded to nearest, Y truncated and U/V left for the
+	 * caller to average.
+	 */
+	for (i = 0; i < 256; i++)
+		in[2][i] = i;
+
+	for (a = 0; a < 256; a++) {
+		for (b = 0; b < 256; b++) {
+			memset(in[0], a, sizeof(in[0]));
+			memset(in[1], b, sizeof(in[1]));
+
+			if (to_rgb) {
+				ref->yuv_to_rgb(&c, in[0], in[1], in[2],
+						xrgb, 256);
+			} else {
+				for (i = 0; i < 256; i++)
+					xrgb[i] = a << 16 | b << 8 | i;
+				ref->rgb_to_yuv(&c, xrgb, y, u, v, 256);
+			}
+
+			for (i = 0; i < 256; i++) {
+				struct igt_vec4 vec = {
+					.d = { a, b, i, 1.0f },
+				}, out;
+				unsigned int ch;
+
+				out = igt_matrix_transform(m, &vec);
+
+				if (!to_rgb) {
+					igt_assert_eq(y[i], clamp((int)out.d[0], 0, 255));
+					igt_assert(u[i] == out.d[1]);
+					igt_assert(v[i] == out.d[2]);
+					continue;
+				}
+
+				for (ch = 0; ch < 3; ch++) {
+					int expect = clamp((int)(out.d[ch] + 0.5f), 0, 255);
+					int got = (xrgb[i] >> (16 - 8 * ch)) & 0xff;
+
+					igt_assert_f(got == expect,
+						     "channel %d: %d vs %d\n",
+						     ch, got, expect);
+				}
+			}
+		}
+	}
+}
+
+igt_main
+{
+	igt_fixture
+		srandom(0xdeadbeef);
+
+	igt_subtest("reference")
+		for_each_matrix(check_reference);
+
+	igt_subtest("bit-exact")
+		for_each_matrix(check_variants);
+}
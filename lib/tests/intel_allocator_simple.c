@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "igt_core.h"
+#include "igt_rand.h"
+#include "intel_allocator.h"
+
+/*
+ * The simple allocator indexes its holes in treaps. Drive it with random
+ * allocations, frees, reservations and lookups, and check every result
+ * against a brute-force model which keeps the holes in a sorted array.
+ * The allocator is used directly, so no GPU is needed.
+ */
+
+struct intel_allocator *
+intel_allocator_simple_create(int fd, uint64_t start, uint64_t end,
+			      enum allocator_strategy strategy);
+
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+/* Not aligned to the larger alignments, so holes need padding. */
+#define START 0x3000ull
+#define END (1ull << 26)
+
+#define OBJECTS 512
+#define RESERVED 32
+#define OPS 200000
+
+static const struct {
+	const char *name;
+	enum allocator_strategy strategy;
+} strategies[] = {
+	{ "high-to-low", ALLOC_STRATEGY_HIGH_TO_LOW },
+	{ "low-to-high", ALLOC_STRATEGY_LOW_TO_HIGH },
+	{ "best-fit", ALLOC_STRATEGY_BEST_FIT },
+};
+
+/* Holes ordered by offset, never adjacent. */
+static struct {
+	uint64_t offset[OBJECTS + RESERVED + 1];
+	uint64_t size[OBJECTS + RESERVED + 1];
+	unsigned int count;
+} model;
+
+struct range {
+	uint32_t handle;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static void model_insert(unsigned int i, uint64_t offset, uint64_t size)
+{
+	igt_assert(model.count < ARRAY_SIZE(model.offset));
+
+	memmove(&model.offset[i + 1], &model.offset[i],
+		(model.count - i) * sizeof(model.offset[0]));
+	memmove(&model.size[i + 1], &model.size[i],
+		(model.count - i) * sizeof(model.size[0]));
+	model.offset[i] = offset;
+	model.size[i] = size;
+	model.count++;
+}
+
+static void model_remove(unsigned int i)
+{
+	model.count--;
+	memmove(&model.offset[i], &model.offset[i + 1],
+		(model.count - i) * sizeof(model.offset[0]));
+	memmove(&model.size[i], &model.size[i + 1],
+		(model.count - i) * sizeof(model.size[0]));
+}
+
+/* Takes [offset, offset + size) out of the hole holding it, if any. */
+static bool model_take(uint64_t offset, uint64_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < model.count; i++) {
+		uint64_t start = model.offset[i];
+		uint64_t end = start + model.size[i];
+
+		if (offset < start || offset + size > end)
+			continue;
+
+		model_remove(i);
+		if (offset + size < end)
+			model_insert(i, offset + size, end - offset - size);
+		if (start < offset)
+			model_insert(i, start, offset - start);
+
+		return true;
+	}
+
+	return false;
+}
+
+/* Gives [offset, offset + size) back, merging it with adjacent holes. */
+static void model_give(uint64_t offset, uint64_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < model.count && model.offset[i] < offset; i++)
+		igt_assert(model.offset[i] + model.size[i] <= offset);
+	igt_assert(i == model.count || offset + size <= model.offset[i]);
+
+	if (i < model.count && offset + size == model.offset[i]) {
+		size += model.size[i];
+		model_remove(i);
+	}
+	if (i && model.offset[i - 1] + model.size[i - 1] == offset) {
+		offset = model.offset[i - 1];
+		size += model.size[i - 1];
+		model_remove(--i);
+	}
+
+	model_insert(i, offset, size);
+}
+
+static bool fit_high(unsigned int i, uint64_t size, uint64_t alignment,
+		     uint64_t *offset)
+{
+	uint64_t start = model.offset[i], end = start + model.size[i];
+
+	if (size > end - start)
+		return false;
+
+	*offset = (end - size) / alignment * alignment;
+
+	return *offset >= start;
+}
+
+static bool fit_low(unsigned int i, uint64_t size, uint64_t alignment,
+		    uint64_t *offset)
+{
+	uint64_t start = model.offset[i], end = start + model.size[i];
+
+	*offset = (start + alignment - 1) / alignment * alignment;
+
+	return *offset + size <= end;
+}
+
+/* Where the allocator is expected to place an object, by walking all holes. */
+static uint64_t model_alloc(enum allocator_strategy strategy,
+			    uint64_t size, uint64_t alignment)
+{
+	uint64_t offset, best = ALLOC_INVALID_ADDRESS;
+	int i, found = -1;
+
+	switch (strategy) {
+	case ALLOC_STRATEGY_HIGH_TO_LOW:
+		for (i = (int)model.count - 1; i >= 0; i--) {
+			if (fit_high(i, size, alignment, &best))
+				break;
+			best = ALLOC_INVALID_ADDRESS;
+		}
+		break;
+
+	case ALLOC_STRATEGY_LOW_TO_HIGH:
+		for (i = 0; i < (int)model.count; i++) {
+			if (fit_low(i, size, alignment, &best))
+				break;
+			best = ALLOC_INVALID_ADDRESS;
+		}
+		break;
+
+	case ALLOC_STRATEGY_BEST_FIT:
+		/* Smallest hole, the lowest of equally sized ones */
+		for (i = 0; i < (int)model.count; i++) {
+			if (!fit_low(i, size, alignment, &offset))
+				continue;
+			if (found < 0 || model.size[i] < model.size[found]) {
+				found = i;
+				best = offset;
+			}
+		}
+		break;
+
+	default:
+		igt_assert(!"reached");
+	}
+
+	if (best != ALLOC_INVALID_ADDRESS)
+		igt_assert(model_take(best, size));
+
+	return best;
+}
+
+static uint64_t random_size(uint32_t *seed)
+{
+	/* Mostly small objects, with large ones which may not fit */
+	switch (hars_petruska_f54_1_random(seed) % 32) {
+	case 0:
+		return (1 + hars_petruska_f54_1_random(seed) % 256) << 16;
+	case 1:
+		return 1 + hars_petruska_f54_1_random(seed) % 0xffff;
+	default:
+		return (1 + hars_petruska_f54_1_random(seed) % 16) << 12;
+	}
+}
+
+static void check_lookups(struct intel_allocator *ial, struct range *objects,
+			  struct range *reserved)
+{
+	unsigned int i;
+
+	for (i = 0; i < OBJECTS; i++) {
+		struct range *obj = &objects[i];
+
+		if (!obj->handle)
+			continue;
+
+		igt_assert(ial->is_allocated(ial, obj->handle, obj->size,
+					     obj->offset));
+		igt_assert(!ial->is_allocated(ial, obj->handle, obj->size,
+					      obj->offset + 4096));
+	}
+
+	for (i = 0; i < RESERVED; i++) {
+		struct range *r = &reserved[i];
+
+		if (!r->size)
+			continue;
+
+		igt_assert(ial->is_reserved(ial, r->offset,
+					    r->offset + r->size));
+		igt_assert(!ial->is_reserved(ial, r->offset,
+					     r->offset + r->size + 4096));
+	}
+}
+
+static void against_model(enum allocator_strategy default_strategy)
+{
+	static const enum allocator_strategy call_strategies[] = {
+		ALLOC_STRATEGY_NONE,
+		ALLOC_STRATEGY_HIGH_TO_LOW,
+		ALLOC_STRATEGY_LOW_TO_HIGH,
+		ALLOC_STRATEGY_BEST_FIT,
+	};
+	struct range objects[OBJECTS] = {}, reserved[RESERVED] = {};
+	struct intel_allocator *ial;
+	uint32_t seed = 0x1234, next = 1;
+	unsigned long failed = 0;
+	unsigned int n, i;
+
+	ial = intel_allocator_simple_create(-1, START, END, default_strategy);
+	model.count = 0;
+	model_give(START, END - START);
+
+	for (n = 0; n < OPS; n++) {
+		uint32_t op = hars_petruska_f54_1_random(&seed) % 16;
+
+		if (op == 0) {
+			struct range *r;
+			uint64_t offset, size;
+			bool expected;
+
+			/* Reserve somewhere, free or not */
+			r = &reserved[hars_petruska_f54_1_random(&seed) % RESERVED];
+			if (r->size) {
+				igt_assert(ial->unreserve(ial, r->handle, r->offset,
+							  r->offset + r->size));
+				model_give(r->offset, r->size);
+				r->size = 0;
+			}
+
+			size = (1 + hars_petruska_f54_1_random(&seed) % 16) << 12;
+			offset = START + (hars_petruska_f54_1_random(&seed) %
+					  ((END - START - size) >> 12) << 12);
+
+			expected = model_take(offset, size);
+			igt_assert_f(ial->reserve(ial, next, offset,
+						  offset + size) == expected,
+				     "reserve 0x%"PRIx64"+0x%"PRIx64", expected %s\n",
+				     offset, size, expected ? "success" : "failure");
+			if (expected)
+				*r = (struct range) { next++, offset, size };
+		} else if (op == 1) {
+			check_lookups(ial, objects, reserved);
+		} else {
+			struct range *obj;
+			enum allocator_strategy strategy;
+			uint64_t size, alignment, offset, expected;
+
+			obj = &objects[hars_petruska_f54_1_random(&seed) % OBJECTS];
+			if (obj->handle) {
+				igt_assert(ial->free(ial, obj->handle));
+				model_give(obj->offset, obj->size);
+				obj->handle = 0;
+				continue;
+			}
+
+			size = random_size(&seed);
+			alignment = 4096ull << (hars_petruska_f54_1_random(&seed) % 6);
+			strategy = call_strategies[hars_petruska_f54_1_random(&seed) %
+						   ARRAY_SIZE(call_strategies)];
+
+			offset = ial->alloc(ial, next, size, alignment, strategy);
+			expected = model_alloc(strategy == ALLOC_STRATEGY_NONE ?
+					       default_strategy : strategy,
+					       size, alignment);
+			igt_assert_f(offset == expected,
+				     "alloc 0x%"PRIx64" aligned to 0x%"PRIx64
+				     " (strategy %d) at 0x%"PRIx64", expected 0x%"PRIx64"\n",
+				     size, alignment, strategy, offset, expected);
+
+			if (offset == ALLOC_INVALID_ADDRESS)
+				failed++;
+			else
+				*obj = (struct range) { next++, offset, size };
+		}
+	}
+
+	/* The large objects do not always fit, so failures must be checked too */
+	igt_assert(failed);
+	check_lookups(ial, objects, reserved);
+
+	for (i = 0; i < OBJECTS; i++)
+		if (objects[i].handle)
+			igt_assert(ial->free(ial, objects[i].handle));
+	for (i = 0; i < RESERVED; i++)
+		if (reserved[i].size)
+			igt_assert(ial->unreserve(ial, reserved[i].handle,
+						  reserved[i].offset,
+						  reserved[i].offset + reserved[i].size));
+	igt_assert(ial->is_empty(ial));
+
+	/* All the holes are merged back into one */
+	igt_assert(ial->reserve(ial, 1, START, END));
+	igt_assert(ial->unreserve(ial, 1, START, END));
+
+	ial->destroy(ial);
+}
+
+igt_main
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(strategies); i++) {
+		igt_subtest_f("%s", strategies[i].name)
+			against_model(strategies[i].strategy);
+	}
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "i915_drm.h"
+#include "igt_core.h"
+#include "intel_batchbuffer.h"
+#include "intel_tiling.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static const struct {
+	const char *name;
+	uint32_t tiling;
+	unsigned int width;	/* in bytes */
+	unsigned int height;
+} tilings[] = {
+	{ "x", I915_TILING_X, 512, 8 },
+	{ "y", I915_TILING_Y, 128, 32 },
+	{ "yf", I915_TILING_Yf, 128, 32 },
+	{ "tile4", I915_TILING_4, 128, 32 },
+};
+
+static void fill_random(void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	while (len--)
+		*p++ = random();
+}
+
+static void check(uint32_t tiling, unsigned int tile_width,
+		  unsigned int tile_height, uint32_t swizzle,
+		  unsigned int width, unsigned int height, unsigned int cpp)
+{
+	unsigned int stride = ((width * cpp + tile_width - 1) / tile_width) *
+			      tile_width;
+	unsigned int rows = ((height + tile_height - 1) / tile_height) *
+			    tile_height;
+	unsigned int linear_stride = width * cpp + 4;
+	size_t tiled_size = (size_t)stride * rows;
+	size_t linear_size = (size_t)linear_stride * height;
+	uint8_t *linear, *out, *ref, *tiled;
+	unsigned int x, y;
+
+	linear = malloc(linear_size);
+	out = malloc(linear_size);
+	ref = aligned_alloc(4096, tiled_size);
+	tiled = aligned_alloc(4096, tiled_size);
+	igt_assert(linear && out && ref && tiled);
+
+	fill_random(linear, linear_size);
+	fill_random(ref, tiled_size);
+	memcpy(tiled, ref, tiled_size);
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			memcpy(intel_tiled_pixel_ptr(ref, tiling, swizzle,
+						     x, y, stride, cpp),
+			       linear + y * linear_stride + x * cpp, cpp);
+
+	intel_linear_to_tiled(tiled, stride, linear, linear_stride,
+			      width, height, cpp, tiling, swizzle);
+	igt_assert_f(!memcmp(ref, tiled, tiled_size),
+		     "%ux%u, cpp %u, swizzle %u differs from the reference\n",
+		     width, height, cpp, swizzle);
+
+	memcpy(out, linear, linear_size);
+	for (y = 0; y < height; y++)
+		memset(out + y * linear_stride, 0, width * cpp);
+
+	intel_tiled_to_linear(out, linear_stride, tiled, stride,
+			      width, height, cpp, tiling, swizzle);
+	igt_assert_f(!memcmp(linear, out, linear_size),
+		     "%ux%u, cpp %u, swizzle %u does not round trip\n",
+		     width, height, cpp, swizzle);
+
+	free(tiled);
+	free(ref);
+	free(out);
+	free(linear);
+}
+
+static void test_layout(int i)
+{
+	static const unsigned int cpps[] = { 1, 2, 4, 8 };
+	static const unsigned int sizes[][2] = {
+		{ 1, 1 }, { 3, 5 }, { 64, 64 }, { 129, 33 }, { 257, 71 },
+	};
+	unsigned int c, s;
+
+	for (c = 0; c < ARRAY_SIZE(cpps); c++)
+		for (s = 0; s < ARRAY_SIZE(sizes); s++)
+			check(tilings[i].tiling,
+			      tilings[i].width, tilings[i].height,
+			      I915_BIT_6_SWIZZLE_NONE,
+			      sizes[s][0], sizes[s][1], cpps[c]);
+}
+
+static void test_swizzle(void)
+{
+	static const uint32_t modes[] = {
+		I915_BIT_6_SWIZZLE_9,
+		I915_BIT_6_SWIZZLE_9_10,
+		I915_BIT_6_SWIZZLE_9_11,
+		I915_BIT_6_SWIZZLE_9_10_11,
+	};
+	unsigned int m, i;
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++)
+		for (i = 0; i < 2; i++)
+			check(tilings[i].tiling,
+			      tilings[i].width, tilings[i].height,
+			      modes[m], 300, 70, 4);
+}
+
+igt_main
+{
+	int i;
+
+	igt_fixture
+		srandom(0xdeadbeef);
+
+	for (i = 0; i < ARRAY_SIZE(tilings); i++)
+		igt_subtest(tilings[i].name)
+			test_layout(i);
+
+	igt_subtest("swizzle")
+		test_swizzle();
+}
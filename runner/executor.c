@@ -571,6 +571,51 @@ void close_outputs(int *fds)
 	}
 }
 
+/*
+ * Removes the subtests already started according to the result
+ * directory of an entry from it. Returns whether the entry still
+ * needs to be run.
+ */
+static bool prune_entry_from_results(struct job_list_entry *entry, int dirfd)
+{
+	bool resume = true;
+	int fd;
+
+	if ((fd = openat(dirfd, filenames[_F_SOCKET], O_RDONLY)) >= 0) {
+		if (!prune_from_comms(entry, fd)) {
+			/*
+			 * No subtests, or incomplete before the first
+			 * subtest. Not suitable to re-run.
+			 */
+			resume = false;
+		} else if (entry->binary[0] == '\0') {
+			/* Full completed */
+			resume = false;
+		}
+
+		close (fd);
+	}
+
+	if ((fd = openat(dirfd, filenames[_F_JOURNAL], O_RDONLY)) >= 0) {
+		if (!prune_from_journal(entry, fd)) {
+			/*
+			 * The test does not have subtests, or
+			 * incompleted before the first subtest
+			 * began. Either way, not suitable to
+			 * re-run.
+			 */
+			resume = false;
+		} else if (entry->binary[0] == '\0') {
+			/* This test is fully completed */
+			resume = false;
+		}
+
+		close(fd);
+	}
+
+	return resume;
+}
+
 /* Returns the number of bytes written to disk, or a negative number on error */
 static long dump_dmesg(int kmsgfd, int outfd)
 {
@@ -1721,6 +1766,377 @@ out_dirfd:
 	return result;
 }
 
+struct shard_slot {
+	pid_t pid;
+	size_t idx;
+	int result;
+	double time_spent;
+	char abortreason[1024];
+};
+
+static bool shard_allowed(struct settings *settings, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < settings->shard_allowlist.size; i++)
+		if (g_regex_match(settings->shard_allowlist.regexes[i], name, 0, NULL))
+			return true;
+
+	return false;
+}
+
+/*
+ * An entry can run at the same time as other entries only if every
+ * test it is going to run is in the shard allowlist.
+ */
+static bool entry_can_run_concurrently(struct settings *settings,
+				       struct job_list_entry *entry)
+{
+	char name[256];
+	size_t i;
+
+	if (settings->shards <= 1 || settings->cov_results_per_test)
+		return false;
+
+	if (entry->subtest_count == 0) {
+		generate_piglit_name(entry->binary, NULL, name, sizeof(name));
+		return shard_allowed(settings, name);
+	}
+
+	for (i = 0; i < entry->subtest_count; i++) {
+		/* Resumed entries with already started subtests run alone */
+		if (entry->subtests[i][0] == '!')
+			return false;
+
+		generate_piglit_name(entry->binary, entry->subtests[i],
+				     name, sizeof(name));
+		if (!shard_allowed(settings, name))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Shard processes leave the watchdogs to the main runner process,
+ * which keeps pinging them for as long as any shard is running.
+ * Closing our copies of the file descriptors doesn't stop the
+ * watchdogs.
+ */
+static void forget_watchdogs(void)
+{
+	size_t i;
+
+	for (i = 0; i < watchdogs.num_dogs; i++)
+		close(watchdogs.fds[i]);
+
+	free(watchdogs.fds);
+	watchdogs.num_dogs = 0;
+	watchdogs.fds = NULL;
+}
+
+static pid_t start_shard(struct shard_slot *slot,
+			 struct execute_state *state,
+			 struct settings *settings,
+			 struct job_list *job_list,
+			 int testdirfd, int resdirfd,
+			 int sigfd, sigset_t *sigmask)
+{
+	pid_t pid;
+
+	memset(slot, 0, sizeof(*slot));
+	slot->idx = state->next;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid == 0) {
+		struct execute_state shard_state = *state;
+		char *reason = NULL;
+
+		forget_watchdogs();
+
+		/*
+		 * The signalfd we inherited reports the signals sent
+		 * to this process, so the test is monitored exactly
+		 * like when running without shards.
+		 */
+		slot->result = execute_next_entry(&shard_state,
+						  job_list->size,
+						  &slot->time_spent,
+						  settings,
+						  &job_list->entries[slot->idx],
+						  testdirfd, resdirfd,
+						  sigfd, sigmask,
+						  &reason);
+		if (reason)
+			snprintf(slot->abortreason, sizeof(slot->abortreason),
+				 "%s", reason);
+
+		fflush(stdout);
+		fflush(stderr);
+		_exit(0);
+	}
+
+	if (pid < 0) {
+		errf("Failed to fork a shard: %m\n");
+		return pid;
+	}
+
+	slot->pid = pid;
+	return pid;
+}
+
+static void copy_entry(struct job_list_entry *dst,
+		       const struct job_list_entry *src)
+{
+	size_t i;
+
+	dst->binary = strdup(src->binary);
+	dst->subtest_count = src->subtest_count;
+	dst->subtests = calloc(src->subtest_count, sizeof(*dst->subtests));
+	for (i = 0; i < src->subtest_count; i++)
+		dst->subtests[i] = strdup(src->subtests[i]);
+}
+
+static void free_entry(struct job_list_entry *entry)
+{
+	size_t i;
+
+	for (i = 0; i < entry->subtest_count; i++)
+		free(entry->subtests[i]);
+	free(entry->subtests);
+	free(entry->binary);
+}
+
+/*
+ * Runs the rest of an entry that timed out in a shard, alone, until
+ * it completes. Like resuming a serial run after a timeout, every
+ * round prunes the original entry with what its result directory
+ * says was already started, so the subtest that timed out is skipped.
+ */
+static int resume_shard_entry(size_t idx,
+			      struct execute_state *state,
+			      struct settings *settings,
+			      struct job_list *job_list,
+			      int testdirfd, int resdirfd,
+			      int sigfd, sigset_t *sigmask,
+			      char **abortreason)
+{
+	struct execute_state resume_state = *state;
+	int result = 1;
+
+	resume_state.next = idx;
+
+	while (result > 0 && !*abortreason) {
+		struct job_list_entry entry;
+		double time_spent;
+		char name[32];
+		bool resume;
+		int dirfd;
+
+		snprintf(name, sizeof(name), "%zd", idx);
+		dirfd = openat(resdirfd, name, O_DIRECTORY | O_RDONLY);
+		if (dirfd < 0) {
+			errf("Error accessing individual test result directory\n");
+			return -1;
+		}
+
+		copy_entry(&entry, &job_list->entries[idx]);
+		resume = prune_entry_from_results(&entry, dirfd);
+		close(dirfd);
+
+		if (!resume) {
+			free_entry(&entry);
+			return 0;
+		}
+
+		if (settings->log_level >= LOG_LEVEL_NORMAL)
+			outf("Resuming entry %zd after a timeout\n", idx);
+
+		result = execute_next_entry(&resume_state, job_list->size,
+					    &time_spent, settings, &entry,
+					    testdirfd, resdirfd,
+					    sigfd, sigmask, abortreason);
+		free_entry(&entry);
+	}
+
+	return result < 0 ? result : 0;
+}
+
+/*
+ * Runs consecutive job list entries that are allowed to run
+ * concurrently, up to settings->shards of them at a time. Each entry
+ * gets its own result directory and is monitored by its own process,
+ * including timeouts and the disk usage limit. Entries that time out
+ * get the rest of their subtests run once the batch is done, without
+ * any shards running. Note that kernel logs are not separated, every
+ * running entry sees the dmesg of all the others.
+ *
+ * On return state->next is the last entry that was started and
+ * time_spent is the wall clock time used.
+ *
+ * Returns:
+ *  =0 - Success
+ *  <0 - Failure executing, or killed by a signal
+ */
+static int execute_shards(struct execute_state *state,
+			  double *time_spent,
+			  struct settings *settings,
+			  struct job_list *job_list,
+			  int testdirfd, int resdirfd,
+			  int sigfd, sigset_t *sigmask,
+			  char **abortreason)
+{
+	struct pollfd sigpoll = { .fd = sigfd, .events = POLLIN };
+	struct signalfd_siginfo siginfo;
+	struct timespec time_beg, time_now;
+	struct shard_slot *slots;
+	size_t num_slots = settings->shards;
+	size_t running = 0, last = state->next, i;
+	size_t *timedout = NULL, num_timedout = 0;
+	bool stop = false;
+	int result = 0;
+
+	slots = mmap(NULL, num_slots * sizeof(*slots),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (slots == MAP_FAILED) {
+		errf("Failed to allocate shard slots: %m\n");
+		return -1;
+	}
+
+	igt_gettime(&time_beg);
+	watchdogs_set_timeout(120);
+
+	while (true) {
+		while (!stop && running < num_slots &&
+		       state->next < job_list->size &&
+		       entry_can_run_concurrently(settings,
+						  &job_list->entries[state->next])) {
+			igt_gettime(&time_now);
+			if (state->time_left >= 0 &&
+			    igt_time_elapsed(&time_beg, &time_now) >= state->time_left) {
+				stop = true;
+				break;
+			}
+
+			for (i = 0; slots[i].pid; i++)
+				;
+
+			if (start_shard(&slots[i], state, settings, job_list,
+					testdirfd, resdirfd, sigfd, sigmask) < 0) {
+				result = -1;
+				stop = true;
+				break;
+			}
+
+			last = state->next++;
+			running++;
+		}
+
+		if (!running)
+			break;
+
+		if (poll(&sigpoll, 1, 1000) < 0 && errno != EINTR) {
+			errf("Poll on signalfd failed with %m\n");
+			break;
+		}
+		ping_watchdogs();
+
+		if (!(sigpoll.revents & POLLIN))
+			continue;
+
+		if (read(sigfd, &siginfo, sizeof(siginfo)) < 0) {
+			errf("Error reading from signalfd: %m\n");
+			continue;
+		}
+
+		if (siginfo.ssi_signo != SIGCHLD) {
+			/* Let every shard wind down its test the usual way */
+			if (settings->log_level >= LOG_LEVEL_NORMAL)
+				outf("Runner is being killed by %s, terminating shards\n",
+				     strsignal(siginfo.ssi_signo));
+
+			for (i = 0; i < num_slots; i++)
+				if (slots[i].pid > 0)
+					kill(slots[i].pid, siginfo.ssi_signo);
+
+			result = -1;
+			stop = true;
+			continue;
+		}
+
+		while (running) {
+			struct shard_slot *slot = NULL;
+			char *reason;
+			int status;
+			pid_t pid;
+
+			pid = waitpid(-1, &status, WNOHANG);
+			if (pid <= 0)
+				break;
+
+			for (i = 0; i < num_slots; i++)
+				if (slots[i].pid == pid)
+					slot = &slots[i];
+
+			if (!slot)
+				continue;
+
+			slot->pid = 0;
+			running--;
+
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+				errf("Shard running entry %zd died unexpectedly\n",
+				     slot->idx);
+				result = -1;
+				stop = true;
+			} else if (slot->result < 0) {
+				result = -1;
+				stop = true;
+			} else if (slot->result > 0) {
+				timedout = realloc(timedout, (num_timedout + 1) *
+						   sizeof(*timedout));
+				timedout[num_timedout++] = slot->idx;
+			}
+
+			if (*abortreason)
+				continue;
+
+			if (slot->abortreason[0]) {
+				*abortreason = strdup(slot->abortreason);
+				stop = true;
+			} else if ((reason = need_to_abort(settings)) != NULL) {
+				*abortreason = reason;
+				stop = true;
+			}
+		}
+	}
+
+	for (i = 0; i < num_timedout && result >= 0 && !*abortreason; i++) {
+		igt_gettime(&time_now);
+		if (state->time_left >= 0 &&
+		    igt_time_elapsed(&time_beg, &time_now) >= state->time_left)
+			break;
+
+		result = resume_shard_entry(timedout[i], state, settings,
+					    job_list, testdirfd, resdirfd,
+					    sigfd, sigmask, abortreason);
+		if (!*abortreason)
+			*abortreason = need_to_abort(settings);
+	}
+	free(timedout);
+
+	igt_gettime(&time_now);
+	*time_spent = igt_time_elapsed(&time_beg, &time_now);
+	state->next = last;
+
+	munmap(slots, num_slots * sizeof(*slots));
+
+	return result;
+}
+
 static void fill_results_directory_with_notruns(struct job_list *list,
 						int resdirfd)
 {
@@ -1870,13 +2286,54 @@ static void init_time_left(struct execute_state *state,
 		state->time_left = settings->overall_timeout;
 }
 
+/*
+ * Shards finish their entries out of order, so a sharded run that
+ * didn't finish may have left any of the entries running alongside
+ * the last one started incomplete, not just the last one. Queues
+ * every entry of the sharded stretch before it that can be resumed.
+ */
+static void queue_incomplete_shard_entries(struct execute_state *state,
+					   struct settings *settings,
+					   struct job_list *list,
+					   int dirfd, size_t last)
+{
+	size_t first = last;
+
+	while (first > 0 &&
+	       entry_can_run_concurrently(settings, &list->entries[first - 1]))
+		first--;
+
+	for (; first < last; first++) {
+		struct job_list_entry entry;
+		char name[32];
+		bool resume;
+		int resdirfd;
+
+		snprintf(name, sizeof(name), "%zd", first);
+		if ((resdirfd = openat(dirfd, name, O_DIRECTORY | O_RDONLY)) < 0)
+			continue;
+
+		copy_entry(&entry, &list->entries[first]);
+		resume = prune_entry_from_results(&entry, resdirfd);
+		free_entry(&entry);
+		close(resdirfd);
+
+		if (!resume)
+			continue;
+
+		state->resume = realloc(state->resume, (state->num_resume + 1) *
+					sizeof(*state->resume));
+		state->resume[state->num_resume++] = first;
+	}
+}
+
 bool initialize_execute_state_from_resume(int dirfd,
 					  struct execute_state *state,
 					  struct settings *settings,
 					  struct job_list *list)
 {
 	struct job_list_entry *entry;
-	int resdirfd, fd, i;
+	int resdirfd, i;
 
 	clear_settings(settings);
 	free_job_list(list);
@@ -1911,37 +2368,11 @@ bool initialize_execute_state_from_resume(int dirfd,
 	entry = &list->entries[i];
 	state->next = i;
 
-	if ((fd = openat(resdirfd, filenames[_F_SOCKET], O_RDONLY)) >= 0) {
-		if (!prune_from_comms(entry, fd)) {
-			/*
-			 * No subtests, or incomplete before the first
-			 * subtest. Not suitable to re-run.
-			 */
-			state->next = i + 1;
-		} else if (entry->binary[0] == '\0') {
-			/* Full completed */
-			state->next = i + 1;
-		}
-
-		close (fd);
-	}
-
-	if ((fd = openat(resdirfd, filenames[_F_JOURNAL], O_RDONLY)) >= 0) {
-		if (!prune_from_journal(entry, fd)) {
-			/*
-			 * The test does not have subtests, or
-			 * incompleted before the first subtest
-			 * began. Either way, not suitable to
-			 * re-run.
-			 */
-			state->next = i + 1;
-		} else if (entry->binary[0] == '\0') {
-			/* This test is fully completed */
-			state->next = i + 1;
-		}
+	if (entry_can_run_concurrently(settings, entry))
+		queue_incomplete_shard_entries(state, settings, list, dirfd, i);
 
-		close(fd);
-	}
+	if (!prune_entry_from_results(entry, resdirfd))
+		state->next = i + 1;
 
  success:
 	close(resdirfd);
@@ -2212,13 +2643,14 @@ bool execute(struct execute_state *state,
 	sigset_t sigmask;
 	double time_spent = 0.0;
 	bool status = true;
+	size_t i;
 
 	if (state->dry) {
 		outf("Dry run, not executing. Invoke igt_resume if you want to execute.\n");
 		return true;
 	}
 
-	if (state->next >= job_list->size) {
+	if (state->next >= job_list->size && !state->num_resume) {
 		outf("All tests already executed.\n");
 		return true;
 	}
@@ -2337,10 +2769,10 @@ bool execute(struct execute_state *state,
 		}
 	}
 
-	for (; state->next < job_list->size;
-	     state->next++) {
+	/* Entries left incomplete by a sharded run go first */
+	for (i = 0; status && i < state->num_resume; i++) {
+		struct timespec time_beg, time_end;
 		char *reason = NULL;
-		char *job_name;
 		int result;
 
 		if (should_die_because_signal(sigfd)) {
@@ -2348,24 +2780,84 @@ bool execute(struct execute_state *state,
 			goto end;
 		}
 
-		if (settings->cov_results_per_test) {
-			code_coverage_start(settings, sigfd, &reason);
-			job_name = entry_display_name(&job_list->entries[state->next]);
+		igt_gettime(&time_beg);
+		result = resume_shard_entry(state->resume[i], state, settings,
+					    job_list, testdirfd, resdirfd,
+					    sigfd, &sigmask, &reason);
+		igt_gettime(&time_end);
+
+		if (reason != NULL || (reason = need_to_abort(settings)) != NULL) {
+			char *prev = entry_display_name(&job_list->entries[state->resume[i]]);
+			char *next = (state->next < job_list->size ?
+				      entry_display_name(&job_list->entries[state->next]) :
+				      strdup("nothing"));
+			write_abort_file(resdirfd, reason, prev, next);
+			free(prev);
+			free(next);
+			free(reason);
+			status = false;
+			break;
 		}
 
-		if (reason == NULL) {
-			result = execute_next_entry(state,
-						job_list->size,
+		if (result < 0) {
+			status = false;
+			break;
+		}
+
+		reduce_time_left(settings, state, igt_time_elapsed(&time_beg, &time_end));
+
+		if (overall_timeout_exceeded(state)) {
+			if (settings->log_level >= LOG_LEVEL_NORMAL) {
+				outf("Overall timeout time exceeded, stopping.\n");
+			}
+
+			break;
+		}
+	}
+	free(state->resume);
+	state->resume = NULL;
+	state->num_resume = 0;
+
+	for (; status && !overall_timeout_exceeded(state) &&
+	     state->next < job_list->size;
+	     state->next++) {
+		char *reason = NULL;
+		char *job_name;
+		int result;
+
+		if (should_die_because_signal(sigfd)) {
+			status = false;
+			goto end;
+		}
+
+		if (entry_can_run_concurrently(settings, &job_list->entries[state->next])) {
+			result = execute_shards(state,
 						&time_spent,
 						settings,
-						&job_list->entries[state->next],
+						job_list,
 						testdirfd, resdirfd,
 						sigfd, &sigmask,
 						&reason);
-
+		} else {
 			if (settings->cov_results_per_test) {
-				code_coverage_stop(settings, job_name, sigfd, &reason);
-				free(job_name);
+				code_coverage_start(settings, sigfd, &reason);
+				job_name = entry_display_name(&job_list->entries[state->next]);
+			}
+
+			if (reason == NULL) {
+				result = execute_next_entry(state,
+							    job_list->size,
+							    &time_spent,
+							    settings,
+							    &job_list->entries[state->next],
+							    testdirfd, resdirfd,
+							    sigfd, &sigmask,
+							    &reason);
+
+				if (settings->cov_results_per_test) {
+					code_coverage_stop(settings, job_name, sigfd, &reason);
+					free(job_name);
+				}
 			}
 		}
 
@@ -7,6 +7,12 @@
 struct execute_state
 {
 	size_t next;
+	/*
+	 * Entries before next that a sharded run left incomplete, to be
+	 * resumed before continuing from next.
+	 */
+	size_t *resume;
+	size_t num_resume;
 	/*
 	 * < 0 : No overall timeout used.
 	 * = 0 : Timeouted, don't execute any more.
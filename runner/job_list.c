@@ -1,14 +1,18 @@
 #include <ctype.h>
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #ifdef __linux__
 #include <linux/limits.h>
 #endif
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "job_list.h"
@@ -42,52 +46,499 @@ static void add_job_list_entry(struct job_list *job_list,
 	entry->subtest_count = subtest_count;
 }
 
-static void add_subtests(struct job_list *job_list, struct settings *settings,
-			 char *binary,
-			 struct regex_list *include, struct regex_list *exclude)
+#define SUBTEST_CACHE_MAGIC "igt-subtest-cache 1"
+
+/*
+ * The subtests of one test binary, as listed by --list-subtests.
+ * status is what pclose() returned for the listing.
+ */
+struct subtest_list {
+	char *binary;
+	char **subtests;
+	size_t size;
+	int status;
+
+	/* Cache key */
+	char *path;
+	off_t file_size;
+	struct timespec mtime;
+	char *build_id;
+	bool cached;
+};
+
+static void free_subtest_list(struct subtest_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->size; i++)
+		free(list->subtests[i]);
+	free(list->subtests);
+	free(list->binary);
+	free(list->path);
+	free(list->build_id);
+	memset(list, 0, sizeof(*list));
+}
+
+static void add_listed_subtest(struct subtest_list *list, char *subtest)
+{
+	list->subtests = realloc(list->subtests,
+				 (list->size + 1) * sizeof(*list->subtests));
+	list->subtests[list->size++] = subtest;
+}
+
+static char *find_build_id(const char *notes, size_t len)
+{
+	while (len >= sizeof(Elf64_Nhdr)) {
+		/* Elf32_Nhdr and Elf64_Nhdr are the same */
+		const Elf64_Nhdr *nhdr = (const Elf64_Nhdr *)notes;
+		size_t namesz = (nhdr->n_namesz + 3) & ~3;
+		size_t descsz = (nhdr->n_descsz + 3) & ~3;
+		const char *name = notes + sizeof(*nhdr);
+		const unsigned char *desc = (const unsigned char *)name + namesz;
+
+		if (namesz + descsz > len - sizeof(*nhdr))
+			break;
+
+		if (nhdr->n_type == NT_GNU_BUILD_ID &&
+		    nhdr->n_namesz == 4 && !memcmp(name, "GNU", 4)) {
+			char *id = malloc(2 * nhdr->n_descsz + 1);
+			size_t i;
+
+			for (i = 0; i < nhdr->n_descsz; i++)
+				sprintf(id + 2 * i, "%02x", desc[i]);
+			id[2 * i] = '\0';
+
+			return id;
+		}
+
+		notes += sizeof(*nhdr) + namesz + descsz;
+		len -= sizeof(*nhdr) + namesz + descsz;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the GNU build id of the ELF file as a hex string, or NULL
+ * if it has none. Only native endian files are looked at.
+ */
+static char *read_build_id(int fd, size_t size)
+{
+	const unsigned char *elf;
+	char *id = NULL;
+	size_t i;
+
+	if (size < sizeof(Elf64_Ehdr))
+		return NULL;
+
+	elf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (elf == MAP_FAILED)
+		return NULL;
+
+	if (memcmp(elf, ELFMAG, SELFMAG))
+		goto out;
+
+	if (elf[EI_CLASS] == ELFCLASS64) {
+		const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)elf;
+
+		if (ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > size)
+			goto out;
+
+		for (i = 0; !id && i < ehdr->e_phnum; i++) {
+			const Elf64_Phdr *phdr = (const Elf64_Phdr *)(elf + ehdr->e_phoff) + i;
+
+			if (phdr->p_type == PT_NOTE &&
+			    phdr->p_offset + phdr->p_filesz <= size)
+				id = find_build_id((const char *)elf + phdr->p_offset,
+						   phdr->p_filesz);
+		}
+	} else if (elf[EI_CLASS] == ELFCLASS32) {
+		const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)elf;
+
+		if (ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr) > size)
+			goto out;
+
+		for (i = 0; !id && i < ehdr->e_phnum; i++) {
+			const Elf32_Phdr *phdr = (const Elf32_Phdr *)(elf + ehdr->e_phoff) + i;
+
+			if (phdr->p_type == PT_NOTE &&
+			    phdr->p_offset + phdr->p_filesz <= size)
+				id = find_build_id((const char *)elf + phdr->p_offset,
+						   phdr->p_filesz);
+		}
+	}
+
+out:
+	munmap((void *)elf, size);
+	return id;
+}
+
+static bool subtest_cache_key(struct subtest_list *list, const char *test_root)
+{
+	struct stat st;
+	int fd;
+
+	if (asprintf(&list->path, "%s/%s", test_root, list->binary) < 0) {
+		list->path = NULL;
+		return false;
+	}
+
+	if ((fd = open(list->path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return false;
+	}
+
+	list->file_size = st.st_size;
+	list->mtime = st.st_mtim;
+	list->build_id = read_build_id(fd, st.st_size);
+	close(fd);
+
+	return true;
+}
+
+static bool subtest_cache_match(const struct subtest_list *a,
+				const struct subtest_list *b)
+{
+	return a->file_size == b->file_size &&
+		a->mtime.tv_sec == b->mtime.tv_sec &&
+		a->mtime.tv_nsec == b->mtime.tv_nsec &&
+		!strcmp(a->build_id ?: "-", b->build_id ?: "-");
+}
+
+/*
+ * The subtest cache is opt-in, a run only reads and writes one when
+ * IGT_RUNNER_SUBTEST_CACHE names the file to use.
+ */
+static char *subtest_cache_path(void)
+{
+	const char *env = getenv("IGT_RUNNER_SUBTEST_CACHE");
+
+	return env && *env ? strdup(env) : NULL;
+}
+
+static void free_cached_subtest_list(gpointer data)
+{
+	free_subtest_list(data);
+	free(data);
+}
+
+/*
+ * Cache format, after the magic line, for each binary:
+ *
+ *   <size> <mtime sec> <mtime nsec> <build id or -> <status> <count> <path>
+ *   <subtest>
+ *   ...
+ */
+static GHashTable *read_subtest_cache(const char *cache_path)
+{
+	GHashTable *cache;
+	char *line = NULL;
+	size_t line_len = 0;
+	ssize_t len;
+	FILE *f;
+
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+				      NULL, free_cached_subtest_list);
+
+	if (!cache_path || (f = fopen(cache_path, "r")) == NULL)
+		return cache;
+
+	if (getline(&line, &line_len, f) < 0 ||
+	    strncmp(line, SUBTEST_CACHE_MAGIC "\n", strlen(SUBTEST_CACHE_MAGIC) + 1))
+		goto out;
+
+	while ((len = getline(&line, &line_len, f)) > 0) {
+		struct subtest_list *list = calloc(1, sizeof(*list));
+		long long file_size, sec, nsec;
+		size_t count;
+		int pathpos = 0;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (sscanf(line, "%lld %lld %lld %ms %d %zu %n",
+			   &file_size, &sec, &nsec, &list->build_id,
+			   &list->status, &count, &pathpos) != 6 ||
+		    !pathpos || pathpos >= len) {
+			free_cached_subtest_list(list);
+			break;
+		}
+
+		list->file_size = file_size;
+		list->mtime.tv_sec = sec;
+		list->mtime.tv_nsec = nsec;
+		list->path = strdup(line + pathpos);
+		if (!strcmp(list->build_id, "-")) {
+			free(list->build_id);
+			list->build_id = NULL;
+		}
+
+		while (list->size < count &&
+		       (len = getline(&line, &line_len, f)) > 0) {
+			if (line[len - 1] == '\n')
+				line[len - 1] = '\0';
+			add_listed_subtest(list, strdup(line));
+		}
+
+		if (list->size < count) {
+			free_cached_subtest_list(list);
+			break;
+		}
+
+		g_hash_table_replace(cache, list->path, list);
+	}
+
+out:
+	free(line);
+	fclose(f);
+	return cache;
+}
+
+static void write_subtest_cache(const char *cache_path, GHashTable *cache)
+{
+	struct subtest_list *list;
+	GHashTableIter iter;
+	char *tmp;
+	FILE *f;
+	size_t i;
+
+	if (asprintf(&tmp, "%s.%d", cache_path, getpid()) < 0)
+		return;
+
+	if ((f = fopen(tmp, "w")) == NULL) {
+		free(tmp);
+		return;
+	}
+
+	fprintf(f, SUBTEST_CACHE_MAGIC "\n");
+
+	g_hash_table_iter_init(&iter, cache);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&list)) {
+		fprintf(f, "%lld %lld %lld %s %d %zu %s\n",
+			(long long)list->file_size,
+			(long long)list->mtime.tv_sec,
+			(long long)list->mtime.tv_nsec,
+			list->build_id ?: "-",
+			list->status, list->size, list->path);
+		for (i = 0; i < list->size; i++)
+			fprintf(f, "%s\n", list->subtests[i]);
+	}
+
+	/* A failure to update the cache only costs time on the next run */
+	if (fclose(f) || rename(tmp, cache_path))
+		unlink(tmp);
+
+	free(tmp);
+}
+
+static bool cacheable_subtest_list(const struct subtest_list *list)
+{
+	if (!list->path || strchr(list->path, '\n'))
+		return false;
+
+	return list->status == 0 ||
+		(WIFEXITED(list->status) &&
+		 WEXITSTATUS(list->status) == IGT_EXIT_INVALID);
+}
+
+static void list_subtests(struct subtest_list *list, const char *test_root)
 {
 	FILE *p;
 	char cmd[256] = {};
 	char *subtestname;
-	char **subtests = NULL;
-	size_t num_subtests = 0;
 	int s;
 
 	s = snprintf(cmd, sizeof(cmd), "%s/%s --list-subtests",
-		     settings->test_root, binary);
+		     test_root, list->binary);
 	if (s < 0) {
 		fprintf(stderr, "Failure generating command string, this shouldn't happen.\n");
+		list->status = -1;
 		return;
 	}
 
 	if (s >= sizeof(cmd)) {
 		fprintf(stderr, "Path to binary too long, ignoring: %s/%s\n",
-			settings->test_root, binary);
+			test_root, list->binary);
+		list->status = -1;
 		return;
 	}
 
-	p = popen(cmd, "r");
+	p = popen(cmd, "re");
 	if (!p) {
 		fprintf(stderr, "popen failed when executing %s: %s\n",
 			cmd,
 			strerror(errno));
+		list->status = -1;
+		return;
+	}
+
+	while (fscanf(p, "%ms", &subtestname) == 1)
+		add_listed_subtest(list, subtestname);
+
+	list->status = pclose(p);
+	if (list->status == -1)
+		fprintf(stderr, "popen error when executing %s: %s\n",
+			list->binary, strerror(errno));
+}
+
+struct subtest_lister {
+	pthread_mutex_t mutex;
+	struct subtest_list *lists;
+	size_t num_lists;
+	size_t next;
+
+	const char *test_root;
+	GHashTable *cache;
+};
+
+static void *subtest_lister_thread(void *data)
+{
+	struct subtest_lister *lister = data;
+
+	while (true) {
+		struct subtest_list *list, *cached;
+		size_t i, k;
+
+		pthread_mutex_lock(&lister->mutex);
+		i = lister->next++;
+		pthread_mutex_unlock(&lister->mutex);
+
+		if (i >= lister->num_lists)
+			break;
+
+		list = &lister->lists[i];
+
+		/* The cache is only read while the threads are running */
+		if (lister->cache &&
+		    subtest_cache_key(list, lister->test_root) &&
+		    (cached = g_hash_table_lookup(lister->cache, list->path)) &&
+		    subtest_cache_match(list, cached)) {
+			for (k = 0; k < cached->size; k++)
+				add_listed_subtest(list, strdup(cached->subtests[k]));
+			list->status = cached->status;
+			list->cached = true;
+			continue;
+		}
+
+		list_subtests(list, lister->test_root);
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs --list-subtests for all the given binaries, as many at a time
+ * as there are online CPUs. Binaries that haven't changed since they
+ * were last listed are not executed at all, their subtests come from
+ * the on-disk cache instead.
+ */
+static void list_all_subtests(struct subtest_list *lists, size_t num_lists,
+			      struct settings *settings)
+{
+	struct subtest_lister lister = {
+		.lists = lists,
+		.num_lists = num_lists,
+		.test_root = settings->test_root,
+	};
+	char *cache_path = subtest_cache_path();
+	pthread_t *threads;
+	size_t num_threads = 0, i;
+	bool dirty = false;
+	long cpus;
+
+	if (cache_path)
+		lister.cache = read_subtest_cache(cache_path);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > num_lists)
+		cpus = num_lists;
+
+	pthread_mutex_init(&lister.mutex, NULL);
+	threads = calloc(cpus, sizeof(*threads));
+
+	for (i = 1; i < cpus; i++) {
+		if (pthread_create(&threads[num_threads], NULL,
+				   subtest_lister_thread, &lister))
+			break;
+		num_threads++;
+	}
+
+	subtest_lister_thread(&lister);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	pthread_mutex_destroy(&lister.mutex);
+
+	if (!lister.cache) {
+		free(cache_path);
 		return;
 	}
 
-	while (fscanf(p, "%ms", &subtestname) == 1) {
+	for (i = 0; i < num_lists; i++) {
+		struct subtest_list *cached;
+		size_t k;
+
+		if (lists[i].cached || !cacheable_subtest_list(&lists[i]))
+			continue;
+
+		cached = calloc(1, sizeof(*cached));
+		cached->path = strdup(lists[i].path);
+		cached->file_size = lists[i].file_size;
+		cached->mtime = lists[i].mtime;
+		cached->build_id = lists[i].build_id ? strdup(lists[i].build_id) : NULL;
+		cached->status = lists[i].status;
+		for (k = 0; k < lists[i].size; k++)
+			add_listed_subtest(cached, strdup(lists[i].subtests[k]));
+
+		g_hash_table_replace(lister.cache, cached->path, cached);
+		dirty = true;
+	}
+
+	if (settings->log_level >= LOG_LEVEL_VERBOSE) {
+		size_t hits = 0;
+
+		for (i = 0; i < num_lists; i++)
+			hits += lists[i].cached;
+
+		printf("Listed subtests of %zd binaries, %zd from %s\n",
+		       num_lists, hits, cache_path);
+	}
+
+	if (dirty)
+		write_subtest_cache(cache_path, lister.cache);
+
+	g_hash_table_destroy(lister.cache);
+	free(cache_path);
+}
+
+static void add_subtests(struct job_list *job_list, struct settings *settings,
+			 struct subtest_list *list,
+			 struct regex_list *include, struct regex_list *exclude)
+{
+	char *binary = list->binary;
+	char **subtests = NULL;
+	size_t num_subtests = 0;
+	size_t i;
+	int s;
+
+	for (i = 0; i < list->size; i++) {
+		char *subtestname = list->subtests[i];
 		char piglitname[256];
 
 		generate_piglit_name(binary, subtestname, piglitname, sizeof(piglitname));
 
-		if (exclude && exclude->size && matches_any(piglitname, exclude)) {
-			free(subtestname);
+		if (exclude && exclude->size && matches_any(piglitname, exclude))
 			continue;
-		}
 
-		if (include && include->size && !matches_any(piglitname, include)) {
-			free(subtestname);
+		if (include && include->size && !matches_any(piglitname, include))
 			continue;
-		}
 
 		if (settings->multiple_mode) {
 			num_subtests++;
@@ -99,18 +550,14 @@ static void add_subtests(struct job_list *job_list, struct settings *settings,
 			add_job_list_entry(job_list, strdup(binary), subtests, 1);
 			subtests = NULL;
 		}
-
-		free(subtestname);
 	}
 
 	if (num_subtests)
 		add_job_list_entry(job_list, strdup(binary), subtests, num_subtests);
 
-	s = pclose(p);
-	if (s == 0) {
+	s = list->status;
+	if (s == 0 || s == -1) {
 		return;
-	} else if (s == -1) {
-		fprintf(stderr, "popen error when executing %s: %s\n", binary, strerror(errno));
 	} else if (WIFEXITED(s)) {
 		if (WEXITSTATUS(s) == IGT_EXIT_INVALID) {
 			char piglitname[256];
@@ -137,6 +584,14 @@ static bool filtered_job_list(struct job_list *job_list,
 			      struct settings *settings,
 			      int fd)
 {
+	/* How the subtests of each binary get added to the job list */
+	enum { ADD_WHOLE, ADD_UNLESS_EXCLUDED, ADD_FILTERED };
+	struct subtest_list *lists = NULL;
+	size_t num_lists = 0, num_binaries = 0, i, k;
+	struct {
+		char *binary;
+		int mode;
+	} *binaries = NULL;
 	FILE *f;
 	char buf[128];
 	bool ok;
@@ -149,6 +604,8 @@ static bool filtered_job_list(struct job_list *job_list,
 	f = fdopen(fd, "r");
 
 	while (fscanf(f, "%127s", buf) == 1) {
+		int mode;
+
 		if (!strcmp(buf, "TESTLIST") || !(strcmp(buf, "END")))
 			continue;
 
@@ -171,21 +628,60 @@ static bool filtered_job_list(struct job_list *job_list,
 				 * get to omit executing
 				 * --list-subtests.
 				 */
-				add_job_list_entry(job_list, strdup(buf), NULL, 0);
+				mode = ADD_WHOLE;
 			else
-				add_subtests(job_list, settings, buf,
-					     NULL, &settings->exclude_regexes);
+				mode = ADD_UNLESS_EXCLUDED;
+		} else {
+			/*
+			 * Binary name doesn't match exclude or include filters.
+			 */
+			mode = ADD_FILTERED;
+		}
+
+		binaries = realloc(binaries, (num_binaries + 1) * sizeof(*binaries));
+		binaries[num_binaries].binary = strdup(buf);
+		binaries[num_binaries].mode = mode;
+		num_binaries++;
+
+		if (mode != ADD_WHOLE) {
+			lists = realloc(lists, (num_lists + 1) * sizeof(*lists));
+			memset(&lists[num_lists], 0, sizeof(*lists));
+			lists[num_lists].binary = strdup(buf);
+			num_lists++;
+		}
+	}
+
+	/*
+	 * Listing the subtests is by far the slowest part, do it for
+	 * all binaries at once so it can run in parallel.
+	 */
+	if (num_lists)
+		list_all_subtests(lists, num_lists, settings);
+
+	for (i = 0, k = 0; i < num_binaries; i++) {
+		switch (binaries[i].mode) {
+		case ADD_WHOLE:
+			add_job_list_entry(job_list, binaries[i].binary, NULL, 0);
 			continue;
+		case ADD_UNLESS_EXCLUDED:
+			add_subtests(job_list, settings, &lists[k++],
+				     NULL, &settings->exclude_regexes);
+			break;
+		case ADD_FILTERED:
+			add_subtests(job_list, settings, &lists[k++],
+				     &settings->include_regexes,
+				     &settings->exclude_regexes);
+			break;
 		}
 
-		/*
-		 * Binary name doesn't match exclude or include filters.
-		 */
-		add_subtests(job_list, settings, buf,
-			     &settings->include_regexes,
-			     &settings->exclude_regexes);
+		free(binaries[i].binary);
 	}
 
+	for (k = 0; k < num_lists; k++)
+		free_subtest_list(&lists[k]);
+	free(lists);
+	free(binaries);
+
 	ok = job_list->size != 0;
 	if (!ok)
 		fprintf(stderr, "Filter didn't match any job name\n");
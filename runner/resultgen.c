@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -693,6 +694,7 @@ static bool fill_from_output(int fd, const char *binary, const char *key,
 {
 	char *buf, *bufend, *nullchr;
 	struct stat statbuf;
+	size_t mapped;
 	char piglit_name[256];
 	char *igt_version = NULL;
 	size_t igt_version_len = 0;
@@ -717,6 +719,7 @@ static bool fill_from_output(int fd, const char *binary, const char *key,
 	} else {
 		buf = NULL;
 	}
+	mapped = statbuf.st_size;
 
 	/*
 	 * Avoid null characters: Just pretend the output stops at the
@@ -744,6 +747,8 @@ static bool fill_from_output(int fd, const char *binary, const char *key,
 				       new_escaped_json_string(buf, statbuf.st_size));
 		add_igt_version(current_test, igt_version, igt_version_len);
 
+		if (buf)
+			munmap(buf, mapped);
 		return true;
 	}
 
@@ -790,6 +795,8 @@ static bool fill_from_output(int fd, const char *binary, const char *key,
 	}
 
 	free_matches(&matches);
+	if (buf)
+		munmap(buf, mapped);
 	return true;
 }
 
@@ -966,7 +973,7 @@ static bool fill_from_dmesg(int fd,
 			    struct subtest_list *subtests,
 			    struct json_object *tests)
 {
-	char *line = NULL;
+	char *buf, *bufend, *p, *next, *line = NULL;
 	char *warnings = NULL, *dynamic_warnings = NULL;
 	char *dmesg = NULL, *dynamic_dmesg = NULL;
 	size_t linelen = 0;
@@ -974,27 +981,49 @@ static bool fill_from_dmesg(int fd,
 	size_t dmesglen = 0, dynamic_dmesg_len = 0;
 	struct json_object *current_test = NULL;
 	struct json_object *current_dynamic_test = NULL;
-	FILE *f = fdopen(fd, "r");
+	struct stat statbuf;
 	char piglit_name[256];
 	char dynamic_piglit_name[256];
 	size_t i;
 	GRegex *re;
 
-	if (!f) {
+	if (fstat(fd, &statbuf))
 		return false;
+
+	if (statbuf.st_size != 0) {
+		buf = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (buf == MAP_FAILED)
+			return false;
+	} else {
+		buf = NULL;
 	}
+	bufend = buf + statbuf.st_size;
 
 	if (!init_regex_whitelist(settings, &re)) {
-		fclose(f);
+		if (buf)
+			munmap(buf, statbuf.st_size);
 		return false;
 	}
 
-	while (getline(&line, &linelen, f) > 0) {
+	/*
+	 * Lines are read from the mapping and only copied out to be null
+	 * terminated for the parsers, saving the stdio buffering.
+	 */
+	for (p = buf; p < bufend; p = next) {
 		char *formatted;
 		unsigned flags;
 		unsigned long long ts_usec;
 		char continuation;
 		char *message, *subtest, *dynamic_subtest;
+		char *eol = memchr(p, '\n', bufend - p);
+
+		next = eol ? eol + 1 : bufend;
+		if (next - p + 1 > linelen) {
+			linelen = next - p + 1;
+			line = realloc(line, linelen);
+		}
+		memcpy(line, p, next - p);
+		line[next - p] = '\0';
 
 		if (!parse_dmesg_line(line, &flags, &ts_usec, &continuation, &message))
 			continue;
@@ -1100,7 +1129,8 @@ static bool fill_from_dmesg(int fd,
 	free(warnings);
 	free(dynamic_warnings);
 	g_regex_unref(re);
-	fclose(f);
+	if (buf)
+		munmap(buf, statbuf.st_size);
 	return true;
 }
 
@@ -1129,7 +1159,7 @@ static void fill_from_journal(int fd,
 			      struct subtest_list *subtests,
 			      struct results *results)
 {
-	FILE *f = fdopen(fd, "r");
+	FILE *f = fdopen(dup(fd), "r");
 	char *line = NULL;
 	size_t linelen = 0;
 	ssize_t read;
@@ -2104,21 +2134,15 @@ static void add_to_totals(const char *binary,
 	}
 }
 
-static bool parse_test_directory(int dirfd,
+static bool parse_test_directory(int *fds,
 				 struct job_list_entry *entry,
 				 struct settings *settings,
 				 struct results *results)
 {
-	int fds[_F_LAST];
 	struct subtest_list subtests = {};
 	bool status = true;
 	int commsparsed;
 
-	if (!open_output_files(dirfd, fds, false)) {
-		fprintf(stderr, "Error opening output files\n");
-		return false;
-	}
-
 	/*
 	 * Get test output from socket comms if it exists, otherwise
 	 * parse stdout/stderr
@@ -2157,7 +2181,6 @@ static bool parse_test_directory(int dirfd,
 	add_to_totals(entry->binary, &subtests, results);
 
  parse_output_end:
-	close_outputs(fds);
 	free_subtests(&subtests);
 
 	return status;
@@ -2212,34 +2235,497 @@ static void create_result_root_nodes(struct json_object *root,
 	json_object_object_add(root, "runtimes", results->runtimes);
 }
 
-struct json_object *generate_results_json(int dirfd)
+static void init_results(struct results *results)
 {
-	struct settings settings;
-	struct job_list job_list;
-	struct json_object *obj, *elapsed;
-	struct results results;
-	int testdirfd, fd;
+	results->tests = json_object_new_object();
+	results->totals = json_object_new_object();
+	results->runtimes = json_object_new_object();
+}
+
+static void free_results(struct results *results)
+{
+	json_object_put(results->tests);
+	json_object_put(results->totals);
+	json_object_put(results->runtimes);
+	memset(results, 0, sizeof(*results));
+}
+
+static void merge_tests(struct json_object *tests, struct json_object *from)
+{
+	json_object_object_foreach(from, key, val)
+		json_object_object_add(tests, key, json_object_get(val));
+}
+
+static void merge_totals(struct json_object *totals, struct json_object *from)
+{
+	json_object_object_foreach(from, key, val) {
+		struct json_object *obj = get_totals_object(totals, key);
+
+		json_object_object_foreach(val, result, numobj) {
+			struct json_object *old;
+			int num = json_object_get_int(numobj);
+
+			if (json_object_object_get_ex(obj, result, &old))
+				num += json_object_get_int(old);
+
+			json_object_object_add(obj, result, json_object_new_int(num));
+		}
+	}
+}
+
+static void merge_runtimes(struct json_object *runtimes, struct json_object *from)
+{
+	json_object_object_foreach(from, key, val) {
+		struct json_object *obj = get_or_create_json_object(runtimes, key);
+		struct json_object *timeobj, *end;
+
+		if (json_object_object_get_ex(val, "time", &timeobj) &&
+		    json_object_object_get_ex(timeobj, "end", &end))
+			add_runtime(obj, json_object_get_double(end));
+	}
+}
+
+static void merge_results(struct results *results, struct results *from)
+{
+	merge_tests(results->tests, from->tests);
+	merge_totals(results->totals, from->totals);
+	merge_runtimes(results->runtimes, from->runtimes);
+}
+
+#define RESULTS_CACHE_FILENAME "results-cache.json"
+#define RESULTS_CACHE_VERSION 1
+
+/*
+ * Describes everything the parsed results of a test directory depend
+ * on: the parsing settings, the job list entry and the size and
+ * modification time of every output file.
+ */
+static char *results_cache_key(int *fds,
+			       const struct job_list_entry *entry,
+			       const struct settings *settings)
+{
+	char *key = NULL;
+	size_t keylen = 0;
+	FILE *f;
 	size_t i;
 
-	init_settings(&settings);
-	init_job_list(&job_list);
+	f = open_memstream(&key, &keylen);
+	if (!f)
+		return NULL;
 
-	if (!read_settings_from_dir(&settings, dirfd)) {
-		fprintf(stderr, "resultgen: Cannot parse settings\n");
+	fprintf(f, "v%d prune:%d piglit:%d warn:%d %s",
+		RESULTS_CACHE_VERSION, settings->prune_mode,
+		settings->piglit_style_dmesg, settings->dmesg_warn_level,
+		entry->binary);
+
+	for (i = 0; i < entry->subtest_count; i++)
+		fprintf(f, "%c%s", i ? ',' : ' ', entry->subtests[i]);
+
+	for (i = 0; i < _F_LAST; i++) {
+		struct stat st;
+
+		if (fds[i] < 0 || fstat(fds[i], &st)) {
+			fprintf(f, " -");
+			continue;
+		}
+
+		fprintf(f, " %lld:%lld.%09ld",
+			(long long)st.st_size,
+			(long long)st.st_mtim.tv_sec,
+			st.st_mtim.tv_nsec);
+	}
+
+	fclose(f);
+
+	return key;
+}
+
+static struct json_object *read_json_file(int dirfd, const char *name)
+{
+	struct json_object *obj = NULL;
+	struct json_tokener *tok;
+	struct stat st;
+	char *buf;
+	int fd;
+
+	if ((fd = openat(dirfd, name, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
 		return NULL;
 	}
 
-	if (!read_job_list(&job_list, dirfd)) {
-		fprintf(stderr, "resultgen: Cannot parse job list\n");
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
 		return NULL;
+
+	tok = json_tokener_new();
+	obj = json_tokener_parse_ex(tok, buf, st.st_size);
+	if (json_tokener_get_error(tok) != json_tokener_success) {
+		json_object_put(obj);
+		obj = NULL;
 	}
+	json_tokener_free(tok);
+	munmap(buf, st.st_size);
+
+	return obj;
+}
+
+static bool read_results_cache(int testdirfd, const char *key,
+			       struct results *results)
+{
+	struct json_object *cache, *obj;
+	struct results cached = {};
+	bool hit = false;
+
+	cache = read_json_file(testdirfd, RESULTS_CACHE_FILENAME);
+	if (!cache)
+		return false;
+
+	if (!json_object_object_get_ex(cache, "key", &obj) ||
+	    strcmp(json_object_get_string(obj), key))
+		goto out;
+
+	if (!json_object_object_get_ex(cache, "tests", &cached.tests) ||
+	    !json_object_object_get_ex(cache, "totals", &cached.totals) ||
+	    !json_object_object_get_ex(cache, "runtimes", &cached.runtimes))
+		goto out;
+
+	merge_results(results, &cached);
+	hit = true;
+
+out:
+	json_object_put(cache);
+
+	return hit;
+}
+
+static void write_results_cache(int testdirfd, const char *key,
+				struct results *results)
+{
+	const char *tmpname = RESULTS_CACHE_FILENAME ".tmp";
+	struct json_object *cache;
+	const char *json_string;
+	size_t len;
+	int fd;
+
+	cache = json_object_new_object();
+	json_object_object_add(cache, "key", json_object_new_string(key));
+	json_object_object_add(cache, "tests", json_object_get(results->tests));
+	json_object_object_add(cache, "totals", json_object_get(results->totals));
+	json_object_object_add(cache, "runtimes", json_object_get(results->runtimes));
+
+	json_string = json_object_to_json_string_ext(cache, JSON_C_TO_STRING_PLAIN);
+	len = json_string ? strlen(json_string) : 0;
+
+	/* A missing cache only costs a reparse, so failures are ignored. */
+	if (len &&
+	    (fd = openat(testdirfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0) {
+		bool written = write(fd, json_string, len) == len;
+
+		close(fd);
+		if (!written || renameat(testdirfd, tmpname, testdirfd, RESULTS_CACHE_FILENAME))
+			unlinkat(testdirfd, tmpname, 0);
+	}
+
+	json_object_put(cache);
+}
+
+static bool parse_job(int dirfd, size_t idx,
+		      struct job_list_entry *entry,
+		      struct settings *settings,
+		      struct results *results,
+		      bool use_cache)
+{
+	int fds[_F_LAST];
+	char name[16];
+	char *key = NULL;
+	int testdirfd;
+	bool ret;
+
+	snprintf(name, 16, "%zd", idx);
+	if ((testdirfd = openat(dirfd, name, O_DIRECTORY | O_RDONLY)) < 0) {
+		try_add_notrun_results(entry, settings, results);
+		return true;
+	}
+
+	if (!open_output_files(testdirfd, fds, false)) {
+		fprintf(stderr, "Error opening output files\n");
+		close(testdirfd);
+		return false;
+	}
+
+	if (use_cache) {
+		key = results_cache_key(fds, entry, settings);
+		if (key && read_results_cache(testdirfd, key, results)) {
+			ret = true;
+			goto out;
+		}
+	}
+
+	ret = parse_test_directory(fds, entry, settings, results);
+
+	if (ret && key)
+		write_results_cache(testdirfd, key, results);
+
+out:
+	free(key);
+	close_outputs(fds);
+	close(testdirfd);
+
+	return ret;
+}
+
+/*
+ * Job list entries are parsed into private results objects and merged
+ * in job list order, which only gives the same results as parsing them
+ * one by one into a shared tree if no two entries can produce results
+ * for the same test. That holds for all job lists the runner creates
+ * itself, but a hand written one can list a binary or subtest twice.
+ */
+static bool job_list_has_overlaps(struct job_list *job_list)
+{
+	GHashTable *binaries, *subtests;
+	bool overlaps = false;
+	size_t i, k;
+
+	binaries = g_hash_table_new(g_str_hash, g_str_equal);
+	subtests = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	for (i = 0; i < job_list->size && !overlaps; i++) {
+		struct job_list_entry *entry = &job_list->entries[i];
+		gpointer whole = g_hash_table_lookup(binaries, entry->binary);
+
+		if (entry->subtest_count == 0) {
+			overlaps = g_hash_table_contains(binaries, entry->binary);
+			g_hash_table_insert(binaries, entry->binary, GINT_TO_POINTER(1));
+			continue;
+		}
+
+		if (whole) {
+			overlaps = true;
+			break;
+		}
+
+		g_hash_table_insert(binaries, entry->binary, GINT_TO_POINTER(0));
+
+		for (k = 0; k < entry->subtest_count; k++) {
+			const char *subtest = entry->subtests[k];
+			/* Dynamic subtests share their parent's result node. */
+			int len = strcspn(subtest, "@");
+			char *key = g_strdup_printf("%s@%.*s", entry->binary, len, subtest);
+
+			if (!g_hash_table_add(subtests, key)) {
+				overlaps = true;
+				break;
+			}
+		}
+	}
+
+	g_hash_table_destroy(subtests);
+	g_hash_table_destroy(binaries);
+
+	return overlaps;
+}
+
+struct resultgen_slot
+{
+	struct results results;
+	bool status;
+	bool done;
+};
+
+/*
+ * Parses test directories on a pool of worker threads. At most window
+ * entries are in flight or waiting to be consumed at a time, so memory
+ * use stays bounded regardless of the size of the job list.
+ */
+struct resultgen_pool
+{
+	int dirfd;
+	struct settings *settings;
+	struct job_list *job_list;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int num_threads;
+	bool stop;
+	bool cache;
+
+	struct resultgen_slot *slots;
+	size_t window;
+	size_t next;
+	size_t consumed;
+};
+
+static void *resultgen_worker(void *data)
+{
+	struct resultgen_pool *pool = data;
+
+	for (;;) {
+		struct resultgen_slot *slot;
+		bool status;
+		size_t i;
+
+		pthread_mutex_lock(&pool->mutex);
+		while (!pool->stop && pool->next < pool->job_list->size &&
+		       pool->next - pool->consumed >= pool->window)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (pool->stop || pool->next >= pool->job_list->size) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		slot = &pool->slots[i % pool->window];
+		init_results(&slot->results);
+		status = parse_job(pool->dirfd, i, &pool->job_list->entries[i],
+				   pool->settings, &slot->results, pool->cache);
+
+		pthread_mutex_lock(&pool->mutex);
+		slot->status = status;
+		slot->done = true;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	return NULL;
+}
+
+static int resultgen_jobs(const struct resultgen_options *opts)
+{
+	long cpus;
+
+	if (!opts)
+		return 1;
+
+	if (opts->jobs > 0)
+		return opts->jobs;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? cpus : 1;
+}
+
+static bool pool_start(struct resultgen_pool *pool, int dirfd,
+		       struct settings *settings,
+		       struct job_list *job_list,
+		       int jobs, bool cache)
+{
+	int i;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->dirfd = dirfd;
+	pool->settings = settings;
+	pool->job_list = job_list;
+	pool->cache = cache;
+
+	/* A single job is parsed in place by pool_wait(). */
+	if (jobs > 1 && (size_t)jobs > job_list->size)
+		jobs = job_list->size;
+	pool->window = jobs > 1 ? 4 * jobs : 1;
+
+	pool->slots = calloc(pool->window, sizeof(*pool->slots));
+	if (!pool->slots)
+		return false;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	if (jobs <= 1)
+		return true;
+
+	pool->threads = calloc(jobs, sizeof(*pool->threads));
+	if (!pool->threads)
+		return true;
+
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   resultgen_worker, pool))
+			break;
+		pool->num_threads++;
+	}
+
+	return true;
+}
+
+static struct resultgen_slot *pool_wait(struct resultgen_pool *pool, size_t i)
+{
+	struct resultgen_slot *slot = &pool->slots[i % pool->window];
+
+	if (!pool->num_threads) {
+		init_results(&slot->results);
+		slot->status = parse_job(pool->dirfd, i,
+					 &pool->job_list->entries[i],
+					 pool->settings, &slot->results,
+					 pool->cache);
+		slot->done = true;
+		return slot;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!slot->done)
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return slot;
+}
+
+static void pool_release(struct resultgen_pool *pool, size_t i)
+{
+	struct resultgen_slot *slot = &pool->slots[i % pool->window];
+
+	free_results(&slot->results);
+
+	pthread_mutex_lock(&pool->mutex);
+	slot->done = false;
+	pool->consumed++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void pool_stop(struct resultgen_pool *pool)
+{
+	size_t i;
+	int t;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (t = 0; t < pool->num_threads; t++)
+		pthread_join(pool->threads[t], NULL);
+
+	for (i = 0; i < pool->window; i++) {
+		if (pool->slots[i].done)
+			free_results(&pool->slots[i].results);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool->slots);
+}
+
+static struct json_object *create_results_header(int dirfd,
+						 struct settings *settings)
+{
+	struct json_object *obj, *elapsed;
+	int fd;
 
 	obj = json_object_new_object();
 	json_object_object_add(obj, "__type__", json_object_new_string("TestrunResult"));
 	json_object_object_add(obj, "results_version", json_object_new_int(10));
 	json_object_object_add(obj, "name",
-			       settings.name ?
-			       json_object_new_string(settings.name) :
+			       settings->name ?
+			       json_object_new_string(settings->name) :
 			       json_object_new_string(""));
 
 	if ((fd = openat(dirfd, "uname.txt", O_RDONLY)) >= 0) {
@@ -2270,6 +2756,115 @@ struct json_object *generate_results_json(int dirfd)
 	}
 	json_object_object_add(obj, "time_elapsed", elapsed);
 
+	return obj;
+}
+
+static void add_aborted_results(int dirfd, struct results *results)
+{
+	char buf[4096];
+	char piglit_name[] = "igt@runner@aborted";
+	struct subtest_list abortsub = {};
+	struct json_object *aborttest;
+	ssize_t s;
+	int fd;
+
+	if ((fd = openat(dirfd, "aborted.txt", O_RDONLY)) < 0)
+		return;
+
+	aborttest = get_or_create_json_object(results->tests, piglit_name);
+
+	add_subtest(&abortsub, strdup("aborted"));
+
+	s = read(fd, buf, sizeof(buf));
+
+	json_object_object_add(aborttest, "out",
+			       new_escaped_json_string(buf, s));
+	json_object_object_add(aborttest, "err",
+			       json_object_new_string(""));
+	json_object_object_add(aborttest, "dmesg",
+			       json_object_new_string(""));
+	json_object_object_add(aborttest, "result",
+			       json_object_new_string("fail"));
+
+	add_to_totals("runner", &abortsub, results);
+
+	free_subtests(&abortsub);
+	close(fd);
+}
+
+static bool read_results_dir(int dirfd,
+			     struct settings *settings,
+			     struct job_list *job_list)
+{
+	init_settings(settings);
+	init_job_list(job_list);
+
+	if (!read_settings_from_dir(settings, dirfd)) {
+		fprintf(stderr, "resultgen: Cannot parse settings\n");
+		return false;
+	}
+
+	if (!read_job_list(job_list, dirfd)) {
+		fprintf(stderr, "resultgen: Cannot parse job list\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool fill_results(int dirfd,
+			 struct settings *settings,
+			 struct job_list *job_list,
+			 struct results *results,
+			 int jobs, bool cache)
+{
+	struct resultgen_pool pool;
+	bool status = true;
+	size_t i;
+
+	if ((jobs <= 1 && !cache) || job_list_has_overlaps(job_list)) {
+		for (i = 0; i < job_list->size; i++) {
+			if (!parse_job(dirfd, i, &job_list->entries[i],
+				       settings, results, false))
+				return false;
+		}
+
+		return true;
+	}
+
+	if (!pool_start(&pool, dirfd, settings, job_list, jobs, cache))
+		return false;
+
+	for (i = 0; i < job_list->size; i++) {
+		struct resultgen_slot *slot = pool_wait(&pool, i);
+
+		if (!slot->status) {
+			status = false;
+			break;
+		}
+
+		merge_results(results, &slot->results);
+		pool_release(&pool, i);
+	}
+
+	pool_stop(&pool);
+
+	return status;
+}
+
+struct json_object *generate_results_json_opts(int dirfd,
+					       const struct resultgen_options *opts)
+{
+	struct settings settings;
+	struct job_list job_list;
+	struct json_object *obj;
+	struct results results;
+
+	if (!read_results_dir(dirfd, &settings, &job_list))
+		return NULL;
+
+	obj = create_results_header(dirfd, &settings);
+
 	create_result_root_nodes(obj, &results);
 
 	/*
@@ -2285,60 +2880,173 @@ struct json_object *generate_results_json(int dirfd)
 	 * - options
 	 */
 
-	for (i = 0; i < job_list.size; i++) {
-		char name[16];
+	if (!fill_results(dirfd, &settings, &job_list, &results,
+			  resultgen_jobs(opts), opts && opts->cache)) {
+		json_object_put(obj);
+		return NULL;
+	}
 
-		snprintf(name, 16, "%zd", i);
-		if ((testdirfd = openat(dirfd, name, O_DIRECTORY | O_RDONLY)) < 0) {
-			try_add_notrun_results(&job_list.entries[i], &settings, &results);
-			continue;
-		}
+	add_aborted_results(dirfd, &results);
 
-		if (!parse_test_directory(testdirfd, &job_list.entries[i], &settings, &results)) {
-			close(testdirfd);
-			return NULL;
+	clear_settings(&settings);
+	free_job_list(&job_list);
+
+	return obj;
+}
+
+struct json_object *generate_results_json(int dirfd)
+{
+	struct resultgen_options opts = { .jobs = 1 };
+
+	return generate_results_json_opts(dirfd, &opts);
+}
+
+static void write_json_key(FILE *f, const char *key)
+{
+	struct json_object *keyobj = json_object_new_string(key);
+
+	fprintf(f, "%s:", json_object_to_json_string(keyobj));
+	json_object_put(keyobj);
+}
+
+static void write_json_members(FILE *f, struct json_object *obj,
+			       const char *indent, bool *first)
+{
+	json_object_object_foreach(obj, key, val) {
+		fprintf(f, "%s\n%s", *first ? "" : ",", indent);
+		write_json_key(f, key);
+		fputs(json_object_to_json_string_ext(val, JSON_C_TO_STRING_PLAIN), f);
+		*first = false;
+	}
+}
+
+bool generate_results_stream(int dirfd, FILE *f,
+			     const struct resultgen_options *opts)
+{
+	struct settings settings;
+	struct job_list job_list;
+	struct resultgen_pool pool;
+	struct json_object *header;
+	struct results results, aborted;
+	bool first = true, status = true;
+	int jobs = resultgen_jobs(opts);
+	size_t i;
+
+	if (!read_results_dir(dirfd, &settings, &job_list))
+		return false;
+
+	header = create_results_header(dirfd, &settings);
+
+	if (job_list_has_overlaps(&job_list)) {
+		/* Cannot stream tests which later entries may update. */
+		create_result_root_nodes(header, &results);
+		status = fill_results(dirfd, &settings, &job_list, &results,
+				      1, false);
+		if (status) {
+			add_aborted_results(dirfd, &results);
+			fputs(json_object_to_json_string_ext(header, JSON_C_TO_STRING_PRETTY), f);
 		}
-		close(testdirfd);
+		goto out;
 	}
 
-	if ((fd = openat(dirfd, "aborted.txt", O_RDONLY)) >= 0) {
-		char buf[4096];
-		char piglit_name[] = "igt@runner@aborted";
-		struct subtest_list abortsub = {};
-		struct json_object *aborttest = get_or_create_json_object(results.tests, piglit_name);
-		ssize_t s;
+	init_results(&results);
 
-		add_subtest(&abortsub, strdup("aborted"));
+	if (!pool_start(&pool, dirfd, &settings, &job_list, jobs,
+			opts && opts->cache)) {
+		status = false;
+		goto out_results;
+	}
 
-		s = read(fd, buf, sizeof(buf));
+	fputs("{", f);
+	write_json_members(f, header, "  ", &first);
+	fputs(",\n  \"tests\":{", f);
 
-		json_object_object_add(aborttest, "out",
-				       new_escaped_json_string(buf, s));
-		json_object_object_add(aborttest, "err",
-				       json_object_new_string(""));
-		json_object_object_add(aborttest, "dmesg",
-				       json_object_new_string(""));
-		json_object_object_add(aborttest, "result",
-				       json_object_new_string("fail"));
+	first = true;
+	for (i = 0; i < job_list.size; i++) {
+		struct resultgen_slot *slot = pool_wait(&pool, i);
 
-		add_to_totals("runner", &abortsub, &results);
+		if (!slot->status) {
+			status = false;
+			break;
+		}
 
-		free_subtests(&abortsub);
-		close(fd);
+		write_json_members(f, slot->results.tests, "    ", &first);
+		merge_totals(results.totals, slot->results.totals);
+		merge_runtimes(results.runtimes, slot->results.runtimes);
+		pool_release(&pool, i);
 	}
 
+	pool_stop(&pool);
+
+	if (!status)
+		goto out_results;
+
+	init_results(&aborted);
+	add_aborted_results(dirfd, &aborted);
+	write_json_members(f, aborted.tests, "    ", &first);
+	merge_totals(results.totals, aborted.totals);
+	free_results(&aborted);
+
+	fputs("\n  },\n  \"totals\":", f);
+	fputs(json_object_to_json_string_ext(results.totals, JSON_C_TO_STRING_PLAIN), f);
+	fputs(",\n  \"runtimes\":", f);
+	fputs(json_object_to_json_string_ext(results.runtimes, JSON_C_TO_STRING_PLAIN), f);
+	fputs("\n}\n", f);
+
+out_results:
+	free_results(&results);
+out:
+	json_object_put(header);
 	clear_settings(&settings);
 	free_job_list(&job_list);
 
-	return obj;
+	return status && !ferror(f);
 }
 
-bool generate_results(int dirfd)
+static bool write_results_stream(int dirfd, const struct resultgen_options *opts)
+{
+	const char *tmpname = "results.json.tmp";
+	bool status;
+	FILE *f;
+	int fd;
+
+	if ((fd = openat(dirfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		fprintf(stderr, "resultgen: Cannot create results file\n");
+		return false;
+	}
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlinkat(dirfd, tmpname, 0);
+		return false;
+	}
+
+	status = generate_results_stream(dirfd, f, opts);
+	if (fclose(f))
+		status = false;
+
+	if (status && renameat(dirfd, tmpname, dirfd, "results.json")) {
+		fprintf(stderr, "resultgen: Cannot create results file\n");
+		status = false;
+	}
+
+	if (!status)
+		unlinkat(dirfd, tmpname, 0);
+
+	return status;
+}
+
+bool generate_results_opts(int dirfd, const struct resultgen_options *opts)
 {
-	struct json_object *obj = generate_results_json(dirfd);
+	struct json_object *obj;
 	const char *json_string;
 	int resultsfd;
 
+	if (opts && opts->stream)
+		return write_results_stream(dirfd, opts);
+
+	obj = generate_results_json_opts(dirfd, opts);
 	if (obj == NULL)
 		return false;
 
@@ -2367,6 +3075,13 @@ bool generate_results(int dirfd)
 	return true;
 }
 
+bool generate_results(int dirfd)
+{
+	struct resultgen_options opts = { .jobs = 1 };
+
+	return generate_results_opts(dirfd, &opts);
+}
+
 bool generate_results_path(char *resultspath)
 {
 	int dirfd = open(resultspath, O_DIRECTORY | O_RDONLY);
@@ -2,10 +2,37 @@
 #define RUNNER_RESULTGEN_H
 
 #include <stdbool.h>
+#include <stdio.h>
+
+struct resultgen_options
+{
+	/*
+	 * Number of threads parsing test directories, 0 for one per
+	 * online CPU and 1 to parse them serially.
+	 */
+	int jobs;
+
+	/*
+	 * Write the results of each test as soon as it is parsed
+	 * instead of building the whole results tree in memory.
+	 */
+	bool stream;
+
+	/*
+	 * Store the parsed results of each test directory in it and
+	 * reuse them as long as its output files are unchanged.
+	 */
+	bool cache;
+};
 
 bool generate_results(int dirfd);
+bool generate_results_opts(int dirfd, const struct resultgen_options *opts);
 bool generate_results_path(char *resultspath);
 
 struct json_object *generate_results_json(int dirfd);
+struct json_object *generate_results_json_opts(int dirfd,
+					       const struct resultgen_options *opts);
+bool generate_results_stream(int dirfd, FILE *f,
+			     const struct resultgen_options *opts);
 
 #endif
@@ -0,0 +1,290 @@
+/*
+ * Generates results.json for a large synthetic results directory with
+ * each of the resultgen modes, reporting the wall time and the peak RSS
+ * of every run. Every run happens in a child process so the peak RSS
+ * figures are independent of each other. An existing results directory
+ * is copied first, so its results.json and caches are left alone.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "resultgen.h"
+
+static const char metadata[] =
+	"abort_mask : 0\n"
+	"name : resultgen-bench\n"
+	"dry_run : 0\n"
+	"sync : 0\n"
+	"log_level : 0\n"
+	"overwrite : 0\n"
+	"multiple_mode : 0\n"
+	"inactivity_timeout : 0\n"
+	"use_watchdog : 0\n"
+	"piglit_style_dmesg : 0\n"
+	"test_root : /path/does/not/exist\n"
+	"results_path : /path/does/not/exist\n";
+
+static void write_file(int dirfd, const char *name, const char *buf, size_t len)
+{
+	int fd;
+
+	fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert(write(fd, buf, len) == len);
+	close(fd);
+}
+
+static void make_test_dir(int dirfd, size_t idx, const char *binary,
+			  const char *subtest, unsigned int dmesg_lines)
+{
+	char name[16], buf[4096];
+	unsigned long long ts = 1000000ULL * idx;
+	unsigned int i;
+	int testdirfd, len;
+	FILE *f;
+
+	snprintf(name, sizeof(name), "%zd", idx);
+	assert(!mkdirat(dirfd, name, 0755));
+	testdirfd = openat(dirfd, name, O_DIRECTORY | O_RDONLY);
+	assert(testdirfd >= 0);
+
+	len = snprintf(buf, sizeof(buf), "%s\nexit:0 (0.%03zds)\n",
+		       subtest, idx % 1000);
+	write_file(testdirfd, "journal.txt", buf, len);
+
+	len = snprintf(buf, sizeof(buf),
+		       "IGT-Version: 1.27-g0000000 (x86_64) (Linux: 6.1.0 x86_64)\n"
+		       "Starting subtest: %s\n"
+		       "Subtest %s: SUCCESS (0.%03zds)\n",
+		       subtest, subtest, idx % 1000);
+	write_file(testdirfd, "out.txt", buf, len);
+
+	len = snprintf(buf, sizeof(buf),
+		       "Starting subtest: %s\n"
+		       "Subtest %s: SUCCESS (0.%03zds)\n",
+		       subtest, subtest, idx % 1000);
+	write_file(testdirfd, "err.txt", buf, len);
+
+	f = fdopen(openat(testdirfd, "dmesg.txt",
+			  O_WRONLY | O_CREAT | O_TRUNC, 0644), "w");
+	assert(f);
+	fprintf(f, "14,%zd,%llu,-;[IGT] %s: executing\n", idx, ts++, binary);
+	fprintf(f, "14,%zd,%llu,-;[IGT] %s: starting subtest %s\n",
+		idx, ts++, binary, subtest);
+	for (i = 0; i < dmesg_lines; i++)
+		fprintf(f, "%d,%zd,%llu,-;i915 0000:00:02.0: [drm] synthetic message %u\n",
+			i % 16 ? 6 : 3, idx, ts++, i);
+	fprintf(f, "14,%zd,%llu,-;[IGT] %s: exiting, ret=0\n", idx, ts++, binary);
+	fclose(f);
+
+	close(testdirfd);
+}
+
+static void make_results_dir(int dirfd, size_t num_entries,
+			     unsigned int subtests_per_binary,
+			     unsigned int dmesg_lines)
+{
+	FILE *joblist;
+	size_t i;
+
+	write_file(dirfd, "metadata.txt", metadata, strlen(metadata));
+	write_file(dirfd, "uname.txt", "Linux resultgen-bench\n", 22);
+	write_file(dirfd, "starttime.txt", "1539953735.111039\n", 18);
+	write_file(dirfd, "endtime.txt", "1539953835.111039\n", 18);
+
+	joblist = fdopen(openat(dirfd, "joblist.txt",
+				O_WRONLY | O_CREAT | O_TRUNC, 0644), "w");
+	assert(joblist);
+
+	for (i = 0; i < num_entries; i++) {
+		char binary[32], subtest[32];
+
+		snprintf(binary, sizeof(binary), "bench_%zd", i / subtests_per_binary);
+		snprintf(subtest, sizeof(subtest), "subtest-%zd", i % subtests_per_binary);
+
+		fprintf(joblist, "%s %s\n", binary, subtest);
+		make_test_dir(dirfd, i, binary, subtest, dmesg_lines);
+	}
+
+	fclose(joblist);
+}
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void run(int dirfd, const char *name,
+		const struct resultgen_options *opts)
+{
+	struct timespec start, end;
+	struct rusage usage;
+	int status;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Or the child prints the buffered lines again */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+		exit(generate_results_opts(dirfd, opts) ? 0 : 1);
+
+	assert(wait4(pid, &status, 0, &usage) == pid);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%-16s %8.3fs %8ldKiB%s\n", name, elapsed(&start, &end),
+	       usage.ru_maxrss,
+	       WIFEXITED(status) && !WEXITSTATUS(status) ? "" : " (failed)");
+}
+
+static const char *copy_dst;
+static size_t copy_src_len;
+
+static int copy_cb(const char *path, const struct stat *st, int flag,
+		   struct FTW *ftw)
+{
+	const char *rel = path + copy_src_len;
+	char dst[PATH_MAX], buf[65536];
+	ssize_t len = 0;
+	int in, out;
+
+	if (ftw->level == 0)
+		return 0;
+
+	while (*rel == '/')
+		rel++;
+	snprintf(dst, sizeof(dst), "%s/%s", copy_dst, rel);
+
+	if (flag == FTW_D)
+		return mkdir(dst, 0755);
+	if (flag != FTW_F)
+		return 0;
+
+	in = open(path, O_RDONLY);
+	if (in < 0)
+		return -1;
+
+	out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	while ((len = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, len) != len) {
+			len = -1;
+			break;
+		}
+	}
+
+	close(out);
+	close(in);
+
+	return len < 0 ? -1 : 0;
+}
+
+static int rm_cb(const char *path, const struct stat *st, int flag,
+		 struct FTW *ftw)
+{
+	return remove(path);
+}
+
+int main(int argc, char **argv)
+{
+	char tmp[] = "/tmp/resultgen_bench.XXXXXX";
+	unsigned int subtests = 20, dmesg_lines = 200, reps = 1;
+	size_t num_entries = 10000;
+	const char *path = NULL;
+	int dirfd, jobs = 0, c;
+
+	while ((c = getopt(argc, argv, "d:n:s:l:j:r:")) != -1) {
+		switch (c) {
+		case 'd':
+			path = optarg;
+			break;
+		case 'n':
+			num_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			subtests = atoi(optarg);
+			if (subtests < 1)
+				subtests = 1;
+			break;
+		case 'l':
+			dmesg_lines = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-d existing-results] [-n entries] [-s subtests-per-binary]\n"
+				"          [-l dmesg-lines] [-j jobs] [-r repeats]\n",
+				argv[0]);
+			exit(1);
+		}
+	}
+
+	if (!mkdtemp(tmp)) {
+		perror(tmp);
+		exit(1);
+	}
+
+	dirfd = open(tmp, O_DIRECTORY | O_RDONLY);
+	assert(dirfd >= 0);
+
+	if (path) {
+		copy_dst = tmp;
+		copy_src_len = strlen(path);
+		if (nftw(path, copy_cb, 16, FTW_PHYS)) {
+			fprintf(stderr, "Failed to copy %s to %s\n", path, tmp);
+			nftw(tmp, rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+			exit(1);
+		}
+	} else {
+		make_results_dir(dirfd, num_entries, subtests, dmesg_lines);
+	}
+
+	while (reps--) {
+		struct resultgen_options serial = { .jobs = 1 };
+		struct resultgen_options parallel = { .jobs = jobs };
+		struct resultgen_options stream = { .jobs = 1, .stream = true };
+		struct resultgen_options stream_parallel = { .jobs = jobs, .stream = true };
+		struct resultgen_options cached = { .jobs = jobs, .cache = true };
+
+		run(dirfd, "serial", &serial);
+		run(dirfd, "parallel", &parallel);
+		run(dirfd, "stream", &stream);
+		run(dirfd, "stream-parallel", &stream_parallel);
+		/* The first cached run only populates the cache. */
+		run(dirfd, "cache-fill", &cached);
+		run(dirfd, "cached", &cached);
+	}
+
+	close(dirfd);
+
+	nftw(tmp, rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+
+	return 0;
+}
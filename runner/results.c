@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -6,18 +7,60 @@
 
 #include "resultgen.h"
 
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] results-path\n\n"
+		"Options:\n"
+		"  -j, --jobs=N    Parse test directories with N threads, 0 for\n"
+		"                  one per CPU (default: 1)\n"
+		"  -s, --stream    Write results.json incrementally instead of\n"
+		"                  building it in memory first\n"
+		"  -c, --cache     Keep the parsed results of each test directory\n"
+		"                  next to it and reuse them while it is unchanged\n",
+		argv0);
+}
+
 int main(int argc, char **argv)
 {
-	int dirfd;
+	static struct option long_options[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"stream", no_argument, NULL, 's'},
+		{"cache", no_argument, NULL, 'c'},
+		{ 0, 0, 0, 0},
+	};
+	struct resultgen_options opts = { .jobs = 1 };
+	int dirfd, c;
 
-	if (argc < 2)
+	while ((c = getopt_long(argc, argv, "j:sc", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			opts.jobs = atoi(optarg);
+			if (opts.jobs < 0)
+				opts.jobs = 1;
+			break;
+		case 's':
+			opts.stream = true;
+			break;
+		case 'c':
+			opts.cache = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
 		exit(1);
+	}
 
-	dirfd = open(argv[1], O_DIRECTORY | O_RDONLY);
+	dirfd = open(argv[optind], O_DIRECTORY | O_RDONLY);
 	if (dirfd < 0)
 		exit(1);
 
-	if (generate_results(dirfd)) {
+	if (generate_results_opts(dirfd, &opts)) {
 		printf("Results generated\n");
 		exit(0);
 	}
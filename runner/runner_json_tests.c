@@ -1,6 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <ftw.h>
 
 #include <json.h>
 
@@ -123,19 +124,30 @@ static void compare(struct json_object *one,
 	}
 }
 
-static void run_results_and_compare(int dirfd, const char *dirname)
+static struct json_object *generate_results_streamed(int testdirfd,
+						     const struct resultgen_options *opts)
 {
-	int testdirfd = openat(dirfd, dirname, O_RDONLY | O_DIRECTORY);
-	int reference;
-	struct json_object *resultsobj, *referenceobj;
+	struct json_object *obj;
+	FILE *f = tmpfile();
 
-	igt_assert_fd(testdirfd);
+	igt_assert(f);
+	igt_assert(generate_results_stream(testdirfd, f, opts));
+	igt_assert_eq(fflush(f), 0);
+	igt_assert_eq(lseek(fileno(f), 0, SEEK_SET), 0);
 
-	igt_assert((resultsobj = generate_results_json(testdirfd)) != NULL);
+	obj = read_json(fileno(f));
+	fclose(f);
 
-	reference = openat(testdirfd, "reference.json", O_RDONLY);
-	close(testdirfd);
+	return obj;
+}
+
+static void compare_with_reference(int testdirfd,
+				   struct json_object *resultsobj)
+{
+	struct json_object *referenceobj;
+	int reference;
 
+	reference = openat(testdirfd, "reference.json", O_RDONLY);
 	igt_assert_fd(reference);
 	referenceobj = read_json(reference);
 	close(reference);
@@ -147,6 +159,211 @@ static void run_results_and_compare(int dirfd, const char *dirname)
 	igt_assert_eq(json_object_put(referenceobj), 1);
 }
 
+static const char *copy_src, *copy_dst;
+
+static int copy_cb(const char *path, const struct stat *st, int flag,
+		   struct FTW *ftw)
+{
+	char dst[PATH_MAX];
+	char buf[4096];
+	int in, out;
+	ssize_t s;
+
+	snprintf(dst, sizeof(dst), "%s%s", copy_dst, path + strlen(copy_src));
+
+	if (flag == FTW_D)
+		return mkdir(dst, 0755) && errno != EEXIST;
+
+	in = open(path, O_RDONLY);
+	igt_assert_fd(in);
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	igt_assert_fd(out);
+	while ((s = read(in, buf, sizeof(buf))) > 0)
+		igt_assert_eq(write(out, buf, s), s);
+	close(out);
+	close(in);
+
+	return 0;
+}
+
+static int rm_cb(const char *path, const struct stat *st, int flag,
+		 struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/*
+ * Overwrites the output files of the test directories with as many
+ * bytes of garbage, keeping their size and modification time, which is
+ * all the cache key looks at.
+ */
+static int scramble_cb(const char *path, const struct stat *st, int flag,
+		       struct FTW *ftw)
+{
+	struct timespec times[2] = { st->st_atim, st->st_mtim };
+	char buf[4096];
+	off_t left;
+	int fd;
+
+	if (flag != FTW_F || ftw->level != 2 ||
+	    !strcmp(path + ftw->base, "results-cache.json"))
+		return 0;
+
+	memset(buf, 'x', sizeof(buf));
+	fd = open(path, O_WRONLY);
+	igt_assert_fd(fd);
+	for (left = st->st_size; left > 0; left -= sizeof(buf)) {
+		int len = left < sizeof(buf) ? left : sizeof(buf);
+
+		igt_assert_eq(write(fd, buf, len), len);
+	}
+	igt_assert_eq(futimens(fd, times), 0);
+	close(fd);
+
+	return 0;
+}
+
+static int copy_test_dir(const char *dirname, char *tmp)
+{
+	char src[PATH_MAX];
+	int testdirfd;
+
+	snprintf(src, sizeof(src), "%s/%s", testdatadir, dirname);
+	igt_assert(mkdtemp(tmp));
+	copy_src = src;
+	copy_dst = tmp;
+	igt_assert_eq(nftw(src, copy_cb, 16, FTW_PHYS), 0);
+
+	testdirfd = open(tmp, O_RDONLY | O_DIRECTORY);
+	igt_assert_fd(testdirfd);
+
+	return testdirfd;
+}
+
+static void remove_test_dir(int testdirfd, const char *tmp)
+{
+	close(testdirfd);
+	nftw(tmp, rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void run_results_cached_and_compare(const char *dirname)
+{
+	struct resultgen_options opts = { .jobs = 2, .cache = true };
+	char tmp[] = "/tmp/runner_json_test.XXXXXX";
+	int testdirfd, pass;
+
+	testdirfd = copy_test_dir(dirname, tmp);
+
+	/*
+	 * First pass fills the cache. The outputs are then garbage, so
+	 * the second one only matches the reference if it read the cache.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		struct json_object *resultsobj;
+
+		if (pass)
+			igt_assert_eq(nftw(tmp, scramble_cb, 16, FTW_PHYS), 0);
+
+		resultsobj = generate_results_json_opts(testdirfd, &opts);
+		igt_assert(resultsobj != NULL);
+		compare_with_reference(testdirfd, resultsobj);
+	}
+
+	remove_test_dir(testdirfd, tmp);
+}
+
+static struct json_object *first_subtest(struct json_object *obj)
+{
+	struct json_object *tests, *test;
+
+	igt_assert(json_object_object_get_ex(obj, "tests", &tests));
+	igt_assert(json_object_object_get_ex(tests, "igt@successtest@first-subtest",
+					     &test));
+
+	return test;
+}
+
+static void check_first_subtest_out(struct json_object *resultsobj,
+				    const char *expected)
+{
+	struct json_object *out;
+
+	igt_assert(resultsobj != NULL);
+	igt_assert(json_object_object_get_ex(first_subtest(resultsobj), "out", &out));
+	igt_assert_f(!strcmp(json_object_get_string(out), expected),
+		     "Expected output \"%s\", got \"%s\"\n",
+		     expected, json_object_get_string(out));
+	json_object_put(resultsobj);
+}
+
+/* Rewriting an output file has to invalidate the cache of its test only. */
+static void run_results_cached_output_changed(void)
+{
+	static const char rewritten[] =
+		"IGT-Version: 1.23-g0c763bfd (x86_64) (Linux: 4.18.0-1-amd64 x86_64)\n"
+		"Starting subtest: first-subtest\n"
+		"Output rewritten after caching\n"
+		"Subtest first-subtest: SUCCESS (0.000s)\n";
+	struct resultgen_options opts = { .jobs = 2, .cache = true };
+	char tmp[] = "/tmp/runner_json_test.XXXXXX";
+	struct json_object *cache;
+	const char *json_string;
+	int testdirfd, fd;
+
+	testdirfd = copy_test_dir("normal-run", tmp);
+
+	json_object_put(generate_results_json_opts(testdirfd, &opts));
+
+	/* Marks what comes from the cache */
+	fd = openat(testdirfd, "0/results-cache.json", O_RDONLY);
+	igt_assert_fd(fd);
+	cache = read_json(fd);
+	close(fd);
+	igt_assert(cache != NULL);
+	json_object_object_add(first_subtest(cache), "out",
+			       json_object_new_string("cached\n"));
+
+	json_string = json_object_to_json_string(cache);
+	fd = openat(testdirfd, "0/results-cache.json", O_WRONLY | O_TRUNC);
+	igt_assert_fd(fd);
+	igt_assert_eq(write(fd, json_string, strlen(json_string)), strlen(json_string));
+	close(fd);
+	json_object_put(cache);
+
+	check_first_subtest_out(generate_results_json_opts(testdirfd, &opts),
+				"cached\n");
+
+	fd = openat(testdirfd, "0/out.txt", O_WRONLY | O_TRUNC);
+	igt_assert_fd(fd);
+	igt_assert_eq(write(fd, rewritten, strlen(rewritten)), strlen(rewritten));
+	close(fd);
+
+	check_first_subtest_out(generate_results_json_opts(testdirfd, &opts),
+				rewritten);
+
+	remove_test_dir(testdirfd, tmp);
+}
+
+static void run_results_and_compare(int dirfd, const char *dirname,
+				    const struct resultgen_options *opts)
+{
+	int testdirfd = openat(dirfd, dirname, O_RDONLY | O_DIRECTORY);
+	struct json_object *resultsobj;
+
+	igt_assert_fd(testdirfd);
+
+	if (!opts)
+		resultsobj = generate_results_json(testdirfd);
+	else if (opts->stream)
+		resultsobj = generate_results_streamed(testdirfd, opts);
+	else
+		resultsobj = generate_results_json_opts(testdirfd, opts);
+	igt_assert(resultsobj != NULL);
+
+	compare_with_reference(testdirfd, resultsobj);
+	close(testdirfd);
+}
+
 static const char *dirnames[] = {
 	"normal-run",
 	"warnings",
@@ -174,6 +391,8 @@ static const char *dirnames[] = {
 
 igt_main
 {
+	struct resultgen_options parallel = { .jobs = 4 };
+	struct resultgen_options stream = { .jobs = 4, .stream = true };
 	int dirfd = open(testdatadir, O_RDONLY | O_DIRECTORY);
 	size_t i;
 
@@ -181,7 +400,22 @@ igt_main
 
 	for (i = 0; i < ARRAY_SIZE(dirnames); i++) {
 		igt_subtest(dirnames[i]) {
-			run_results_and_compare(dirfd, dirnames[i]);
+			run_results_and_compare(dirfd, dirnames[i], NULL);
+		}
+
+		igt_subtest_f("%s-parallel", dirnames[i]) {
+			run_results_and_compare(dirfd, dirnames[i], &parallel);
+		}
+
+		igt_subtest_f("%s-stream", dirnames[i]) {
+			run_results_and_compare(dirfd, dirnames[i], &stream);
+		}
+
+		igt_subtest_f("%s-cached", dirnames[i]) {
+			run_results_cached_and_compare(dirnames[i]);
 		}
 	}
+
+	igt_subtest("cached-output-changed")
+		run_results_cached_output_changed();
 }
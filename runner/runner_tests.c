@@ -180,9 +180,11 @@ static void clear_directory(char *name)
 
 static void assert_settings_equal(struct settings *one, struct settings *two)
 {
+	size_t i;
+
 	/*
-	 * Regex lists are not serialized, and thus won't be compared
-	 * here.
+	 * Regex lists other than the shard allowlist are not
+	 * serialized, and thus won't be compared here.
 	 */
 	igt_assert_eq(one->abort_mask, two->abort_mask);
 	igt_assert_eq_u64(one->disk_usage_limit, two->disk_usage_limit);
@@ -202,6 +204,11 @@ static void assert_settings_equal(struct settings *one, struct settings *two)
 	igt_assert_eq(one->piglit_style_dmesg, two->piglit_style_dmesg);
 	igt_assert_eq(one->dmesg_warn_level, two->dmesg_warn_level);
 	igt_assert_eq(one->prune_mode, two->prune_mode);
+	igt_assert_eq(one->shards, two->shards);
+	igt_assert_eq(one->shard_allowlist.size, two->shard_allowlist.size);
+	for (i = 0; i < one->shard_allowlist.size; i++)
+		igt_assert_eqstr(one->shard_allowlist.regex_strings[i],
+				 two->shard_allowlist.regex_strings[i]);
 }
 
 static void assert_job_list_equal(struct job_list *one, struct job_list *two)
@@ -273,6 +280,9 @@ igt_main
 		for (i = 3; i < 400; i++)
 			close(i);
 
+		/* Keep the user's subtest cache out of the tests */
+		unsetenv("IGT_RUNNER_SUBTEST_CACHE");
+
 		init_settings(settings);
 	}
 
@@ -302,6 +312,8 @@ igt_main
 		igt_assert_eq(settings->overall_timeout, 0);
 		igt_assert(!settings->use_watchdog);
 		igt_assert_eq(settings->prune_mode, 0);
+		igt_assert_eq(settings->shards, 0);
+		igt_assert_eq(settings->shard_allowlist.size, 0);
 		igt_assert(strstr(settings->test_root, "test-root-dir") != NULL);
 		igt_assert(strstr(settings->results_path, "path-to-results") != NULL);
 
@@ -433,6 +445,7 @@ igt_main
 
 	igt_subtest("parse-all-settings") {
 		char blacklist_name[PATH_MAX], blacklist2_name[PATH_MAX];
+		char allowlist_name[PATH_MAX];
 		struct environment_variable *env_var;
 
 		const char *argv[] = { "runner",
@@ -465,6 +478,8 @@ igt_main
 				       "--coverage-per-test",
 				       "--collect-script", "/usr/bin/true",
 				       "--prune-mode=keep-subtests",
+				       "--shards", "4",
+				       "--shard-allowlist", allowlist_name,
 				       "test-root-dir",
 				       "path-to-results",
 		};
@@ -473,6 +488,7 @@ igt_main
 
 		sprintf(blacklist_name, "%s/test-blacklist.txt", testdatadir);
 		sprintf(blacklist2_name, "%s/test-blacklist2.txt", testdatadir);
+		sprintf(allowlist_name, "%s/test-shard-allowlist.txt", testdatadir);
 
 		igt_assert(parse_options(ARRAY_SIZE(argv), (char**)argv, settings));
 
@@ -512,6 +528,10 @@ igt_main
 		igt_assert_eq(settings->overall_timeout, 360);
 		igt_assert(settings->use_watchdog);
 		igt_assert_eq(settings->prune_mode, PRUNE_KEEP_SUBTESTS);
+		igt_assert_eq(settings->shards, 4);
+		igt_assert_eq(settings->shard_allowlist.size, 2);
+		igt_assert_eqstr(settings->shard_allowlist.regex_strings[0], "igt@successtest@.*");
+		igt_assert_eqstr(settings->shard_allowlist.regex_strings[1], "igt@no-subtests");
 		igt_assert(strstr(settings->test_root, "test-root-dir") != NULL);
 		igt_assert(strstr(settings->results_path, "path-to-results") != NULL);
 
@@ -790,6 +810,54 @@ igt_main
 		}
 	}
 
+	igt_subtest_group {
+		char dirname[] = "tmpdirXXXXXX";
+		char cachename[PATH_MAX];
+		struct job_list *list = malloc(sizeof(*list));
+		struct job_list *cmp_list = malloc(sizeof(*cmp_list));
+
+		igt_fixture {
+			igt_require(mkdtemp(dirname) != NULL);
+			snprintf(cachename, sizeof(cachename), "%s/subtests.txt", dirname);
+			setenv("IGT_RUNNER_SUBTEST_CACHE", cachename, 1);
+			init_job_list(list);
+			init_job_list(cmp_list);
+		}
+
+		igt_subtest("job-list-subtest-cache") {
+			const char *argv[] = { "runner",
+					       "--allow-non-root",
+					       testdatadir,
+					       "path-to-results",
+			};
+			char *cache;
+
+			igt_assert(parse_options(ARRAY_SIZE(argv), (char**)argv, settings));
+
+			igt_assert(create_job_list(list, settings));
+			igt_assert_eq(list->size, NUM_TESTDATA_SUBTESTS);
+
+			cache = dump_file(AT_FDCWD, cachename);
+			igt_assert_f(cache != NULL, "Subtest cache was not written\n");
+			igt_assert(!strncmp(cache, "igt-subtest-cache 1\n", 20));
+			free(cache);
+
+			/* Second time around the subtests come from the cache */
+			igt_assert(create_job_list(cmp_list, settings));
+			assert_job_list_equal(list, cmp_list);
+		}
+
+		igt_fixture {
+			unsetenv("IGT_RUNNER_SUBTEST_CACHE");
+			unlink(cachename);
+			rmdir(dirname);
+			free_job_list(list);
+			free_job_list(cmp_list);
+			free(list);
+			free(cmp_list);
+		}
+	}
+
 	job_list_filter_test("nofilters", "-n", "placeholderargs", NUM_TESTDATA_SUBTESTS, NUM_TESTDATA_BINARIES);
 	job_list_filter_test("binary-include", "-t", "successtest", 2, 1);
 	job_list_filter_test("binary-exclude", "-x", "successtest", NUM_TESTDATA_SUBTESTS - 2, NUM_TESTDATA_BINARIES - 1);
@@ -940,6 +1008,7 @@ igt_main
 		}
 
 		igt_subtest("settings-serialize") {
+			char allowlist_name[PATH_MAX];
 			const char *argv[] = { "runner",
 					       "-n", "foo",
 					       "--abort-on-monitored-error",
@@ -961,10 +1030,14 @@ igt_main
 					       "--use-watchdog",
 					       "--piglit-style-dmesg",
 					       "--prune-mode=keep-all",
+					       "--shards", "3",
+					       "--shard-allowlist", allowlist_name,
 					       testdatadir,
 					       dirname,
 			};
 
+			sprintf(allowlist_name, "%s/test-shard-allowlist.txt", testdatadir);
+
 			igt_assert(parse_options(ARRAY_SIZE(argv), (char**)argv, settings));
 
 			igt_assert(serialize_settings(settings));
@@ -1524,6 +1597,97 @@ igt_main
 		}
 	}
 
+	igt_subtest_group {
+		char dirname[] = "tmpdirXXXXXX";
+		struct job_list *list = malloc(sizeof(*list));
+		volatile int dirfd = -1, subdirfd = -1, fd = -1;
+
+		igt_fixture {
+			init_job_list(list);
+			igt_require(mkdtemp(dirname) != NULL);
+		}
+
+		igt_subtest("execute-initialize-shards-incomplete") {
+			struct execute_state state;
+			char allowlist_name[PATH_MAX];
+			const char *argv[] = { "runner",
+					       "--allow-non-root",
+					       "--multiple-mode",
+					       "--shards", "4",
+					       "--shard-allowlist", allowlist_name,
+					       testdatadir,
+					       dirname,
+			};
+			/*
+			 * Entries 0 to 3 ran concurrently when the run died.
+			 * Entry 0 completed, the others did not.
+			 */
+			const char *journaltext[] = {
+				"first-subtest\nexit:0 (0.100s)\n",
+				"first-subtest\n",
+				"first-subtest\n",
+				"first-subtest\n",
+			};
+			const char allowlist[] = "igt@.*\n";
+			char name[16];
+			size_t i;
+
+			snprintf(allowlist_name, sizeof(allowlist_name), "%s/allowlist.txt", dirname);
+			igt_assert_lte(0, fd = open(allowlist_name, O_CREAT | O_WRONLY | O_EXCL, 0660));
+			igt_assert_eq(write(fd, allowlist, strlen(allowlist)), strlen(allowlist));
+			close(fd);
+			fd = -1;
+
+			igt_assert(parse_options(ARRAY_SIZE(argv), (char**)argv, settings));
+			igt_assert(create_job_list(list, settings));
+			igt_assert(list->size == NUM_TESTDATA_BINARIES);
+
+			igt_assert(serialize_settings(settings));
+			igt_assert(serialize_job_list(list, settings));
+
+			igt_assert_lte(0, dirfd = open(dirname, O_DIRECTORY | O_RDONLY));
+			for (i = 0; i < ARRAY_SIZE(journaltext); i++) {
+				snprintf(name, sizeof(name), "%zd", i);
+				igt_assert_eq(mkdirat(dirfd, name, 0770), 0);
+				igt_assert((subdirfd = openat(dirfd, name, O_DIRECTORY | O_RDONLY)) >= 0);
+				igt_assert_lte(0, fd = openat(subdirfd, "journal.txt", O_CREAT | O_WRONLY | O_EXCL, 0660));
+				igt_assert_eq(write(fd, journaltext[i], strlen(journaltext[i])),
+					      strlen(journaltext[i]));
+				close(fd);
+				close(subdirfd);
+				fd = subdirfd = -1;
+			}
+
+			free_job_list(list);
+			clear_settings(settings);
+			igt_assert(initialize_execute_state_from_resume(dirfd, &state, settings, list));
+
+			/* The last one continues where it stopped ... */
+			igt_assert_eq(state.next, 3);
+			igt_assert_eq(list->entries[3].subtest_count, 2);
+			igt_assert_eqstr(list->entries[3].subtests[1], "!first-subtest");
+
+			/* ... after the incomplete ones that ran alongside */
+			igt_assert_eq(state.num_resume, 2);
+			igt_assert_eq(state.resume[0], 1);
+			igt_assert_eq(state.resume[1], 2);
+			free(state.resume);
+
+			/* Those are pruned only when they are resumed */
+			igt_assert_eq(list->entries[1].subtest_count, 0);
+			igt_assert_eq(list->entries[2].subtest_count, 0);
+		}
+
+		igt_fixture {
+			close(fd);
+			close(subdirfd);
+			close(dirfd);
+			clear_directory(dirname);
+			free_job_list(list);
+			free(list);
+		}
+	}
+
 	igt_subtest_group {
 		struct job_list *list = malloc(sizeof(*list));
 		volatile int dirfd = -1, subdirfd = -1, fd = -1;
@@ -1594,6 +1758,65 @@ igt_main
 			free(list);
 	}
 
+	igt_subtest_group {
+		struct job_list *list = malloc(sizeof(*list));
+		volatile int dirfd = -1, subdirfd = -1;
+		char dirname[] = "tmpdirXXXXXX";
+		char allowlist_name[PATH_MAX];
+
+		igt_fixture {
+			init_job_list(list);
+			igt_require(mkdtemp(dirname) != NULL);
+			rmdir(dirname);
+			sprintf(allowlist_name, "%s/test-shard-allowlist.txt", testdatadir);
+		}
+
+		igt_subtest("execute-shards") {
+			struct execute_state state;
+			const char *argv[] = { "runner",
+					       "--allow-non-root",
+					       "--shards", "2",
+					       "--shard-allowlist", allowlist_name,
+					       "-t", "successtest",
+					       "-t", "no-subtests",
+					       testdatadir,
+					       dirname,
+			};
+			char testdirname[16];
+			size_t i;
+
+			igt_assert(parse_options(ARRAY_SIZE(argv), (char**)argv, settings));
+			igt_assert(create_job_list(list, settings));
+			igt_assert(initialize_execute_state(&state, settings, list));
+
+			igt_assert(execute(&state, settings, list));
+			igt_assert_eq(state.next, list->size);
+			igt_assert_f((dirfd = open(dirname, O_DIRECTORY | O_RDONLY)) >= 0,
+				     "Execute didn't create the results directory\n");
+
+			for (i = 0; i < list->size; i++) {
+				snprintf(testdirname, 16, "%zd", i);
+
+				igt_assert_f((subdirfd = openat(dirfd, testdirname, O_DIRECTORY | O_RDONLY)) >= 0,
+					     "Execute didn't create result directory '%s'\n", testdirname);
+				assert_execution_results_exist(subdirfd);
+				close(subdirfd);
+			}
+
+			snprintf(testdirname, 16, "%zd", list->size);
+			igt_assert_f((subdirfd = openat(dirfd, testdirname, O_DIRECTORY | O_RDONLY)) < 0,
+				     "Execute created too many directories\n");
+		}
+
+		igt_fixture {
+			close(subdirfd);
+			close(dirfd);
+			clear_directory(dirname);
+			free_job_list(list);
+			free(list);
+		}
+	}
+
 	igt_subtest_group {
 		igt_subtest("metadata-read-old-style-infer-dmesg-warn-piglit-style") {
 			char metadata[] = "piglit_style_dmesg : 1\n";
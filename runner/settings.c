@@ -30,6 +30,8 @@ enum {
 	OPT_COV_RESULTS_PER_TEST,
 	OPT_VERSION,
 	OPT_PRUNE_MODE,
+	OPT_SHARDS,
+	OPT_SHARD_ALLOWLIST,
 	OPT_HELP = 'h',
 	OPT_NAME = 'n',
 	OPT_DRY_RUN = 'd',
@@ -81,6 +83,7 @@ static struct {
 
 static const char settings_filename[] = "metadata.txt";
 static const char env_filename[] = "environment.txt";
+static const char shard_allowlist_filename[] = "shard-allowlist.txt";
 
 static bool set_log_level(struct settings* settings, const char *level)
 {
@@ -291,6 +294,15 @@ static const char *usage_str =
 	"                        If only the key is provided, the current value is read\n"
 	"                        from the runner's environment (and saved for resumes).\n"
 	"  -L, --list-all        List all matching subtests instead of running\n"
+	"  --shards <n>          Run up to <n> job list entries at the same time. Only\n"
+	"                        entries whose tests all match the shard allowlist are\n"
+	"                        run concurrently, everything else runs alone once the\n"
+	"                        running entries have finished. Kernel logs are not\n"
+	"                        separated between concurrently running tests.\n"
+	"  --shard-allowlist FILENAME\n"
+	"                        Regexes, one per line, of tests that are safe to run\n"
+	"                        concurrently with each other, for example tests using\n"
+	"                        only vgem, sw_sync or syncobj (can be used more than once)\n"
 	"  --collect-code-cov    Enables gcov-based collect of code coverage for tests.\n"
 	"                        Requires --collect-script FILENAME\n"
 	"  --coverage-per-test   Stores code coverage results per each test.\n"
@@ -301,6 +313,10 @@ static const char *usage_str =
 	"  [test_root]           Directory that contains the IGT tests. The environment\n"
 	"                        variable IGT_TEST_ROOT will be used if set, overriding\n"
 	"                        this option if given.\n"
+	"\n"
+	"  Setting the environment variable IGT_RUNNER_SUBTEST_CACHE to a file name\n"
+	"  caches the subtests of each test binary in that file, so that unchanged\n"
+	"  binaries are not listed again on the next run.\n"
 	;
 
 __attribute__ ((format (printf, 2, 3)))
@@ -341,18 +357,12 @@ static bool add_regex(struct regex_list *list, char *new)
 	return true;
 }
 
-static bool parse_blacklist(struct regex_list *exclude_regexes,
-			    char *blacklist_filename)
+static bool read_regexes_from_file(struct regex_list *regexes, FILE *f)
 {
-	FILE *f;
 	char *line = NULL;
 	size_t line_len = 0;
 	bool status = false;
 
-	if ((f = fopen(blacklist_filename, "r")) == NULL) {
-		fprintf(stderr, "Cannot open blacklist file %s\n", blacklist_filename);
-		return false;
-	}
 	while (1) {
 		size_t str_size = 0, idx = 0;
 
@@ -375,13 +385,29 @@ static bool parse_blacklist(struct regex_list *exclude_regexes,
 		if (str_size > 0) {
 			char *test_regex = strndup(line, str_size);
 
-			status = add_regex(exclude_regexes, test_regex);
+			status = add_regex(regexes, test_regex);
 			if (!status)
 				break;
 		}
 	}
 
 	free(line);
+	return status;
+}
+
+static bool parse_regex_list(struct regex_list *regexes,
+			     const char *what, char *filename)
+{
+	FILE *f;
+	bool status;
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		fprintf(stderr, "Cannot open %s file %s\n", what, filename);
+		return false;
+	}
+
+	status = read_regexes_from_file(regexes, f);
+
 	fclose(f);
 	return status;
 }
@@ -624,6 +650,7 @@ void clear_settings(struct settings *settings)
 
 	free_regexes(&settings->include_regexes);
 	free_regexes(&settings->exclude_regexes);
+	free_regexes(&settings->shard_allowlist);
 	free_env_vars(&settings->env_vars);
 
 	init_settings(settings);
@@ -664,6 +691,8 @@ bool parse_options(int argc, char **argv,
 		{"prune-mode", required_argument, NULL, OPT_PRUNE_MODE},
 		{"blacklist", required_argument, NULL, OPT_BLACKLIST},
 		{"list-all", no_argument, NULL, OPT_LIST_ALL},
+		{"shards", required_argument, NULL, OPT_SHARDS},
+		{"shard-allowlist", required_argument, NULL, OPT_SHARD_ALLOWLIST},
 		{ 0, 0, 0, 0},
 	};
 
@@ -771,13 +800,25 @@ bool parse_options(int argc, char **argv,
 			}
 			break;
 		case OPT_BLACKLIST:
-			if (!parse_blacklist(&settings->exclude_regexes,
-					     absolute_path(optarg)))
+			if (!parse_regex_list(&settings->exclude_regexes,
+					      "blacklist", absolute_path(optarg)))
 				goto error;
 			break;
 		case OPT_LIST_ALL:
 			settings->list_all = true;
 			break;
+		case OPT_SHARDS:
+			settings->shards = atoi(optarg);
+			if (settings->shards < 1) {
+				usage(stderr, "Shard count must be at least 1");
+				goto error;
+			}
+			break;
+		case OPT_SHARD_ALLOWLIST:
+			if (!parse_regex_list(&settings->shard_allowlist,
+					      "shard allowlist", absolute_path(optarg)))
+				goto error;
+			break;
 		case '?':
 			usage(stderr, NULL);
 			goto error;
@@ -970,6 +1011,31 @@ static bool serialize_environment(struct settings *settings, int dirfd)
 	return true;
 }
 
+static bool serialize_shard_allowlist(struct settings *settings, int dirfd)
+{
+	FILE *f;
+	size_t i;
+
+	if (file_exists_at(dirfd, shard_allowlist_filename) && !settings->overwrite) {
+		usage(stderr, "%s already exists, not overwriting", shard_allowlist_filename);
+		return false;
+	}
+
+	if ((f = fopenat_create(dirfd, shard_allowlist_filename, settings->overwrite)) == NULL)
+		return false;
+
+	for (i = 0; i < settings->shard_allowlist.size; i++)
+		fprintf(f, "%s\n", settings->shard_allowlist.regex_strings[i]);
+
+	if (settings->sync) {
+		fflush(f);
+		fsync(fileno(f));
+	}
+
+	fclose(f);
+	return true;
+}
+
 bool serialize_settings(struct settings *settings)
 {
 #define SERIALIZE_LINE(f, s, name, format) fprintf(f, "%s : " format "\n", #name, s->name)
@@ -1039,6 +1105,7 @@ bool serialize_settings(struct settings *settings)
 	SERIALIZE_LINE(f, settings, enable_code_coverage, "%d");
 	SERIALIZE_LINE(f, settings, cov_results_per_test, "%d");
 	SERIALIZE_LINE(f, settings, code_coverage_script, "%s");
+	SERIALIZE_LINE(f, settings, shards, "%d");
 
 	if (settings->sync) {
 		fflush(f);
@@ -1054,6 +1121,15 @@ bool serialize_settings(struct settings *settings)
 		}
 	}
 
+	if (settings->shard_allowlist.size) {
+		if (!serialize_shard_allowlist(settings, dirfd)) {
+			close(dirfd);
+			return false;
+		}
+	} else if (settings->overwrite) {
+		unlinkat(dirfd, shard_allowlist_filename, 0);
+	}
+
 	if (settings->sync)
 		fsync(dirfd);
 
@@ -1102,6 +1178,7 @@ bool read_settings_from_file(struct settings *settings, FILE *f)
 		PARSE_LINE(settings, name, val, enable_code_coverage, numval);
 		PARSE_LINE(settings, name, val, cov_results_per_test, numval);
 		PARSE_LINE(settings, name, val, code_coverage_script, val ? strdup(val) : NULL);
+		PARSE_LINE(settings, name, val, shards, numval);
 
 		printf("Warning: Unknown field in settings file: %s = %s\n",
 		       name, val);
@@ -1201,5 +1278,19 @@ bool read_settings_from_dir(struct settings *settings, int dirfd)
 		fclose(f);
 	}
 
+	/* allowlist file only exists if --shard-allowlist was set */
+	if (file_exists_at(dirfd, shard_allowlist_filename)) {
+		bool status;
+
+		if ((f = fopenat_read(dirfd, shard_allowlist_filename)) == NULL)
+			return false;
+
+		status = read_regexes_from_file(&settings->shard_allowlist, f);
+		fclose(f);
+
+		if (!status)
+			return false;
+	}
+
 	return true;
 }
@@ -72,6 +72,8 @@ struct settings {
 	char *code_coverage_script;
 	bool enable_code_coverage;
 	bool cov_results_per_test;
+	int shards;
+	struct regex_list shard_allowlist;
 };
 
 /**
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Usage:
+#  scripts/wsim-trace.py trace.bin [trace.json]
+#
+# Converts a gem_wsim -t trace to the Chrome trace event JSON format, as
+# loaded by chrome://tracing and ui.perfetto.dev. Every client becomes a
+# process with one track per engine, showing each batch from submission
+# to completion, and a counter of its requests in flight on the engine.
+
+import json
+import struct
+import sys
+
+HEADER = struct.Struct('<8sIIII')
+RECORD = struct.Struct('<QQIIIHH')
+
+def read_trace(f):
+	magic, version, record_size, nr_engines, _ = HEADER.unpack(f.read(HEADER.size))
+	if magic.rstrip(b'\0') != b'WSIMTRC' or version != 1:
+		sys.exit('Not a gem_wsim trace (version 1)!')
+	if record_size < RECORD.size:
+		sys.exit('Truncated trace records!')
+
+	engines = [f.read(8).rstrip(b'\0').decode() for i in range(nr_engines)]
+
+	records = []
+	while True:
+		data = f.read(record_size)
+		if len(data) < record_size:
+			break
+		records.append(RECORD.unpack_from(data))
+
+	return engines, records
+
+def convert(engines, records):
+	events = []
+	clients = set()
+	start = min((r[0] for r in records), default=0)
+
+	for i, (submit, complete, client, ctx, step, engine, queued) in enumerate(records):
+		name = '%u.%s' % (step, engines[engine])
+		ts = (submit - start) / 1000
+		common = { 'cat': 'batch', 'name': name, 'pid': client,
+			   'tid': engines[engine], 'id': i }
+
+		events.append(dict(common, ph='b', ts=ts,
+				   args={ 'context': ctx, 'step': step,
+					  'queued': queued }))
+		events.append(dict(common, ph='e', ts=(complete - start) / 1000))
+		events.append({ 'ph': 'C', 'name': 'queued ' + engines[engine],
+				'pid': client, 'ts': ts,
+				'args': { 'queued': queued } })
+		clients.add(client)
+
+	for client in sorted(clients):
+		events.append({ 'ph': 'M', 'name': 'process_name', 'pid': client,
+				'args': { 'name': 'client %u' % client } })
+
+	events.sort(key=lambda e: e.get('ts', 0))
+
+	return { 'traceEvents': events, 'displayTimeUnit': 'ns' }
+
+if len(sys.argv) < 2:
+	sys.exit('Usage: %s trace.bin [trace.json]' % sys.argv[0])
+
+with open(sys.argv[1], 'rb') as f:
+	engines, records = read_trace(f)
+
+out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+json.dump(convert(engines, records), out)
+out.write('\n')
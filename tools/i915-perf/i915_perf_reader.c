@@ -25,6 +25,8 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -43,18 +45,33 @@
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) > (b) ? (b) : (a))
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 
 static void
 usage(void)
 {
-	printf("Usage: i915-perf-reader [options] file\n"
-	       "Reads the content of an i915-perf recording.\n"
+	printf("Usage: i915-perf-reader [options] file [file...]\n"
+	       "Reads the content of i915-perf recordings.\n"
 	       "\n"
 	       "     --help,    -h             Print this screen\n"
 	       "     --counters, -c c1,c2,...  List of counters to display values for.\n"
 	       "                               Use 'all' to display all counters.\n"
 	       "                               Use 'list' to list available counters.\n"
-	       "     --reports, -r             Print out data per report.\n");
+	       "     --reports, -r             Print out data per report.\n"
+	       "     --from, -f <seconds>      Skip reports before this time, relative\n"
+	       "                               to the first report.\n"
+	       "     --to, -t <seconds>        Skip reports after this time, relative\n"
+	       "                               to the first report.\n"
+	       "     --index, -i <path>        Where to cache the index of the recording\n"
+	       "                               (default: <file>.idx).\n"
+	       "     --format, -F csv|binary   Write a table of counter values instead.\n"
+	       "                               Several recordings are read in parallel\n"
+	       "                               and merged in CPU timestamp order, with\n"
+	       "                               times relative to the earliest report.\n"
+	       "                               One row per context switch, or per\n"
+	       "                               report with --reports (default: csv when\n"
+	       "                               given several files).\n"
+	       "     --output, -o <path>       Where to write the table (default: stdout).\n");
 }
 
 static struct intel_perf_logical_counter *
@@ -167,7 +184,7 @@ get_logical_counters(struct intel_perf_metric_set *metric_set,
 }
 
 static void
-print_report_deltas(const struct intel_perf_data_reader *reader,
+print_report_deltas(const struct intel_perf_data_stream *stream,
 		    const struct drm_i915_perf_record_header *i915_report0,
 		    const struct drm_i915_perf_record_header *i915_report1,
 		    struct intel_perf_logical_counter **counters,
@@ -176,7 +193,7 @@ print_report_deltas(const struct intel_perf_data_reader *reader,
 	struct intel_perf_accumulator accu;
 
 	intel_perf_accumulate_reports(&accu,
-				      reader->perf, reader->metric_set,
+				      stream->perf, stream->metric_set,
 				      i915_report0, i915_report1);
 
 	for (uint32_t c = 0; c < n_counters; c++) {
@@ -187,21 +204,1011 @@ print_report_deltas(const struct intel_perf_data_reader *reader,
 		case INTEL_PERF_LOGICAL_COUNTER_STORAGE_UINT32:
 		case INTEL_PERF_LOGICAL_COUNTER_STORAGE_BOOL32:
 			fprintf(stdout, "   %s: %" PRIu64 "\n",
-				counter->symbol_name, counter->read_uint64(reader->perf,
-									   reader->metric_set,
+				counter->symbol_name, counter->read_uint64(stream->perf,
+									   stream->metric_set,
 									   accu.deltas));
 			break;
 		case INTEL_PERF_LOGICAL_COUNTER_STORAGE_DOUBLE:
 		case INTEL_PERF_LOGICAL_COUNTER_STORAGE_FLOAT:
 			fprintf(stdout, "   %s: %f\n",
-				counter->symbol_name, counter->read_float(reader->perf,
-									  reader->metric_set,
+				counter->symbol_name, counter->read_float(stream->perf,
+									  stream->metric_set,
 									  accu.deltas));
 			break;
 		}
 	}
 }
 
+/* Records handed out by the iterators only live until the next call,
+ * keep a copy of those we need to look back at.
+ */
+static void
+copy_record(struct drm_i915_perf_record_header *dst,
+	    const struct drm_i915_perf_record_header *src)
+{
+	memcpy(dst, src, src->size);
+}
+
+static struct drm_i915_perf_record_header *
+alloc_record(void)
+{
+	struct drm_i915_perf_record_header *record = malloc(UINT16_MAX + 1);
+
+	assert(record);
+	return record;
+}
+
+/* Moves @iter to the sample at @pos, and reads a copy of it. */
+static const struct drm_i915_perf_record_header *
+read_record_at(struct intel_perf_data_iter *iter,
+	       const struct intel_perf_data_index_entry *pos,
+	       struct drm_i915_perf_record_header *record)
+{
+	intel_perf_data_iter_seek(iter, pos);
+	if (!intel_perf_data_iter_next(iter))
+		return NULL;
+
+	copy_record(record, iter->record);
+
+	return record;
+}
+
+struct timeline_printer {
+	struct intel_perf_data_stream *stream;
+	struct intel_perf_data_iter reports_iter;
+	struct drm_i915_perf_record_header *report;
+
+	struct intel_perf_logical_counter **counters;
+	int32_t n_counters;
+	bool print_reports;
+
+	uint32_t n_timelines;
+};
+
+static bool
+print_timeline(void *data,
+	       const struct drm_i915_perf_record_header *start,
+	       const struct intel_perf_data_index_entry *start_pos,
+	       const struct drm_i915_perf_record_header *end,
+	       const struct intel_perf_data_index_entry *end_pos)
+{
+	struct timeline_printer *printer = data;
+	struct intel_perf_data_stream *stream = printer->stream;
+	uint32_t hw_id = intel_perf_data_stream_ctx_id(stream, start);
+
+	fprintf(stdout, "Time: CPU=0x%016" PRIx64 "-0x%016" PRIx64
+		" GPU=0x%016" PRIx64 "-0x%016" PRIx64"\n",
+		intel_perf_data_stream_cpu_timestamp(stream, start_pos->gpu_ts),
+		intel_perf_data_stream_cpu_timestamp(stream, end_pos->gpu_ts),
+		intel_perf_read_record_timestamp(stream->perf, stream->metric_set, start),
+		intel_perf_read_record_timestamp(stream->perf, stream->metric_set, end));
+	fprintf(stdout, "hw_id=0x%x %s\n",
+		hw_id, hw_id == 0xffffffff ? "(idle)" : "");
+
+	print_report_deltas(stream, start, end,
+			    printer->counters, printer->n_counters);
+
+	printer->n_timelines++;
+
+	if (!printer->print_reports)
+		return true;
+
+	intel_perf_data_iter_seek(&printer->reports_iter, start_pos);
+	copy_record(printer->report,
+		    intel_perf_data_iter_next(&printer->reports_iter));
+
+	for (uint64_t r = start_pos->sample; r < end_pos->sample; r++) {
+		const struct drm_i915_perf_record_header *next =
+			intel_perf_data_iter_next(&printer->reports_iter);
+
+		assert(next);
+		fprintf(stdout, " report%" PRIu64 " = %s\n",
+			r - start_pos->sample,
+			intel_perf_read_report_reason(stream->perf, printer->report));
+		print_report_deltas(stream, printer->report, next,
+				    printer->counters, printer->n_counters);
+		copy_record(printer->report, next);
+	}
+
+	return true;
+}
+
+typedef bool (*timeline_fn)(void *data,
+			    const struct drm_i915_perf_record_header *start,
+			    const struct intel_perf_data_index_entry *start_pos,
+			    const struct drm_i915_perf_record_header *end,
+			    const struct intel_perf_data_index_entry *end_pos);
+
+/* Splits the reports of the range on context switches, until @fn
+ * returns false.
+ */
+static void
+split_timelines(struct intel_perf_data_stream *stream,
+		struct intel_perf_data_iter *iter,
+		timeline_fn fn, void *data)
+{
+	struct drm_i915_perf_record_header *start = alloc_record();
+	struct intel_perf_data_index_entry start_pos, end_pos;
+	const struct drm_i915_perf_record_header *current;
+	uint32_t start_ctx_id;
+
+	if (!intel_perf_data_iter_next(iter))
+		goto out;
+
+	copy_record(start, iter->record);
+	start_pos = end_pos = iter->current;
+	start_ctx_id = intel_perf_data_stream_ctx_id(stream, start);
+
+	while ((current = intel_perf_data_iter_next(iter))) {
+		end_pos = iter->current;
+
+		if (intel_perf_data_stream_ctx_id(stream, current) == start_ctx_id)
+			continue;
+
+		if (!fn(data, start, &start_pos, current, &end_pos))
+			goto out;
+
+		copy_record(start, current);
+		start_pos = end_pos;
+		start_ctx_id = intel_perf_data_stream_ctx_id(stream, start);
+	}
+
+	if (end_pos.sample != start_pos.sample) {
+		struct drm_i915_perf_record_header *end = alloc_record();
+
+		if (read_record_at(iter, &end_pos, end))
+			fn(data, start, &start_pos, end, &end_pos);
+		free(end);
+	}
+
+ out:
+	free(start);
+}
+
+/* Several recordings (e.g. one per GT, or from several hosts sharing a
+ * CPU clock) are read in parallel, one thread each, and their rows are
+ * merged into a single timeline ordered by CPU timestamps.
+ */
+
+enum merge_format {
+	MERGE_FORMAT_CSV,
+	MERGE_FORMAT_BINARY,
+};
+
+struct merge_row {
+	uint64_t cpu_ts_begin;
+	uint64_t cpu_ts_end;
+	uint64_t gpu_ts_begin;
+	uint64_t gpu_ts_end;
+	uint32_t hw_id;
+};
+
+/* Counter values keep the type of their column. */
+union merge_value {
+	uint64_t u;
+	double f;
+};
+
+/* Rows a reader thread can get ahead of the merge. */
+#define MERGE_QUEUE_SIZE 4096
+
+struct merge_source {
+	const char *path;
+	char *index_path;
+	int fd;
+
+	struct intel_perf_data_stream stream;
+	bool opened;
+
+	/* Counter of the recording for each output column, NULL when its
+	 * metric set doesn't have it.
+	 */
+	struct intel_perf_logical_counter **counters;
+	const bool *integer_columns;
+	uint32_t n_counters;
+
+	/* CPU time range to keep rows from, and the GPU one to read. */
+	uint64_t cpu_ts_begin;
+	uint64_t cpu_ts_end;
+	uint64_t gpu_ts_begin;
+	uint64_t gpu_ts_end;
+	bool per_report;
+
+	/* Ring of rows from the reader thread to the merge. The reader
+	 * fills the slot at head, the merge writes out the one at tail,
+	 * and both only move under the lock.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct merge_row *rows;
+	union merge_value *values;
+	uint64_t head;
+	uint64_t tail;
+	bool done;
+	bool cancelled;
+
+	pthread_t thread;
+	bool threaded;
+	char error_msg[512];
+};
+
+static void *
+merge_source_open(void *data)
+{
+	struct merge_source *source = data;
+
+	source->fd = open(source->path, O_RDONLY);
+	if (source->fd < 0) {
+		snprintf(source->error_msg, sizeof(source->error_msg),
+			 "Cannot open '%s': %s", source->path, strerror(errno));
+		return NULL;
+	}
+
+	if (!source->index_path &&
+	    asprintf(&source->index_path, "%s.idx", source->path) < 0)
+		source->index_path = NULL;
+
+	if (!intel_perf_data_stream_open(&source->stream, source->fd,
+					 source->index_path)) {
+		snprintf(source->error_msg, sizeof(source->error_msg),
+			 "Unable to parse '%s': %s", source->path,
+			 source->stream.error_msg);
+		return NULL;
+	}
+	source->opened = true;
+
+	if (source->stream.n_correlations < 2)
+		snprintf(source->error_msg, sizeof(source->error_msg),
+			 "'%s': Less than 2 CPU/GPU timestamp correlation points",
+			 source->path);
+	else if (!source->stream.n_samples)
+		snprintf(source->error_msg, sizeof(source->error_msg),
+			 "'%s': No reports in the recording", source->path);
+
+	return NULL;
+}
+
+/* First GPU timestamp of the recording whose CPU time isn't before
+ * @cpu_ts, so that reading can start from the closest index entry.
+ */
+static uint64_t
+merge_source_gpu_timestamp(const struct intel_perf_data_stream *stream,
+			   uint64_t cpu_ts)
+{
+	uint64_t lo = stream->index[0].gpu_ts, hi = stream->last.gpu_ts + 1;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (intel_perf_data_stream_cpu_timestamp(stream, mid) < cpu_ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool
+counter_is_integer(const struct intel_perf_logical_counter *counter)
+{
+	return counter->storage != INTEL_PERF_LOGICAL_COUNTER_STORAGE_DOUBLE &&
+		counter->storage != INTEL_PERF_LOGICAL_COUNTER_STORAGE_FLOAT;
+}
+
+/* Integer counters are only converted when another recording has a
+ * floating point counter of the same name, which decided the column.
+ */
+static union merge_value
+read_counter(const struct intel_perf_data_stream *stream,
+	     const struct intel_perf_logical_counter *counter,
+	     bool integer, uint64_t *deltas)
+{
+	union merge_value value;
+
+	if (!counter) {
+		if (integer)
+			value.u = UINT64_MAX;
+		else
+			value.f = NAN;
+	} else if (counter_is_integer(counter)) {
+		uint64_t v = counter->read_uint64(stream->perf, stream->metric_set, deltas);
+
+		if (integer)
+			value.u = v;
+		else
+			value.f = v;
+	} else {
+		double v = counter->read_float(stream->perf, stream->metric_set, deltas);
+
+		if (integer)
+			value.u = v;
+		else
+			value.f = v;
+	}
+
+	return value;
+}
+
+static bool
+merge_source_add_row(void *data,
+		     const struct drm_i915_perf_record_header *start,
+		     const struct intel_perf_data_index_entry *start_pos,
+		     const struct drm_i915_perf_record_header *end,
+		     const struct intel_perf_data_index_entry *end_pos)
+{
+	struct merge_source *source = data;
+	struct intel_perf_data_stream *stream = &source->stream;
+	uint64_t cpu_ts_begin =
+		intel_perf_data_stream_cpu_timestamp(stream, start_pos->gpu_ts);
+	struct intel_perf_accumulator accu;
+	struct merge_row *row;
+	union merge_value *values;
+	uint32_t slot;
+	bool cancelled;
+
+	if (cpu_ts_begin < source->cpu_ts_begin ||
+	    cpu_ts_begin >= source->cpu_ts_end)
+		return true;
+
+	pthread_mutex_lock(&source->lock);
+	while (source->head - source->tail == MERGE_QUEUE_SIZE &&
+	       !source->cancelled)
+		pthread_cond_wait(&source->cond, &source->lock);
+	cancelled = source->cancelled;
+	pthread_mutex_unlock(&source->lock);
+
+	if (cancelled)
+		return false;
+
+	slot = source->head % MERGE_QUEUE_SIZE;
+	row = &source->rows[slot];
+	values = &source->values[slot * source->n_counters];
+
+	row->cpu_ts_begin = cpu_ts_begin;
+	row->cpu_ts_end = intel_perf_data_stream_cpu_timestamp(stream, end_pos->gpu_ts);
+	row->gpu_ts_begin = start_pos->gpu_ts;
+	row->gpu_ts_end = end_pos->gpu_ts;
+	row->hw_id = intel_perf_data_stream_ctx_id(stream, start);
+
+	intel_perf_accumulate_reports(&accu, stream->perf, stream->metric_set,
+				      start, end);
+
+	for (uint32_t c = 0; c < source->n_counters; c++)
+		values[c] = read_counter(stream, source->counters[c],
+					 source->integer_columns[c], accu.deltas);
+
+	pthread_mutex_lock(&source->lock);
+	if (source->head++ == source->tail)
+		pthread_cond_signal(&source->cond);
+	pthread_mutex_unlock(&source->lock);
+
+	return true;
+}
+
+static void
+merge_source_read_rows(struct merge_source *source)
+{
+	struct intel_perf_data_stream *stream = &source->stream;
+	struct drm_i915_perf_record_header *prev;
+	struct intel_perf_data_index_entry prev_pos;
+	struct intel_perf_data_iter iter;
+	const struct drm_i915_perf_record_header *current;
+
+	if (!intel_perf_data_iter_init(&iter, stream, source->gpu_ts_begin,
+				       source->gpu_ts_end)) {
+		snprintf(source->error_msg, sizeof(source->error_msg),
+			 "Unable to read '%s': %s", source->path,
+			 stream->error_msg);
+		return;
+	}
+
+	if (!source->per_report) {
+		split_timelines(stream, &iter, merge_source_add_row, source);
+		intel_perf_data_iter_fini(&iter);
+		return;
+	}
+
+	prev = alloc_record();
+	if (intel_perf_data_iter_next(&iter)) {
+		copy_record(prev, iter.record);
+		prev_pos = iter.current;
+
+		while ((current = intel_perf_data_iter_next(&iter))) {
+			if (!merge_source_add_row(source, prev, &prev_pos,
+						  current, &iter.current))
+				break;
+			copy_record(prev, current);
+			prev_pos = iter.current;
+		}
+	}
+	free(prev);
+
+	intel_perf_data_iter_fini(&iter);
+}
+
+static void *
+merge_source_read(void *data)
+{
+	struct merge_source *source = data;
+
+	merge_source_read_rows(source);
+
+	pthread_mutex_lock(&source->lock);
+	source->done = true;
+	pthread_cond_signal(&source->cond);
+	pthread_mutex_unlock(&source->lock);
+
+	return NULL;
+}
+
+/* Waits for the reader of @source, returns false once it has no more
+ * rows. Otherwise the next row is in the slot at tail.
+ */
+static bool
+merge_source_peek(struct merge_source *source)
+{
+	bool ready;
+
+	pthread_mutex_lock(&source->lock);
+	while (source->head == source->tail && !source->done)
+		pthread_cond_wait(&source->cond, &source->lock);
+	ready = source->head != source->tail;
+	pthread_mutex_unlock(&source->lock);
+
+	return ready;
+}
+
+static void
+merge_source_pop(struct merge_source *source)
+{
+	pthread_mutex_lock(&source->lock);
+	if (source->head - source->tail++ == MERGE_QUEUE_SIZE)
+		pthread_cond_signal(&source->cond);
+	pthread_mutex_unlock(&source->lock);
+}
+
+/* Makes the reader of @source stop at its next row. */
+static void
+merge_source_cancel(struct merge_source *source)
+{
+	pthread_mutex_lock(&source->lock);
+	source->cancelled = true;
+	pthread_cond_signal(&source->cond);
+	pthread_mutex_unlock(&source->lock);
+}
+
+/* Runs @fn on each source in its own thread, returns false if any of
+ * them failed.
+ */
+static bool
+merge_sources_run(struct merge_source *sources, int n_sources,
+		  void *(*fn)(void *))
+{
+	bool ok = true;
+
+	for (int i = 0; i < n_sources; i++) {
+		sources[i].threaded =
+			!pthread_create(&sources[i].thread, NULL, fn, &sources[i]);
+		if (!sources[i].threaded)
+			fn(&sources[i]);
+	}
+
+	for (int i = 0; i < n_sources; i++) {
+		if (sources[i].threaded)
+			pthread_join(sources[i].thread, NULL);
+		sources[i].threaded = false;
+
+		if (sources[i].error_msg[0]) {
+			fprintf(stderr, "%s.\n", sources[i].error_msg);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+/*
+ * Binary output, in host endianness:
+ *
+ *   header:  "i915mrg\0", u32 version, u32 n_files, u32 n_columns,
+ *            u32 reserved
+ *   files:   n_files x (u32 length, path)
+ *   columns: n_columns x (u32 type, u32 length, name)
+ *   blocks:  u64 n_rows, then n_columns x n_rows x 8 bytes, one column
+ *            after the other. A block of 0 rows ends the data.
+ *
+ * Blocks hold at most MERGE_BINARY_BLOCK_ROWS rows, so that the table
+ * is written while the recordings are read. The file column holds the
+ * index of the recording in the list of files. Counter columns are u64
+ * for integer counters and doubles otherwise, UINT64_MAX or NaN where
+ * the recording doesn't have the counter.
+ */
+#define MERGE_BINARY_MAGIC "i915mrg"
+#define MERGE_BINARY_VERSION 2
+#define MERGE_BINARY_BLOCK_ROWS 1024
+
+enum merge_column_type {
+	MERGE_COLUMN_UINT64,
+	MERGE_COLUMN_DOUBLE,
+};
+
+struct merge {
+	struct merge_source *sources;
+	int n_sources;
+
+	/* Column names point into the metric sets or into names. */
+	char *names;
+	const char **columns;
+	bool *integer_columns;
+	uint32_t n_columns;
+
+	/* Sources with rows left, as a min-heap on their next row. */
+	int *heap;
+	int n_heap;
+
+	enum merge_format format;
+	FILE *file;
+
+	/* Binary block being filled, column after column. */
+	uint64_t *block;
+	uint32_t n_block_rows;
+};
+
+static struct intel_perf_logical_counter *
+merge_find_counter(struct merge *merge, const char *name)
+{
+	struct intel_perf_logical_counter *counter = NULL;
+
+	for (int i = 0; i < merge->n_sources && !counter; i++)
+		counter = find_counter(merge->sources[i].stream.metric_set, name);
+
+	return counter;
+}
+
+static void
+merge_append_column(struct merge *merge, uint32_t *n_allocated_columns,
+		    const struct intel_perf_logical_counter *counter,
+		    const char *name)
+{
+	if (merge->n_columns == *n_allocated_columns) {
+		*n_allocated_columns = MAX(64, *n_allocated_columns * 2);
+		merge->columns = realloc(merge->columns, *n_allocated_columns *
+					 sizeof(*merge->columns));
+		merge->integer_columns = realloc(merge->integer_columns,
+						 *n_allocated_columns *
+						 sizeof(*merge->integer_columns));
+		assert(merge->columns && merge->integer_columns);
+	}
+
+	merge->columns[merge->n_columns] = name;
+	merge->integer_columns[merge->n_columns] = counter_is_integer(counter);
+	merge->n_columns++;
+}
+
+/* Output columns are the requested counters, or all the counters of
+ * all the recordings. Each recording fills in those it has.
+ */
+static bool
+merge_columns(struct merge *merge, const char *counter_list)
+{
+	uint32_t n_allocated_columns = 0;
+	char *name, *next;
+
+	if (!counter_list || !strcmp(counter_list, "all")) {
+		for (int i = 0; i < merge->n_sources; i++) {
+			struct intel_perf_metric_set *metric_set =
+				merge->sources[i].stream.metric_set;
+
+			for (uint32_t c = 0; c < metric_set->n_counters; c++) {
+				struct intel_perf_logical_counter *counter =
+					&metric_set->counters[c];
+
+				if (merge_find_counter(merge, counter->symbol_name) == counter)
+					merge_append_column(merge, &n_allocated_columns,
+							    counter, counter->symbol_name);
+			}
+		}
+
+		return true;
+	}
+
+	merge->names = strdup(counter_list);
+	for (name = merge->names; name; name = next) {
+		struct intel_perf_logical_counter *counter;
+
+		next = strchr(name, ',');
+		if (next)
+			*next++ = '\0';
+		if (!*name)
+			continue;
+
+		counter = merge_find_counter(merge, name);
+		if (!counter) {
+			fprintf(stderr, "Unknown counter '%s'.\n", name);
+			return false;
+		}
+
+		merge_append_column(merge, &n_allocated_columns, counter, name);
+	}
+
+	return true;
+}
+
+static const char * const merge_row_columns[] = {
+	"file", "cpu_ts_begin", "cpu_ts_end", "gpu_ts_begin", "gpu_ts_end", "hw_id",
+};
+
+static uint64_t
+merge_row_value(int source, const struct merge_row *row, int column)
+{
+	switch (column) {
+	case 0: return source;
+	case 1: return row->cpu_ts_begin;
+	case 2: return row->cpu_ts_end;
+	case 3: return row->gpu_ts_begin;
+	case 4: return row->gpu_ts_end;
+	default: return row->hw_id;
+	}
+}
+
+static void
+write_csv_string(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; str++) {
+		if (*str == '"')
+			fputc('"', file);
+		fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static void
+write_csv_header(const struct merge *merge)
+{
+	for (int c = 0; c < ARRAY_SIZE(merge_row_columns); c++)
+		fprintf(merge->file, "%s%s", c ? "," : "", merge_row_columns[c]);
+	for (uint32_t c = 0; c < merge->n_columns; c++)
+		fprintf(merge->file, ",%s", merge->columns[c]);
+	fputc('\n', merge->file);
+}
+
+static void
+write_csv_row(const struct merge *merge, int s, const struct merge_row *row,
+	      const union merge_value *values)
+{
+	const struct merge_source *source = &merge->sources[s];
+	FILE *file = merge->file;
+
+	write_csv_string(file, source->path);
+	for (int c = 1; c < ARRAY_SIZE(merge_row_columns); c++)
+		fprintf(file, ",%" PRIu64, merge_row_value(s, row, c));
+
+	for (uint32_t c = 0; c < merge->n_columns; c++) {
+		if (!source->counters[c])
+			fputc(',', file);
+		else if (merge->integer_columns[c])
+			fprintf(file, ",%" PRIu64, values[c].u);
+		else
+			fprintf(file, ",%f", values[c].f);
+	}
+	fputc('\n', file);
+}
+
+static void
+write_binary_string(FILE *file, const char *str)
+{
+	uint32_t len = strlen(str);
+
+	fwrite(&len, sizeof(len), 1, file);
+	fwrite(str, len, 1, file);
+}
+
+static void
+write_binary_header(const struct merge *merge)
+{
+	struct {
+		char magic[8];
+		uint32_t version;
+		uint32_t n_files;
+		uint32_t n_columns;
+		uint32_t reserved;
+	} header = {
+		.magic = MERGE_BINARY_MAGIC,
+		.version = MERGE_BINARY_VERSION,
+		.n_files = merge->n_sources,
+		.n_columns = ARRAY_SIZE(merge_row_columns) + merge->n_columns,
+	};
+
+	fwrite(&header, sizeof(header), 1, merge->file);
+	for (int i = 0; i < merge->n_sources; i++)
+		write_binary_string(merge->file, merge->sources[i].path);
+
+	for (uint32_t c = 0; c < header.n_columns; c++) {
+		uint32_t type = MERGE_COLUMN_UINT64;
+		const char *name;
+
+		if (c < ARRAY_SIZE(merge_row_columns)) {
+			name = merge_row_columns[c];
+		} else {
+			uint32_t v = c - ARRAY_SIZE(merge_row_columns);
+
+			name = merge->columns[v];
+			if (!merge->integer_columns[v])
+				type = MERGE_COLUMN_DOUBLE;
+		}
+
+		fwrite(&type, sizeof(type), 1, merge->file);
+		write_binary_string(merge->file, name);
+	}
+}
+
+/* Writes the block being filled, an empty one ends the data. */
+static void
+write_binary_block(struct merge *merge)
+{
+	uint64_t n_rows = merge->n_block_rows;
+	uint32_t n_columns = ARRAY_SIZE(merge_row_columns) + merge->n_columns;
+
+	fwrite(&n_rows, sizeof(n_rows), 1, merge->file);
+	for (uint32_t c = 0; c < n_columns && n_rows; c++)
+		fwrite(&merge->block[c * MERGE_BINARY_BLOCK_ROWS],
+		       sizeof(merge->block[0]), n_rows, merge->file);
+
+	merge->n_block_rows = 0;
+}
+
+static void
+write_binary_row(struct merge *merge, int s, const struct merge_row *row,
+		 const union merge_value *values)
+{
+	uint64_t *block = &merge->block[merge->n_block_rows];
+	uint32_t c;
+
+	for (c = 0; c < ARRAY_SIZE(merge_row_columns); c++)
+		block[c * MERGE_BINARY_BLOCK_ROWS] = merge_row_value(s, row, c);
+	for (uint32_t v = 0; v < merge->n_columns; v++, c++)
+		block[c * MERGE_BINARY_BLOCK_ROWS] = values[v].u;
+
+	if (++merge->n_block_rows == MERGE_BINARY_BLOCK_ROWS)
+		write_binary_block(merge);
+}
+
+/* Earliest next row first, the first recording on a tie. */
+static bool
+merge_before(const struct merge *merge, int a, int b)
+{
+	const struct merge_source *sa = &merge->sources[a];
+	const struct merge_source *sb = &merge->sources[b];
+	uint64_t ts_a = sa->rows[sa->tail % MERGE_QUEUE_SIZE].cpu_ts_begin;
+	uint64_t ts_b = sb->rows[sb->tail % MERGE_QUEUE_SIZE].cpu_ts_begin;
+
+	return ts_a < ts_b || (ts_a == ts_b && a < b);
+}
+
+static void
+merge_heap_down(struct merge *merge, int i)
+{
+	for (;;) {
+		int first = i, child = 2 * i + 1, tmp;
+
+		for (int c = child; c < child + 2 && c < merge->n_heap; c++) {
+			if (merge_before(merge, merge->heap[c], merge->heap[first]))
+				first = c;
+		}
+
+		if (first == i)
+			return;
+
+		tmp = merge->heap[i];
+		merge->heap[i] = merge->heap[first];
+		merge->heap[first] = tmp;
+		i = first;
+	}
+}
+
+/* Rows of each recording come in CPU time order from its reader thread,
+ * a k-way merge through a heap of their next rows writes them out as
+ * they come.
+ */
+static void
+merge_rows(struct merge *merge)
+{
+	for (int i = 0; i < merge->n_sources; i++) {
+		if (merge_source_peek(&merge->sources[i]))
+			merge->heap[merge->n_heap++] = i;
+	}
+	for (int i = merge->n_heap / 2 - 1; i >= 0; i--)
+		merge_heap_down(merge, i);
+
+	while (merge->n_heap && !ferror(merge->file)) {
+		int s = merge->heap[0];
+		struct merge_source *source = &merge->sources[s];
+		uint32_t slot = source->tail % MERGE_QUEUE_SIZE;
+
+		if (merge->format == MERGE_FORMAT_BINARY)
+			write_binary_row(merge, s, &source->rows[slot],
+					 &source->values[slot * merge->n_columns]);
+		else
+			write_csv_row(merge, s, &source->rows[slot],
+				      &source->values[slot * merge->n_columns]);
+
+		merge_source_pop(source);
+		if (!merge_source_peek(source))
+			merge->heap[0] = merge->heap[--merge->n_heap];
+		merge_heap_down(merge, 0);
+	}
+
+	if (merge->format == MERGE_FORMAT_BINARY) {
+		if (merge->n_block_rows)
+			write_binary_block(merge);
+		write_binary_block(merge);
+	}
+}
+
+static int
+merge_recordings(char **paths, int n_paths, char *index_path,
+		 const char *counter_names,
+		 bool per_report, double from, double to,
+		 enum merge_format format, const char *output)
+{
+	struct merge merge = {
+		.n_sources = n_paths,
+		.format = format,
+		.file = stdout,
+	};
+	uint64_t cpu_ts_begin = UINT64_MAX;
+	int ret = EXIT_FAILURE;
+
+	if (counter_names && !strcmp(counter_names, "list")) {
+		fprintf(stderr, "Cannot list counters with --format.\n");
+		free(index_path);
+		return EXIT_FAILURE;
+	}
+
+	merge.sources = calloc(n_paths, sizeof(*merge.sources));
+	merge.heap = calloc(n_paths, sizeof(*merge.heap));
+	assert(merge.sources && merge.heap);
+	for (int i = 0; i < n_paths; i++) {
+		merge.sources[i].path = paths[i];
+		merge.sources[i].fd = -1;
+		merge.sources[i].per_report = per_report;
+		pthread_mutex_init(&merge.sources[i].lock, NULL);
+		pthread_cond_init(&merge.sources[i].cond, NULL);
+	}
+
+	/* --index only makes sense for a single recording. */
+	if (n_paths == 1)
+		merge.sources[0].index_path = index_path;
+	else
+		free(index_path);
+
+	if (!merge_sources_run(merge.sources, merge.n_sources, merge_source_open))
+		goto exit;
+
+	if (!merge_columns(&merge, counter_names))
+		goto exit;
+
+	/* The time range is relative to the earliest report of all the
+	 * recordings.
+	 */
+	for (int i = 0; i < merge.n_sources; i++) {
+		struct intel_perf_data_stream *stream = &merge.sources[i].stream;
+
+		cpu_ts_begin = MIN(cpu_ts_begin,
+				   intel_perf_data_stream_cpu_timestamp(stream,
+									stream->index[0].gpu_ts));
+	}
+
+	for (int i = 0; i < merge.n_sources; i++) {
+		struct merge_source *source = &merge.sources[i];
+
+		source->cpu_ts_begin = cpu_ts_begin + (uint64_t) (from * 1e9);
+		source->cpu_ts_end = to < 0.0 ? UINT64_MAX :
+			cpu_ts_begin + (uint64_t) (to * 1e9) + 1;
+		source->gpu_ts_begin =
+			merge_source_gpu_timestamp(&source->stream,
+						   source->cpu_ts_begin);
+		source->gpu_ts_end = to < 0.0 ? UINT64_MAX :
+			merge_source_gpu_timestamp(&source->stream,
+						   source->cpu_ts_end);
+
+		source->n_counters = merge.n_columns;
+		source->integer_columns = merge.integer_columns;
+		source->counters = calloc(merge.n_columns, sizeof(*source->counters));
+		source->rows = calloc(MERGE_QUEUE_SIZE, sizeof(*source->rows));
+		source->values = calloc(MERGE_QUEUE_SIZE * merge.n_columns,
+					sizeof(*source->values));
+		assert((source->counters && source->values) || !merge.n_columns);
+		assert(source->rows);
+		for (uint32_t c = 0; c < merge.n_columns; c++)
+			source->counters[c] = find_counter(source->stream.metric_set,
+							   merge.columns[c]);
+	}
+
+	if (output) {
+		merge.file = fopen(output, "w");
+		if (!merge.file) {
+			fprintf(stderr, "Cannot open '%s': %s.\n",
+				output, strerror(errno));
+			merge.file = stdout;
+			goto exit;
+		}
+	}
+
+	if (format == MERGE_FORMAT_BINARY) {
+		merge.block = malloc((ARRAY_SIZE(merge_row_columns) + merge.n_columns) *
+				     MERGE_BINARY_BLOCK_ROWS * sizeof(*merge.block));
+		assert(merge.block);
+		write_binary_header(&merge);
+	} else {
+		write_csv_header(&merge);
+	}
+
+	for (int i = 0; i < merge.n_sources; i++) {
+		struct merge_source *source = &merge.sources[i];
+
+		source->threaded = !pthread_create(&source->thread, NULL,
+						   merge_source_read, source);
+		if (!source->threaded) {
+			fprintf(stderr, "Cannot start a reader for '%s'.\n",
+				source->path);
+			goto exit;
+		}
+	}
+
+	merge_rows(&merge);
+
+	if (ferror(merge.file) || fflush(merge.file)) {
+		fprintf(stderr, "Failed to write the output: %s.\n", strerror(errno));
+		goto exit;
+	}
+
+	ret = EXIT_SUCCESS;
+
+ exit:
+	for (int i = 0; i < merge.n_sources; i++) {
+		struct merge_source *source = &merge.sources[i];
+
+		if (!source->threaded)
+			continue;
+
+		merge_source_cancel(source);
+		pthread_join(source->thread, NULL);
+		if (source->error_msg[0]) {
+			fprintf(stderr, "%s.\n", source->error_msg);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	if (merge.file != stdout)
+		fclose(merge.file);
+
+	for (int i = 0; i < merge.n_sources; i++) {
+		struct merge_source *source = &merge.sources[i];
+
+		free(source->rows);
+		free(source->values);
+		free(source->counters);
+		pthread_cond_destroy(&source->cond);
+		pthread_mutex_destroy(&source->lock);
+		if (source->opened)
+			intel_perf_data_stream_close(&source->stream);
+		free(source->index_path);
+		if (source->fd >= 0)
+			close(source->fd);
+	}
+	free(merge.block);
+	free(merge.heap);
+	free(merge.integer_columns);
+	free(merge.columns);
+	free(merge.names);
+	free(merge.sources);
+
+	return ret;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -209,17 +1216,27 @@ main(int argc, char *argv[])
 		{"help",             no_argument, 0, 'h'},
 		{"counters",   required_argument, 0, 'c'},
 		{"reports",          no_argument, 0, 'r'},
+		{"from",       required_argument, 0, 'f'},
+		{"to",         required_argument, 0, 't'},
+		{"index",      required_argument, 0, 'i'},
+		{"format",     required_argument, 0, 'F'},
+		{"output",     required_argument, 0, 'o'},
 		{0, 0, 0, 0}
 	};
-	struct intel_perf_data_reader reader;
-	struct intel_perf_logical_counter **counters;
+	struct timeline_printer printer = {};
+	struct intel_perf_data_stream stream;
+	struct intel_perf_data_iter iter;
+	struct drm_i915_perf_record_header *first, *last;
+	const struct intel_perf_data_correlation *corr0, *corr1;
 	const struct intel_device_info *devinfo;
-	const char *counter_names = NULL;
-	int32_t n_counters;
-	int fd, opt;
-	bool print_reports = false;
+	const char *counter_names = NULL, *output = NULL;
+	char *index_path = NULL;
+	int format = -1;
+	double from = 0.0, to = -1.0;
+	uint64_t gpu_ts_begin, gpu_ts_end;
+	int fd, opt, ret = EXIT_FAILURE;
 
-	while ((opt = getopt_long(argc, argv, "hc:r", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hc:rf:t:i:F:o:", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
 			usage();
@@ -228,7 +1245,29 @@ main(int argc, char *argv[])
 			counter_names = optarg;
 			break;
 		case 'r':
-			print_reports = true;
+			printer.print_reports = true;
+			break;
+		case 'f':
+			from = atof(optarg);
+			break;
+		case 't':
+			to = atof(optarg);
+			break;
+		case 'i':
+			index_path = strdup(optarg);
+			break;
+		case 'F':
+			if (!strcmp(optarg, "csv")) {
+				format = MERGE_FORMAT_CSV;
+			} else if (!strcmp(optarg, "binary")) {
+				format = MERGE_FORMAT_BINARY;
+			} else {
+				fprintf(stderr, "Unknown format '%s'.\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'o':
+			output = optarg;
 			break;
 		default:
 			fprintf(stderr, "Internal error: "
@@ -243,6 +1282,19 @@ main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (from < 0.0 || (to >= 0.0 && to < from)) {
+		fprintf(stderr, "Invalid time range.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (format >= 0 || argc - optind > 1) {
+		return merge_recordings(&argv[optind], argc - optind,
+					index_path, counter_names,
+					printer.print_reports, from, to,
+					format >= 0 ? format : MERGE_FORMAT_CSV,
+					output);
+	}
+
 	fd = open(argv[optind], 0, O_RDONLY);
 	if (fd < 0) {
 		fprintf(stderr, "Cannot open '%s': %s.\n",
@@ -250,95 +1302,115 @@ main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	if (!intel_perf_data_reader_init(&reader, fd)) {
+	if (!index_path && asprintf(&index_path, "%s.idx", argv[optind]) < 0)
+		index_path = NULL;
+
+	if (!intel_perf_data_stream_open(&stream, fd, index_path)) {
 		fprintf(stderr, "Unable to parse '%s': %s.\n",
-			argv[optind], reader.error_msg);
+			argv[optind], stream.error_msg);
 		return EXIT_FAILURE;
 	}
 
-	counters = get_logical_counters(reader.metric_set, counter_names, &n_counters);
-	if (n_counters < 0)
+	printer.stream = &stream;
+	printer.counters = get_logical_counters(stream.metric_set, counter_names,
+						&printer.n_counters);
+	if (printer.n_counters < 0) {
+		ret = EXIT_SUCCESS;
 		goto exit;
+	}
 
-	devinfo = intel_get_device_info(reader.devinfo.devid);
+	devinfo = intel_get_device_info(stream.devinfo.devid);
 
 	fprintf(stdout, "Recorded on device=0x%x(%s) graphics_ver=%i\n",
-		reader.devinfo.devid, devinfo->codename,
-		reader.devinfo.graphics_ver);
+		stream.devinfo.devid, devinfo->codename,
+		stream.devinfo.graphics_ver);
 	fprintf(stdout, "Metric used : %s (%s) uuid=%s\n",
-		reader.metric_set->symbol_name, reader.metric_set->name,
-		reader.metric_set->hw_config_guid);
-	fprintf(stdout, "Reports: %u\n", reader.n_records);
-	fprintf(stdout, "Context switches: %u\n", reader.n_timelines);
-	fprintf(stdout, "Timestamp correlation points: %u\n", reader.n_correlations);
+		stream.metric_set->symbol_name, stream.metric_set->name,
+		stream.metric_set->hw_config_guid);
+	fprintf(stdout, "Reports: %" PRIu64 "\n", stream.n_samples);
+	fprintf(stdout, "Timestamp correlation points: %u\n", stream.n_correlations);
 
-	if (reader.n_correlations < 2) {
+	if (stream.n_correlations < 2) {
 		fprintf(stderr, "Less than 2 CPU/GPU timestamp correlation points.\n");
-		return EXIT_FAILURE;
+		goto exit;
 	}
 
+	if (!stream.n_samples) {
+		fprintf(stderr, "No reports in the recording.\n");
+		goto exit;
+	}
+
+	corr0 = &stream.correlations[0];
+	corr1 = &stream.correlations[stream.n_correlations - 1];
 	fprintf(stdout, "Timestamp correlation CPU range:       0x%016"PRIx64"-0x%016"PRIx64"\n",
-		reader.correlations[0]->cpu_timestamp,
-		reader.correlations[reader.n_correlations - 1]->cpu_timestamp);
+		corr0->cpu_ts, corr1->cpu_ts);
 	fprintf(stdout, "Timestamp correlation GPU range (64b): 0x%016"PRIx64"-0x%016"PRIx64"\n",
-		reader.correlations[0]->gpu_timestamp,
-		reader.correlations[reader.n_correlations - 1]->gpu_timestamp);
+		corr0->gpu_ts, corr1->gpu_ts);
 	fprintf(stdout, "Timestamp correlation GPU range (32b): 0x%016"PRIx64"-0x%016"PRIx64"\n",
-		reader.correlations[0]->gpu_timestamp & 0xffffffff,
-		reader.correlations[reader.n_correlations - 1]->gpu_timestamp & 0xffffffff);
-
-	fprintf(stdout, "OA data timestamp range:               0x%016"PRIx64"-0x%016"PRIx64"\n",
-		intel_perf_read_record_timestamp(reader.perf,
-						 reader.metric_set,
-						 reader.records[0]),
-		intel_perf_read_record_timestamp(reader.perf,
-						 reader.metric_set,
-						 reader.records[reader.n_records - 1]));
-	fprintf(stdout, "OA raw data timestamp range:           0x%016"PRIx64"-0x%016"PRIx64"\n",
-		intel_perf_read_record_timestamp_raw(reader.perf,
-						     reader.metric_set,
-						     reader.records[0]),
-		intel_perf_read_record_timestamp_raw(reader.perf,
-						     reader.metric_set,
-						     reader.records[reader.n_records - 1]));
-
-	if (strcmp(reader.metric_set_uuid, reader.metric_set->hw_config_guid)) {
+		corr0->gpu_ts & 0xffffffff, corr1->gpu_ts & 0xffffffff);
+
+	first = alloc_record();
+	last = alloc_record();
+	if (intel_perf_data_iter_init(&iter, &stream, 0, UINT64_MAX) &&
+	    read_record_at(&iter, &stream.index[0], first) &&
+	    read_record_at(&iter, &stream.last, last)) {
+		fprintf(stdout, "OA data timestamp range:               0x%016"PRIx64"-0x%016"PRIx64"\n",
+			intel_perf_read_record_timestamp(stream.perf,
+							 stream.metric_set,
+							 first),
+			intel_perf_read_record_timestamp(stream.perf,
+							 stream.metric_set,
+							 last));
+		fprintf(stdout, "OA raw data timestamp range:           0x%016"PRIx64"-0x%016"PRIx64"\n",
+			intel_perf_read_record_timestamp_raw(stream.perf,
+							     stream.metric_set,
+							     first),
+			intel_perf_read_record_timestamp_raw(stream.perf,
+							     stream.metric_set,
+							     last));
+	}
+	intel_perf_data_iter_fini(&iter);
+	free(first);
+	free(last);
+
+	if (strcmp(stream.metric_set_uuid, stream.metric_set->hw_config_guid)) {
 		fprintf(stdout,
 			"WARNING: Recording used a different HW configuration.\n"
 			"WARNING: This could lead to inconsistent counter values.\n");
 	}
 
-	for (uint32_t i = 0; i < reader.n_timelines; i++) {
-		const struct intel_perf_timeline_item *item = &reader.timelines[i];
-
-		fprintf(stdout, "Time: CPU=0x%016" PRIx64 "-0x%016" PRIx64
-			" GPU=0x%016" PRIx64 "-0x%016" PRIx64"\n",
-			item->cpu_ts_start, item->cpu_ts_end,
-			item->ts_start, item->ts_end);
-		fprintf(stdout, "hw_id=0x%x %s\n",
-			item->hw_id, item->hw_id == 0xffffffff ? "(idle)" : "");
-
-		print_report_deltas(&reader,
-				    reader.records[item->record_start],
-				    reader.records[item->record_end],
-				    counters, n_counters);
-
-		if (print_reports) {
-			for (uint32_t r = item->record_start; r < item->record_end; r++) {
-				fprintf(stdout, " report%i = %s\n",
-					r - item->record_start,
-					intel_perf_read_report_reason(reader.perf, reader.records[r]));
-				print_report_deltas(&reader,
-						    reader.records[r],
-						    reader.records[r + 1],
-						    counters, n_counters);
-			}
-		}
+	gpu_ts_begin = stream.index[0].gpu_ts +
+		(uint64_t) (from * stream.devinfo.timestamp_frequency);
+	gpu_ts_end = to < 0.0 ? UINT64_MAX :
+		stream.index[0].gpu_ts +
+		(uint64_t) (to * stream.devinfo.timestamp_frequency) + 1;
+
+	if (!intel_perf_data_iter_init(&iter, &stream, gpu_ts_begin, gpu_ts_end) ||
+	    !intel_perf_data_iter_init(&printer.reports_iter, &stream,
+				       gpu_ts_begin, gpu_ts_end)) {
+		fprintf(stderr, "Unable to read '%s': %s.\n",
+			argv[optind], stream.error_msg);
+		intel_perf_data_iter_fini(&printer.reports_iter);
+		intel_perf_data_iter_fini(&iter);
+		goto exit;
 	}
 
+	printer.report = alloc_record();
+	split_timelines(&stream, &iter, print_timeline, &printer);
+	free(printer.report);
+
+	intel_perf_data_iter_fini(&printer.reports_iter);
+	intel_perf_data_iter_fini(&iter);
+
+	fprintf(stdout, "Context switches: %u\n", printer.n_timelines);
+
+	ret = EXIT_SUCCESS;
+
  exit:
-	intel_perf_data_reader_fini(&reader);
+	free(printer.counters);
+	intel_perf_data_stream_close(&stream);
+	free(index_path);
 	close(fd);
 
-	return EXIT_SUCCESS;
+	return ret;
 }
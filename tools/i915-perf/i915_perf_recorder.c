@@ -27,12 +27,15 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
@@ -51,6 +54,7 @@
 #include "i915_perf_recorder_commands.h"
 
 #define ALIGN(v, a) (((v) + (a)-1) & ~((a)-1))
+#define ALIGN_DOWN(v, a) ((v) & ~((uint64_t)(a)-1))
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof((arr)[0]))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -98,25 +102,6 @@ get_chunks(struct chunk *chunks, struct circular_buffer *buffer, bool write, siz
 	}
 }
 
-static ssize_t
-circular_buffer_read(void *c, char *buf, size_t size)
-{
-	struct circular_buffer *buffer = c;
-	struct chunk chunks[2];
-
-	if (buffer->size < size)
-		return -1;
-
-	get_chunks(chunks, buffer, false, size);
-
-	memcpy(buf, chunks[0].data, chunks[0].len);
-	memcpy(buf + chunks[0].len, chunks[1].data, chunks[1].len);
-	buffer->beginpos = (buffer->beginpos + size) % buffer->allocated_size;
-	buffer->size -= size;
-
-	return size;
-}
-
 static size_t
 peek_item_size(struct circular_buffer *buffer)
 {
@@ -183,25 +168,102 @@ circular_buffer_write(void *c, const char *buf, size_t _size)
 	return _size;
 }
 
-static int
-circular_buffer_seek(void *c, off64_t *offset, int whence)
+/* The recording goes through a ring with a single producer, the drain
+ * thread reading the perf stream, and a single consumer, the flush
+ * thread writing to the output. Positions only ever grow and the
+ * producer only publishes whole records.
+ */
+#define RING_CHUNK (1 << 20)
+#define DIRECT_IO_ALIGN 4096
+#define DRAIN_READ_SIZE (256 * 1024)
+
+struct spsc_ring {
+	uint8_t *data;
+	uint64_t size;
+
+	_Atomic uint64_t head;
+	_Atomic uint64_t tail;
+	atomic_bool closed;
+
+	/* Wakes the consumer up when there is a chunk to write. */
+	int wake_fd;
+};
+
+struct recorder_stats {
+	_Atomic uint64_t bytes_read;
+	_Atomic uint64_t bytes_dropped;
+	_Atomic uint64_t bytes_written;
+	_Atomic uint64_t ring_high_water;
+	_Atomic uint64_t records_lost;
+};
+
+static bool
+spsc_ring_init(struct spsc_ring *ring, uint64_t size)
 {
-	return -1;
+	ring->size = 4 * RING_CHUNK;
+	while (ring->size < size)
+		ring->size *= 2;
+
+	if (posix_memalign((void **) &ring->data, DIRECT_IO_ALIGN, ring->size))
+		return false;
+
+	ring->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return ring->wake_fd >= 0;
 }
 
-static int
-circular_buffer_close(void *c)
+static void
+spsc_ring_fini(struct spsc_ring *ring)
 {
-	return 0;
+	free(ring->data);
+	if (ring->wake_fd >= 0)
+		close(ring->wake_fd);
 }
 
-cookie_io_functions_t circular_buffer_functions = {
-	.read  = circular_buffer_read,
-	.write = circular_buffer_write,
-	.seek  = circular_buffer_seek,
-	.close = circular_buffer_close,
-};
+static void
+spsc_ring_wake(struct spsc_ring *ring)
+{
+	uint64_t one = 1;
 
+	if (write(ring->wake_fd, &one, sizeof(one)) < 0)
+		assert(errno == EAGAIN);
+}
+
+/* Producer side, all or nothing so records aren't split. */
+static bool
+spsc_ring_push(struct spsc_ring *ring, struct recorder_stats *stats,
+	       const void *data, size_t len)
+{
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint64_t offset = head & (ring->size - 1);
+	size_t len0 = MIN(len, ring->size - offset);
+
+	if (ring->size - (head - tail) < len)
+		return false;
+
+	memcpy(ring->data + offset, data, len0);
+	memcpy(ring->data, (const uint8_t *) data + len0, len - len0);
+
+	atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+	if (head + len - tail > atomic_load_explicit(&stats->ring_high_water,
+						     memory_order_relaxed))
+		atomic_store_explicit(&stats->ring_high_water, head + len - tail,
+				      memory_order_relaxed);
+
+	/* Only bother the consumer once a chunk is complete. */
+	if ((head ^ (head + len)) & ~(uint64_t) (RING_CHUNK - 1))
+		spsc_ring_wake(ring);
+
+	return true;
+}
+
+static void
+spsc_ring_close(struct spsc_ring *ring)
+{
+	atomic_store_explicit(&ring->closed, true, memory_order_release);
+	spsc_ring_wake(ring);
+}
 
 static bool
 read_file_uint64(const char *file, uint64_t *value)
@@ -402,7 +464,20 @@ struct recording_context {
 	uint32_t oa_exponent;
 
 	struct circular_buffer circular_buffer;
-	FILE *output_stream;
+	pthread_mutex_t circular_buffer_lock;
+
+	struct spsc_ring ring;
+	struct recorder_stats stats;
+
+	int output_fd;
+	bool direct_io;
+	atomic_bool write_failed;
+
+	pthread_t drain_thread;
+	pthread_t flush_thread;
+	bool threads_started;
+
+	uint64_t corr_period_ns;
 
 	const char *command_fifo;
 	int command_fifo_fd;
@@ -459,7 +534,7 @@ perf_open(struct recording_context *ctx)
 	return stream_fd;
 }
 
-static bool quit = false;
+static atomic_bool quit = false;
 
 static void
 sigint_handler(int val)
@@ -565,21 +640,6 @@ write_topology(FILE *output, struct recording_context *ctx)
 	return true;
 }
 
-static bool
-write_i915_perf_data(FILE *output, int perf_fd)
-{
-	ssize_t ret;
-	char data[4096];
-
-	while ((ret = read(perf_fd, data, sizeof(data))) > 0 ||
-	       errno == EINTR) {
-		if (fwrite(data, ret, 1, output) != 1)
-			return false;
-	}
-
-	return true;
-}
-
 static uint64_t timespec_diff(struct timespec *begin,
 			      struct timespec *end)
 {
@@ -672,6 +732,272 @@ write_correlation_timestamps(FILE *output, int drm_fd)
 	return write_saved_correlation_timestamps(output, &corr);
 }
 
+static bool
+push_correlation_timestamps(struct recording_context *ctx)
+{
+	struct {
+		struct drm_i915_perf_record_header header;
+		struct intel_perf_record_timestamp_correlation corr;
+	} record = {
+		.header = {
+			.type = INTEL_PERF_RECORD_TYPE_TIMESTAMP_CORRELATION,
+			.size = sizeof(record),
+		},
+	};
+
+	if (!get_correlation_timestamps(&record.corr, ctx->drm_fd))
+		return false;
+
+	if (!spsc_ring_push(&ctx->ring, &ctx->stats, &record, sizeof(record)))
+		atomic_fetch_add(&ctx->stats.bytes_dropped, sizeof(record));
+
+	return true;
+}
+
+/* Reads everything available from the perf stream. A read that doesn't
+ * fit in the ring is dropped as a whole, keeping the stream of records
+ * parsable.
+ */
+static void
+drain_i915_perf_data(struct recording_context *ctx, uint8_t *data)
+{
+	ssize_t ret;
+
+	while ((ret = read(ctx->perf_fd, data, DRAIN_READ_SIZE)) > 0 ||
+	       (ret < 0 && errno == EINTR)) {
+		if (ret < 0)
+			continue;
+
+		atomic_fetch_add(&ctx->stats.bytes_read, ret);
+
+		for (ssize_t offset = 0; offset < ret;) {
+			const struct drm_i915_perf_record_header *header =
+				(const void *) (data + offset);
+
+			if (header->type == DRM_I915_PERF_RECORD_OA_REPORT_LOST ||
+			    header->type == DRM_I915_PERF_RECORD_OA_BUFFER_LOST)
+				atomic_fetch_add(&ctx->stats.records_lost, 1);
+
+			if (!header->size)
+				break;
+			offset += header->size;
+		}
+
+		if (!spsc_ring_push(&ctx->ring, &ctx->stats, data, ret))
+			atomic_fetch_add(&ctx->stats.bytes_dropped, ret);
+	}
+}
+
+static void *
+drain_thread(void *arg)
+{
+	struct recording_context *ctx = arg;
+	uint64_t poll_time_ns = ctx->corr_period_ns;
+	uint8_t *data = malloc(DRAIN_READ_SIZE);
+	struct timespec now;
+
+	assert(data);
+
+	while (!quit) {
+		struct pollfd pollfd = { ctx->perf_fd, POLLIN, 0 };
+		uint64_t elapsed_ns;
+		int ret;
+
+		igt_gettime(&now);
+		ret = poll(&pollfd, 1, poll_time_ns / 1000000);
+		if (ret < 0 && errno != EINTR) {
+			fprintf(stderr, "Failed to poll i915-perf stream: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		if (ret > 0 && (pollfd.revents & POLLIN))
+			drain_i915_perf_data(ctx, data);
+
+		elapsed_ns = igt_nsec_elapsed(&now);
+		if (elapsed_ns > poll_time_ns) {
+			poll_time_ns = ctx->corr_period_ns;
+			if (!push_correlation_timestamps(ctx)) {
+				fprintf(stderr,
+					"Failed to write i915 timestamp correlation data: %s\n",
+					strerror(errno));
+				break;
+			}
+		} else {
+			poll_time_ns -= elapsed_ns;
+		}
+	}
+
+	drain_i915_perf_data(ctx, data);
+
+	if (!push_correlation_timestamps(ctx)) {
+		fprintf(stderr,
+			"Failed to write final i915 timestamp correlation data: %s\n",
+			strerror(errno));
+	}
+
+	free(data);
+
+	quit = true;
+	spsc_ring_close(&ctx->ring);
+
+	return NULL;
+}
+
+static bool
+write_output(struct recording_context *ctx, const uint8_t *data,
+	     uint64_t len, uint64_t offset)
+{
+	/* Only the last write of the recording can be unaligned. */
+	if (ctx->direct_io && (len % DIRECT_IO_ALIGN)) {
+		fcntl(ctx->output_fd, F_SETFL,
+		      fcntl(ctx->output_fd, F_GETFL) & ~O_DIRECT);
+		ctx->direct_io = false;
+	}
+
+	while (len) {
+		ssize_t ret = pwrite(ctx->output_fd, data, len, offset);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		data += ret;
+		len -= ret;
+		offset += ret;
+	}
+
+	return true;
+}
+
+/* The circular buffer can't make room for more than its size at once. */
+static void
+feed_circular_buffer(struct circular_buffer *buffer,
+		     const uint8_t *data, uint64_t len)
+{
+	while (len) {
+		uint64_t size = MIN(len, buffer->allocated_size);
+
+		circular_buffer_write(buffer, (const char *) data, size);
+		data += size;
+		len -= size;
+	}
+}
+
+/* Writes the ring out in chunks, or feeds the in memory circular
+ * buffer when recording for i915-perf-control dumps.
+ */
+static void *
+flush_thread(void *arg)
+{
+	struct recording_context *ctx = arg;
+	struct spsc_ring *ring = &ctx->ring;
+	struct timespec last_flush;
+
+	igt_gettime(&last_flush);
+
+	for (;;) {
+		bool closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint64_t offset = tail & (ring->size - 1);
+		uint64_t len = head - tail;
+		struct pollfd pollfd = { ring->wake_fd, POLLIN, 0 };
+		uint64_t wakeup;
+
+		if (ctx->circular_buffer.data) {
+			uint64_t len0 = MIN(len, ring->size - offset);
+
+			pthread_mutex_lock(&ctx->circular_buffer_lock);
+			feed_circular_buffer(&ctx->circular_buffer,
+					     ring->data + offset, len0);
+			feed_circular_buffer(&ctx->circular_buffer,
+					     ring->data, len - len0);
+			pthread_mutex_unlock(&ctx->circular_buffer_lock);
+		} else {
+			/* Full chunks as they come, whatever is there once
+			 * a correlation period went by, everything at the
+			 * end.
+			 */
+			if (!closed) {
+				if (len >= RING_CHUNK)
+					len = RING_CHUNK;
+				else if (igt_nsec_elapsed(&last_flush) >= ctx->corr_period_ns)
+					len = ALIGN_DOWN(len, DIRECT_IO_ALIGN);
+				else
+					len = 0;
+			}
+			len = MIN(len, ring->size - offset);
+
+			if (len) {
+				if (ctx->write_failed) {
+					/* Keep draining so the producer doesn't block. */
+				} else if (write_output(ctx, ring->data + offset, len, tail)) {
+					atomic_fetch_add(&ctx->stats.bytes_written, len);
+				} else {
+					fprintf(stderr, "Failed to write i915-perf data: %s\n",
+						strerror(errno));
+					ctx->write_failed = true;
+					quit = true;
+				}
+				igt_gettime(&last_flush);
+			}
+		}
+
+		atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+
+		if (closed && tail + len == head)
+			break;
+
+		if (len)
+			continue;
+
+		poll(&pollfd, 1, 100);
+		if (read(ring->wake_fd, &wakeup, sizeof(wakeup)) < 0)
+			assert(errno == EAGAIN);
+	}
+
+	return NULL;
+}
+
+static bool
+push_header(struct recording_context *ctx)
+{
+	char *data = NULL;
+	size_t len = 0;
+	FILE *stream = open_memstream(&data, &len);
+	bool ret;
+
+	if (!stream)
+		return false;
+
+	ret = write_version(stream, ctx) &&
+	      write_header(stream, ctx) &&
+	      write_topology(stream, ctx) &&
+	      write_correlation_timestamps(stream, ctx->drm_fd);
+	ret = fclose(stream) == 0 && ret &&
+	      spsc_ring_push(&ctx->ring, &ctx->stats, data, len);
+	free(data);
+
+	return ret;
+}
+
+static void
+print_stats(FILE *output, struct recording_context *ctx)
+{
+	fprintf(output,
+		"Read %"PRIu64" bytes, dropped %"PRIu64" bytes, "
+		"wrote %"PRIu64" bytes, ring high-water %"PRIu64"/%"PRIu64" bytes, "
+		"%"PRIu64" lost report records\n",
+		atomic_load(&ctx->stats.bytes_read),
+		atomic_load(&ctx->stats.bytes_dropped),
+		atomic_load(&ctx->stats.bytes_written),
+		atomic_load(&ctx->stats.ring_high_water),
+		ctx->ring.size,
+		atomic_load(&ctx->stats.records_lost));
+}
+
 static void
 read_command_file(struct recording_context *ctx)
 {
@@ -701,7 +1027,7 @@ read_command_file(struct recording_context *ctx)
 		if (file) {
 			struct chunk chunks[2];
 
-			fflush(ctx->output_stream);
+			pthread_mutex_lock(&ctx->circular_buffer_lock);
 			get_chunks(chunks, &ctx->circular_buffer,
 				   false, ctx->circular_buffer.size);
 
@@ -715,6 +1041,7 @@ read_command_file(struct recording_context *ctx)
 				fprintf(stderr, "Unable to write circular buffer data in file '%s'\n",
 					dump);
 			}
+			pthread_mutex_unlock(&ctx->circular_buffer_lock);
 			fclose(file);
 		} else
 			fprintf(stderr, "Unable to write dump file '%s'\n", dump);
@@ -805,7 +1132,10 @@ usage(const char *name)
 		"                                       Values: boot, mono, mono_raw (default = mono)\n"
 		"     --poll-period         -P <value>  Polling interval in microseconds used by a timer in the driver to query\n"
 		"                                       for OA reports periodically\n"
-		"                                       (default = 5000), Minimum = 100.\n",
+		"                                       (default = 5000), Minimum = 100.\n"
+		"     --ring-size,          -r <value>  Size in kilobytes of the buffer between reading the\n"
+		"                                       i915-perf stream and writing the output\n"
+		"                                       (default = 16384, minimum = 4096)\n",
 		name);
 }
 
@@ -823,9 +1153,16 @@ teardown_recording_context(struct recording_context *ctx)
 	if (ctx->command_fifo_fd != -1)
 		close(ctx->command_fifo_fd);
 
-	if (ctx->output_stream)
-		fclose(ctx->output_stream);
+	if (ctx->threads_started) {
+		quit = true;
+		pthread_join(ctx->drain_thread, NULL);
+		pthread_join(ctx->flush_thread, NULL);
+	}
+
+	if (ctx->output_fd != -1)
+		close(ctx->output_fd);
 
+	spsc_ring_fini(&ctx->ring);
 	free(ctx->circular_buffer.data);
 
 	if (ctx->perf_fd != -1)
@@ -849,6 +1186,7 @@ main(int argc, char *argv[])
 		{"command-fifo",         required_argument, 0, 'f'},
 		{"cpu-clock",            required_argument, 0, 'k'},
 		{"poll-period",          required_argument, 0, 'P'},
+		{"ring-size",            required_argument, 0, 'r'},
 		{0, 0, 0, 0}
 	};
 	const struct {
@@ -862,16 +1200,17 @@ main(int argc, char *argv[])
 	double corr_period = 1.0, perf_period = 0.001;
 	const char *metric_name = NULL, *output_file = "i915_perf.record";
 	struct intel_perf_metric_set *metric_set;
-	struct intel_perf_record_timestamp_correlation initial_correlation;
-	struct timespec now;
-	uint64_t corr_period_ns, poll_time_ns;
+	uint64_t ring_size = 16 * 1024 * 1024, last_dropped = 0;
 	uint32_t circular_size = 0;
 	int opt, dev_node_id = -1;
 	bool list_counters = false;
-	FILE *output = NULL;
+	sigset_t sigint, sigmask;
 	struct recording_context ctx = {
 		.drm_fd = -1,
 		.perf_fd = -1,
+		.output_fd = -1,
+
+		.ring.wake_fd = -1,
 
 		.command_fifo = I915_PERF_RECORD_FIFO_PATH,
 		.command_fifo_fd = -1,
@@ -880,7 +1219,7 @@ main(int argc, char *argv[])
 		.poll_period = 5 * 1000 * 1000,
 	};
 
-	while ((opt = getopt_long(argc, argv, "hc:d:p:m:Co:s:f:k:P:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hc:d:p:m:Co:s:f:k:P:r:", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
 			usage(argv[0]);
@@ -931,6 +1270,9 @@ main(int argc, char *argv[])
 		case 'P':
 			ctx.poll_period = MAX(100, atol(optarg)) * 1000;
 			break;
+		case 'r':
+			ring_size = MAX(4096, atol(optarg)) * 1024ull;
+			break;
 		default:
 			fprintf(stderr, "Internal error: "
 				"unexpected getopt value: %d\n", opt);
@@ -1028,6 +1370,13 @@ main(int argc, char *argv[])
 		}
 	}
 
+	ctx.corr_period_ns = corr_period * 1000000000ul;
+
+	if (!spsc_ring_init(&ctx.ring, ring_size)) {
+		fprintf(stderr, "Unable to allocate ring buffer\n");
+		goto fail;
+	}
+
 	if (circular_size) {
 		ctx.circular_buffer.allocated_size = circular_size;
 		ctx.circular_buffer.data = malloc(circular_size);
@@ -1035,42 +1384,40 @@ main(int argc, char *argv[])
 			fprintf(stderr, "Unable to allocate circular buffer\n");
 			goto fail;
 		}
+		pthread_mutex_init(&ctx.circular_buffer_lock, NULL);
 
-		ctx.output_stream = fopencookie(&ctx.circular_buffer, "w+",
-						circular_buffer_functions);
-		if (!ctx.output_stream) {
-			fprintf(stderr, "Unable to create circular buffer\n");
-			goto fail;
-		}
-
-		if (!get_correlation_timestamps(&initial_correlation, ctx.drm_fd)) {
+		if (!push_correlation_timestamps(&ctx)) {
 			fprintf(stderr, "Unable to correlation timestamps\n");
 			goto fail;
 		}
 
-		write_correlation_timestamps(ctx.output_stream, ctx.drm_fd);
 		fprintf(stdout,
 			"Recoding in internal circular buffer.\n"
 			"Use i915-perf-control to snapshot into file.\n");
 	} else {
-		output = fopen(output_file, "w+");
-		if (!output) {
+		/* Not all filesystems do direct IO (e.g. tmpfs). */
+		ctx.output_fd = open(output_file,
+				     O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC | O_DIRECT,
+				     0666);
+		ctx.direct_io = ctx.output_fd >= 0;
+		if (ctx.output_fd < 0 && errno == EINVAL)
+			ctx.output_fd = open(output_file,
+					     O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,
+					     0666);
+		if (ctx.output_fd < 0) {
 			fprintf(stderr, "Unable to open output file '%s'\n",
 				output_file);
 			goto fail;
 		}
 
-		if (!write_version(output, &ctx) ||
-		    !write_header(output, &ctx) ||
-		    !write_topology(output, &ctx) ||
-		    !write_correlation_timestamps(output, ctx.drm_fd)) {
+		if (!push_header(&ctx)) {
 			fprintf(stderr, "Unable to write header in file '%s'\n",
 				output_file);
 			goto fail;
 		}
 
-		ctx.output_stream = output;
-		fprintf(stdout, "Writing recoding to %s\n", output_file);
+		fprintf(stdout, "Writing recoding to %s%s\n", output_file,
+			ctx.direct_io ? " (direct IO)" : "");
 	}
 
 	if (ctx.metric_set->perf_oa_metrics_set == 0) {
@@ -1095,65 +1442,55 @@ main(int argc, char *argv[])
 		goto fail;
 	}
 
-	corr_period_ns = corr_period * 1000000000ul;
-	poll_time_ns = corr_period_ns;
+	/* Leave SIGINT to the main thread, it's the one waiting. */
+	sigemptyset(&sigint);
+	sigaddset(&sigint, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &sigint, &sigmask);
 
-	while (!quit) {
-		struct pollfd pollfd[2] = {
-			{         ctx.perf_fd, POLLIN, 0 },
-			{ ctx.command_fifo_fd, POLLIN, 0 },
-		};
-		uint64_t elapsed_ns;
-		int ret;
+	if (pthread_create(&ctx.flush_thread, NULL, flush_thread, &ctx)) {
+		fprintf(stderr, "Unable to create flush thread\n");
+		pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+		goto fail;
+	}
 
-		igt_gettime(&now);
-		ret = poll(pollfd, ctx.command_fifo_fd != -1 ? 2 : 1, poll_time_ns / 1000000);
-		if (ret < 0 && errno != EINTR) {
-			fprintf(stderr, "Failed to poll i915-perf stream: %s\n",
-				strerror(errno));
-			break;
-		}
+	if (pthread_create(&ctx.drain_thread, NULL, drain_thread, &ctx)) {
+		fprintf(stderr, "Unable to create drain thread\n");
+		pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+		spsc_ring_close(&ctx.ring);
+		pthread_join(ctx.flush_thread, NULL);
+		goto fail;
+	}
 
-		if (ret > 0) {
-			if (pollfd[0].revents & POLLIN) {
-				if (!write_i915_perf_data(ctx.output_stream, ctx.perf_fd)) {
-					fprintf(stderr, "Failed to write i915-perf data: %s\n",
-						strerror(errno));
-					break;
-				}
-			}
+	ctx.threads_started = true;
+	pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
 
-			if (pollfd[1].revents & POLLIN) {
-				read_command_file(&ctx);
-			}
-		}
+	while (!quit) {
+		struct pollfd pollfd = { ctx.command_fifo_fd, POLLIN, 0 };
+		uint64_t dropped;
+		int ret;
 
-		elapsed_ns = igt_nsec_elapsed(&now);
-		if (elapsed_ns > poll_time_ns) {
-			poll_time_ns = corr_period_ns;
-			if (!write_correlation_timestamps(ctx.output_stream, ctx.drm_fd)) {
-				fprintf(stderr,
-					"Failed to write i915 timestamp correlation data: %s\n",
-					strerror(errno));
-				break;
-			}
-		} else {
-			poll_time_ns -= elapsed_ns;
+		ret = poll(&pollfd, ctx.command_fifo_fd != -1 ? 1 : 0, 1000);
+		if (ret > 0 && (pollfd.revents & POLLIN))
+			read_command_file(&ctx);
+
+		dropped = atomic_load(&ctx.stats.bytes_dropped);
+		if (dropped != last_dropped) {
+			fprintf(stderr, "Warning: ring buffer full, dropping i915-perf data.\n");
+			print_stats(stderr, &ctx);
+			last_dropped = dropped;
 		}
 	}
 
 	fprintf(stdout, "Exiting...\n");
 
-	if (!write_i915_perf_data(ctx.output_stream, ctx.perf_fd)) {
-		fprintf(stderr, "Failed to write i915-perf data: %s\n",
-			strerror(errno));
-	}
+	pthread_join(ctx.drain_thread, NULL);
+	pthread_join(ctx.flush_thread, NULL);
+	ctx.threads_started = false;
 
-	if (!write_correlation_timestamps(ctx.output_stream, ctx.drm_fd)) {
-		fprintf(stderr,
-			"Failed to write final i915 timestamp correlation data: %s\n",
-			strerror(errno));
-	}
+	print_stats(stdout, &ctx);
+
+	if (ctx.write_failed)
+		goto fail;
 
 	teardown_recording_context(&ctx);
 
@@ -51,21 +51,29 @@
 #include <assert.h>
 #include <zlib.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "intel_chipset.h"
 #include "intel_io.h"
 #include "instdone.h"
 #include "intel_reg.h"
 #include "drmtest.h"
+#include "igt_aux.h"
 #include "i915/intel_decode.h"
 
 static uint32_t
-print_head(unsigned int reg)
+ring_head(unsigned int reg)
 {
-	printf("    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
 	return reg & (0x7ffff<<2);
 }
 
+static void
+print_head(unsigned int reg)
+{
+	printf("    head = 0x%08x, wraps = %d\n", ring_head(reg), reg >> 21);
+}
+
 static uint32_t
 print_ctl(unsigned int reg)
 {
@@ -434,6 +442,89 @@ print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
 }
 
 #define MAX_RINGS 10 /* I really hope this never... */
+#define MAX_THREADS 64
+#define SECTIONS_PER_THREAD 8 /* decoded but not yet printed */
+#define ASCII85_BLOCK 4096 /* dwords handed to zlib at once */
+
+/*
+ * The error state is mapped and split in a first pass into runs of text
+ * lines and buffers, each buffer section carrying the ring state it is to
+ * be decoded with. Buffers are then decoded by a pool of threads into
+ * memory streams and printed in file order along with the text, at most
+ * SECTIONS_PER_THREAD sections per thread ahead of the output.
+ */
+
+enum section_type {
+	SECTION_TEXT,
+	SECTION_ASCII85,
+	SECTION_HEX,
+};
+
+struct section {
+	enum section_type type;
+
+	/* Lines of the file, without the ':' or '~' of an ascii85 buffer. */
+	const char *start, *end;
+
+	const char *buffer_name;
+	const char *ring_name;
+	int ring_name_len;
+	uint64_t gtt_offset;
+	uint32_t head_offset;
+	bool do_decode;
+	bool inflate;
+
+	/* Batch decoding context, without a PCI ID buffers are dumped. */
+	uint32_t devid;
+	uint32_t head, tail;
+
+	char *output;
+	size_t output_size;
+	bool done;
+};
+
+struct decoder {
+	struct section *sections;
+	unsigned int n_sections;
+	unsigned int n_allocated;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int next;	/* next section to decode */
+	unsigned int printed;	/* sections already out */
+	unsigned int window;
+
+	const char *data;
+	const char *released;
+	bool mapped;
+};
+
+struct decode_worker {
+	pthread_t thread;
+	struct decoder *decoder;
+
+	/* Reused for all the sections decoded by this thread. */
+	uint32_t *data;
+	size_t size;
+	struct z_stream_s zstream;
+
+	struct intel_decode *ctx;
+	uint32_t devid;
+};
+
+static bool
+parse_pci_id(const char *line, unsigned int *reg)
+{
+	const char *pci_id_start;
+
+	if (sscanf(line, "PCI ID: 0x%04x\n", reg) == 1 ||
+	    sscanf(line, " PCI ID: 0x%04x\n", reg) == 1)
+		return true;
+
+	pci_id_start = strstr(line, "PCI ID");
+	return pci_id_start &&
+		sscanf(pci_id_start, "PCI ID: 0x%04x\n", reg) == 1;
+}
 
 static bool maybe_ascii(const void *data, int check)
 {
@@ -445,160 +536,347 @@ static bool maybe_ascii(const void *data, int check)
 	return true;
 }
 
-static void decode(struct intel_decode *ctx,
-		   const char *buffer_name,
-		   const char *ring_name,
-		   uint64_t gtt_offset,
-		   uint32_t head_offset,
-		   uint32_t *data, int *count,
-		   int decode)
+static void decode(FILE *out,
+		   struct intel_decode *ctx,
+		   const struct section *s,
+		   uint32_t *data, int count)
 {
-	if (!*count)
+	if (!count)
 		return;
 
-	printf("%s (%s) at 0x%08x_%08x", buffer_name, ring_name,
-	       (unsigned)(gtt_offset >> 32),
-	       (unsigned)(gtt_offset & 0xffffffff));
-	if (head_offset != -1)
-		printf("; HEAD points to: 0x%08x_%08x",
-		       (unsigned)((head_offset + gtt_offset) >> 32),
-		       (unsigned)((head_offset + gtt_offset) & 0xffffffff));
-	printf("\n");
-
-	if (decode && ctx) {
-		intel_decode_set_batch_pointer(ctx, data, gtt_offset,
-						   *count);
+	fprintf(out, "%s (%.*s) at 0x%08x_%08x", s->buffer_name,
+		s->ring_name_len, s->ring_name,
+		(unsigned)(s->gtt_offset >> 32),
+		(unsigned)(s->gtt_offset & 0xffffffff));
+	if (s->head_offset != -1)
+		fprintf(out, "; HEAD points to: 0x%08x_%08x",
+			(unsigned)((s->head_offset + s->gtt_offset) >> 32),
+			(unsigned)((s->head_offset + s->gtt_offset) & 0xffffffff));
+	fprintf(out, "\n");
+
+	if (s->do_decode && ctx) {
+		intel_decode_set_output_file(ctx, out);
+		intel_decode_set_head_tail(ctx, s->head, s->tail);
+		intel_decode_set_batch_pointer(ctx, data, s->gtt_offset,
+					       count);
 		intel_decode(ctx);
 	} else if (maybe_ascii(data, 16)) {
-		printf("%*s\n", 4 * *count, (char *)data);
+		fprintf(out, "%*s\n", 4 * count, (char *)data);
 	} else {
-		for (int i = 0; i + 4 <= *count; i += 4)
-			printf("[%04x] %08x %08x %08x %08x\n",
-			       4*i, data[i], data[i+1], data[i+2], data[i+3]);
+		for (int i = 0; i + 4 <= count; i += 4)
+			fprintf(out, "[%04x] %08x %08x %08x %08x\n",
+				4*i, data[i], data[i+1], data[i+2], data[i+3]);
 	}
-	*count = 0;
 }
 
-static int zlib_inflate(uint32_t **ptr, int len)
+/* Keeps a zeroed dword past the end, buffers are printed as strings. */
+static bool worker_reserve(struct decode_worker *w, size_t size)
 {
-	struct z_stream_s zstream;
-	void *out;
+	uint32_t *data;
+
+	if (size <= w->size)
+		return true;
 
-	memset(&zstream, 0, sizeof(zstream));
+	size = max(size, max(2 * w->size, (size_t)128*4096));
+	data = realloc(w->data, size + sizeof(uint32_t));
+	if (!data)
+		return false;
 
-	zstream.next_in = (unsigned char *)*ptr;
-	zstream.avail_in = 4*len;
+	w->data = data;
+	w->size = size;
+	return true;
+}
 
-	if (inflateInit(&zstream) != Z_OK)
-		return 0;
+static bool inflate_block(struct decode_worker *w,
+			  const uint32_t *block, unsigned int len)
+{
+	struct z_stream_s *zstream = &w->zstream;
+	int ret;
 
-	out = malloc(128*4096); /* approximate obj size */
-	zstream.next_out = out;
-	zstream.avail_out = 128*4096;
+	zstream->next_in = (unsigned char *)block;
+	zstream->avail_in = 4*len;
 
 	do {
-		switch (inflate(&zstream, Z_SYNC_FLUSH)) {
-		case Z_STREAM_END:
-			goto end;
-		case Z_OK:
-			break;
-		default:
-			inflateEnd(&zstream);
-			return 0;
+		if (!zstream->avail_out) {
+			if (!worker_reserve(w, zstream->total_out + 1))
+				return false;
+
+			zstream->next_out = (unsigned char *)w->data + zstream->total_out;
+			zstream->avail_out = w->size - zstream->total_out;
 		}
 
-		if (zstream.avail_out)
+		ret = inflate(zstream, Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END || ret == Z_BUF_ERROR)
 			break;
+		if (ret != Z_OK)
+			return false;
+	} while (zstream->avail_in || !zstream->avail_out);
 
-		out = realloc(out, 2*zstream.total_out);
-		if (out == NULL) {
-			inflateEnd(&zstream);
+	/* Trailing data after the end of the stream is ignored. */
+	zstream->avail_in = 0;
+	return true;
+}
+
+/* Returns the number of dwords decoded into w->data, 0 on failure. */
+static int ascii85_decode(struct decode_worker *w,
+			  const char *in, const char *end, bool inflate)
+{
+	uint32_t block[ASCII85_BLOCK];
+	size_t len = 0;
+
+	if (inflate) {
+		if (inflateReset(&w->zstream) != Z_OK)
 			return 0;
+
+		w->zstream.next_out = (unsigned char *)w->data;
+		w->zstream.avail_out = w->size;
+	}
+
+	while (in < end) {
+		unsigned int n = 0;
+
+		while (n < ASCII85_BLOCK && in < end) {
+			uint32_t v = 0;
+
+			if (*in < '!' || *in > 'z' ||
+			    (*in != 'z' && end - in < 5)) {
+				end = in;
+				break;
+			}
+
+			if (*in == 'z') {
+				in++;
+			} else {
+				v += in[0] - 33; v *= 85;
+				v += in[1] - 33; v *= 85;
+				v += in[2] - 33; v *= 85;
+				v += in[3] - 33; v *= 85;
+				v += in[4] - 33;
+				in += 5;
+			}
+			block[n++] = v;
+		}
+
+		if (inflate) {
+			if (!inflate_block(w, block, n))
+				return 0;
+		} else {
+			if (!worker_reserve(w, 4 * (len + n)))
+				return 0;
+
+			memcpy(w->data + len, block, 4 * n);
+			len += n;
 		}
+	}
+
+	if (inflate)
+		len = w->zstream.total_out / 4;
 
-		zstream.next_out = (unsigned char *)out + zstream.total_out;
-		zstream.avail_out = zstream.total_out;
-	} while (1);
-end:
-	inflateEnd(&zstream);
-	free(*ptr);
-	*ptr = out;
-	return zstream.total_out / 4;
+	if (len)
+		w->data[len] = 0;
+	return len;
 }
 
-static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
+static int hex_decode(struct decode_worker *w,
+		      const char *in, const char *end)
 {
-	int len = 0, size = 1024;
+	int count = 0;
 
-	*out = realloc(*out, sizeof(uint32_t)*size);
-	if (*out == NULL)
-		return 0;
+	while (in < end) {
+		const char *eol = memchr(in, '\n', end - in) ?: end;
+		uint32_t offset, value;
+		char line[64];
 
-	while (*in >= '!' && *in <= 'z') {
-		uint32_t v = 0;
+		snprintf(line, sizeof(line), "%.*s", (int)(eol - in), in);
+		in = eol + 1;
 
-		if (len == size) {
-			size *= 2;
-			*out = realloc(*out, sizeof(uint32_t)*size);
-			if (*out == NULL)
-				return 0;
+		if (sscanf(line, "%08x : %08x", &offset, &value) != 2)
+			continue;
+
+		if (!worker_reserve(w, 4 * (count + 1))) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
 		}
+		w->data[count++] = value;
+	}
 
-		if (*in == 'z') {
-			in++;
-		} else {
-			v += in[0] - 33; v *= 85;
-			v += in[1] - 33; v *= 85;
-			v += in[2] - 33; v *= 85;
-			v += in[3] - 33; v *= 85;
-			v += in[4] - 33;
-			in += 5;
+	if (count)
+		w->data[count] = 0;
+	return count;
+}
+
+static void decode_section(struct decode_worker *w, struct section *s)
+{
+	FILE *out;
+	int count;
+
+	if (s->devid != w->devid) {
+		intel_decode_context_free(w->ctx);
+		w->ctx = s->devid ? intel_decode_context_alloc(s->devid) : NULL;
+		w->devid = s->devid;
+	}
+
+	if (s->type == SECTION_HEX) {
+		count = hex_decode(w, s->start, s->end);
+	} else {
+		count = ascii85_decode(w, s->start, s->end, s->inflate);
+		if (count == 0)
+			fprintf(stderr, "ASCII85 decode failed (%.*s - %s).\n",
+				s->ring_name_len, s->ring_name, s->buffer_name);
+	}
+
+	out = open_memstream(&s->output, &s->output_size);
+	if (!out) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	decode(out, w->ctx, s, w->data, count);
+	fclose(out);
+}
+
+static void *decode_thread(void *data)
+{
+	struct decode_worker *w = data;
+	struct decoder *d = w->decoder;
+
+	pthread_mutex_lock(&d->mutex);
+	for (;;) {
+		struct section *s;
+
+		while (d->next < d->n_sections &&
+		       d->sections[d->next].type == SECTION_TEXT)
+			d->next++;
+		if (d->next == d->n_sections)
+			break;
+
+		if (d->next >= d->printed + d->window) {
+			pthread_cond_wait(&d->cond, &d->mutex);
+			continue;
 		}
-		(*out)[len++] = v;
+
+		s = &d->sections[d->next++];
+		pthread_mutex_unlock(&d->mutex);
+
+		decode_section(w, s);
+
+		pthread_mutex_lock(&d->mutex);
+		s->done = true;
+		pthread_cond_broadcast(&d->cond);
 	}
+	pthread_mutex_unlock(&d->mutex);
+
+	return NULL;
+}
 
-	if (!inflate)
-		return len;
+/*
+ * Drops the pages of the mapping up to end, which are faulted back from
+ * the page cache if read again.
+ */
+static void release_mapping(struct decoder *d, const char *end)
+{
+	if (!d->mapped || end - d->released < 1 << 20)
+		return;
 
-	return zlib_inflate(out, len);
+	end = d->data + ((end - d->data) & -sysconf(_SC_PAGESIZE));
+	madvise((void *)d->released, end - d->released, MADV_DONTNEED);
+	d->released = end;
 }
 
-static void
-read_data_file(FILE *file)
+/* Returns the start of the next line, copying this one into *line. */
+static const char *
+copy_line(const char *in, const char *end, char **line, size_t *line_size)
 {
-	struct intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
-	uint32_t *data = NULL;
+	const char *eol = memchr(in, '\n', end - in);
+	size_t len = eol ? eol + 1 - in : end - in;
+
+	if (len + 1 > *line_size) {
+		*line_size = max(len + 1, 2 * *line_size);
+		*line = realloc(*line, *line_size);
+		if (*line == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	memcpy(*line, in, len);
+	(*line)[len] = '\0';
+
+	return in + len;
+}
+
+static struct section *
+add_section(struct decoder *d, enum section_type type,
+	    const struct section *state, const char *start)
+{
+	struct section *s;
+
+	if (d->n_sections == d->n_allocated) {
+		d->n_allocated = d->n_allocated ? 2 * d->n_allocated : 256;
+		d->sections = realloc(d->sections,
+				      d->n_allocated * sizeof(*d->sections));
+		if (d->sections == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	s = &d->sections[d->n_sections++];
+	*s = *state;
+	s->type = type;
+	s->start = start;
+
+	return s;
+}
+
+/* Splits the error state, tracking the ring state of each buffer. */
+static void index_sections(struct decoder *d, const char *in, const char *end)
+{
+	struct section state = {
+		.buffer_name = "batch buffer",
+		.ring_name = "",
+		.head_offset = -1,
+		.do_decode = true,
+	};
+	struct section *s = NULL;
 	uint32_t head[MAX_RINGS];
 	int head_idx = 0;
 	int num_rings = 0;
-	long long unsigned fence;
-	int data_size = 0, count = 0, matched;
 	char *line = NULL;
-	size_t line_size;
-	uint32_t offset, value, ring_length = 0;
-	uint64_t gtt_offset = 0;
-	uint32_t head_offset = -1;
-	const char *buffer_name = "batch buffer";
-	char *ring_name = NULL;
-	int do_decode = 1;
-
-	while (getline(&line, &line_size, file) > 0) {
+	size_t line_size = 0;
+
+	for (const char *next; in < end; in = next) {
+		unsigned int offset, value, reg;
 		char *dashes;
 
-		if (line[0] == ':' || line[0] == '~') {
-			count = ascii85_decode(line+1, &data, line[0] == ':');
-			if (count == 0)
-				fprintf(stderr, "ASCII85 decode failed (%s - %s).\n",
-					ring_name, buffer_name);
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
+		release_mapping(d, in);
+
+		if (in[0] == ':' || in[0] == '~') {
+			const char *eol = memchr(in, '\n', end - in) ?: end;
+
+			s = add_section(d, SECTION_ASCII85, &state, in + 1);
+			s->inflate = in[0] == ':';
+			s->end = eol;
+			s = NULL;
+
+			next = eol < end ? eol + 1 : end;
 			continue;
 		}
 
+		next = copy_line(in, end, &line, &line_size);
 		dashes = strstr(line, "---");
+
+		if (!dashes &&
+		    sscanf(line, "%08x : %08x", &offset, &value) == 2) {
+			if (!s || s->type != SECTION_HEX)
+				s = add_section(d, SECTION_HEX, &state, in);
+			s->end = next;
+			continue;
+		}
+
+		if (!s || s->type != SECTION_TEXT)
+			s = add_section(d, SECTION_TEXT, &state, in);
+		s->end = next;
+
 		if (dashes) {
 			const struct {
 				const char *match;
@@ -619,25 +897,17 @@ read_data_file(FILE *file)
 				{ "guc log buffer", "GuC log", 0 },
 				{ },
 			}, *b;
-			char *new_ring_name;
-
-			new_ring_name = malloc(dashes - line);
-			strncpy(new_ring_name, line, dashes - line);
-			new_ring_name[dashes - line - 1] = '\0';
-
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
-			gtt_offset = 0;
-			head_offset = -1;
 
-			free(ring_name);
-			ring_name = new_ring_name;
+			/* The ring name ends with the space before the dashes. */
+			state.ring_name = in;
+			state.ring_name_len = max((int)(dashes - line) - 1, 0);
+			state.gtt_offset = 0;
+			state.head_offset = -1;
 
 			dashes += 4;
 			for (b = buffers; b->match; b++) {
 				uint32_t lo, hi;
+				int matched;
 
 				if (strncasecmp(dashes, b->match,
 						strlen(b->match)))
@@ -650,122 +920,241 @@ read_data_file(FILE *file)
 				matched = sscanf(dashes, "= 0x%08x %08x\n",
 						 &hi, &lo);
 				if (matched > 0) {
-					gtt_offset = hi;
+					state.gtt_offset = hi;
 					if (matched == 2) {
-						gtt_offset <<= 32;
-						gtt_offset |= lo;
+						state.gtt_offset <<= 32;
+						state.gtt_offset |= lo;
 					}
 				}
 
-				do_decode = b->do_decode;
-				buffer_name = b->name;
-				if (b == buffers)
-					head_offset = head[head_idx++];
+				state.do_decode = b->do_decode;
+				state.buffer_name = b->name;
+				if (b == buffers && head_idx < num_rings)
+					state.head_offset = head[head_idx++];
 				break;
 			}
 
 			continue;
 		}
 
-		matched = sscanf(line, "%08x : %08x", &offset, &value);
-		if (matched != 2) {
-			unsigned int reg, reg2;
-
-			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
-
-			printf("%s", line);
-
-			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
-			if (matched == 0)
-				matched = sscanf(line, " PCI ID: 0x%04x\n", &reg);
-			if (matched == 0) {
-				const char *pci_id_start = strstr(line, "PCI ID");
-				if (pci_id_start)
-					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
-			}
-			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
+		if (parse_pci_id(line, &reg)) {
+			state.devid = reg;
+			state.head = 0;
+			state.tail = 0;
+		}
 
-				decode_ctx = intel_decode_context_alloc(devid);
-			}
+		if (sscanf(line, "  HEAD: 0x%08x\n", &reg) == 1 &&
+		    num_rings < MAX_RINGS)
+			head[num_rings++] = ring_head(reg);
 
-			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
-			if (matched == 1)
-				ring_length = print_ctl(reg);
+		if (sscanf(line, "  ACTHD: 0x%08x\n", &reg) == 1 &&
+		    state.devid) {
+			state.head = reg;
+			state.tail = 0xffffffff;
+		}
+	}
 
-			matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				head[num_rings++] = print_head(reg);
-			}
+	free(line);
+}
 
-			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				print_acthd(reg, ring_length);
-				if (decode_ctx)
-					intel_decode_set_head_tail(decode_ctx,
-								       reg,
-								       0xffffffff);
-			}
+/* Prints the registers and other text between the buffers. */
+static void print_text(const struct section *s, uint32_t *devid,
+		       uint32_t *ring_length)
+{
+	const char *in = s->start;
+	char *line = NULL;
+	size_t line_size = 0;
 
-			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+	while (in < s->end) {
+		unsigned int reg, reg2;
+		long long unsigned fence;
+		int matched;
 
-			matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_error(reg, devid);
+		in = copy_line(in, s->end, &line, &line_size);
 
-			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, reg, -1);
+		if (strstr(line, "---"))
+			continue;
 
-			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, -1, reg);
+		printf("%s", line);
 
-			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
-			if (matched == 2)
-				print_fence(devid, fence);
+		if (parse_pci_id(line, &reg)) {
+			*devid = reg;
+			printf("Detected GEN%i chipset\n",
+					intel_gen(*devid));
+		}
 
-			matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_fault_reg(devid, reg);
+		matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
+		if (matched == 1)
+			*ring_length = print_ctl(reg);
 
-			matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
-			if (matched == 2)
-				print_fault_data(devid, reg, reg2);
+		matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
+		if (matched == 1)
+			print_head(reg);
 
-			continue;
-		}
+		matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
+		if (matched == 1)
+			print_acthd(reg, *ring_length);
 
-		count++;
+		matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
+		if (matched == 1 && reg)
+			print_pgtbl_err(reg, *devid);
 
-		if (count > data_size) {
-			data_size = data_size ? data_size * 2 : 1024;
-			data = realloc(data, data_size * sizeof (uint32_t));
+		matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
+		if (matched == 1 && reg)
+			print_error(reg, *devid);
+
+		matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
+		if (matched == 1)
+			print_instdone(*devid, reg, -1);
+
+		matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
+		if (matched == 1)
+			print_instdone(*devid, -1, reg);
+
+		matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
+		if (matched == 2)
+			print_fence(*devid, fence);
+
+		matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
+		if (matched == 1 && reg)
+			print_fault_reg(*devid, reg);
+
+		matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
+		if (matched == 2)
+			print_fault_data(*devid, reg, reg2);
+	}
+
+	free(line);
+}
+
+/*
+ * Regular files are mapped, sysfs, debugfs and pipes don't know their size
+ * upfront and are read in full.
+ */
+static char *load_file(FILE *file, size_t *size, bool *mapped)
+{
+	struct stat st;
+	size_t allocated = 0;
+	char *data = NULL;
+	ssize_t len;
+
+	*size = 0;
+	*mapped = false;
+
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			    fileno(file), 0);
+		if (data != MAP_FAILED) {
+			*size = st.st_size;
+			*mapped = true;
+			return data;
+		}
+		data = NULL;
+	}
+
+	for (;;) {
+		if (*size == allocated) {
+			allocated = allocated ? 2 * allocated : 1 << 20;
+			data = realloc(data, allocated);
 			if (data == NULL) {
 				fprintf(stderr, "Out of memory.\n");
 				exit(1);
 			}
 		}
 
-		data[count-1] = value;
+		len = read(fileno(file), data + *size, allocated - *size);
+		if (len == 0)
+			break;
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "Failed to read the error state");
+		}
+		*size += len;
 	}
 
-	decode(decode_ctx,
-	       buffer_name, ring_name,
-	       gtt_offset, head_offset,
-	       data, &count, do_decode);
+	return data;
+}
 
-	free(data);
-	free(line);
-	free(ring_name);
+static void
+read_data_file(FILE *file)
+{
+	struct decoder d = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct decode_worker *workers;
+	uint32_t devid = PCI_CHIP_I855_GM;
+	uint32_t ring_length = 0;
+	int num_threads;
+	size_t size;
+	char *data;
+
+	data = load_file(file, &size, &d.mapped);
+	d.data = d.released = data;
+	index_sections(&d, data, data + size);
+	d.released = data;
+
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	num_threads = clamp(num_threads, 1, MAX_THREADS);
+	d.window = SECTIONS_PER_THREAD * num_threads;
+
+	workers = calloc(num_threads, sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		int ret;
+
+		workers[i].decoder = &d;
+		if (inflateInit(&workers[i].zstream) != Z_OK)
+			errx(1, "Failed to initialize zlib");
+		ret = pthread_create(&workers[i].thread, NULL,
+				     decode_thread, &workers[i]);
+		if (ret)
+			errx(1, "Failed to create a decode thread: %s",
+			     strerror(ret));
+	}
+
+	for (unsigned int i = 0; i < d.n_sections; i++) {
+		struct section *s = &d.sections[i];
+
+		if (s->type == SECTION_TEXT) {
+			print_text(s, &devid, &ring_length);
+		} else {
+			pthread_mutex_lock(&d.mutex);
+			while (!s->done)
+				pthread_cond_wait(&d.cond, &d.mutex);
+			pthread_mutex_unlock(&d.mutex);
+
+			fwrite(s->output, 1, s->output_size, stdout);
+			free(s->output);
+		}
+
+		pthread_mutex_lock(&d.mutex);
+		d.printed = i + 1;
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.mutex);
+
+		release_mapping(&d, s->end);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		inflateEnd(&workers[i].zstream);
+		intel_decode_context_free(workers[i].ctx);
+		free(workers[i].data);
+	}
+	free(workers);
+	free(d.sections);
+
+	if (d.mapped)
+		munmap(data, size);
+	else
+		free(data);
 }
 
 static void setup_pager(void)
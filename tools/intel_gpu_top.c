@@ -47,6 +47,8 @@
 
 #include "igt_perf.h"
 #include "igt_drm_fdinfo.h"
+#include "igt_drm_fdinfo_scan.h"
+#include "igt_map.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 
@@ -461,7 +463,8 @@ static void free_engines(struct engines *engines)
 		free((char *)engine->display_name);
 	}
 
-	closedir(engines->root);
+	if (engines->root)
+		closedir(engines->root);
 
 	free(engines->class);
 	free(engines);
@@ -627,20 +630,522 @@ static void __update_sample(struct pmu_counter *counter, uint64_t val)
 	counter->val.cur = val;
 }
 
-static void update_sample(struct pmu_counter *counter, uint64_t *val)
+static void update_sample(struct pmu_counter *counter, const uint64_t *val)
 {
 	if (counter->present)
 		__update_sample(counter, val[counter->idx]);
 }
 
-static void pmu_sample(struct engines *engines)
+/*
+ * Recording format, all values in host byte order:
+ *
+ *   struct record_header
+ *   struct record_counter, one for each of the global counters
+ *   struct record_engine, num_engines times
+ *
+ * Followed by any number of samples:
+ *
+ *   struct record_sample
+ *   uint64_t raw[num_raw], see pmu_num_raw()
+ *   struct record_client + uint64_t busy[num_classes], num_clients times
+ */
+#define RECORD_MAGIC "IGTGPUTP"
+#define RECORD_VERSION 1
+
+#define RECORD_DISCRETE	(1 << 0)
+
+/* Limits a replayed recording is checked against. */
+#define RECORD_MAX_ENGINES	256
+#define RECORD_MAX_COUNTERS(num_engines) (4 + 3 * (num_engines))
+#define RECORD_MAX_RAPL		2
+#define RECORD_MAX_IMC		2
+
+struct record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t num_engines;
+	uint32_t num_counters;
+	uint32_t num_rapl;
+	uint32_t num_imc;
+	uint32_t num_classes; /* Zero if clients were not recorded. */
+	uint32_t period_us;
+	char card[64];
+	char pci_slot[64];
+	char codename[64];
+};
+
+struct record_counter {
+	uint32_t present;
+	uint32_t idx;
+	double scale;
+	char units[16];
+};
+
+struct record_engine {
+	char name[32];
+	uint32_t class;
+	uint32_t instance;
+	uint32_t num_counters;
+	uint32_t pad;
+	struct record_counter busy;
+	struct record_counter wait;
+	struct record_counter sema;
+};
+
+struct record_sample {
+	uint32_t size; /* Of the payload following this header. */
+	uint32_t num_clients;
+};
+
+struct record_client {
+	uint32_t id;
+	uint32_t pid;
+	char name[24];
+};
+
+struct recording {
+	FILE *f;
+
+	unsigned int num_raw;
+	unsigned int num_classes;
+	size_t client_size;
+
+	char pci_slot[64];
+
+	/* Current sample, including the struct record_sample header. */
+	char *buf;
+	size_t size;
+	size_t max;
+	unsigned int num_clients;
+};
+
+static struct recording *record, *replay;
+
+static struct pmu_counter *
+global_counter(struct engines *engines, unsigned int i)
+{
+	struct pmu_counter *counters[] = {
+		&engines->freq_req,
+		&engines->freq_act,
+		&engines->irq,
+		&engines->rc6,
+		&engines->r_gpu,
+		&engines->r_pkg,
+		&engines->imc_reads,
+		&engines->imc_writes,
+		NULL
+	};
+
+	return i < ARRAY_SIZE(counters) ? counters[i] : NULL;
+}
+
+static unsigned int pmu_num_raw(struct engines *engines)
+{
+	/* Timestamp followed by the i915, RAPL and IMC counter groups. */
+	return 1 + engines->num_counters + engines->num_rapl + engines->num_imc;
+}
+
+static void record_reserve(struct recording *r, size_t size)
+{
+	if (r->size + size <= r->max)
+		return;
+
+	while (r->size + size > r->max)
+		r->max = r->max ? 2 * r->max : 4096;
+
+	r->buf = realloc(r->buf, r->max);
+	assert(r->buf);
+}
+
+static void record_append(struct recording *r, const void *data, size_t size)
+{
+	record_reserve(r, size);
+	memcpy(r->buf + r->size, data, size);
+	r->size += size;
+}
+
+static void record_counter(struct record_counter *rc,
+			   const struct pmu_counter *pmu)
+{
+	memset(rc, 0, sizeof(*rc));
+
+	rc->present = pmu->present;
+	rc->idx = pmu->idx;
+	rc->scale = pmu->scale;
+	if (pmu->units)
+		strncpy(rc->units, pmu->units, sizeof(rc->units) - 1);
+}
+
+static struct recording *
+record_open(const char *path, struct engines *engines,
+	    const struct igt_device_card *card, const char *codename,
+	    const char *pci_slot, unsigned int num_classes,
+	    unsigned int period_us)
+{
+	struct record_header hdr = { };
+	struct pmu_counter *pmu;
+	struct recording *r;
+	unsigned int i;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->f = fopen(path, "w");
+	if (!r->f) {
+		free(r);
+		return NULL;
+	}
+	setvbuf(r->f, NULL, _IOFBF, 1 << 20);
+
+	r->num_raw = pmu_num_raw(engines);
+	r->num_classes = num_classes;
+	r->client_size = sizeof(struct record_client) +
+			 num_classes * sizeof(uint64_t);
+
+	memcpy(hdr.magic, RECORD_MAGIC, sizeof(hdr.magic));
+	hdr.version = RECORD_VERSION;
+	hdr.flags = engines->discrete ? RECORD_DISCRETE : 0;
+	hdr.num_engines = engines->num_engines;
+	hdr.num_counters = engines->num_counters;
+	hdr.num_rapl = engines->num_rapl;
+	hdr.num_imc = engines->num_imc;
+	hdr.num_classes = num_classes;
+	hdr.period_us = period_us;
+	strncpy(hdr.card, card->card, sizeof(hdr.card) - 1);
+	strncpy(hdr.pci_slot, pci_slot, sizeof(hdr.pci_slot) - 1);
+	if (codename)
+		strncpy(hdr.codename, codename, sizeof(hdr.codename) - 1);
+	record_append(r, &hdr, sizeof(hdr));
+
+	for (i = 0; (pmu = global_counter(engines, i)); i++) {
+		struct record_counter rc;
+
+		record_counter(&rc, pmu);
+		record_append(r, &rc, sizeof(rc));
+	}
+
+	for (i = 0; i < engines->num_engines; i++) {
+		struct engine *engine = engine_ptr(engines, i);
+		struct record_engine re = { };
+
+		strncpy(re.name, engine->name, sizeof(re.name) - 1);
+		re.class = engine->class;
+		re.instance = engine->instance;
+		re.num_counters = engine->num_counters;
+		record_counter(&re.busy, &engine->busy);
+		record_counter(&re.wait, &engine->wait);
+		record_counter(&re.sema, &engine->sema);
+		record_append(r, &re, sizeof(re));
+	}
+
+	if (fwrite(r->buf, r->size, 1, r->f) != 1) {
+		fclose(r->f);
+		free(r->buf);
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+static void record_pmu(struct recording *r, const uint64_t *raw)
+{
+	struct record_sample hdr = { };
+
+	r->size = 0;
+	r->num_clients = 0;
+	record_append(r, &hdr, sizeof(hdr));
+	record_append(r, raw, r->num_raw * sizeof(*raw));
+}
+
+static void
+record_client(struct recording *r, unsigned int id, unsigned int pid,
+	      const char *name, const uint64_t *busy)
+{
+	struct record_client rc = { };
+
+	rc.id = id;
+	rc.pid = pid;
+	strncpy(rc.name, name, sizeof(rc.name) - 1);
+	record_append(r, &rc, sizeof(rc));
+	record_append(r, busy, r->num_classes * sizeof(*busy));
+
+	r->num_clients++;
+}
+
+static bool record_flush(struct recording *r)
+{
+	struct record_sample *hdr = (struct record_sample *)r->buf;
+
+	hdr->size = r->size - sizeof(*hdr);
+	hdr->num_clients = r->num_clients;
+
+	return fwrite(r->buf, r->size, 1, r->f) == 1;
+}
+
+/* Returns false if buffered samples could not be written out. */
+static bool record_close(struct recording *r)
+{
+	bool ok;
+
+	if (!r)
+		return true;
+
+	ok = fclose(r->f) == 0;
+	free(r->buf);
+	free(r);
+
+	return ok;
+}
+
+static bool replay_read(struct recording *r, void *data, size_t size)
+{
+	return fread(data, size, 1, r->f) == 1;
+}
+
+static bool replay_counter(struct recording *r, struct pmu_counter *pmu)
+{
+	struct record_counter rc;
+
+	if (!replay_read(r, &rc, sizeof(rc)))
+		return false;
+
+	pmu->present = rc.present;
+	pmu->idx = rc.idx;
+	pmu->scale = rc.scale;
+	if (rc.present && rc.units[0]) {
+		rc.units[sizeof(rc.units) - 1] = 0;
+		pmu->units = strdup(rc.units);
+	}
+
+	return true;
+}
+
+static bool replay_idx_valid(const struct pmu_counter *pmu, unsigned int num)
+{
+	return !pmu->present || pmu->idx < num;
+}
+
+/* Counters index the group they were read with, see pmu_update(). */
+static bool replay_valid(struct engines *engines)
+{
+	unsigned int i;
+
+	if (!replay_idx_valid(&engines->freq_req, engines->num_counters) ||
+	    !replay_idx_valid(&engines->freq_act, engines->num_counters) ||
+	    !replay_idx_valid(&engines->irq, engines->num_counters) ||
+	    !replay_idx_valid(&engines->rc6, engines->num_counters) ||
+	    !replay_idx_valid(&engines->r_gpu, engines->num_rapl) ||
+	    !replay_idx_valid(&engines->r_pkg, engines->num_rapl) ||
+	    !replay_idx_valid(&engines->imc_reads, engines->num_imc) ||
+	    !replay_idx_valid(&engines->imc_writes, engines->num_imc))
+		return false;
+
+	for (i = 0; i < engines->num_engines; i++) {
+		struct engine *engine = engine_ptr(engines, i);
+
+		if (engine->class >= DRM_CLIENT_FDINFO_MAX_ENGINES ||
+		    engine->num_counters > 3 ||
+		    !replay_idx_valid(&engine->busy, engines->num_counters) ||
+		    !replay_idx_valid(&engine->wait, engines->num_counters) ||
+		    !replay_idx_valid(&engine->sema, engines->num_counters))
+			return false;
+	}
+
+	return true;
+}
+
+static struct engines *
+replay_open(const char *path, struct igt_device_card *card, char **codename,
+	    unsigned int *period_us)
+{
+	struct engines *engines = NULL;
+	struct record_header hdr;
+	struct pmu_counter *pmu;
+	struct recording *r;
+	unsigned int i;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->f = fopen(path, "r");
+	if (!r->f)
+		goto err;
+
+	if (!replay_read(r, &hdr, sizeof(hdr)) ||
+	    memcmp(hdr.magic, RECORD_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != RECORD_VERSION ||
+	    hdr.num_classes > DRM_CLIENT_FDINFO_MAX_ENGINES ||
+	    !hdr.num_engines || hdr.num_engines > RECORD_MAX_ENGINES ||
+	    hdr.num_counters > RECORD_MAX_COUNTERS(hdr.num_engines) ||
+	    hdr.num_rapl > RECORD_MAX_RAPL ||
+	    hdr.num_imc > RECORD_MAX_IMC)
+		goto err;
+
+	hdr.card[sizeof(hdr.card) - 1] = 0;
+	hdr.pci_slot[sizeof(hdr.pci_slot) - 1] = 0;
+	hdr.codename[sizeof(hdr.codename) - 1] = 0;
+
+	engines = calloc(1, sizeof(*engines) +
+			    hdr.num_engines * sizeof(struct engine));
+	if (!engines)
+		goto err;
+
+	engines->fd = engines->rapl_fd = engines->imc_fd = -1;
+	engines->discrete = hdr.flags & RECORD_DISCRETE;
+	engines->num_counters = hdr.num_counters;
+	engines->num_rapl = hdr.num_rapl;
+	engines->num_imc = hdr.num_imc;
+
+	for (i = 0; (pmu = global_counter(engines, i)); i++) {
+		if (!replay_counter(r, pmu))
+			goto err;
+	}
+
+	for (i = 0; i < hdr.num_engines; i++) {
+		struct engine *engine = engine_ptr(engines, i);
+		struct record_engine re;
+
+		if (!replay_read(r, &re, sizeof(re)))
+			goto err;
+
+		re.name[sizeof(re.name) - 1] = 0;
+		engine->name = strdup(re.name);
+		engine->class = re.class;
+		engine->instance = re.instance;
+		engine->num_counters = re.num_counters;
+		engine->busy.present = re.busy.present;
+		engine->busy.idx = re.busy.idx;
+		engine->wait.present = re.wait.present;
+		engine->wait.idx = re.wait.idx;
+		engine->sema.present = re.sema.present;
+		engine->sema.idx = re.sema.idx;
+
+		if (asprintf(&engine->display_name, "%s/%u",
+			     class_display_name(engine->class),
+			     engine->instance) <= 0 ||
+		    asprintf(&engine->short_name, "%s/%u",
+			     class_short_name(engine->class),
+			     engine->instance) <= 0)
+			goto err;
+
+		engines->num_engines++;
+	}
+
+	if (!replay_valid(engines))
+		goto err;
+
+	r->num_raw = pmu_num_raw(engines);
+	r->num_classes = hdr.num_classes;
+	r->client_size = sizeof(struct record_client) +
+			 hdr.num_classes * sizeof(uint64_t);
+	strcpy(r->pci_slot, hdr.pci_slot);
+
+	memset(card, 0, sizeof(*card));
+	strncpy(card->card, hdr.card, sizeof(card->card) - 1);
+	strncpy(card->pci_slot_name, hdr.pci_slot,
+		sizeof(card->pci_slot_name) - 1);
+	*codename = strdup(hdr.codename);
+	*period_us = hdr.period_us;
+
+	replay = r;
+
+	return engines;
+
+err:
+	if (engines) {
+		for (i = 0; (pmu = global_counter(engines, i)); i++)
+			free((char *)pmu->units);
+		for (i = 0; i < engines->num_engines; i++) {
+			struct engine *engine = engine_ptr(engines, i);
+
+			free((char *)engine->name);
+			free(engine->display_name);
+			free(engine->short_name);
+		}
+		free(engines);
+	}
+	if (r->f)
+		fclose(r->f);
+	free(r);
+
+	return NULL;
+}
+
+static bool replay_sample(struct recording *r, uint64_t *raw)
+{
+	struct record_sample hdr;
+
+	if (!replay_read(r, &hdr, sizeof(hdr)))
+		return false;
+
+	if (hdr.size != r->num_raw * sizeof(*raw) +
+			hdr.num_clients * r->client_size)
+		return false;
+
+	r->size = 0;
+	record_reserve(r, hdr.size);
+	if (hdr.size && !replay_read(r, r->buf, hdr.size))
+		return false;
+
+	r->size = hdr.size;
+	r->num_clients = hdr.num_clients;
+	memcpy(raw, r->buf, r->num_raw * sizeof(*raw));
+
+	return true;
+}
+
+static void
+replay_clients(struct recording *r, igt_drm_fdinfo_client_t fn, void *data)
+{
+	const char *p = r->buf + r->num_raw * sizeof(uint64_t);
+	unsigned int i;
+
+	for (i = 0; i < r->num_clients; i++, p += r->client_size) {
+		struct drm_client_fdinfo info = { };
+		struct record_client rc;
+		char name[sizeof(rc.name) + 1] = { };
+
+		memcpy(&rc, p, sizeof(rc));
+		memcpy(name, rc.name, sizeof(rc.name));
+
+		strcpy(info.driver, "i915");
+		strcpy(info.pdev, r->pci_slot);
+		info.id = rc.id;
+		info.num_engines = r->num_classes;
+		memcpy(info.busy, p + sizeof(rc),
+		       r->num_classes * sizeof(info.busy[0]));
+
+		fn(rc.pid, name, &info, data);
+	}
+}
+
+static void pmu_read_raw(struct engines *engines, uint64_t *raw)
+{
+	uint64_t *val = raw + 1;
+
+	raw[0] = pmu_read_multi(engines->fd, engines->num_counters, val);
+	val += engines->num_counters;
+
+	if (engines->num_rapl) {
+		pmu_read_multi(engines->rapl_fd, engines->num_rapl, val);
+		val += engines->num_rapl;
+	}
+
+	if (engines->num_imc)
+		pmu_read_multi(engines->imc_fd, engines->num_imc, val);
+}
+
+static void pmu_update(struct engines *engines, const uint64_t *raw)
 {
-	const int num_val = engines->num_counters;
-	uint64_t val[2 + num_val];
+	const uint64_t *val = raw + 1;
 	unsigned int i;
 
 	engines->ts.prev = engines->ts.cur;
-	engines->ts.cur = pmu_read_multi(engines->fd, num_val, val);
+	engines->ts.cur = raw[0];
 
 	update_sample(&engines->freq_req, val);
 	update_sample(&engines->freq_act, val);
@@ -655,19 +1160,39 @@ static void pmu_sample(struct engines *engines)
 		update_sample(&engine->wait, val);
 	}
 
+	val += engines->num_counters;
+
 	if (engines->num_rapl) {
-		pmu_read_multi(engines->rapl_fd, engines->num_rapl, val);
 		update_sample(&engines->r_gpu, val);
 		update_sample(&engines->r_pkg, val);
+		val += engines->num_rapl;
 	}
 
 	if (engines->num_imc) {
-		pmu_read_multi(engines->imc_fd, engines->num_imc, val);
 		update_sample(&engines->imc_reads, val);
 		update_sample(&engines->imc_writes, val);
 	}
 }
 
+static bool pmu_sample(struct engines *engines)
+{
+	uint64_t raw[pmu_num_raw(engines)];
+
+	if (replay) {
+		if (!replay_sample(replay, raw))
+			return false;
+	} else {
+		pmu_read_raw(engines, raw);
+	}
+
+	pmu_update(engines, raw);
+
+	if (record)
+		record_pmu(record, raw);
+
+	return true;
+}
+
 enum client_status {
 	FREE = 0, /* mbz */
 	ALIVE,
@@ -689,6 +1214,8 @@ struct client {
 	unsigned long last_runtime;
 	unsigned long *val;
 	uint64_t *last;
+
+	struct client *next_free;
 };
 
 struct clients {
@@ -700,12 +1227,47 @@ struct clients {
 
 	char pci_slot[64];
 
-	struct client *client;
+	struct igt_drm_fdinfo_scan *scan;
+
+	/* Live clients indexed by id. */
+	struct igt_map *map;
+
+	/* Freed clients kept around for reuse. */
+	struct client *free_list;
+	unsigned int num_free;
+
+	unsigned int alloc_clients;
+	struct client **client;
 };
 
 #define for_each_client(clients, c, tmp) \
-	for ((tmp) = (clients)->num_clients, c = (clients)->client; \
-	     (tmp > 0); (tmp)--, (c)++)
+	for ((tmp) = 0; \
+	     (tmp) < (clients)->num_clients && ((c) = (clients)->client[(tmp)]); \
+	     (tmp)++)
+
+/* 2^31 + 2^29 - 2^25 + 2^22 - 2^19 - 2^16 + 1 */
+#define GOLDEN_RATIO_PRIME_32 0x9e370001UL
+
+static uint32_t hash_client_id(const void *key)
+{
+	uint32_t hash = *(const unsigned int *)key;
+
+	hash = hash * GOLDEN_RATIO_PRIME_32;
+	return hash;
+}
+
+static int equal_client_id(const void *key1, const void *key2)
+{
+	return *(const unsigned int *)key1 == *(const unsigned int *)key2;
+}
+
+static bool client_filter(const struct drm_client_fdinfo *info, void *data)
+{
+	struct clients *clients = data;
+
+	return !strcmp(info->driver, "i915") &&
+	       !strcmp(info->pdev, clients->pci_slot);
+}
 
 static struct clients *init_clients(const char *pci_slot)
 {
@@ -719,31 +1281,73 @@ static struct clients *init_clients(const char *pci_slot)
 
 	strncpy(clients->pci_slot, pci_slot, sizeof(clients->pci_slot));
 
+	clients->map = igt_map_create(hash_client_id, equal_client_id);
+	if (!clients->map) {
+		free(clients);
+		return NULL;
+	}
+
+	clients->scan = igt_drm_fdinfo_scan_create(NULL, client_filter, clients);
+	if (!clients->scan) {
+		igt_map_destroy(clients->map, NULL);
+		free(clients);
+		return NULL;
+	}
+
 	return clients;
 }
 
 static struct client *
 find_client(struct clients *clients, enum client_status status, unsigned int id)
 {
-	unsigned int start, num;
 	struct client *c;
 
-	start = status == FREE ? clients->active_clients : 0; /* Free block at the end. */
-	num = clients->num_clients - start;
+	c = igt_map_search(clients->map, &id);
+	if (!c || c->status != status)
+		return NULL;
 
-	for (c = &clients->client[start]; num; c++, num--) {
-		if (status != c->status)
-			continue;
+	return c;
+}
 
-		if (status == FREE || c->id == id)
-			return c;
+static struct client *alloc_client(struct clients *clients)
+{
+	struct client *c = clients->free_list;
+
+	if (c) {
+		unsigned long *val = c->val;
+		uint64_t *last = c->last;
+
+		clients->free_list = c->next_free;
+		clients->num_free--;
+
+		memset(c, 0, sizeof(*c));
+		memset(val, 0, clients->num_classes * sizeof(*val));
+		memset(last, 0, clients->num_classes * sizeof(*last));
+		c->val = val;
+		c->last = last;
+	} else {
+		c = calloc(1, sizeof(*c));
+		assert(c);
+		c->val = calloc(clients->num_classes, sizeof(*c->val));
+		c->last = calloc(clients->num_classes, sizeof(*c->last));
+		assert(c->val && c->last);
 	}
 
-	return NULL;
+	if (clients->num_clients == clients->alloc_clients) {
+		clients->alloc_clients += (clients->alloc_clients + 2) / 2;
+		clients->client = realloc(clients->client,
+					  clients->alloc_clients *
+					  sizeof(*clients->client));
+		assert(clients->client);
+	}
+
+	clients->client[clients->num_clients++] = c;
+
+	return c;
 }
 
 static void
-update_client(struct client *c, unsigned int pid, char *name,
+update_client(struct client *c, unsigned int pid, const char *name,
 	      const struct drm_client_fdinfo *info)
 {
 	unsigned int i;
@@ -786,45 +1390,45 @@ update_client(struct client *c, unsigned int pid, char *name,
 
 static void
 add_client(struct clients *clients, const struct drm_client_fdinfo *info,
-	   unsigned int pid, char *name)
+	   unsigned int pid, const char *name)
 {
 	struct client *c;
 
 	assert(!find_client(clients, ALIVE, info->id));
 
-	c = find_client(clients, FREE, 0);
-	if (!c) {
-		unsigned int idx = clients->num_clients;
-
-		clients->num_clients += (clients->num_clients + 2) / 2;
-		clients->client = realloc(clients->client,
-					  clients->num_clients * sizeof(*c));
-		assert(clients->client);
-
-		c = &clients->client[idx];
-		memset(c, 0, (clients->num_clients - idx) * sizeof(*c));
-	}
-
+	c = alloc_client(clients);
 	c->id = info->id;
 	c->clients = clients;
-	c->val = calloc(clients->num_classes, sizeof(c->val));
-	c->last = calloc(clients->num_classes, sizeof(c->last));
-	assert(c->val && c->last);
+	igt_map_insert(clients->map, &c->id, c);
 
 	update_client(c, pid, name, info);
 }
 
+/* Caller is responsible for removing the client from the clients array. */
 static void free_client(struct client *c)
 {
-	free(c->val);
-	free(c->last);
-	memset(c, 0, sizeof(*c));
+	struct clients *clients = c->clients;
+
+	igt_map_remove(clients->map, &c->id, NULL);
+	c->status = FREE;
+
+	/* Keep at most as many spare clients as there are live ones. */
+	if (clients->num_free > clients->num_clients) {
+		free(c->val);
+		free(c->last);
+		free(c);
+		return;
+	}
+
+	c->next_free = clients->free_list;
+	clients->free_list = c;
+	clients->num_free++;
 }
 
 static int client_last_cmp(const void *_a, const void *_b)
 {
-	const struct client *a = _a;
-	const struct client *b = _b;
+	const struct client *a = *(const struct client **)_a;
+	const struct client *b = *(const struct client **)_b;
 	long tot_a, tot_b;
 
 	/*
@@ -847,8 +1451,8 @@ static int client_last_cmp(const void *_a, const void *_b)
 
 static int client_total_cmp(const void *_a, const void *_b)
 {
-	const struct client *a = _a;
-	const struct client *b = _b;
+	const struct client *a = *(const struct client **)_a;
+	const struct client *b = *(const struct client **)_b;
 	long tot_a, tot_b;
 
 	tot_a = a->status == ALIVE ? a->total_runtime : -1;
@@ -865,8 +1469,8 @@ static int client_total_cmp(const void *_a, const void *_b)
 
 static int client_id_cmp(const void *_a, const void *_b)
 {
-	const struct client *a = _a;
-	const struct client *b = _b;
+	const struct client *a = *(const struct client **)_a;
+	const struct client *b = *(const struct client **)_b;
 	int id_a, id_b;
 
 	id_a = a->status == ALIVE ? a->id : -1;
@@ -883,8 +1487,8 @@ static int client_id_cmp(const void *_a, const void *_b)
 
 static int client_pid_cmp(const void *_a, const void *_b)
 {
-	const struct client *a = _a;
-	const struct client *b = _b;
+	const struct client *a = *(const struct client **)_a;
+	const struct client *b = *(const struct client **)_b;
 	int pid_a, pid_b;
 
 	pid_a = a->status == ALIVE ? a->pid : INT_MAX;
@@ -901,20 +1505,47 @@ static int client_pid_cmp(const void *_a, const void *_b)
 
 static int (*client_cmp)(const void *, const void *) = client_last_cmp;
 
+/*
+ * The array is usually still sorted, or close to it, from the previous
+ * refresh so insertion sort is linear in the common case. Fall back to
+ * qsort if the order has changed a lot.
+ */
+static void sort_client_array(struct client **client, unsigned int num,
+			      int (*cmp)(const void *, const void *))
+{
+	unsigned int i, moves = 0;
+
+	for (i = 1; i < num; i++) {
+		struct client *c = client[i];
+		unsigned int j = i;
+
+		while (j > 0 && cmp(&client[j - 1], &c) > 0) {
+			client[j] = client[j - 1];
+			j--;
+
+			if (++moves > 8 * num) {
+				client[j] = c;
+				qsort(client, num, sizeof(*client), cmp);
+				return;
+			}
+		}
+
+		client[j] = c;
+	}
+}
+
 static struct clients *sort_clients(struct clients *clients,
 				    int (*cmp)(const void *, const void *))
 {
-	unsigned int active, free;
+	unsigned int active;
 	struct client *c;
 	int tmp;
 
 	if (!clients)
 		return clients;
 
-	qsort(clients->client, clients->num_clients, sizeof(*clients->client),
-	      cmp);
+	sort_client_array(clients->client, clients->num_clients, cmp);
 
-	/* Trim excessive array space. */
 	active = 0;
 	for_each_client(clients, c, tmp) {
 		if (c->status != ALIVE)
@@ -924,17 +1555,6 @@ static struct clients *sort_clients(struct clients *clients,
 
 	clients->active_clients = active;
 
-	free = clients->num_clients - active;
-	if (free > clients->num_clients / 2) {
-		active = clients->num_clients - free / 2;
-		if (active != clients->num_clients) {
-			clients->num_clients = active;
-			clients->client = realloc(clients->client,
-						  clients->num_clients *
-						  sizeof(*c));
-		}
-	}
-
 	return clients;
 }
 
@@ -955,12 +1575,13 @@ static struct clients *display_clients(struct clients *clients)
 	aggregated = calloc(1, sizeof(*clients));
 	assert(aggregated);
 
-	ac = calloc(clients->num_clients, sizeof(*c));
-	assert(ac);
+	aggregated->client = calloc(clients->num_clients,
+				    sizeof(*aggregated->client));
+	assert(aggregated->client);
 
 	aggregated->num_classes = clients->num_classes;
 	aggregated->class = clients->class;
-	aggregated->client = ac;
+	aggregated->alloc_clients = clients->num_clients;
 
 	for_each_client(clients, c, tmp) {
 		unsigned int i;
@@ -971,7 +1592,9 @@ static struct clients *display_clients(struct clients *clients)
 		assert(c->status == ALIVE);
 
 		if (!cp || c->pid != cp->pid) {
-			ac = &aggregated->client[num++];
+			ac = calloc(1, sizeof(*ac));
+			assert(ac);
+			aggregated->client[num++] = ac;
 
 			/* New pid. */
 			ac->clients = aggregated;
@@ -1016,88 +1639,46 @@ static void free_clients(struct clients *clients)
 	for_each_client(clients, c, tmp) {
 		free(c->val);
 		free(c->last);
+		free(c);
 	}
 
+	while ((c = clients->free_list)) {
+		clients->free_list = c->next_free;
+		free(c->val);
+		free(c->last);
+		free(c);
+	}
+
+	if (clients->map)
+		igt_map_destroy(clients->map, NULL);
+	igt_drm_fdinfo_scan_destroy(clients->scan);
 	free(clients->client);
 	free(clients);
 }
 
-static bool is_drm_fd(int fd_dir, const char *name)
+static void scan_client(unsigned int pid, const char *name,
+			const struct drm_client_fdinfo *info, void *data)
 {
-	struct stat stat;
-	int ret;
-
-	ret = fstatat(fd_dir, name, &stat, 0);
-
-	return ret == 0 &&
-	       (stat.st_mode & S_IFMT) == S_IFCHR &&
-	       major(stat.st_rdev) == 226;
-}
-
-static bool get_task_name(const char *buffer, char *out, unsigned long sz)
-{
-	char *s = index(buffer, '(');
-	char *e = rindex(buffer, ')');
-	unsigned int len;
-
-	if (!s || !e)
-		return false;
-	assert(e >= s);
-
-	len = e - ++s;
-	if(!len || (len + 1) >= sz)
-		return false;
-
-	strncpy(out, s, len);
-	out[len] = 0;
-
-	return true;
-}
-
-static DIR *opendirat(int at, const char *name)
-{
-	DIR *dir;
-	int fd;
-
-	fd = openat(at, name, O_DIRECTORY);
-	if (fd < 0)
-		return NULL;
-
-	dir = fdopendir(fd);
-	if (!dir)
-		close(fd);
-
-	return dir;
-}
-
-static size_t readat2buf(int at, const char *name, char *buf, const size_t sz)
-{
-	ssize_t count;
-	int fd;
-
-	fd = openat(at, name, O_RDONLY);
-	if (fd <= 0)
-		return 0;
-
-	count = read(fd, buf, sz - 1);
-	close(fd);
+	struct clients *clients = data;
+	struct client *c;
 
-	if (count > 0) {
-		buf[count] = 0;
+	if (find_client(clients, ALIVE, info->id))
+		return; /* Skip duplicate fds. */
 
-		return count;
-	} else {
-		buf[0] = 0;
+	if (record)
+		record_client(record, info->id, pid, name, info->busy);
 
-		return 0;
-	}
+	c = find_client(clients, PROBE, info->id);
+	if (!c)
+		add_client(clients, info, pid, name);
+	else
+		update_client(c, pid, name, info);
 }
 
 static struct clients *scan_clients(struct clients *clients, bool display)
 {
-	struct dirent *proc_dent;
+	unsigned int i, j;
 	struct client *c;
-	DIR *proc_dir;
 	int tmp;
 
 	if (!clients)
@@ -1111,97 +1692,21 @@ static struct clients *scan_clients(struct clients *clients, bool display)
 			break; /* Free block at the end of array. */
 	}
 
-	proc_dir = opendir("/proc");
-	if (!proc_dir)
-		return clients;
-
-	while ((proc_dent = readdir(proc_dir)) != NULL) {
-		int pid_dir = -1, fd_dir = -1;
-		struct dirent *fdinfo_dent;
-		char client_name[64] = { };
-		unsigned int client_pid;
-		DIR *fdinfo_dir = NULL;
-		char buf[4096];
-		size_t count;
-
-		if (proc_dent->d_type != DT_DIR)
-			continue;
-		if (!isdigit(proc_dent->d_name[0]))
-			continue;
-
-		pid_dir = openat(dirfd(proc_dir), proc_dent->d_name,
-				 O_DIRECTORY | O_RDONLY);
-		if (pid_dir < 0)
-			continue;
-
-		count = readat2buf(pid_dir, "stat", buf, sizeof(buf));
-		if (!count)
-			goto next;
-
-		client_pid = atoi(buf);
-		if (!client_pid)
-			goto next;
-
-		if (!get_task_name(buf, client_name, sizeof(client_name)))
-			goto next;
-
-		fd_dir = openat(pid_dir, "fd", O_DIRECTORY | O_RDONLY);
-		if (fd_dir < 0)
-			goto next;
-
-		fdinfo_dir = opendirat(pid_dir, "fdinfo");
-		if (!fdinfo_dir)
-			goto next;
-
-		while ((fdinfo_dent = readdir(fdinfo_dir)) != NULL) {
-			struct drm_client_fdinfo info = { };
-
-			if (fdinfo_dent->d_type != DT_REG)
-				continue;
-			if (!isdigit(fdinfo_dent->d_name[0]))
-				continue;
-
-			if (!is_drm_fd(fd_dir, fdinfo_dent->d_name))
-				continue;
-
-			if (!__igt_parse_drm_fdinfo(dirfd(fdinfo_dir),
-						    fdinfo_dent->d_name,
-						    &info))
-				continue;
-
-			if (strcmp(info.driver, "i915"))
-				continue;
-			if (strcmp(info.pdev, clients->pci_slot))
-				continue;
-			if (find_client(clients, ALIVE, info.id))
-				continue; /* Skip duplicate fds. */
-
-			c = find_client(clients, PROBE, info.id);
-			if (!c)
-				add_client(clients, &info, client_pid,
-					   client_name);
-			else
-				update_client(c, client_pid, client_name,
-					      &info);
-		}
-
-next:
-		if (fdinfo_dir)
-			closedir(fdinfo_dir);
-		if (fd_dir >= 0)
-			close(fd_dir);
-		if (pid_dir >= 0)
-			close(pid_dir);
-	}
+	if (replay)
+		replay_clients(replay, scan_client, clients);
+	else
+		igt_drm_fdinfo_scan(clients->scan, scan_client, clients);
 
-	closedir(proc_dir);
+	/* Drop clients which went away, preserving the order of the rest. */
+	for (i = 0, j = 0; i < clients->num_clients; i++) {
+		c = clients->client[i];
 
-	for_each_client(clients, c, tmp) {
 		if (c->status == PROBE)
 			free_client(c);
-		else if (c->status == FREE)
-			break;
+		else
+			clients->client[j++] = c;
 	}
+	clients->num_clients = j;
 
 	return display ? display_clients(clients) : clients;
 }
@@ -1268,6 +1773,8 @@ usage(const char *appname)
 		"\t[-s <ms>]       Refresh period in milliseconds (default %ums).\n"
 		"\t[-L]            List all cards.\n"
 		"\t[-d <device>]   Device filter, please check manual page for more details.\n"
+		"\t[-w <file>]     Record samples to a file instead of displaying them.\n"
+		"\t[-r <file>]     Replay samples from a file recorded with -w.\n"
 		"\n",
 		appname, DEFAULT_PERIOD_MS);
 	igt_device_print_filter_types();
@@ -2448,15 +2955,16 @@ int main(int argc, char **argv)
 	struct clients *clients = NULL;
 	int con_w = -1, con_h = -1;
 	char *output_path = NULL;
+	char *record_path = NULL, *replay_path = NULL;
 	struct engines *engines;
 	int ret = 0, ch;
 	bool list_device = false;
-	char *pmu_device, *opt_device = NULL;
+	char *pmu_device = NULL, *opt_device = NULL;
 	struct igt_device_card card;
 	char *codename = NULL;
 
 	/* Parse options */
-	while ((ch = getopt(argc, argv, "o:s:d:JLlh")) != -1) {
+	while ((ch = getopt(argc, argv, "o:s:d:r:w:JLlh")) != -1) {
 		switch (ch) {
 		case 'o':
 			output_path = optarg;
@@ -2467,6 +2975,12 @@ int main(int argc, char **argv)
 		case 'd':
 			opt_device = strdup(optarg);
 			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'w':
+			record_path = optarg;
+			break;
 		case 'J':
 			output_mode = JSON;
 			break;
@@ -2486,7 +3000,14 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (output_mode == INTERACTIVE && (output_path || isatty(1) != 1))
+	if (record_path && replay_path) {
+		fprintf(stderr, "Recording and replay are mutually exclusive!\n");
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (output_mode == INTERACTIVE &&
+	    (output_path || isatty(1) != 1 || record_path || replay_path))
 		output_mode = STDOUT;
 
 	if (output_path && strcmp(output_path, "-")) {
@@ -2521,6 +3042,34 @@ int main(int argc, char **argv)
 		break;
 	};
 
+	if (replay_path) {
+		engines = replay_open(replay_path, &card, &codename, &period_us);
+		if (!engines) {
+			fprintf(stderr, "Failed to open recording '%s'!\n",
+				replay_path);
+			ret = EXIT_FAILURE;
+			goto exit;
+		}
+
+		init_engine_classes(engines);
+		if (replay->num_classes) {
+			clients = init_clients(card.pci_slot_name[0] ?
+					       card.pci_slot_name : IGPU_PCI);
+			if (clients) {
+				clients->num_classes = engines->num_classes;
+				clients->class = engines->class;
+			}
+		}
+
+		ret = EXIT_SUCCESS;
+
+		if (!pmu_sample(engines))
+			goto out;
+		scan_clients(clients, false);
+
+		goto loop;
+	}
+
 	igt_devices_scan(false);
 
 	if (list_device) {
@@ -2593,10 +3142,32 @@ int main(int argc, char **argv)
 		clients->class = engines->class;
 	}
 
+	codename = igt_device_get_pretty_name(&card, false);
+
+	if (record_path) {
+		record = record_open(record_path, engines, &card, codename,
+				     card.pci_slot_name[0] ?
+				     card.pci_slot_name : IGPU_PCI,
+				     clients ? engines->num_classes : 0,
+				     period_us);
+		if (!record) {
+			fprintf(stderr, "Failed to open recording '%s'! (%s)\n",
+				record_path, strerror(errno));
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+	}
+
 	pmu_sample(engines);
 	scan_clients(clients, false);
-	codename = igt_device_get_pretty_name(&card, false);
+	if (record && !record_flush(record)) {
+		fprintf(stderr, "Failed to write recording '%s'! (%s)\n",
+			record_path, strerror(errno));
+		ret = EXIT_FAILURE;
+		goto out;
+	}
 
+loop:
 	while (!stop_top) {
 		struct clients *disp_clients;
 		bool consumed = false;
@@ -2618,14 +3189,27 @@ int main(int argc, char **argv)
 			}
 		}
 
-		pmu_sample(engines);
+		if (!pmu_sample(engines))
+			break; /* End of recording. */
 		t = (double)(engines->ts.cur - engines->ts.prev) / 1e9;
 
-		disp_clients = scan_clients(clients, true);
+		disp_clients = scan_clients(clients, !record);
 
 		if (stop_top)
 			break;
 
+		if (record) {
+			if (!record_flush(record)) {
+				fprintf(stderr,
+					"Failed to write recording '%s'! (%s)\n",
+					record_path, strerror(errno));
+				ret = EXIT_FAILURE;
+				break;
+			}
+			usleep(period_us);
+			continue;
+		}
+
 		while (!consumed) {
 			pops->open_struct(NULL);
 
@@ -2679,18 +3263,26 @@ int main(int argc, char **argv)
 
 		if (output_mode == INTERACTIVE)
 			process_stdin(period_us);
-		else
+		else if (!replay)
 			usleep(period_us);
 	}
 
+out:
 	if (clients)
 		free_clients(clients);
 
+	if (!record_close(record) && ret == EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to write recording '%s'! (%s)\n",
+			record_path, strerror(errno));
+		ret = EXIT_FAILURE;
+	}
 	free(codename);
 err:
 	free_engines(engines);
 	free(pmu_device);
 exit:
-	igt_devices_free();
+	record_close(replay);
+	if (!replay_path)
+		igt_devices_free();
 	return ret;
 }
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# Usage:
+#  tools/test/gpu-top-recording.py variant recording
+#
+# Writes a small intel_gpu_top -w recording of one render engine, or a
+# broken variant of it, for the replay (-r) tests. See the recording format
+# described in intel_gpu_top.c.
+
+import struct
+import sys
+
+HEADER = struct.Struct('=8sIIIIIIII64s64s64s')
+COUNTER = struct.Struct('=IId16s')
+ENGINE = struct.Struct('=32sIIII')
+SAMPLE = struct.Struct('=II')
+
+def counter(idx=None, scale=1.0, units=b''):
+	if idx is None:
+		return COUNTER.pack(0, 0, 0.0, b'')
+	return COUNTER.pack(1, idx, scale, units)
+
+def recording(variant):
+	num_engines = 1000000 if variant == 'too-many-engines' else 1
+	busy = 7 if variant == 'bad-index' else 2
+
+	# Counters: irq, rc6 and render busy in the i915 group.
+	data = HEADER.pack(b'IGTGPUTP', 1, 0, num_engines, 3, 0, 0, 0, 1000,
+			   b'card0', b'0000:00:02.0', b'test')
+	data += counter()			# freq_req
+	data += counter()			# freq_act
+	data += counter(0, 1.0, b'irq/s')	# irq
+	data += counter(1, 1e-9, b'%')		# rc6
+	data += counter() * 4			# RAPL and IMC
+	data += ENGINE.pack(b'rcs0', 0, 0, 1, 0)
+	data += counter(busy, 1e-9, b'%') + counter() + counter()
+
+	for i in range(4):
+		ts = (i + 1) * 1000000000
+		data += SAMPLE.pack(4 * 8, 0)
+		data += struct.pack('=QQQQ', ts, 100 * i, ts // 2, ts // 4)
+
+	if variant == 'truncated-header':
+		data = data[:HEADER.size + 3 * COUNTER.size]
+	elif variant == 'truncated-sample':
+		data = data[:-12]
+
+	return data
+
+with open(sys.argv[2], 'wb') as f:
+	f.write(recording(sys.argv[1]))
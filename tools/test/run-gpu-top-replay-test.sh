@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Replays (-r) generated recordings of every variant, checking that valid
+# and truncated samples replay and that broken recordings are refused
+# rather than read out of bounds.
+#
+# Usage: run-gpu-top-replay-test.sh intel_gpu_top gpu-top-recording.py
+
+BUILDDIR="${top_builddir-`pwd`}"
+PYTHON="${PYTHON-python3}"
+
+gputop="$1"
+generate="$2"
+
+out="${BUILDDIR}/test/gpu-top-replay"
+mkdir -p "$out"
+
+replay() {
+	variant="$1"
+	expected="$2"
+
+	"$PYTHON" "$generate" "$variant" "$out/$variant.bin" || exit 1
+	"$gputop" -J -o "$out/$variant.json" -r "$out/$variant.bin" \
+		2> "$out/$variant.err"
+	ret=$?
+
+	if [ $ret -ne $expected ]; then
+		echo "Replay of ${variant} exited with $ret, expected $expected"
+		cat "$out/$variant.err"
+		exit 1
+	fi
+}
+
+replay valid 0
+replay truncated-sample 0
+replay truncated-header 1
+replay bad-index 1
+replay too-many-engines 1
+
+periods() {
+	variant="$1"
+	expected="$2"
+
+	if [ `grep -c '"Render/3D/0"' "$out/$variant.json"` -ne $expected ]; then
+		echo "Replay of ${variant} does not show $expected periods"
+		cat "$out/$variant.json"
+		exit 1
+	fi
+}
+
+# The first of the four samples only starts the first period.
+periods valid 3
+periods truncated-sample 2